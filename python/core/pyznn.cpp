@@ -55,6 +55,9 @@ Functions:
 
  CNet.get_output_num() - returns the number of 3d output volumes to the network
 
+ CNet.compile() - replays a static plan of the forward pass instead of
+ 	dispatching it dynamically, CNet.uncompile() switches back
+
  CNet.get_opts() - serializes all fields of the network data structure, and returns
  	them as a tuple of lists of dictionaries. Each dictionary represents the fields
  	of a given layer of the network, the list consolidates all of the layers, and the
@@ -62,6 +65,27 @@ Functions:
 
  	This function is also used for saving networks to disk.
 
+ get_pool_stats(), trim_pool(bytes), set_pool_budget(bytes),
+ 	set_pool_size_classes(bool) - cube memory pool statistics and limits
+
+ set_fft_planning(mode), import_fft_wisdom(fname), export_fft_wisdom(fname),
+ 	get_fft_planning_time() - FFTW planning rigor ("estimate", "measure",
+ 	"patient" or "exhaustive") for the plans created afterwards, wisdom
+ 	files and the seconds spent planning so far
+
+ CMPFNet(opts, outsz, tc, force_fft) - dense inference of the net of the
+ 	options of a CNet (see CNet.get_opts) with max-pooling fragments
+ 	instead of max filters and sparse convolutions, the output size has
+ 	to be a multiple of the pooling factor. It has the forward() and the
+ 	size functions of CNet, and is created by the front end for the
+ 	forward pass when is_forward_mpf is set
+
+ set_tuning_cache(fname), get_tuning_cache() - file keeping the
+ 	convolutions chosen by the optimization of CNet(..., is_optimize)
+ 	for this machine, thread number and output size (also set by the
+ 	ZNN_TUNING_CACHE environment variable); the nets created later only
+ 	time the layers not found in it
+
 Jingpeng Wu <jingpeng.wu@gmail.com>
 Nicholas Turner <nturner@cs.princeton.edu>, 2015
 */
@@ -84,6 +108,7 @@ Nicholas Turner <nturner@cs.princeton.edu>, 2015
 
 // znn
 #include "network/parallel/network.hpp"
+#include "network/parallel/mpf_network.hpp"
 #include "cube/cube.hpp"
 #include <zi/zargs/zargs.hpp>
 
@@ -210,6 +235,37 @@ std::shared_ptr<network> CNet_loadopts( bp::tuple const & opts,
     return net;
 }
 
+//Initializes a CMPFNet instance based on
+// the passed options struct (tuple(list(dict)), see CNet_getopts)
+std::shared_ptr<mpf_network> CMPFNet_loadopts( bp::tuple const & opts,
+                                               np::ndarray const & outsz_a,
+                                               std::size_t tc = 0,
+                                               bool const force_fft = false )
+{
+    bp::list node_opts_list = bp::extract<bp::list>( opts[0] );
+    bp::list edge_opts_list = bp::extract<bp::list>( opts[1] );
+
+    std::vector<options> node_opts = pyopt_to_znnopt(node_opts_list);
+    std::vector<options> edge_opts = pyopt_to_znnopt(edge_opts_list);
+
+    vec3i out_sz( reinterpret_cast<std::int64_t*>(outsz_a.get_data())[0],
+                  reinterpret_cast<std::int64_t*>(outsz_a.get_data())[1],
+                  reinterpret_cast<std::int64_t*>(outsz_a.get_data())[2]
+            );
+    if ( tc == 0 )
+        tc = std::thread::hardware_concurrency();
+
+    if ( force_fft )
+    {
+        network::force_fft(edge_opts);
+    }
+
+    std::shared_ptr<mpf_network> net(
+        new mpf_network( node_opts,edge_opts,out_sz,tc ));
+
+    return net;
+}
+
 //Returns a tuple of list of dictionaries of the following form
 // (node_opts, edge_opts)
 // node_opts = [node_group_option_dict, ...]
@@ -251,10 +307,11 @@ bp::tuple CNet_getopts( bp::object const & self )
 //PROPOGATION FUNCTIONS
 
 //Computes the forward-pass
+template<class Net>
 bp::dict CNet_forward( bp::object const & self, bp::dict& ins )
 {
     // extract the class from self
-    network& net = bp::extract<network&>(self)();
+    Net& net = bp::extract<Net&>(self)();
 
     // run forward and get output
     auto prop = net.forward( std::move( pydict2sample<real>( ins ) ) );
@@ -279,32 +336,36 @@ void CNet_backward( bp::object & self, bp::dict& grdts )
 //NETWORK STATISTIC FUNCTIONS
 
 //Returns the field-of-view as a tuple
+template<class Net>
 bp::tuple CNet_fov( bp::object const & self )
 {
-    network& net = bp::extract<network&>(self)();
+    Net& net = bp::extract<Net&>(self)();
     vec3i fov_vec =  net.fov();
     return bp::make_tuple(fov_vec[0], fov_vec[1], fov_vec[2]);
 }
 
 //Returns the number of 3d input volumes for the network
+template<class Net>
 std::size_t CNet_get_input_num( bp::object const & self )
 {
-    network& net = bp::extract<network&>(self)();
+    Net& net = bp::extract<Net&>(self)();
     std::map<std::string, std::pair<vec3i, std::size_t>> ins = net.inputs();
     return ins["input"].second;
 }
 
 //Returns the number of 3d output volumes for the network
+template<class Net>
 std::size_t CNet_get_output_num( bp::object const & self )
 {
-    network& net = bp::extract<network&>(self)();
+    Net& net = bp::extract<Net&>(self)();
     std::map<std::string, std::pair<vec3i,std::size_t>> outs = net.outputs();
     return outs["output"].second;
 }
 
+template<class Net>
 bp::dict CNet_get_inputs_setsz( bp::object const & self )
 {
-    network& net = bp::extract<network&>(self)();
+    Net& net = bp::extract<Net&>(self)();
     std::map<std::string, std::pair<vec3i,size_t>> inputs = net.inputs();
 
     bp::dict ret;
@@ -320,9 +381,10 @@ bp::dict CNet_get_inputs_setsz( bp::object const & self )
     return ret;
 }
 
+template<class Net>
 bp::dict CNet_get_outputs_setsz( bp::object const & self )
 {
-    network& net = bp::extract<network&>(self)();
+    Net& net = bp::extract<Net&>(self)();
     std::map<std::string, std::pair<vec3i,size_t>> outputs = net.outputs();
 
     bp::dict ret;
@@ -355,6 +417,64 @@ real pyget_rand_error(np::ndarray& affs_arr, np::ndarray& taffs_arr)
     return re;
 }
 
+//===========================================================================
+// cube pool statistics, one dict per block size
+bp::list pyget_pool_stats()
+{
+    bp::list ret;
+    for ( auto & s: cube_pool_stats() )
+    {
+        bp::dict d;
+        d["size"]       = s.size;
+        d["hits"]       = s.hits;
+        d["misses"]     = s.misses;
+        d["bytes_held"] = s.bytes_held;
+        ret.append(d);
+    }
+    return ret;
+}
+
+void pytrim_pool( size_t keep )
+{
+    trim_cube_pool(keep);
+}
+
+#ifndef ZNN_USE_MKL_NATIVE_FFT
+//===========================================================================
+// fftw planning
+void pyset_fft_planning( std::string const & mode )
+{
+    fft_plans.set_planning_mode(mode);
+}
+
+bool pyimport_fft_wisdom( std::string const & fname )
+{
+    return fft_plans.import_wisdom(fname);
+}
+
+bool pyexport_fft_wisdom( std::string const & fname )
+{
+    return fft_plans.export_wisdom(fname);
+}
+#endif
+
+real pyget_fft_planning_time()
+{
+    return fft_plans.planning_time();
+}
+
+//===========================================================================
+// tuning cache
+bool pyset_tuning_cache( std::string const & fname )
+{
+    return tuning_cache.set_file(fname);
+}
+
+std::string pyget_tuning_cache()
+{
+    return tuning_cache.file();
+}
+
 //===========================================================================
 //BOOST PYTHON INTERFACE DEFINITION
 BOOST_PYTHON_MODULE(pyznn)
@@ -365,18 +485,41 @@ BOOST_PYTHON_MODULE(pyznn)
     bp::class_<network, boost::shared_ptr<network>, boost::noncopyable>("CNet",bp::no_init)
         .def("__init__", bp::make_constructor(&CNet_Init))
         .def("__init__", bp::make_constructor(&CNet_loadopts))
-        .def("get_fov",  &CNet_fov)
-        .def("forward",  &CNet_forward)
+        .def("get_fov",  &CNet_fov<network>)
+        .def("forward",  &CNet_forward<network>)
         .def("backward", &CNet_backward)
         .def("set_eta",                 &network::set_eta)
         .def("set_phase",               &CNet_set_phase)
         .def("set_momentum",		&network::set_momentum)
         .def("set_weight_decay",	&network::set_weight_decay )
-        .def("get_inputs_setsz", 	&CNet_get_inputs_setsz)
-        .def("get_input_num", 		&CNet_get_input_num)
-        .def("get_outputs_setsz", 	&CNet_get_outputs_setsz)
-        .def("get_output_num", 		&CNet_get_output_num)
+        .def("get_inputs_setsz", 	&CNet_get_inputs_setsz<network>)
+        .def("get_input_num", 		&CNet_get_input_num<network>)
+        .def("get_outputs_setsz", 	&CNet_get_outputs_setsz<network>)
+        .def("get_output_num", 		&CNet_get_output_num<network>)
         .def("get_opts",		&CNet_getopts)
+        .def("compile",			&network::compile)
+        .def("uncompile",		&network::uncompile)
+        ;
+    bp::class_<mpf_network, boost::shared_ptr<mpf_network>, boost::noncopyable>("CMPFNet",bp::no_init)
+        .def("__init__", bp::make_constructor(&CMPFNet_loadopts))
+        .def("get_fov",  &CNet_fov<mpf_network>)
+        .def("forward",  &CNet_forward<mpf_network>)
+        .def("get_inputs_setsz", 	&CNet_get_inputs_setsz<mpf_network>)
+        .def("get_input_num", 		&CNet_get_input_num<mpf_network>)
+        .def("get_outputs_setsz", 	&CNet_get_outputs_setsz<mpf_network>)
+        .def("get_output_num", 		&CNet_get_output_num<mpf_network>)
         ;
     def("get_rand_error", pyget_rand_error);
+    def("get_pool_stats", pyget_pool_stats);
+    def("trim_pool", pytrim_pool);
+    def("set_pool_budget", set_cube_pool_budget);
+    def("set_pool_size_classes", set_cube_pool_size_classes);
+#ifndef ZNN_USE_MKL_NATIVE_FFT
+    def("set_fft_planning", pyset_fft_planning);
+    def("import_fft_wisdom", pyimport_fft_wisdom);
+    def("export_fft_wisdom", pyexport_fft_wisdom);
+#endif
+    def("get_fft_planning_time", pyget_fft_planning_time);
+    def("set_tuning_cache", pyset_tuning_cache);
+    def("get_tuning_cache", pyget_tuning_cache);
 }
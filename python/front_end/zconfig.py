@@ -119,6 +119,17 @@ def parser( conf_fname ):
         pars['train_conv_mode'] = config.get('parameters', 'train_conv_mode')
     if config.has_option('parameters', 'forward_conv_mode'):
         pars['forward_conv_mode'] = config.get('parameters', 'forward_conv_mode')
+    #Whether to run the forward pass with max-pooling fragments
+    if config.has_option('parameters', 'is_forward_mpf'):
+        pars['is_forward_mpf'] = config.getboolean('parameters', 'is_forward_mpf')
+    else:
+        pars['is_forward_mpf'] = False
+    #File remembering the choices of the optimization
+    if config.has_option('parameters', 'tuning_cache'):
+        pars['tuning_cache'] = os.path.expanduser(
+            config.get('parameters', 'tuning_cache'))
+    else:
+        pars['tuning_cache'] = None
 
     #Whether to use data augmentation
     if config.has_option('parameters', 'is_data_aug'):
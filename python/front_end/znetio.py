@@ -279,7 +279,7 @@ def consolidate_opts(source_opts, dest_opts, params=None, layers=None):
 
 def load_network( params=None, train=True, hdf5_filename=None,
     network_specfile=None, output_patch_shape=None, num_threads=None,
-    optimize=None, force_fft=None, is_stdio=None ):
+    optimize=None, force_fft=None, is_stdio=None, mpf=None ):
     '''
     Loads a network from an hdf5 file.
 
@@ -289,9 +289,13 @@ def load_network( params=None, train=True, hdf5_filename=None,
     If both a parameter object and any optional arguments are specified,
     the parameter object will form the default options, and those will be
     overwritten by the other optional arguments
+
+    With mpf (is_forward_mpf of the parameters) the forward network
+    is a CMPFNet, computing the dense output with max-pooling fragments
     '''
     #Need to specify either a params object, or all of the other optional args
     params_defined = params is not None
+    _mpf = False
 
     #"ALL" optional args excludes train (it has a default)
     assert_arglist(params,
@@ -333,6 +337,7 @@ def load_network( params=None, train=True, hdf5_filename=None,
         _network_specfile = params['fnet_spec']
         _num_threads = params['num_threads']
         _is_stdio = params['is_stdio']
+        _mpf = not train and params.get('is_forward_mpf', False)
 
     #Overwriting defaults with any other optional args
     if hdf5_filename is not None:
@@ -345,6 +350,8 @@ def load_network( params=None, train=True, hdf5_filename=None,
         _num_threads = num_threads
     if is_stdio is not None:
         _is_stdio = is_stdio
+    if mpf is not None:
+        _mpf = mpf and not train
 
     #ACTUAL LOADING FUNCTIONALITY
     #This is a little strange to allow for "seeding" larger
@@ -375,6 +382,10 @@ def load_network( params=None, train=True, hdf5_filename=None,
         final_options = template.get_opts()
         del template
 
+    if _mpf:
+        return pyznn.CMPFNet(final_options, _output_patch_shape,
+                    _num_threads, _force_fft)
+
     return pyznn.CNet(final_options, _network_specfile, _output_patch_shape,
                 _num_threads, _optimize, phase, _force_fft)
 
@@ -429,6 +440,10 @@ def init_network( params=None, train=True, network_specfile=None,
         _network_specfile = params['fnet_spec']
         _num_threads = params['num_threads']
 
+        #Choices of earlier optimizations
+        if params.get('tuning_cache'):
+            pyznn.set_tuning_cache( params['tuning_cache'] )
+
     #Overwriting defaults with any other optional args
     if network_specfile is not None:
         _network_specfile = network_specfile
@@ -0,0 +1,52 @@
+#!/usr/bin/env python
+__doc__ = """
+
+Dense forward pass of a net with max filters and sparse convolutions
+(CNet) and with max-pooling fragments (CMPFNet), with the same weights,
+the outputs have to match
+
+usage: python test_mpf.py [net.znn] [threads]
+"""
+import os
+import sys
+import numpy as np
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'))
+from core import pyznn
+
+def test_mpf( fnet, num_threads ):
+    # the output size has to be a multiple of the pooling factor
+    outsz = np.asarray([1,16,16], dtype='int64')
+
+    net = pyznn.CNet( fnet, outsz, num_threads, False, 1, False )
+    mpf = pyznn.CMPFNet( net.get_opts(), outsz, num_threads, False )
+
+    assert net.get_fov() == mpf.get_fov()
+
+    for name, setsz in net.get_inputs_setsz().iteritems():
+        assert np.all( setsz == mpf.get_inputs_setsz()[name] )
+
+    for it in range(3):
+        vol_ins = dict()
+        for name, setsz in net.get_inputs_setsz().iteritems():
+            vol_ins[name] = np.random.rand( *setsz ).astype('float32')
+
+        outs = net.forward( dict(vol_ins) )
+        mpf_outs = mpf.forward( dict(vol_ins) )
+
+        for name, out in outs.iteritems():
+            diff = np.abs( out - mpf_outs[name] ).max()
+            print "iteration {}, {}: max difference {}".format(it, name, diff)
+            assert diff < 1e-5
+
+if __name__ == '__main__':
+    fnet = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        '../../networks/hd2d.znn')
+    num_threads = 0
+    if len(sys.argv) > 1:
+        fnet = sys.argv[1]
+    if len(sys.argv) > 2:
+        num_threads = int(sys.argv[2])
+
+    test_mpf( fnet, num_threads )
+    print "OK"
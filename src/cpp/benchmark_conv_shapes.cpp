@@ -0,0 +1,101 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "assert.hpp"
+#include "cube/cube_operators.hpp"
+#include "convolution/convolution.hpp"
+#include "initializator/initializators.hpp"
+
+#include <zi/time.hpp>
+
+#include <iostream>
+
+// Time of the forward direct convolution with the generic row kernel
+// and with the kernel specialized for the shape of the filter, for
+// each of the specialized shapes
+//
+// usage: benchmark_conv_shapes [x y z] [rounds]
+//
+using namespace znn::v4;
+
+template<typename F>
+double time_rounds( std::size_t rounds, F const & f )
+{
+    f(); // warmup
+
+    zi::wall_timer wt;
+    wt.reset();
+
+    for ( std::size_t i = 0; i < rounds; ++i ) f();
+
+    return wt.elapsed<double>() / rounds;
+}
+
+void benchmark( vec3i const & s, vec3i const & f, std::size_t rounds )
+{
+    if ( f[0] > s[0] || f[1] > s[1] || f[2] > s[2] ) return;
+
+    vec3i o = s - f + vec3i::one;
+
+    auto a = get_cube<real>(s);
+    auto b = get_cube<real>(f);
+    auto r = get_cube<real>(o);
+
+    uniform_init(-1,1).initialize(*a);
+    uniform_init(-1,1).initialize(*b);
+    fill(*r, 0);
+
+    auto const & k = simd::active();
+    auto special   = k.conv_line_for(f[0], f[1], f[2]);
+
+    double generic = time_rounds(rounds, [&]()
+        {
+            detail::blocked::correlate_add(a->data(), s, b->data(), f,
+                                           vec3i::one, r->data(), o,
+                                           k.conv_line);
+        });
+
+    double fixed = time_rounds(rounds, [&]()
+        {
+            detail::blocked::correlate_add(a->data(), s, b->data(), f,
+                                           vec3i::one, r->data(), o,
+                                           special);
+        });
+
+    std::cout << s << " * " << f << ": " << generic * 1000 << " ms -> "
+              << fixed * 1000 << " ms  (" << ( generic / fixed ) << "x)\n";
+}
+
+int main(int argc, char** argv)
+{
+    vec3i s(32,64,64);
+    if ( argc >= 4 )
+    {
+        s = vec3i(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
+    }
+
+    std::size_t rounds = 10;
+    if ( argc >= 5 ) rounds = atoi(argv[4]);
+
+    std::cout << "kernels: " << simd::isa_name(simd::active_isa()) << "\n";
+
+#define ZNN_BENCHMARK_SHAPE(X,Y,Z) benchmark(s, vec3i(X,Y,Z), rounds);
+
+    ZNN_SIMD_CONV_SHAPES(ZNN_BENCHMARK_SHAPE)
+
+#undef ZNN_BENCHMARK_SHAPE
+}
@@ -0,0 +1,103 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "assert.hpp"
+#include "cube/cube_operators.hpp"
+#include "convolution/convolution.hpp"
+#include "initializator/initializators.hpp"
+
+#include <zi/time.hpp>
+
+#include <iostream>
+
+// Time of the direct convolutions (forward, weight gradient and the
+// inverse of the backward pass) of the reference implementation and of
+// the blocked kernels
+//
+// usage: benchmark_direct_conv [x y z] [rounds]
+//
+using namespace znn::v4;
+
+template<typename F>
+double time_rounds( std::size_t rounds, F const & f )
+{
+    f(); // warmup
+
+    zi::wall_timer wt;
+    wt.reset();
+
+    for ( std::size_t i = 0; i < rounds; ++i ) f();
+
+    return wt.elapsed<double>() / rounds;
+}
+
+void benchmark( vec3i const & s, vec3i const & f, std::size_t rounds )
+{
+    if ( f[0] > s[0] || f[1] > s[1] || f[2] > s[2] ) return;
+
+    vec3i o = s - f + vec3i::one;
+
+    auto a = get_cube<real>(s);
+    auto b = get_cube<real>(f);
+    auto g = get_cube<real>(o);
+
+    uniform_init(-1,1).initialize(*a);
+    uniform_init(-1,1).initialize(*b);
+    uniform_init(-1,1).initialize(*g);
+
+    auto r  = get_cube<real>(o);
+    auto dw = get_cube<real>(f);
+    auto di = get_cube<real>(s);
+
+    double t[2][3];
+
+    t[0][0] = time_rounds(rounds, [&]() { convolve_add<real>(*a,*b,*r); });
+    t[0][1] = time_rounds(rounds, [&]()
+                          { convolve_flipped_add<real>(*a,*g,*dw); });
+    t[0][2] = time_rounds(rounds, [&]()
+                          { convolve_inverse_add<real>(*g,*b,*di); });
+
+    t[1][0] = time_rounds(rounds, [&]() { convolve_add(*a,*b,*r); });
+    t[1][1] = time_rounds(rounds, [&]() { convolve_flipped_add(*a,*g,*dw); });
+    t[1][2] = time_rounds(rounds, [&]() { convolve_inverse_add(*g,*b,*di); });
+
+    char const * names[] = { "forward", "flipped", "inverse" };
+
+    for ( int i = 0; i < 3; ++i )
+    {
+        std::cout << s << " * " << f << " " << names[i] << ": "
+                  << t[0][i] * 1000 << " ms -> " << t[1][i] * 1000
+                  << " ms  (" << ( t[0][i] / t[1][i] ) << "x)\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    vec3i s(32,32,32);
+    if ( argc >= 4 )
+    {
+        s = vec3i(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
+    }
+
+    std::size_t rounds = 10;
+    if ( argc >= 5 ) rounds = atoi(argv[4]);
+
+    std::cout << "kernels: " << simd::isa_name(simd::active_isa()) << "\n";
+
+    benchmark(s, vec3i(3,3,3), rounds);
+    benchmark(s, vec3i(1,3,3), rounds);
+}
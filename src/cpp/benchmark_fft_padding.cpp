@@ -0,0 +1,104 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Per layer time of the FFTs of a featuremap (forward, product with a
+// filter, backward) at the original and at the padded size
+//
+// usage: benchmark_fft_padding <net.znn> [x y z] [rounds]
+//
+#include "network/parallel/network.hpp"
+
+using namespace znn::v4;
+
+template<typename F>
+double time_rounds( size_t rounds, F const & f )
+{
+    f(); // plans and pool warmup
+
+    zi::wall_timer wt;
+    wt.reset();
+
+    for ( size_t i = 0; i < rounds; ++i ) f();
+
+    return wt.elapsed<double>() / rounds;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<options> nodes, edges;
+    parse_net_file(nodes, edges, argv[1]);
+
+    int64_t x = 1;
+    int64_t y = 1;
+    int64_t z = 1;
+
+    if ( argc >= 5 )
+    {
+        x = atoi(argv[2]);
+        y = atoi(argv[3]);
+        z = atoi(argv[4]);
+    }
+
+    size_t rounds = 10;
+    if ( argc >= 6 ) rounds = atoi(argv[5]);
+
+    auto layers = parallel_network::network::conv_input_sizes
+        (nodes, edges, {x,y,z});
+
+    double total_raw = 0;
+    double total_pad = 0;
+
+    for ( auto & l: layers )
+    {
+        vec3i s = l.second;
+
+        auto f = get_cube<real>(s);
+        uniform_init(-1,1).initialize(*f);
+        ccube_p<real> cf = std::move(f);
+
+        // the original size
+        auto w_raw = fftw::forward_pad(cf, s);
+        double raw = time_rounds(rounds, [&]()
+            {
+                auto t = fftw::forward_pad(cf, s);
+                *t *= *w_raw;
+                fftw::backward(std::move(t), s);
+            });
+
+        // padded to the optimal size
+        fftw::transformer tr(s);
+        auto w_pad = tr.forward_pad(cf);
+        double pad = time_rounds(rounds, [&]()
+            {
+                auto t = tr.forward_pad(cf);
+                *t *= *w_pad;
+                tr.backward(std::move(t));
+            });
+
+        total_raw += raw;
+        total_pad += pad;
+
+        std::cout << l.first << ": " << s << " -> " << tr.actual_size()
+                  << "  " << raw * 1000 << " ms -> " << pad * 1000
+                  << " ms  (" << ( raw / pad ) << "x)" << std::endl;
+    }
+
+    std::cout << "total: " << total_raw * 1000 << " ms -> "
+              << total_pad * 1000 << " ms  ("
+              << ( total_raw / total_pad ) << "x)" << std::endl;
+}
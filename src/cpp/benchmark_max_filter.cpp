@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "assert.hpp"
+#include "cube/cube_operators.hpp"
+#include "pooling/pooling.hpp"
+#include "pooling/max_filter.hpp"
+#include "initializator/initializators.hpp"
+
+#include <zi/time.hpp>
+
+#include <iostream>
+
+// Time of a max filter (forward and backprop) with pooling_filter and
+// with the separable max_filter, for growing windows, and the bytes of
+// the indices each keeps for the backward pass
+//
+// usage: benchmark_max_filter [x y z] [rounds]
+//
+using namespace znn::v4;
+
+template<typename F>
+double time_rounds( std::size_t rounds, F const & f )
+{
+    f(); // warmup
+
+    zi::wall_timer wt;
+    wt.reset();
+
+    for ( std::size_t i = 0; i < rounds; ++i ) f();
+
+    return wt.elapsed<double>() / rounds;
+}
+
+void benchmark( vec3i const & s, vec3i const & w, std::size_t rounds )
+{
+    if ( w[0] > s[0] || w[1] > s[1] || w[2] > s[2] ) return;
+
+    auto a = get_cube<real>(s);
+    uniform_init(-1,1).initialize(*a);
+
+    auto cmp = [](real x, real y) { return x > y; };
+
+    auto old = pooling_filter(get_copy(*a), cmp, w);
+    auto neu = max_filter(*a, cmp, w);
+
+    auto g = get_cube<real>(size(*neu.first));
+    uniform_init(-1,1).initialize(*g);
+
+    double t[2][2];
+
+    t[0][0] = time_rounds(rounds, [&]()
+                          { pooling_filter(get_copy(*a), cmp, w); });
+    t[0][1] = time_rounds(rounds, [&]()
+                          { pooling_backprop(s, *g, *old.second); });
+
+    t[1][0] = time_rounds(rounds, [&]() { max_filter(*a, cmp, w); });
+    t[1][1] = time_rounds(rounds, [&]()
+                          { max_filter_backprop(s, *g, neu.second); });
+
+    char const * names[] = { "forward", "backprop" };
+
+    for ( int i = 0; i < 2; ++i )
+    {
+        std::cout << s << " max " << w << " " << names[i] << ": "
+                  << t[0][i] * 1000 << " ms -> " << t[1][i] * 1000
+                  << " ms  (" << ( t[0][i] / t[1][i] ) << "x)\n";
+    }
+
+    std::size_t bytes = neu.second.bytes
+        ? neu.second.bytes->num_elements()
+        : neu.second.words->num_elements() * 2;
+
+    std::cout << s << " max " << w << " indices: "
+              << old.second->num_elements() * sizeof(int) << " -> "
+              << bytes << " bytes\n";
+}
+
+int main(int argc, char** argv)
+{
+    vec3i s(64,64,64);
+    if ( argc >= 4 )
+    {
+        s = vec3i(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
+    }
+
+    std::size_t rounds = 10;
+    if ( argc >= 5 ) rounds = atoi(argv[4]);
+
+    benchmark(s, vec3i(2,2,2), rounds);
+    benchmark(s, vec3i(3,3,3), rounds);
+    benchmark(s, vec3i(5,5,5), rounds);
+    benchmark(s, vec3i(1,7,7), rounds);
+    benchmark(s, vec3i(9,9,9), rounds);
+}
@@ -0,0 +1,131 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Dense inference of the same net (and weights) with max_filter layers
+// and sparse convolutions, and with max-pooling fragments, the time of a
+// forward pass of each and the largest difference of the outputs. The
+// max_pool layers are turned into max_filter layers (hd3d_strided.znn
+// into hd3d.znn), the output size has to be a multiple of the pooling
+// factor
+//
+// usage: benchmark_mpf <net.znn> [x y z] [threads] [rounds]
+//
+#include "network/parallel/mpf_network.hpp"
+
+using namespace znn::v4;
+using namespace znn::v4::parallel_network;
+
+typedef std::map<std::string, std::vector<cube_p<real>>> sample_t;
+
+sample_t copy_sample( sample_t const & s )
+{
+    sample_t ret;
+    for ( auto & f: s )
+        for ( auto & c: f.second )
+            ret[f.first].push_back(get_copy(*c));
+    return ret;
+}
+
+template<class Net>
+double forward_time( Net & net, std::vector<sample_t> const & ins,
+                     sample_t & out )
+{
+    out = net.forward(copy_sample(ins[0]));
+
+    zi::wall_timer wt;
+    wt.reset();
+
+    for ( size_t i = 1; i < ins.size(); ++i )
+    {
+        net.forward(copy_sample(ins[i]));
+    }
+
+    return wt.elapsed<double>() / ( ins.size() - 1 );
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<options> nodes, edges;
+    parse_net_file(nodes, edges, argv[1]);
+
+    int64_t x = 16;
+    int64_t y = 16;
+    int64_t z = 4;
+
+    if ( argc >= 5 )
+    {
+        x = atoi(argv[2]);
+        y = atoi(argv[3]);
+        z = atoi(argv[4]);
+    }
+
+    size_t tc = std::thread::hardware_concurrency();
+    if ( argc >= 6 ) tc = atoi(argv[5]);
+
+    size_t rounds = 3;
+    if ( argc >= 7 ) rounds = atoi(argv[6]);
+
+    vec3i outsz(z,y,x);
+
+    for ( auto & e: edges )
+    {
+        if ( e.require_as<std::string>("type") == "max_pool" )
+        {
+            e.push("type", "max_filter");
+            e.push("stride", e.require_as<std::string>("size"));
+        }
+    }
+
+    network dense(nodes, edges, outsz, tc, phase::TEST);
+
+    // the same weights
+    auto net = dense.serialize();
+    mpf_network mpf(net.first, net.second, outsz, tc);
+
+    std::vector<sample_t> ins, outs;
+    std::tie(ins, outs) = generate_inout(rounds + 1, dense);
+
+    sample_t a, b;
+    double t_dense = forward_time(dense, ins, a);
+    double t_mpf   = forward_time(mpf, ins, b);
+
+    real diff = 0;
+    for ( auto & f: a )
+    {
+        for ( size_t i = 0; i < f.second.size(); ++i )
+        {
+            cube<real> const & p = *f.second[i];
+            cube<real> const & q = *b[f.first][i];
+
+            for ( size_t k = 0; k < p.num_elements(); ++k )
+            {
+                diff = std::max(diff, std::abs(p.data()[k] - q.data()[k]));
+            }
+        }
+    }
+
+    std::cout << "\nfov: " << dense.fov() << " output: " << outsz
+              << " stages: " << mpf.stages() << "\n"
+              << "sparse: " << t_dense << " secs\n"
+              << "mpf:    " << t_mpf << " secs  ("
+              << ( t_dense / t_mpf ) << "x)\n"
+              << "max difference: " << diff << std::endl;
+
+    dense.zap();
+    mpf.zap();
+}
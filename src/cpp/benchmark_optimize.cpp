@@ -0,0 +1,139 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Time of network::optimize timing every convolution of every conv layer
+// (an infinite margin) and pruned by the cost model, the convolutions
+// they chose and the time of an iteration with each choice
+//
+// usage: benchmark_optimize <net.znn> [x y z] [threads] [margin]
+//
+#include "network/parallel/network.hpp"
+
+#include <limits>
+
+using namespace znn::v4;
+using namespace znn::v4::parallel_network;
+
+double iteration( std::vector<options> & nodes,
+                  std::vector<options> & edges,
+                  vec3i const & outsz,
+                  size_t tc,
+                  size_t rounds = 5 )
+{
+    network net(nodes, edges, outsz, tc);
+
+    std::vector<std::map<std::string, std::vector<cube_p<real>>>> ins, outs;
+    std::tie(ins, outs) = generate_inout(rounds + 1, net);
+
+    net.forward(std::move(ins[0]));
+
+    zi::wall_timer wt;
+    wt.reset();
+
+    for ( size_t i = 0; i < rounds; ++i )
+    {
+        net.backward(std::move(outs[i]));
+        net.forward(std::move(ins[i+1]));
+    }
+
+    double r = wt.elapsed<double>() / rounds;
+    net.zap();
+    return r;
+}
+
+std::string choice( options const & e )
+{
+    if ( e.optional_as<int>("fft", "0") ) return "fft";
+    if ( e.optional_as<int>("gemm", "0") ) return "gemm";
+
+    switch ( e.optional_as<int>("winograd", "0") )
+    {
+    case 2: return "winograd2";
+    case 4: return "winograd4";
+    }
+
+    return "direct";
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<options> nodes, edges;
+    parse_net_file(nodes, edges, argv[1]);
+
+    int64_t x = 1;
+    int64_t y = 1;
+    int64_t z = 1;
+
+    if ( argc >= 5 )
+    {
+        x = atoi(argv[2]);
+        y = atoi(argv[3]);
+        z = atoi(argv[4]);
+    }
+
+    size_t tc = std::thread::hardware_concurrency();
+    if ( argc >= 6 ) tc = atoi(argv[5]);
+
+    real margin = 0.2;
+    if ( argc >= 7 ) margin = atof(argv[6]);
+
+    vec3i outsz(z,y,x);
+
+    // neither run may see the choices of the other
+    tuning_cache.set_file("");
+
+    std::vector<options> exhaustive = edges;
+    std::vector<options> pruned     = edges;
+
+    tuning_cache.clear();
+    zi::wall_timer wt;
+    network::optimize(nodes, exhaustive, outsz, tc, 10,
+                      std::numeric_limits<real>::infinity());
+    double t_exhaustive = wt.elapsed<double>();
+
+    tuning_cache.clear();
+    wt.reset();
+    network::optimize(nodes, pruned, outsz, tc, 10, margin);
+    double t_pruned = wt.elapsed<double>();
+
+    tuning_cache.clear();
+
+    std::cout << "\nlayer  exhaustive  pruned\n";
+
+    size_t differ = 0;
+    for ( size_t i = 0; i < edges.size(); ++i )
+    {
+        if ( edges[i].require_as<std::string>("type") != "conv" ) continue;
+
+        auto a = choice(exhaustive[i]);
+        auto b = choice(pruned[i]);
+        if ( a != b ) ++differ;
+
+        std::cout << edges[i].require_as<std::string>("name") << "  " << a
+                  << "  " << b << std::endl;
+    }
+
+    double i_exhaustive = iteration(nodes, exhaustive, outsz, tc);
+    double i_pruned     = iteration(nodes, pruned, outsz, tc);
+
+    std::cout << "\noptimize: " << t_exhaustive << " secs -> " << t_pruned
+              << " secs  (" << ( t_exhaustive / t_pruned ) << "x)\n"
+              << "iteration: " << i_exhaustive << " secs -> " << i_pruned
+              << " secs  (" << ( i_pruned / i_exhaustive ) << "x), "
+              << differ << " layers differ" << std::endl;
+}
@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Forward pass time of the dynamically dispatched and of the compiled
+// network, small output patches show the scheduling overhead
+//
+// usage: benchmark_plan <net.znn> [x y z] [threads] [rounds]
+//
+#include "network/parallel/network.hpp"
+
+using namespace znn::v4;
+
+int main(int argc, char** argv)
+{
+    std::vector<options> nodes, edges;
+    parse_net_file(nodes, edges, argv[1]);
+
+    int64_t x = 1;
+    int64_t y = 1;
+    int64_t z = 1;
+
+    if ( argc >= 5 )
+    {
+        x = atoi(argv[2]);
+        y = atoi(argv[3]);
+        z = atoi(argv[4]);
+    }
+
+    size_t tc     = std::thread::hardware_concurrency();
+    size_t rounds = 100;
+
+    if ( argc >= 6 ) tc     = atoi(argv[5]);
+    if ( argc >= 7 ) rounds = atoi(argv[6]);
+
+    parallel_network::network net(nodes, edges, {x,y,z}, tc,
+                                  parallel_network::phase::TEST);
+
+    auto ins = net.inputs();
+
+    auto sample = [&]()
+        {
+            std::map<std::string, std::vector<cube_p<real>>> in;
+            for ( auto & i: ins )
+            {
+                for ( size_t n = 0; n < i.second.second; ++n )
+                {
+                    auto v = get_cube<real>(i.second.first);
+                    uniform_init(-1,1).initialize(*v);
+                    in[i.first].push_back(v);
+                }
+            }
+            return in;
+        };
+
+    for ( int compiled = 0; compiled < 2; ++compiled )
+    {
+        if ( compiled ) net.compile();
+
+        // warmup
+        net.forward(sample());
+
+        zi::wall_timer wt;
+        double total = 0;
+
+        for ( size_t i = 0; i < rounds; ++i )
+        {
+            auto in = sample();
+            wt.reset();
+            net.forward(std::move(in));
+            total += wt.elapsed<double>();
+        }
+
+        std::cout << ( compiled ? "compiled: " : "dynamic:  " )
+                  << ( total / rounds * 1000 ) << " ms/iteration\n";
+    }
+}
@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "assert.hpp"
+#include "cube/cube_operators.hpp"
+
+#include <zi/time.hpp>
+
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Memory throughput (GB/s) of the element-wise cube kernels for each
+// instruction set supported by the CPU
+//
+// usage: benchmark_simd [n] [rounds]
+//
+// n is the number of reals (default 32^3), the complex kernels work on
+// n/2 complex values
+//
+using namespace znn::v4;
+
+template<typename F>
+double gbps( std::size_t bytes, std::size_t rounds, F const & f )
+{
+    f(); // warmup
+
+    zi::wall_timer wt;
+    wt.reset();
+
+    for ( std::size_t i = 0; i < rounds; ++i ) f();
+
+    return static_cast<double>(bytes) * rounds / wt.elapsed<double>() / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t n      = 32 * 32 * 32;
+    std::size_t rounds = 1000;
+
+    if ( argc > 1 ) n      = std::stoul(argv[1]);
+    if ( argc > 2 ) rounds = std::stoul(argv[2]);
+
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<real> dis(-1, 1);
+
+    std::vector<real> a(n), b(n), o(n), u(n);
+    for ( auto & x: a ) x = dis(rng);
+    for ( auto & x: b ) x = dis(rng);
+    for ( auto & x: o ) x = dis(rng);
+    for ( auto & x: u ) x = ( dis(rng) < 0 ) ? -1 : 1;
+
+    std::size_t r = n * sizeof(real);
+
+    std::cout << "n = " << n << ", active: "
+              << simd::isa_name(simd::active_isa()) << "\n\n"
+              << std::setw(8) << "GB/s";
+
+    char const * ops[] = { "add_to", "scale_add", "mad_to", "mul_with",
+                           "sum", "reverse", "cmul", "cmad" };
+
+    for ( auto op: ops ) std::cout << std::setw(11) << op;
+    std::cout << "\n";
+
+    for ( int i = 0; i <= static_cast<int>(simd::supported()); ++i )
+    {
+        simd::isa  s = static_cast<simd::isa>(i);
+        auto const & k = simd::kernels_for(s);
+
+        real c = 0.5;
+        real t = 0;
+
+        // mul_with multiplies by +-1 so that the repeated products don't
+        // become denormal
+        double res[] = {
+            gbps(3*r, rounds, [&]() { k.add_to(o.data(), a.data(), n); }),
+            gbps(3*r, rounds, [&]() { k.scale_add(c, a.data(), o.data(), n); }),
+            gbps(4*r, rounds, [&]() { k.mad_to(a.data(), b.data(), o.data(), n); }),
+            gbps(3*r, rounds, [&]() { k.mul_with(o.data(), u.data(), n); }),
+            gbps(1*r, rounds, [&]() { t += k.sum(a.data(), n); }),
+            gbps(2*r, rounds, [&]() { k.reverse(o.data(), n); }),
+            gbps(3*r, rounds, [&]() { k.cmul(a.data(), b.data(), o.data(), n/2); }),
+            gbps(4*r, rounds, [&]() { k.cmad(a.data(), b.data(), o.data(), n/2); })
+        };
+
+        std::cout << std::setw(8) << simd::isa_name(s);
+        for ( auto g: res )
+            std::cout << std::setw(11) << std::fixed << std::setprecision(2) << g;
+        std::cout << "\n";
+
+        if ( t == 12345 ) std::cout << t; // keep the sums
+    }
+}
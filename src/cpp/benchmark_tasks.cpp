@@ -0,0 +1,91 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Scheduler overhead: tasks/sec of empty tasks carrying the same
+// captures as the edge tasks (an object and a featuremap)
+//
+#include "network/parallel/network.hpp"
+#include "utils/waiter.hpp"
+
+using namespace znn::v4;
+
+struct dummy_edge
+{
+    std::atomic<size_t> count{0};
+
+    void forward( ccube_p<real> const & )
+    {
+        ++count;
+    }
+};
+
+int main(int argc, char** argv)
+{
+    size_t tc = std::thread::hardware_concurrency();
+    size_t n  = 1000000;
+
+    if ( argc >= 2 ) tc = atoi(argv[1]);
+    if ( argc >= 3 ) n  = atoi(argv[2]);
+
+    task_manager tm(tc);
+
+    dummy_edge e;
+    ccube_p<real> f = get_cube<real>(vec3i(1,1,1));
+
+    {
+        waiter w(n);
+        dummy_edge* t = &e;
+
+        zi::wall_timer wt;
+        wt.reset();
+
+        for ( size_t i = 0; i < n; ++i )
+        {
+            tm.schedule(i % 64, [t,f,&w]() {
+                    t->forward(f);
+                    w.one_done();
+                });
+        }
+
+        w.wait();
+
+        std::cout << "schedule:     "
+                  << ( n / wt.elapsed<double>() ) << " tasks/sec\n";
+    }
+
+    {
+        size_t m = n / 10;
+        waiter w(m);
+
+        zi::wall_timer wt;
+        wt.reset();
+
+        for ( size_t i = 0; i < m; ++i )
+        {
+            auto h = tm.schedule_unprivileged(&dummy_edge::forward, &e, f);
+            tm.require_done(h, &waiter::one_done, &w);
+        }
+
+        w.wait();
+
+        std::cout << "unprivileged: "
+                  << ( m / wt.elapsed<double>() ) << " tasks/sec\n";
+    }
+
+    std::cout << "total: " << e.count << std::endl;
+}
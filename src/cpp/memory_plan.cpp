@@ -0,0 +1,95 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Prints the predicted memory use of a network for the given output
+// size; with rounds > 0 also trains on random data after preallocating
+// and reports the cubes that still had to be allocated. The first
+// iteration is the warm-up, the program fails if any of the following
+// ones misses the pool.
+//
+// usage: memory_plan <net.znn> [x y z] [threads] [rounds]
+//
+#include "network/parallel/network.hpp"
+
+using namespace znn::v4;
+using namespace znn::v4::parallel_network;
+
+int main(int argc, char** argv)
+{
+    std::vector<options> nodes, edges;
+    parse_net_file(nodes, edges, argv[1]);
+
+    int64_t x = 1;
+    int64_t y = 1;
+    int64_t z = 1;
+
+    if ( argc >= 5 )
+    {
+        x = atoi(argv[2]);
+        y = atoi(argv[3]);
+        z = atoi(argv[4]);
+    }
+
+    size_t tc     = std::thread::hardware_concurrency();
+    size_t rounds = 0;
+
+    if ( argc >= 6 ) tc     = atoi(argv[5]);
+    if ( argc >= 7 ) rounds = atoi(argv[6]);
+
+    std::cout << network::plan_memory(nodes, edges, {x,y,z}, tc);
+
+    if ( rounds == 0 ) return 0;
+
+    network net(nodes, edges, {x,y,z}, tc);
+    net.preallocate();
+
+    auto misses = []()
+        {
+            size_t r = 0;
+            for ( auto & s: cube_pool_stats() ) r += s.misses;
+            return r;
+        };
+
+    inout_t ins, outs;
+    std::tie(ins, outs) = generate_inout(rounds, net);
+
+    size_t steady = 0;
+
+    for ( size_t i = 0; i < rounds; ++i )
+    {
+        size_t before = misses();
+
+        net.forward(std::move(ins[i]));
+        net.backward(std::move(outs[i]));
+        net.zap();
+
+        size_t n = misses() - before;
+        if ( i > 0 ) steady += n;
+
+        std::cout << "iteration " << i << ": "
+                  << n << " allocations, "
+                  << cube_pool_bytes_held() << " bytes idle in the pool\n";
+    }
+
+    if ( steady )
+    {
+        std::cout << "FAILED: " << steady
+                  << " allocations after the warm-up\n";
+        return 1;
+    }
+}
@@ -0,0 +1,78 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Build with -DZNN_NUMA, on a single socket machine run with
+// ZNN_NUMA_NODES=<n> to simulate n nodes
+//
+#include "network/parallel/network.hpp"
+#include "utils/numa.hpp"
+#include "utils/waiter.hpp"
+
+#include <sched.h>
+
+using namespace znn::v4;
+
+int main(int argc, char** argv)
+{
+    size_t tc = std::thread::hardware_concurrency();
+    size_t n  = 100000;
+
+    if ( argc >= 2 ) tc = atoi(argv[1]);
+    if ( argc >= 3 ) n  = atoi(argv[2]);
+
+    std::cout << "nodes: " << numa.size()
+              << ( numa.simulated() ? " (simulated)" : "" ) << "\n";
+
+    for ( size_t i = 0; i < numa.size(); ++i )
+    {
+        std::cout << "  node " << i << ":";
+        for ( auto c: numa.cpus(i) ) std::cout << ' ' << c;
+        std::cout << "\n";
+    }
+
+    task_manager tm(tc);
+
+    std::vector<std::atomic<size_t>> local(numa.size());
+    std::vector<std::atomic<size_t>> pinned(numa.size());
+
+    waiter w(n);
+
+    for ( size_t i = 0; i < n; ++i )
+    {
+        size_t node = i % numa.size();
+        tm.schedule_on(node, i % 17, [&,node]() {
+                if ( this_numa_node() == node ) ++local[node];
+
+                int cpu = sched_getcpu();
+                for ( auto c: numa.cpus(this_numa_node()) )
+                    if ( static_cast<int>(c) == cpu ) ++pinned[node];
+
+                auto c = get_cube<real>(vec3i(8,8,8));
+                fill(*c,0);
+                w.one_done();
+            });
+    }
+
+    w.wait();
+
+    for ( size_t i = 0; i < numa.size(); ++i )
+    {
+        std::cout << "node " << i << " local: " << local[i]
+                  << " pinned: " << pinned[i] << "\n";
+    }
+}
@@ -0,0 +1,154 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Compares the forward pass of the compiled network with the dynamically
+// dispatched one, for each kind of conv edges
+//
+// usage: plan_test [threads] [direct|gemm|winograd2|winograd4|fft ...]
+//
+#include "network/parallel/network.hpp"
+
+using namespace znn::v4;
+using namespace znn::v4::parallel_network;
+
+namespace {
+
+std::pair<std::vector<options>,std::vector<options>>
+make_net( options const & conv )
+{
+    std::vector<options> ns, es;
+
+    ns.push_back({{"name","input"},{"type","input"},{"size","2"}});
+    ns.push_back({{"name","nl1"},{"type","transfer"},
+                  {"function","rectify_linear"},{"size","5"}});
+    ns.push_back({{"name","nl2"},{"type","transfer"},
+                  {"function","tanh"},{"function_args","1,1"},{"size","3"}});
+    ns.push_back({{"name","output"},{"type","transfer"},
+                  {"function","linear"},{"function_args","1,0"},
+                  {"size","2"}});
+
+    char const * names[] = { "input", "nl1", "nl2", "output" };
+
+    for ( size_t l = 0; l < 3; ++l )
+    {
+        options e = conv;
+        e.push("name", "conv" + std::to_string(l + 1));
+        e.push("type", "conv");
+        e.push("init", "uniform");
+        e.push("size", "3,3,3");
+        e.push("stride", "1,1,1");
+        e.push("input", names[l]);
+        e.push("output", names[l + 1]);
+        es.push_back(e);
+    }
+
+    return {ns, es};
+}
+
+real max_difference( cube<real> const & a, cube<real> const & b )
+{
+    real r = 0;
+    for ( size_t i = 0; i < a.num_elements(); ++i )
+    {
+        r = std::max(r, std::abs(a.data()[i] - b.data()[i]));
+    }
+    return r;
+}
+
+bool test( std::string const & name, options const & conv, size_t tc )
+{
+    auto net_opts = make_net(conv);
+
+    network net(net_opts.first, net_opts.second, {4,5,6}, tc,
+                phase::TEST);
+
+    std::map<std::string, std::vector<cube_p<real>>> in;
+    for ( auto & i: net.inputs() )
+    {
+        for ( size_t n = 0; n < i.second.second; ++n )
+        {
+            auto v = get_cube<real>(i.second.first);
+            uniform_init(-1,1).initialize(*v);
+            in[i.first].push_back(v);
+        }
+    }
+
+    auto copy = [&]()
+        {
+            std::map<std::string, std::vector<cube_p<real>>> r;
+            for ( auto & i: in )
+                for ( auto & v: i.second )
+                    r[i.first].push_back(get_copy(*v));
+            return r;
+        };
+
+    auto expected = net.forward(copy());
+    for ( auto & o: expected )
+        for ( auto & v: o.second ) v = get_copy(*v);
+
+    net.compile();
+
+    real diff = 0;
+    for ( size_t round = 0; round < 5; ++round )
+    {
+        auto out = net.forward(copy());
+        for ( auto & o: expected )
+        {
+            for ( size_t i = 0; i < o.second.size(); ++i )
+            {
+                diff = std::max(diff, max_difference(*o.second[i],
+                                                     *out[o.first][i]));
+            }
+        }
+    }
+
+    bool ok = diff < 1e-5;
+    std::cout << name << ": " << ( ok ? "OK" : "FAILED" )
+              << " (max difference " << diff << ")" << std::endl;
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    size_t tc = 4;
+    if ( argc >= 2 ) tc = atoi(argv[1]);
+
+    std::map<std::string, options> kinds;
+    kinds["direct"]    = options();
+    kinds["gemm"]      = options{{"gemm","1"}};
+    kinds["winograd2"] = options{{"winograd","2"}};
+    kinds["winograd4"] = options{{"winograd","4"}};
+    kinds["fft"]       = options{{"fft","1"}};
+
+    std::vector<std::string> run;
+    for ( int i = 2; i < argc; ++i ) run.push_back(argv[i]);
+    if ( run.empty() )
+    {
+        run = { "direct", "gemm", "winograd2", "winograd4", "fft" };
+    }
+
+    bool ok = true;
+    for ( auto & k: run )
+    {
+        ok = test(k, kinds.at(k), tc) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -21,4 +21,49 @@
 #include "convolve_constant.hpp"
 #include "convolve_sparse.hpp"
 
+#ifdef ZNN_USE_MKL_DIRECT_CONV
+
+#include "../utils/parallel_for.hpp"
+
+namespace znn { namespace v4 {
+
+// MKL chooses its own kernels and threads, see convolve_blocked.hpp
+class direct_kernel
+{
+public:
+    direct_kernel() = default;
+    direct_kernel( vec3i const &, vec3i const &, vec3i const & ) {}
+};
+
+inline cube_p<real> convolve_sparse( cube<real> const & a,
+                                     cube<real> const & b,
+                                     vec3i const & s,
+                                     direct_kernel const &,
+                                     spatial_split const & = spatial_split() )
+{
+    return convolve_sparse(a,b,s);
+}
+
+inline cube_p<real> convolve_sparse_inverse( cube<real> const & a,
+                                             cube<real> const & b,
+                                             vec3i const & s,
+                                             direct_kernel const &,
+                                             spatial_split const &
+                                             = spatial_split() )
+{
+    return convolve_sparse_inverse(a,b,s);
+}
+
+inline cube_p<real> convolve_sparse_flipped( cube<real> const & a,
+                                             cube<real> const & b,
+                                             vec3i const & s,
+                                             spatial_split const & )
+{
+    return convolve_sparse_flipped(a,b,s);
+}
+
+}} // namespace znn::v4
+
+#endif
+
 //#include "naive/convolution.hpp"
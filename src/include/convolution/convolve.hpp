@@ -23,9 +23,13 @@
 
 #include "../types.hpp"
 #include "convolve_constant.hpp"
+#include "convolve_blocked.hpp"
 
 namespace znn { namespace v4 {
 
+// The templates below are the reference implementations, the real
+// cubes use the overloads of convolve_blocked.hpp
+
 template< typename T >
 inline void convolve_add( cube<T> const & a,
                           cube<T> const & b,
@@ -0,0 +1,396 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "../types.hpp"
+#include "../cube/cube.hpp"
+#include "../cube/detail/simd.hpp"
+#include "../utils/parallel_for.hpp"
+#include "convolve_constant.hpp"
+
+#include <algorithm>
+
+// Direct convolutions of real cubes vectorized along z
+//
+// The non-template overloads below are preferred to the templates of
+// convolve.hpp and convolve_sparse.hpp, which are kept as the reference
+// (e.g. convolve_add<real>(a,b,r)). Every row of the output is computed
+// by simd::kernels::conv_line, blocks of four registers of outputs get
+// all the taps of the filter before being stored. The weight gradients
+// (flipped) are long dot products of the gradient with the shifted
+// input, four neighbouring outputs share the loads of the gradient
+// (simd::kernels::correlate_rows). The inverse is a valid convolution
+// of the zero padded input. When z is trivial (2D), the cubes are
+// treated as 1 x X x Y. The rows of the output are split into chunks
+// among the idle workers when a spatial_split is given.
+//
+// The flipped taps and the padded input are taken from the cube pool,
+// the functions that need them (or split the rows) aren't noexcept.
+//
+namespace znn { namespace v4 {
+
+namespace detail { namespace blocked {
+
+// moves the trailing dimensions of size one to the front so that the
+// vectorized dimension isn't trivial, the memory layout is the same
+inline void squeeze( vec3i & a, vec3i & b, vec3i & r, vec3i & s )
+{
+    for ( int i = 0; i < 2; ++i )
+    {
+        if ( a[2] != 1 || b[2] != 1 || r[2] != 1 ) return;
+        if ( a[0] == 1 && a[1] == 1 ) return;
+
+        a = vec3i(1, a[0], a[1]);
+        b = vec3i(1, b[0], b[1]);
+        r = vec3i(1, r[0], r[1]);
+        s = vec3i(1, s[0], s[1]);
+    }
+}
+
+// the row kernel for a (squeezed) filter shape, specialized when the
+// shape is one of ZNN_SIMD_CONV_SHAPES
+inline simd::conv_line_t conv_line_for( vec3i const & bs )
+{
+    auto const & k = simd::active();
+    auto line = k.conv_line_for(bs[0], bs[1], bs[2]);
+    return line ? line : k.conv_line;
+}
+
+// r += a * w with the taps w of the (dilated by s) filter of size bs
+// in the order of the correlation
+inline void correlate_add( real const * a, vec3i const & as,
+                           real const * w, vec3i const & bs,
+                           vec3i const & s,
+                           real * r, vec3i const & rs,
+                           simd::conv_line_t line,
+                           spatial_split const & split
+                           = spatial_split() )
+{
+    std::size_t sx = s[0] * as[1] * as[2];
+    std::size_t sy = s[1] * as[2];
+
+    double work = static_cast<double>(rs[0] * rs[1] * rs[2])
+        * ( bs[0] * bs[1] * bs[2] );
+
+    split(rs[0] * rs[1], work, [&]( std::size_t b, std::size_t e )
+        {
+            for ( std::size_t q = b; q < e; ++q )
+            {
+                long_t x = q / rs[1];
+                long_t y = q % rs[1];
+
+                line(a + ( x * as[1] + y ) * as[2], sx, sy, s[2],
+                     w, bs[0], bs[1], bs[2],
+                     r + ( x * rs[1] + y ) * rs[2], rs[2]);
+            }
+        });
+}
+
+}} // namespace detail::blocked
+
+// The row kernel of the direct convolutions of an edge, chosen when the
+// edge is constructed from the size of its filter and of its input
+class direct_kernel
+{
+private:
+    vec3i             shape_ = vec3i::zero;
+    simd::conv_line_t line_  = nullptr;
+
+public:
+    direct_kernel() = default;
+
+    direct_kernel( vec3i const & filter,
+                   vec3i const & in,
+                   vec3i const & stride )
+    {
+        vec3i b = filter;
+        vec3i a = in;
+        vec3i r = in - ( filter - vec3i::one ) * stride;
+        vec3i s = stride;
+
+        detail::blocked::squeeze(a, b, r, s);
+
+        shape_ = b;
+        line_  = detail::blocked::conv_line_for(b);
+    }
+
+    // the kernel for the squeezed filter shape bs
+    simd::conv_line_t for_shape( vec3i const & bs ) const
+    {
+        if ( line_ && bs == shape_ ) return line_;
+        return detail::blocked::conv_line_for(bs);
+    }
+};
+
+namespace detail { namespace blocked {
+
+inline void convolve_sparse_add( cube<real> const & a,
+                                 cube<real> const & b,
+                                 vec3i s,
+                                 cube<real> & r,
+                                 direct_kernel const & k
+                                 = direct_kernel(),
+                                 spatial_split const & split
+                                 = spatial_split() )
+{
+    vec3i as = size(a);
+    vec3i bs = size(b);
+    vec3i rs = size(r);
+
+    ZI_ASSERT(rs==as-(bs-vec3i::one)*s);
+
+    // the taps flipped
+    auto w = get_cube<real>(bs);
+    std::reverse_copy(b.data(), b.data() + b.num_elements(), w->data());
+
+    squeeze(as, bs, rs, s);
+    correlate_add(a.data(), as, w->data(), bs, s, r.data(), rs,
+                  k.for_shape(bs), split);
+}
+
+inline void convolve_sparse_flipped_add( cube<real> const & a,
+                                         cube<real> const & b,
+                                         vec3i s,
+                                         cube<real> & r,
+                                         spatial_split const & split
+                                         = spatial_split() )
+{
+    vec3i as = size(a);
+    vec3i bs = size(b);
+    vec3i rs = size(r);
+
+    ZI_ASSERT(rs==(as-bs)/s+vec3i::one);
+
+    squeeze(as, bs, rs, s);
+
+    auto const & k = simd::active();
+
+    // r[q] += sum b[u] * a[as - bs - q*s + u]
+    vec3i c = as - bs;
+
+    std::size_t sx = as[1] * as[2];
+    std::size_t sy = as[2];
+
+    double work = static_cast<double>(rs[0] * rs[1] * rs[2])
+        * ( bs[0] * bs[1] * bs[2] );
+
+    split(rs[0] * rs[1], work, [&]( std::size_t from, std::size_t to )
+        {
+            for ( std::size_t q = from; q < to; ++q )
+            {
+                long_t qx = q / rs[1];
+                long_t qy = q % rs[1];
+
+                k.correlate_rows(a.data() + ( ( c[0] - qx * s[0] ) * as[1]
+                                              + c[1] - qy * s[1] ) * as[2]
+                                 + c[2],
+                                 sx, sy, b.data(), bs[0], bs[1], bs[2], s[2],
+                                 r.data() + ( qx * rs[1] + qy ) * rs[2],
+                                 rs[2]);
+            }
+        });
+}
+
+inline void convolve_sparse_inverse_add( cube<real> const & a,
+                                         cube<real> const & b,
+                                         vec3i s,
+                                         cube<real> & r,
+                                         direct_kernel const & k
+                                         = direct_kernel(),
+                                         spatial_split const & split
+                                         = spatial_split() )
+{
+    vec3i as = size(a);
+    vec3i bs = size(b);
+    vec3i rs = size(r);
+
+    ZI_ASSERT(rs==as+(bs-vec3i::one)*s);
+
+    // valid convolution of the input padded by the size of the
+    // (dilated) filter on both sides, the taps aren't flipped
+    vec3i o  = ( bs - vec3i::one ) * s;
+    vec3i ps = as + o + o;
+
+    auto p = get_cube<real>(ps);
+    std::fill_n(p->data(), p->num_elements(), 0);
+
+    real const * ap = a.data();
+    real       * pp = p->data();
+
+    for ( long_t x = 0; x < as[0]; ++x )
+        for ( long_t y = 0; y < as[1]; ++y )
+        {
+            std::copy_n(ap + ( x * as[1] + y ) * as[2], as[2],
+                        pp + ( ( x + o[0] ) * ps[1] + y + o[1] ) * ps[2]
+                        + o[2]);
+        }
+
+    squeeze(ps, bs, rs, s);
+    correlate_add(p->data(), ps, b.data(), bs, s, r.data(), rs,
+                  k.for_shape(bs), split);
+}
+
+}} // namespace detail::blocked
+
+inline void convolve_add( cube<real> const & a,
+                          cube<real> const & b,
+                          cube<real> & r)
+{
+    if ( b.num_elements() == 1 )
+    {
+        convolve_constant_add(a,b.data()[0],r);
+        return;
+    }
+
+    detail::blocked::convolve_sparse_add(a,b,vec3i::one,r);
+}
+
+inline void convolve_flipped_add( cube<real> const & a,
+                                  cube<real> const & b,
+                                  cube<real> & r) noexcept
+{
+    if ( size(a) == size(b) )
+    {
+        ZI_ASSERT(r.num_elements()==1);
+        r.data()[0] += convolve_constant_flipped(a,b);
+        return;
+    }
+
+    detail::blocked::convolve_sparse_flipped_add(a,b,vec3i::one,r);
+}
+
+inline void convolve_inverse_add( cube<real> const & a,
+                                  cube<real> const & b,
+                                  cube<real> & r)
+{
+    if ( size(b) == vec3i::one )
+    {
+        convolve_constant_inverse_add(a,b.data()[0],r);
+        return;
+    }
+
+    detail::blocked::convolve_sparse_inverse_add(a,b,vec3i::one,r);
+}
+
+inline void convolve_sparse_add( cube<real> const & a,
+                                 cube<real> const & b,
+                                 vec3i const & s,
+                                 cube<real> & r )
+{
+    if ( s == vec3i::one )
+    {
+        convolve_add(a,b,r);
+        return;
+    }
+
+    detail::blocked::convolve_sparse_add(a,b,s,r);
+}
+
+inline void convolve_sparse_flipped_add( cube<real> const & a,
+                                         cube<real> const & b,
+                                         vec3i const & s,
+                                         cube<real> & r ) noexcept
+{
+    if ( s == vec3i::one )
+    {
+        convolve_flipped_add(a,b,r);
+        return;
+    }
+
+    detail::blocked::convolve_sparse_flipped_add(a,b,s,r);
+}
+
+inline void convolve_sparse_inverse_add( cube<real> const & a,
+                                         cube<real> const & b,
+                                         vec3i const & s,
+                                         cube<real> & r )
+{
+    if ( s == vec3i::one )
+    {
+        convolve_inverse_add(a,b,r);
+        return;
+    }
+
+    detail::blocked::convolve_sparse_inverse_add(a,b,s,r);
+}
+
+// Versions of convolve_sparse and convolve_sparse_inverse with the
+// kernel chosen by the edge, and of convolve_sparse_flipped, split among
+// the idle workers
+inline cube_p<real> convolve_sparse( cube<real> const & a,
+                                     cube<real> const & b,
+                                     vec3i const & s,
+                                     direct_kernel const & k,
+                                     spatial_split const & split
+                                     = spatial_split() )
+{
+    cube_p<real> r = get_cube<real>(size(a) - (size(b) - vec3i::one) * s);
+    std::fill_n(r->data(), r->num_elements(), 0);
+
+    if ( b.num_elements() == 1 )
+    {
+        convolve_constant_add(a,b.data()[0],*r);
+    }
+    else
+    {
+        detail::blocked::convolve_sparse_add(a,b,s,*r,k,split);
+    }
+    return r;
+}
+
+inline cube_p<real> convolve_sparse_inverse( cube<real> const & a,
+                                             cube<real> const & b,
+                                             vec3i const & s,
+                                             direct_kernel const & k,
+                                             spatial_split const & split
+                                             = spatial_split() )
+{
+    cube_p<real> r = get_cube<real>(size(a) + (size(b) - vec3i::one) * s);
+    std::fill_n(r->data(), r->num_elements(), 0);
+
+    if ( b.num_elements() == 1 )
+    {
+        convolve_constant_inverse_add(a,b.data()[0],*r);
+    }
+    else
+    {
+        detail::blocked::convolve_sparse_inverse_add(a,b,s,*r,k,split);
+    }
+    return r;
+}
+
+inline cube_p<real> convolve_sparse_flipped( cube<real> const & a,
+                                             cube<real> const & b,
+                                             vec3i const & s,
+                                             spatial_split const & split )
+{
+    cube_p<real> r = get_cube<real>((size(a) - size(b)) / s + vec3i::one);
+    std::fill_n(r->data(), r->num_elements(), 0);
+
+    if ( size(a) == size(b) )
+    {
+        r->data()[0] = convolve_constant_flipped(a,b);
+    }
+    else
+    {
+        detail::blocked::convolve_sparse_flipped_add(a,b,s,*r,split);
+    }
+    return r;
+}
+
+}} // namespace znn::v4
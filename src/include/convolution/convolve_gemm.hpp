@@ -0,0 +1,234 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "../assert.hpp"
+#include "../types.hpp"
+#include "../cube/cube.hpp"
+#include "../cube/detail/simd.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// Convolutions of all the featuremaps of a layer as matrix products
+//
+// Each of the n inputs of size as is convolved with m filters of size k
+// (sparse with the stride s) and summed into the m outputs. The outputs
+// are the product W * L of the m x nK matrix W of the taps (K is the
+// volume of the filter) and the nK x |os| lowered input L, whose row
+// (i,t) is the input i shifted by the tap t (im2col). L is never built
+// whole: the outputs are split into blocks of rows, only the columns of
+// L of a block are lowered (implicit GEMM) so that they stay in the
+// cache, and the blocks can be computed concurrently. The products are
+// simd::kernels::gemm.
+//
+namespace znn { namespace v4 {
+
+class gemm_convolution
+{
+private:
+    std::size_t n_     ;
+    std::size_t m_     ;
+    vec3i       as_    ;
+    vec3i       k_     ;
+    vec3i       s_     ;
+    vec3i       os_    ;
+    std::size_t taps_  ;
+    std::size_t rows_  ; // rows (x,y) of the outputs per block
+    std::size_t blocks_;
+
+    std::vector<real> w_;
+
+    // bytes of the lowered input of a block
+    static constexpr std::size_t block_bytes = 1 << 19;
+
+public:
+    gemm_convolution( std::size_t n,
+                      std::size_t m,
+                      vec3i const & as,
+                      vec3i const & k,
+                      vec3i const & s,
+                      std::size_t threads )
+        : n_(n), m_(m), as_(as), k_(k), s_(s)
+    {
+        // as detail::blocked::squeeze, 2D layers are 1 x X x Y so that
+        // the rows copied while lowering aren't trivial
+        for ( int i = 0; i < 2; ++i )
+        {
+            if ( as_[2] != 1 || k_[2] != 1 ) break;
+            if ( as_[0] == 1 && as_[1] == 1 ) break;
+
+            as_ = vec3i(1, as_[0], as_[1]);
+            k_  = vec3i(1, k_[0],  k_[1] );
+            s_  = vec3i(1, s_[0],  s_[1] );
+        }
+
+        os_   = as_ - ( k_ - vec3i::one ) * s_;
+        taps_ = k_[0] * k_[1] * k_[2];
+
+        ZI_ASSERT(os_[0]>0&&os_[1]>0&&os_[2]>0);
+
+        std::size_t total = os_[0] * os_[1];
+        std::size_t row   = n_ * taps_ * os_[2] * sizeof(real);
+
+        rows_ = std::max<std::size_t>(1, block_bytes / row);
+
+        // at least a block per thread
+        threads = std::max<std::size_t>(threads, 1);
+        rows_   = std::min(rows_, ( total + threads - 1 ) / threads);
+
+        blocks_ = ( total + rows_ - 1 ) / rows_;
+    }
+
+    std::size_t blocks() const { return blocks_; }
+    std::size_t taps()   const { return taps_;   }
+
+    // w is the m x nK matrix of the taps, flipped
+    void set_taps( real const * w )
+    {
+        w_.assign(w, w + m_ * n_ * taps_);
+    }
+
+    // the scratch cubes of forward() and weight_gradient()
+    std::vector<vec3i> forward_buffers() const
+    {
+        std::size_t c = block_size(0);
+        return { vec3i(1, n_ * taps_, c), vec3i(1, m_, c) };
+    }
+
+    std::vector<vec3i> update_buffers() const
+    {
+        std::size_t c = block_size(0);
+        return { vec3i(1, n_ * taps_, c), vec3i(1, c, n_ * taps_),
+                 vec3i(1, m_, c) };
+    }
+
+    // the outputs (in memory order) of the block b
+    std::size_t block_begin( std::size_t b ) const
+    {
+        return b * rows_ * os_[2];
+    }
+
+    std::size_t block_size( std::size_t b ) const
+    {
+        std::size_t r = std::min(rows_, os_[0] * os_[1] - b * rows_);
+        return r * os_[2];
+    }
+
+    // the nK x block_size(b) lowered inputs of the block b, the null
+    // inputs are zeros
+    void lower( std::size_t b, real const * const * in, real * l ) const
+    {
+        std::size_t c  = block_size(b);
+        std::size_t r0 = b * rows_;
+        std::size_t r1 = r0 + c / os_[2];
+
+        for ( std::size_t i = 0; i < n_; ++i )
+        {
+            if ( !in[i] )
+            {
+                std::fill_n(l, taps_ * c, 0);
+                l += taps_ * c;
+                continue;
+            }
+
+            for ( long_t tx = 0; tx < k_[0]; ++tx )
+                for ( long_t ty = 0; ty < k_[1]; ++ty )
+                    for ( long_t tz = 0; tz < k_[2]; ++tz, l += c )
+                    {
+                        real * lp = l;
+                        for ( std::size_t r = r0; r < r1; ++r, lp += os_[2] )
+                        {
+                            long_t x = r / os_[1] + tx * s_[0];
+                            long_t y = r % os_[1] + ty * s_[1];
+                            std::copy_n(in[i] + ( x * as_[1] + y ) * as_[2]
+                                        + tz * s_[2], os_[2], lp);
+                        }
+                    }
+        }
+    }
+
+    // out[j] = sum_i in[i] * w_ji for the outputs of the block b; the
+    // null outputs are skipped
+    void forward( std::size_t b,
+                  real const * const * in,
+                  real * const * out ) const
+    {
+        std::size_t c  = block_size(b);
+        std::size_t nk = n_ * taps_;
+
+        auto l = get_cube<real>(vec3i(1, nk, c));
+        auto r = get_cube<real>(vec3i(1, m_, c));
+
+        lower(b, in, l->data());
+        std::fill_n(r->data(), m_ * c, 0);
+
+        simd::active().gemm(m_, c, nk, w_.data(), nk, l->data(), c,
+                            r->data(), c);
+
+        for ( std::size_t j = 0; j < m_; ++j )
+        {
+            if ( out[j] )
+            {
+                std::copy_n(r->data() + j * c, c, out[j] + block_begin(b));
+            }
+        }
+    }
+
+    // dw += g * L^T for the outputs of the block b, the m x nK gradient
+    // of the taps in the order of forward(); the null gradients are zeros
+    void weight_gradient( std::size_t b,
+                          real const * const * in,
+                          real const * const * g,
+                          real * dw ) const
+    {
+        std::size_t c  = block_size(b);
+        std::size_t nk = n_ * taps_;
+
+        auto l  = get_cube<real>(vec3i(1, nk, c));
+        auto lt = get_cube<real>(vec3i(1, c, nk));
+        auto gr = get_cube<real>(vec3i(1, m_, c));
+
+        lower(b, in, l->data());
+
+        real const * lp  = l->data();
+        real       * ltp = lt->data();
+
+        for ( std::size_t i = 0; i < nk; ++i )
+            for ( std::size_t j = 0; j < c; ++j )
+                ltp[j * nk + i] = lp[i * c + j];
+
+        for ( std::size_t j = 0; j < m_; ++j )
+        {
+            if ( g[j] )
+            {
+                std::copy_n(g[j] + block_begin(b), c, gr->data() + j * c);
+            }
+            else
+            {
+                std::fill_n(gr->data() + j * c, c, 0);
+            }
+        }
+
+        simd::active().gemm(m_, nk, c, gr->data(), c, ltp, nk, dw, nk);
+    }
+
+}; // class gemm_convolution
+
+}} // namespace znn::v4
@@ -0,0 +1,564 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "../assert.hpp"
+#include "../types.hpp"
+#include "../cube/cube.hpp"
+#include "../cube/detail/simd.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Convolutions of all the featuremaps of a layer with the minimal
+// filtering algorithms of Winograd
+//
+// The filters are 3 or 1 wide in each dimension, the stride is 1. The
+// outputs are split into tiles of mt (2 or 4) along the dimensions of
+// width 3, computed with F(mt,3) along each of them: the input tiles of
+// a = mt + 2 are transformed by B^T, the filters by G, and the tiles of
+// the outputs are A^T of the sum of the products of the transforms
+//
+//   Y = A^T [ sum_i ( G w_ji ) .* ( B^T X_i ) ]
+//
+// (the transforms of the 3D tiles are the Kronecker products of those of
+// the dimensions). For each of the T = a^d elements of the transforms
+// the sum over the inputs is an m x n by n x tiles matrix product, done
+// with simd::kernels::gemm a block of tiles at a time, the blocks can be
+// computed concurrently. F(2,3) needs 8/27 of the multiplications of a
+// direct 3x3x3 convolution (4/9 for 3x3), F(4,3) 1/8 (1/4).
+//
+// The gradient of the taps is the backpropagation through the same
+// transforms, exact up to the rounding.
+//
+namespace znn { namespace v4 {
+
+class winograd_convolution
+{
+private:
+    std::size_t n_      ;
+    std::size_t m_      ;
+    vec3i       as_     ;
+    vec3i       k_      ;
+    vec3i       os_     ;
+    vec3i       mt_     ; // outputs of a tile
+    vec3i       al_     ; // inputs of a tile
+    vec3i       nt_     ; // tiles
+    std::size_t taps_   ;
+    std::size_t t_      ; // elements of the transforms
+    std::size_t tiles_  ;
+    std::size_t per_    ; // tiles per block
+    std::size_t blocks_ ;
+
+    // the transforms of each dimension, row major
+    std::vector<real> bt_[3]; // al x al
+    std::vector<real> g_ [3]; // al x k
+    std::vector<real> gt_[3]; // k x al
+    std::vector<real> at_[3]; // mt x al
+    std::vector<real> a_ [3]; // al x mt
+
+    std::vector<real> u_; // T x m x n transformed taps
+
+    // bytes of the transformed inputs and products of a block
+    static constexpr std::size_t block_bytes = 1 << 20;
+
+    static constexpr std::size_t max_tile = 6 * 6 * 6;
+
+    // tiles transformed together
+    static constexpr std::size_t chunk = 32;
+
+private:
+    static std::vector<real> transpose( std::vector<real> const & v,
+                                        std::size_t rows,
+                                        std::size_t cols )
+    {
+        std::vector<real> r(v.size());
+        for ( std::size_t i = 0; i < rows; ++i )
+            for ( std::size_t j = 0; j < cols; ++j )
+                r[j * rows + i] = v[i * cols + j];
+        return r;
+    }
+
+    void init_transforms( std::size_t d, long_t tile )
+    {
+        if ( k_[d] == 1 )
+        {
+            mt_[d] = al_[d] = 1;
+            bt_[d] = g_[d] = at_[d] = { 1 };
+        }
+        else if ( tile == 2 )
+        {
+            mt_[d] = 2;
+            al_[d] = 4;
+            bt_[d] = { 1,  0, -1,  0,
+                       0,  1,  1,  0,
+                       0, -1,  1,  0,
+                       0,  1,  0, -1 };
+            g_[d]  = { 1,    0,   0,
+                       0.5,  0.5, 0.5,
+                       0.5, -0.5, 0.5,
+                       0,    0,   1 };
+            at_[d] = { 1,  1,  1,  0,
+                       0,  1, -1, -1 };
+        }
+        else
+        {
+            real const a = 1./4, b = 1./6, c = 1./12, e = 1./24;
+
+            mt_[d] = 4;
+            al_[d] = 6;
+            bt_[d] = { 4,  0, -5,  0,  1,  0,
+                       0, -4, -4,  1,  1,  0,
+                       0,  4, -4, -1,  1,  0,
+                       0, -2, -1,  2,  1,  0,
+                       0,  2, -1, -2,  1,  0,
+                       0,  4,  0, -5,  0,  1 };
+            g_[d]  = {  a,  0,  0,
+                       -b, -b, -b,
+                       -b,  b, -b,
+                        e,  c,  b,
+                        e, -c,  b,
+                        0,  0,  1 };
+            at_[d] = { 1,  1,  1,  1,  1,  0,
+                       0,  1, -1,  2, -2,  0,
+                       0,  1,  1,  4,  4,  0,
+                       0,  1, -1,  8, -8,  1 };
+        }
+
+        gt_[d] = transpose(g_[d],  al_[d], k_[d] );
+        a_[d]  = transpose(at_[d], mt_[d], al_[d]);
+    }
+
+    // one dimension of kron(): dst(o,i,b) = sum_j m(i,j) src(o,j,b),
+    // each a row of len
+    static void pass( real const * m,
+                      std::size_t outer,
+                      std::size_t rows,
+                      std::size_t cols,
+                      std::size_t inner,
+                      real const * src,
+                      std::size_t ss,
+                      real * dst,
+                      std::size_t ds,
+                      std::size_t len )
+    {
+        for ( std::size_t o = 0; o < outer; ++o )
+            for ( std::size_t i = 0; i < rows; ++i )
+                for ( std::size_t b = 0; b < inner; ++b )
+                {
+                    real * d = dst + ( ( o * rows + i ) * inner + b ) * ds;
+                    bool   z = true;
+
+                    for ( std::size_t j = 0; j < cols; ++j )
+                    {
+                        real v = m[i * cols + j];
+                        if ( v == 0 ) continue;
+
+                        real const * r
+                            = src + ( ( o * cols + j ) * inner + b ) * ss;
+                        if ( z )
+                        {
+                            for ( std::size_t l = 0; l < len; ++l )
+                                d[l] = v * r[l];
+                            z = false;
+                        }
+                        else
+                        {
+                            for ( std::size_t l = 0; l < len; ++l )
+                                d[l] += v * r[l];
+                        }
+                    }
+
+                    if ( z ) std::fill_n(d, len, 0);
+                }
+    }
+
+    // y = ( m[0] x m[1] x m[2] ) x for len vectors (tiles) at once,
+    // m[d] is r[d] x c[d]; the element a of the c[0] x c[1] x c[2] x is
+    // the row x + a * xs, the element e of the r[0] x r[1] x r[2] y the
+    // row y + e * ys
+    static void kron( std::vector<real> const * m,
+                      vec3i const & r,
+                      vec3i const & c,
+                      real const * x,
+                      std::size_t xs,
+                      real * y,
+                      std::size_t ys,
+                      std::size_t len )
+    {
+        real t1[max_tile * chunk];
+        real t2[max_tile * chunk];
+
+        // the identities of the dimensions of 1 are skipped
+        if ( r[0] != 1 || c[0] != 1 )
+        {
+            pass(m[0].data(), 1, r[0], c[0], c[1] * c[2], x, xs, t1, len,
+                 len);
+            x  = t1;
+            xs = len;
+        }
+
+        if ( r[1] != 1 || c[1] != 1 )
+        {
+            pass(m[1].data(), r[0], r[1], c[1], c[2], x, xs, t2, len, len);
+            x  = t2;
+            xs = len;
+        }
+
+        pass(m[2].data(), r[0] * r[1], r[2], c[2], 1, x, xs, y, ys, len);
+    }
+
+    vec3i tile_origin( std::size_t t ) const
+    {
+        return vec3i( t / ( nt_[1] * nt_[2] ) * mt_[0],
+                      t / nt_[2] % nt_[1] * mt_[1],
+                      t % nt_[2] * mt_[2] );
+    }
+
+    // outputs of the tile at o, the last tiles are clipped
+    vec3i tile_extent( vec3i const & o ) const
+    {
+        return vec3i( std::min(mt_[0], os_[0] - o[0]),
+                      std::min(mt_[1], os_[1] - o[1]),
+                      std::min(mt_[2], os_[2] - o[2]) );
+    }
+
+    // the tiles at o[0] ... o[len-1] of f (of size fs) of the extent
+    // a, zero beyond f; the element e of the tile l at x[e * chunk + l]
+    static void gather( real const * f,
+                        vec3i const & fs,
+                        vec3i const & a,
+                        vec3i const * o,
+                        std::size_t len,
+                        real * x )
+    {
+        long_t base[chunk];
+        vec3i  left[chunk];
+
+        bool inside = true;
+        for ( std::size_t l = 0; l < len; ++l )
+        {
+            base[l] = ( o[l][0] * fs[1] + o[l][1] ) * fs[2] + o[l][2];
+            left[l] = fs - o[l];
+            inside  = inside && left[l][0] >= a[0] && left[l][1] >= a[1]
+                && left[l][2] >= a[2];
+        }
+
+        if ( inside )
+        {
+            for ( long_t i = 0; i < a[0]; ++i )
+                for ( long_t j = 0; j < a[1]; ++j )
+                    for ( long_t k = 0; k < a[2]; ++k, x += chunk )
+                    {
+                        real const * p = f + ( i * fs[1] + j ) * fs[2] + k;
+                        for ( std::size_t l = 0; l < len; ++l )
+                            x[l] = p[base[l]];
+                    }
+            return;
+        }
+
+        for ( long_t i = 0; i < a[0]; ++i )
+            for ( long_t j = 0; j < a[1]; ++j )
+                for ( long_t k = 0; k < a[2]; ++k, x += chunk )
+                {
+                    long_t off = ( i * fs[1] + j ) * fs[2] + k;
+                    for ( std::size_t l = 0; l < len; ++l )
+                    {
+                        bool in = i < left[l][0] && j < left[l][1]
+                            && k < left[l][2];
+                        x[l] = in ? f[base[l] + off] : 0;
+                    }
+                }
+    }
+
+    // the origins of the tiles t0 ... t0 + len
+    void tile_origins( std::size_t t0, std::size_t len, vec3i * o ) const
+    {
+        for ( std::size_t l = 0; l < len; ++l )
+        {
+            o[l] = tile_origin(t0 + l);
+        }
+    }
+
+    // the transforms of the input tiles of the block b, T x n x c; the
+    // null inputs are zeros
+    void transform_inputs( std::size_t b,
+                           real const * const * in,
+                           real * v ) const
+    {
+        std::size_t c  = block_size(b);
+        std::size_t t0 = b * per_;
+
+        real  x[max_tile * chunk];
+        vec3i o[chunk];
+
+        for ( std::size_t i = 0; i < n_; ++i )
+        {
+            if ( !in[i] )
+            {
+                for ( std::size_t e = 0; e < t_; ++e )
+                {
+                    std::fill_n(v + ( e * n_ + i ) * c, c, 0);
+                }
+            }
+        }
+
+        for ( std::size_t t = 0; t < c; t += chunk )
+        {
+            std::size_t len = std::min(c - t, std::size_t(chunk));
+            tile_origins(t0 + t, len, o);
+
+            for ( std::size_t i = 0; i < n_; ++i )
+            {
+                if ( !in[i] ) continue;
+
+                gather(in[i], as_, al_, o, len, x);
+                kron(bt_, al_, al_, x, chunk, v + i * c + t, n_ * c, len);
+            }
+        }
+    }
+
+public:
+    winograd_convolution( std::size_t n,
+                          std::size_t m,
+                          vec3i const & as,
+                          vec3i const & k,
+                          vec3i const & s,
+                          std::size_t threads,
+                          long_t tile = 2 )
+        : n_(n), m_(m), as_(as), k_(k)
+    {
+        if ( !eligible(k, s) )
+        {
+            throw std::logic_error(HERE() + "winograd convolution of "
+                                   "unsupported filter or stride");
+        }
+
+        if ( tile != 2 && tile != 4 )
+        {
+            throw std::logic_error(HERE() + "winograd tile must be 2 or 4,"
+                                   " not " + std::to_string(tile));
+        }
+
+        os_ = as_ - k_ + vec3i::one;
+        ZI_ASSERT(os_[0]>0&&os_[1]>0&&os_[2]>0);
+
+        for ( std::size_t d = 0; d < 3; ++d )
+        {
+            init_transforms(d, tile);
+            nt_[d] = ( os_[d] + mt_[d] - 1 ) / mt_[d];
+        }
+
+        taps_  = k_[0] * k_[1] * k_[2];
+        t_     = al_[0] * al_[1] * al_[2];
+        tiles_ = nt_[0] * nt_[1] * nt_[2];
+
+        std::size_t tile_bytes = ( n_ + m_ ) * t_ * sizeof(real);
+
+        per_ = std::max<std::size_t>(16, block_bytes / tile_bytes);
+        per_ = ( per_ + 15 ) / 16 * 16;
+
+        // at least a block per thread
+        threads = std::max<std::size_t>(threads, 1);
+        per_    = std::min(per_, ( tiles_ + threads - 1 ) / threads);
+
+        blocks_ = ( tiles_ + per_ - 1 ) / per_;
+    }
+
+    // filters of 3 or 1 in each dimension, at least one of 3, stride 1
+    static bool eligible( vec3i const & k, vec3i const & s )
+    {
+        if ( s != vec3i::one || k == vec3i::one ) return false;
+
+        for ( std::size_t d = 0; d < 3; ++d )
+        {
+            if ( k[d] != 1 && k[d] != 3 ) return false;
+        }
+
+        return true;
+    }
+
+    std::size_t blocks() const { return blocks_; }
+    std::size_t taps()   const { return taps_;   }
+
+    // tiles of the block b
+    std::size_t block_size( std::size_t b ) const
+    {
+        return std::min(per_, tiles_ - b * per_);
+    }
+
+    // w is the m x nK matrix of the taps, flipped (in the order of the
+    // correlation)
+    void set_taps( real const * w )
+    {
+        u_.resize(t_ * m_ * n_);
+
+        for ( std::size_t j = 0; j < m_; ++j )
+            for ( std::size_t i = 0; i < n_; ++i )
+            {
+                kron(g_, al_, k_, w + ( j * n_ + i ) * taps_, 1,
+                     u_.data() + j * n_ + i, m_ * n_, 1);
+            }
+    }
+
+    // the scratch cubes of forward() and weight_gradient()
+    std::vector<vec3i> forward_buffers() const
+    {
+        std::size_t c = block_size(0);
+        return { vec3i(t_, n_, c), vec3i(t_, m_, c) };
+    }
+
+    std::vector<vec3i> update_buffers() const
+    {
+        std::size_t c = block_size(0);
+        return { vec3i(t_, n_, c), vec3i(1, c, n_), vec3i(t_, m_, c),
+                 vec3i(t_, m_, n_) };
+    }
+
+    // out[j] = sum_i in[i] * w_ji for the tiles of the block b; the null
+    // outputs are skipped
+    void forward( std::size_t b,
+                  real const * const * in,
+                  real * const * out ) const
+    {
+        std::size_t c  = block_size(b);
+        std::size_t t0 = b * per_;
+
+        auto v = get_cube<real>(vec3i(t_, n_, c));
+        auto p = get_cube<real>(vec3i(t_, m_, c));
+
+        transform_inputs(b, in, v->data());
+        std::fill_n(p->data(), t_ * m_ * c, 0);
+
+        auto const & k = simd::active();
+        for ( std::size_t e = 0; e < t_; ++e )
+        {
+            k.gemm(m_, c, n_, u_.data() + e * m_ * n_, n_,
+                   v->data() + e * n_ * c, c, p->data() + e * m_ * c, c);
+        }
+
+        real y[max_tile * chunk];
+
+        for ( std::size_t j = 0; j < m_; ++j )
+        {
+            if ( !out[j] ) continue;
+
+            for ( std::size_t t = 0; t < c; t += chunk )
+            {
+                std::size_t len = std::min(c - t, std::size_t(chunk));
+                kron(at_, mt_, al_, p->data() + j * c + t, m_ * c,
+                     y, chunk, len);
+
+                for ( std::size_t l = 0; l < len; ++l )
+                {
+                    vec3i o = tile_origin(t0 + t + l);
+                    vec3i e = tile_extent(o);
+
+                    for ( long_t a = 0; a < e[0]; ++a )
+                        for ( long_t d = 0; d < e[1]; ++d )
+                        {
+                            real const * r
+                                = y + ( a * mt_[1] + d ) * mt_[2] * chunk + l;
+                            real * q = out[j] + ( ( o[0] + a ) * os_[1]
+                                                  + o[1] + d ) * os_[2] + o[2];
+                            for ( long_t z = 0; z < e[2]; ++z )
+                                q[z] = r[z * chunk];
+                        }
+                }
+            }
+        }
+    }
+
+    // dw += the gradient of the m x nK taps (in the order of set_taps())
+    // from the tiles of the block b; the null gradients are zeros
+    void weight_gradient( std::size_t b,
+                          real const * const * in,
+                          real const * const * g,
+                          real * dw ) const
+    {
+        std::size_t c  = block_size(b);
+        std::size_t t0 = b * per_;
+
+        auto v  = get_cube<real>(vec3i(t_, n_, c));
+        auto vt = get_cube<real>(vec3i(1, c, n_));
+        auto dm = get_cube<real>(vec3i(t_, m_, c));
+        auto du = get_cube<real>(vec3i(t_, m_, n_));
+
+        transform_inputs(b, in, v->data());
+
+        real  x[max_tile * chunk];
+        vec3i o[chunk];
+
+        for ( std::size_t j = 0; j < m_; ++j )
+        {
+            if ( !g[j] )
+            {
+                for ( std::size_t e = 0; e < t_; ++e )
+                {
+                    std::fill_n(dm->data() + ( e * m_ + j ) * c, c, 0);
+                }
+                continue;
+            }
+
+            // the gradient tiles, clipped to the outputs
+            for ( std::size_t t = 0; t < c; t += chunk )
+            {
+                std::size_t len = std::min(c - t, std::size_t(chunk));
+                tile_origins(t0 + t, len, o);
+                gather(g[j], os_, mt_, o, len, x);
+                kron(a_, al_, mt_, x, chunk, dm->data() + j * c + t,
+                     m_ * c, len);
+            }
+        }
+
+        std::fill_n(du->data(), t_ * m_ * n_, 0);
+
+        auto const & k = simd::active();
+        for ( std::size_t e = 0; e < t_; ++e )
+        {
+            real const * ve  = v->data() + e * n_ * c;
+            real       * vtp = vt->data();
+
+            for ( std::size_t i = 0; i < n_; ++i )
+                for ( std::size_t t = 0; t < c; ++t )
+                    vtp[t * n_ + i] = ve[i * c + t];
+
+            k.gemm(m_, n_, c, dm->data() + e * m_ * c, c, vtp, n_,
+                   du->data() + e * m_ * n_, n_);
+        }
+
+        for ( std::size_t j = 0; j < m_; ++j )
+            for ( std::size_t i = 0; i < n_; ++i )
+            {
+                kron(gt_, k_, al_, du->data() + j * n_ + i, m_ * n_,
+                     x, 1, 1);
+
+                real * r = dw + ( j * n_ + i ) * taps_;
+                for ( std::size_t e = 0; e < taps_; ++e )
+                {
+                    r[e] += x[e];
+                }
+            }
+    }
+
+}; // class winograd_convolution
+
+}} // namespace znn::v4
@@ -18,6 +18,7 @@
 #pragma once
 
 #include "cube.hpp"
+#include "detail/simd.hpp"
 #include "../types.hpp"
 #include "../meta.hpp"
 
@@ -181,6 +182,80 @@ inline T sum(T const * a, std::size_t s) noexcept
 }
 
 
+#ifdef ZNN_SIMD_DISPATCH
+
+// The kernels of the real operators compiled for the instruction set
+// of the CPU (simd.hpp), preferred over the templates above
+inline void add_to(real * a, real const * v, std::size_t s) noexcept
+{
+    simd::active().add_to(a, v, s);
+}
+
+inline void mad_to(real a, real const * x, real * o, std::size_t s) noexcept
+{
+    simd::active().scale_add(a, x, o, s);
+}
+
+inline void mad_to(real const * a, real const * b, real * r,
+                   std::size_t s) noexcept
+{
+    simd::active().mad_to(a, b, r, s);
+}
+
+inline void mul_with(real * a, real const * v, std::size_t s) noexcept
+{
+    simd::active().mul_with(a, v, s);
+}
+
+inline real sum(real const * a, std::size_t s) noexcept
+{
+    return simd::active().sum(a, s);
+}
+
+inline void reverse(real * a, std::size_t s) noexcept
+{
+    simd::active().reverse(a, s);
+}
+
+#else
+
+inline void reverse(real * a, std::size_t s) noexcept
+{
+    std::reverse(a, a + s);
+}
+
+#endif
+
+// The complex products written out, std::complex's operator* checks
+// for infinities and NaNs unless compiled with -ffast-math
+inline void mul_two(complex const * a, complex const * b,
+                    complex * r, std::size_t s) noexcept
+{
+    real const * x = reinterpret_cast<real const *>(a);
+    real const * y = reinterpret_cast<real const *>(b);
+    real       * o = reinterpret_cast<real *>(r);
+
+#ifdef ZNN_SIMD_DISPATCH
+    simd::active().cmul(x, y, o, s);
+#else
+    simd::scalar::cmul(x, y, o, s);
+#endif
+}
+
+inline void mad_to(complex const * a, complex const * b,
+                   complex * r, std::size_t s) noexcept
+{
+    real const * x = reinterpret_cast<real const *>(a);
+    real const * y = reinterpret_cast<real const *>(b);
+    real       * o = reinterpret_cast<real *>(r);
+
+#ifdef ZNN_SIMD_DISPATCH
+    simd::active().cmad(x, y, o, s);
+#else
+    simd::scalar::cmad(x, y, o, s);
+#endif
+}
+
 } // namespace detail
 
 template<typename T>
@@ -325,8 +400,7 @@ inline void fill( cube<T> & v, identity_t<T> c) noexcept
 
 inline void flip(cube<real>& v) noexcept
 {
-    real* data = v.data();
-    std::reverse(data, data + v.num_elements());
+    detail::reverse(v.data(), v.num_elements());
 }
 
 template<typename T>
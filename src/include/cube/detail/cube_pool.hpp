@@ -18,52 +18,18 @@
 #pragma once
 
 #include <zi/utility/singleton.hpp>
-#include <list>
-
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "memory.hpp"
+#include "pool_stats.hpp"
 #include "../../types.hpp"
 
-#ifdef ZNN_XEON_PHI
-#  include <mkl.h>
-#endif
-
 namespace znn { namespace v4 {
 
-#ifdef ZNN_XEON_PHI
-#  define __ZNN_ALIGN 0x3F // 64 byte alignment
-#else
-#  define __ZNN_ALIGN 0xF // 16 byte alignment
-#endif
-
-#ifdef ZNN_XEON_PHI
-
-inline void* znn_malloc(size_t s)
-{
-    void* r = mkl_malloc(s,64);
-    if ( !r ) throw std::bad_alloc();
-    return r;
-}
-
-inline void znn_free(void* ptr)
-{
-    mkl_free(ptr);
-}
-
-#else
-
-inline void* znn_malloc(size_t s)
-{
-    void* r = malloc(s);
-    if ( !r ) throw std::bad_alloc();
-    return r;
-}
-
-inline void znn_free(void* ptr)
-{
-    free(ptr);
-}
-
-#endif
-
 template <typename T> struct cube: boost::multi_array_ref<T,3>
 {
 private:
@@ -99,7 +65,7 @@ public:
 template <typename T> struct qube: boost::multi_array_ref<T,4>
 {
 private:
-    using base_type =  boost::multi_array_ref<T,3>;
+    using base_type =  boost::multi_array_ref<T,4>;
 
 
 public:
@@ -135,304 +101,303 @@ struct __znn_aligned_size
     static_assert((value&__ZNN_ALIGN)==0, "bad value");
 };
 
-inline void* znn_aligned_malloc(size_t s)
-{
-    return znn_malloc(((s-1)|__ZNN_ALIGN)+1);
-}
-
 template<class T>
 inline T* __offset_cast(void* mem, size_t off)
 {
     return reinterpret_cast<T*>(reinterpret_cast<uint8_t*>(mem)+off);
 }
 
-template<typename T>
-cube<T>* malloc_cube(const vec3i& s)
-{
-    void*    mem  = znn_aligned_malloc(__znn_aligned_size<cube<T>>::value
-                                       + s[0]*s[1]*s[2]*sizeof(T) );
-
-    ZI_ASSERT((reinterpret_cast<size_t>(mem)&__ZNN_ALIGN)==0);
-
-    T*       data = __offset_cast<T>(mem, __znn_aligned_size<cube<T>>::value);
-    cube<T>* c    = new (mem) cube<T>(s,data);
-
-    ZI_ASSERT(c==mem);
-
-    return c;
-}
-
-
-template<typename T>
-cube<T>* malloc_qube(const vec4i& s)
-{
-    void*    mem  = znn_aligned_malloc(__znn_aligned_size<qube<T>>::value
-                                       + s[0]*s[1]*s[2]*s[3]*sizeof(T) );
-
-    ZI_ASSERT((reinterpret_cast<size_t>(mem)&__ZNN_ALIGN)==0);
-
-    T*       data = __offset_cast<T>(mem, __znn_aligned_size<qube<T>>::value);
-    qube<T>* c    = new (mem) qube<T>(s,data);
-
-    ZI_ASSERT(c==mem);
-
-    return c;
-}
-
-
-template<typename T>
-class single_size_cube_pool
+// Idle memory blocks of a single size
+class single_size_pool
 {
-private:
-    vec3i                      size_;
-    std::list<cube<T>*>        list_;
-    std::mutex                 m_   ;
-
 public:
-    void clear()
-    {
-        std::lock_guard<std::mutex> g(m_);
-        for ( auto& v: list_ )
-        {
-            znn_free(v);
-        }
-        list_.clear();
-    }
+    std::size_t const   mem_size_;
+    std::vector<void*>  list_    ;
+    std::mutex          m_       ;
 
-public:
-    void return_cube( cube<T>* c )
-    {
-        std::lock_guard<std::mutex> g(m_);
-        list_.push_back(c);
-    }
+    std::size_t         hits_     = 0;
+    std::size_t         misses_   = 0;
+    std::uint64_t       last_use_ = 0;
 
 public:
-    single_size_cube_pool( const vec3i& s )
-        : size_(s)
-        , list_{}
-        , m_{}
+    explicit single_size_pool( std::size_t s )
+        : mem_size_(s)
     {}
 
-    ~single_size_cube_pool()
+    ~single_size_pool()
     {
-        clear();
-    }
-
-    std::shared_ptr<cube<T>> get()
-    {
-        cube<T>* r = nullptr;
-        {
-            std::lock_guard<std::mutex> g(m_);
-            if ( list_.size() > 0 )
-            {
-                r = list_.back();
-                list_.pop_back();
-            }
-        }
-
-        if ( !r )
+        for ( auto& v: list_ )
         {
-            r = malloc_cube<T>(size_);
+            znn_free_block(v, mem_size_);
         }
-
-        return std::shared_ptr<cube<T>>(r,[this](cube<T>* c)
-                                        {
-                                            this->return_cube(c);
-                                        });
     }
-
 };
 
-template<typename T>
-class single_size_qube_pool
+// Memory of all the cube types, in blocks of the exact requested size
+// or rounded up to a power of two when size classes are on (so the
+// pools are shared between the shapes of the similar size).
+//
+// Idle memory is accounted for in held_. When a budget is set, memory
+// returned to a full pool first trims the least recently used sizes,
+// and is freed if it still doesn't fit.
+//
+class memory_pool
 {
 private:
-    vec4i                      size_;
-    std::list<qube<T>*>        list_;
-    std::mutex                 m_   ;
+    std::mutex                                          m_;
+    std::map<std::size_t, std::unique_ptr<single_size_pool>> pools_;
 
-public:
-    void clear()
+    std::atomic<std::size_t>   held_   {0}; // bytes
+    std::atomic<std::size_t>   budget_ {0}; // bytes, 0 for unlimited
+    std::atomic<std::uint64_t> clock_  {0};
+    std::atomic<bool>          classes_{false};
+
+    single_size_pool* get_pool( std::size_t s )
     {
         std::lock_guard<std::mutex> g(m_);
-        for ( auto& v: list_ )
-        {
-            znn_free(v);
-        }
-        list_.clear();
+        auto& r = pools_[s];
+        if ( !r ) r = std::make_unique<single_size_pool>(s);
+        return r.get();
     }
 
 public:
-    void return_qube( qube<T>* q )
+    single_size_pool* pool_for( std::size_t bytes )
     {
-        std::lock_guard<std::mutex> g(m_);
-        list_.push_back(q);
-    }
+        bytes = ((bytes-1)|__ZNN_ALIGN)+1;
 
-public:
-    single_size_qube_pool( const vec4i& s )
-        : size_(s)
-        , list_{}
-        , m_{}
-    {}
+        if ( classes_.load(std::memory_order_relaxed) )
+        {
+            bytes = static_cast<std::size_t>(1) << (64-__builtin_clzl(bytes-1));
+        }
 
-    ~single_size_qube_pool()
-    {
-        clear();
+        return get_pool(bytes);
     }
 
-    std::shared_ptr<qube<T>> get()
+    void* get( single_size_pool* p )
     {
-        qube<T>* r = nullptr;
+        void* r = nullptr;
         {
-            std::lock_guard<std::mutex> g(m_);
-            if ( list_.size() > 0 )
+            std::lock_guard<std::mutex> g(p->m_);
+            p->last_use_ = ++clock_;
+            if ( p->list_.size() > 0 )
+            {
+                r = p->list_.back();
+                p->list_.pop_back();
+                ++p->hits_;
+            }
+            else
             {
-                r = list_.back();
-                list_.pop_back();
+                ++p->misses_;
             }
         }
 
-        if ( !r )
+        if ( r )
         {
-            r = malloc_qube<T>(size_);
+            held_ -= p->mem_size_;
+            return r;
         }
 
-        return std::shared_ptr<cube<T>>(r,[this](qube<T>* c)
-                                        {
-                                            this->return_qube(c);
-                                        });
+        r = znn_malloc_block(p->mem_size_);
+        ZI_ASSERT((reinterpret_cast<size_t>(r)&__ZNN_ALIGN)==0);
+        return r;
     }
 
-};
+    void return_memory( single_size_pool* p, void* mem )
+    {
+        std::size_t budget = budget_.load(std::memory_order_relaxed);
 
+        if ( budget && held_.load() + p->mem_size_ > budget )
+        {
+            // trim a quarter below the budget, not to trim on every
+            // return once the pool is full
+            if ( p->mem_size_ <= budget )
+            {
+                trim( ( budget - p->mem_size_ ) / 4 * 3 );
+            }
 
-template< typename T >
-class single_type_cube_pool
-{
-private:
-    std::mutex                                   m_;
-    std::map<vec3i, single_size_cube_pool<T>*>   pools_;
+            if ( held_.load() + p->mem_size_ > budget )
+            {
+                znn_free_block(mem, p->mem_size_);
+                return;
+            }
+        }
+
+        held_ += p->mem_size_;
+
+        std::lock_guard<std::mutex> g(p->m_);
+        p->list_.push_back(mem);
+    }
 
-    single_size_cube_pool<T>* get_pool( const vec3i& s )
+    // frees idle memory of the least recently used sizes until at
+    // most keep bytes are held
+    void trim( std::size_t keep = 0 )
     {
         std::lock_guard<std::mutex> g(m_);
-        if ( pools_.count(s) )
+
+        std::vector<std::pair<std::uint64_t, single_size_pool*>> order;
+        for ( auto& p: pools_ )
         {
-            return pools_[s];
+            std::lock_guard<std::mutex> pg(p.second->m_);
+            order.emplace_back(p.second->last_use_, p.second.get());
         }
-        else
+
+        std::sort(order.begin(), order.end());
+
+        for ( auto& o: order )
         {
-            single_size_cube_pool<T>* r = new single_size_cube_pool<T>{s};
-            pools_[s] = r;
-            return r;
+            single_size_pool* p = o.second;
+            std::lock_guard<std::mutex> pg(p->m_);
+            while ( held_.load() > keep && p->list_.size() )
+            {
+                znn_free_block(p->list_.back(), p->mem_size_);
+                p->list_.pop_back();
+                held_ -= p->mem_size_;
+            }
         }
     }
 
-public:
-    std::shared_ptr<cube<T>> get( const vec3i& s )
+    void set_budget( std::size_t bytes )
     {
-        return get_pool(s)->get();
+        budget_ = bytes;
+        if ( bytes && held_.load() > bytes ) trim(bytes);
     }
 
-    void return_cube( cube<T>* c )
+    std::size_t budget() const
     {
-        get_pool(vec3i(c->shape()[0], c->shape()[1], c->shape()[2]))->return_cube(c);
+        return budget_.load();
     }
 
-}; // single_type_cube_pool
+    std::size_t bytes_held() const
+    {
+        return held_.load();
+    }
 
-template< typename T >
-class single_type_qube_pool
-{
-private:
-    std::mutex                                   m_;
-    std::map<vec4i, single_size_qube_pool<T>*>   pools_;
+    void set_size_classes( bool b )
+    {
+        classes_ = b;
+    }
 
-    single_size_qube_pool<T>* get_pool( const vec4i& s )
+    std::vector<pool_bucket_stats> stats()
     {
         std::lock_guard<std::mutex> g(m_);
-        if ( pools_.count(s) )
-        {
-            return pools_[s];
-        }
-        else
+
+        std::vector<pool_bucket_stats> r;
+        for ( auto& p: pools_ )
         {
-            single_size_qube_pool<T>* r = new single_size_qube_pool<T>{s};
-            pools_[s] = r;
-            return r;
+            std::lock_guard<std::mutex> pg(p.second->m_);
+
+            pool_bucket_stats s;
+            s.size       = p.first;
+            s.hits       = p.second->hits_;
+            s.misses     = p.second->misses_;
+            s.bytes_held = p.second->list_.size() * p.first;
+            r.push_back(s);
         }
+        return r;
     }
 
-public:
-    std::shared_ptr<qube<T>> get( const vec4i& s )
+    void reset_stats()
     {
-        return get_pool(s)->get();
+        std::lock_guard<std::mutex> g(m_);
+        for ( auto& p: pools_ )
+        {
+            std::lock_guard<std::mutex> pg(p.second->m_);
+            p.second->hits_   = 0;
+            p.second->misses_ = 0;
+        }
     }
 
-    void return_cube( qube<T>* c )
-    {
-        get_pool(vec4i(c->shape()[0], c->shape()[1],
-                       c->shape()[2], c->shape()[3]))->return_cube(c);
-    }
+}; // class memory_pool
+
+namespace {
+memory_pool& cube_memory = zi::singleton<memory_pool>::instance();
+}
 
-}; // single_type_cube_pool
+template<typename T>
+std::shared_ptr<cube<T>> get_cube(const vec3i& s)
+{
+    single_size_pool* p = cube_memory.pool_for
+        (__znn_aligned_size<cube<T>>::value + s[0]*s[1]*s[2]*sizeof(T));
 
+    void*    mem  = cube_memory.get(p);
+    T*       data = __offset_cast<T>(mem, __znn_aligned_size<cube<T>>::value);
+    cube<T>* c    = new (mem) cube<T>(s,data);
 
+    return std::shared_ptr<cube<T>>(c,[p](cube<T>* c) {
+            cube_memory.return_memory(p, c);
+        });
+}
 
-template< typename T >
-struct pool
+template<typename T>
+std::shared_ptr<qube<T>> get_qube(const vec4i& s)
 {
-private:
-    static single_type_cube_pool<T>& cinstance;
-    static single_type_qube_pool<T>& qinstance;
+    single_size_pool* p = cube_memory.pool_for
+        (__znn_aligned_size<qube<T>>::value + s[0]*s[1]*s[2]*s[3]*sizeof(T));
 
-public:
-    static std::shared_ptr<cube<T>> get_cube( const vec3i& s )
-    {
-        return cinstance.get(s);
-    }
-
-    static std::shared_ptr<cube<T>> get_cube( size_t x, size_t y, size_t z )
-    {
-        return cinstance.get( vec3i(x,y,z) );
-    }
+    void*    mem  = cube_memory.get(p);
+    T*       data = __offset_cast<T>(mem, __znn_aligned_size<qube<T>>::value);
+    qube<T>* c    = new (mem) qube<T>(s,data);
 
-    static std::shared_ptr<qube<T>> get_qube( const vec4i& s )
-    {
-        return qinstance.get(s);
-    }
+    return std::shared_ptr<qube<T>>(c,[p](qube<T>* c) {
+            cube_memory.return_memory(p, c);
+        });
+}
 
-    static std::shared_ptr<qube<T>> get_qube( size_t x, size_t y,
-                                              size_t z, size_t t )
-    {
-        return qinstance.get( vec4i(x,y,z,t) );
-    }
+// A cube sharing the memory of the n-th volume of the qube, keeps the
+// qube alive
+template<typename T>
+std::shared_ptr<cube<T>> get_cube_view(const std::shared_ptr<qube<T>>& q,
+                                       size_t n)
+{
+    vec3i    s(q->shape()[1], q->shape()[2], q->shape()[3]);
+    void*    mem = znn_malloc(sizeof(cube<T>));
+    cube<T>* c   = new (mem) cube<T>(s, q->data() + n * s[0] * s[1] * s[2]);
 
-};
+    return std::shared_ptr<cube<T>>(c,[q](cube<T>* c) {
+            znn_free(c);
+        });
+}
 
-template< typename T >
-single_type_cube_pool<T>& pool<T>::cinstance =
-    zi::singleton<single_type_cube_pool<T>>::instance();
+// Memory management of the pool
 
+// frees idle memory, least recently used sizes first, until at most
+// keep bytes are held
+inline void trim_cube_pool( size_t keep = 0 )
+{
+    cube_memory.trim(keep);
+}
 
-template< typename T >
-single_type_qube_pool<T>& pool<T>::qinstance =
-    zi::singleton<single_type_qube_pool<T>>::instance();
+// limits the idle memory held by the pool, 0 for no limit
+inline void set_cube_pool_budget( size_t bytes )
+{
+    cube_memory.set_budget(bytes);
+}
 
+inline size_t cube_pool_budget()
+{
+    return cube_memory.budget();
+}
 
-template<typename T>
-std::shared_ptr<cube<T>> get_cube(const vec3i& s)
+inline size_t cube_pool_bytes_held()
 {
-    return pool<T>::get_cube(s);
+    return cube_memory.bytes_held();
 }
 
+// round the sizes up to powers of two, affects only the cubes
+// allocated afterwards
+inline void set_cube_pool_size_classes( bool b )
+{
+    cube_memory.set_size_classes(b);
+}
 
-template<typename T>
-std::shared_ptr<qube<T>> get_qube(const vec4i& s)
+inline std::vector<pool_bucket_stats> cube_pool_stats()
 {
-    return pool<T>::get_qube(s);
+    return cube_memory.stats();
 }
 
+inline void reset_cube_pool_stats()
+{
+    cube_memory.reset_stats();
+}
 
 }} // namespace znn::v4
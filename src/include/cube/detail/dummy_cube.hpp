@@ -19,6 +19,7 @@
 
 #include <memory>
 
+#include "pool_stats.hpp"
 #include "../../types.hpp"
 
 namespace znn { namespace v4 {
@@ -43,4 +44,29 @@ std::shared_ptr<qube<T>> get_qube(const vec4i& s)
         (new qube<T>(extents[s[0]][s[1]][s[2]][s[3]]));
 }
 
+// A copy of the n-th volume of the qube, the multi_arrays own their
+// memory
+template<typename T>
+std::shared_ptr<cube<T>> get_cube_view(const std::shared_ptr<qube<T>>& q,
+                                       size_t n)
+{
+    auto r = get_cube<T>(vec3i(q->shape()[1], q->shape()[2], q->shape()[3]));
+    *r = (*q)[n];
+    return r;
+}
+
+// The cubes are not pooled, nothing to manage
+
+inline void trim_cube_pool( size_t = 0 ) {}
+inline void set_cube_pool_budget( size_t ) {}
+inline size_t cube_pool_budget() { return 0; }
+inline size_t cube_pool_bytes_held() { return 0; }
+inline void set_cube_pool_size_classes( bool ) {}
+inline void reset_cube_pool_stats() {}
+
+inline std::vector<pool_bucket_stats> cube_pool_stats()
+{
+    return std::vector<pool_bucket_stats>();
+}
+
 }} // namespace znn::v4
@@ -20,44 +20,22 @@
 #include <zi/utility/singleton.hpp>
 #include <boost/lockfree/stack.hpp>
 #include <boost/lockfree/queue.hpp>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <mutex>
 
+#include "memory.hpp"
+#include "pool_stats.hpp"
 #include "../../types.hpp"
 #include "../../lockfree_allocator.hpp"
 
-#ifdef ZNN_XEON_PHI
-#  include <mkl.h>
+#ifdef ZNN_NUMA
+#  include "../../utils/numa.hpp"
 #endif
 
 namespace znn { namespace v4 {
 
-#ifdef ZNN_XEON_PHI
-#  define __ZNN_ALIGN 0x3F // 64 byte alignment
-#else
-#  define __ZNN_ALIGN 0xF // 16 byte alignment
-#endif
-
-
-inline void* znn_malloc(size_t s)
-{
-#ifdef ZNN_XEON_PHI
-    void* r = mkl_malloc(s,64);
-#else
-    void* r = malloc(s);
-#endif
-    if ( !r ) throw std::bad_alloc();
-    return r;
-}
-
-inline void znn_free(void* ptr)
-{
-#ifdef ZNN_XEON_PHI
-    mkl_free(ptr);
-#else
-    free(ptr);
-#endif
-}
-
 template <typename T> struct cube: boost::multi_array_ref<T,3>
 {
 private:
@@ -140,10 +118,15 @@ public:
     std::size_t                   mem_size_;
     boost::lockfree::queue<void*> stack_   ;
 
+    std::atomic<std::size_t>      held_    {0}; // idle blocks
+    std::atomic<std::size_t>      hits_    {0};
+    std::atomic<std::size_t>      misses_  {0};
+    std::atomic<std::uint64_t>    last_use_{0};
+
 public:
-    memory_bucket(size_t ms = 0)
+    memory_bucket(size_t ms = 0, size_t reserve = 65536*4)
         : mem_size_(ms)
-        , stack_(65536*4)
+        , stack_(reserve)
     {}
 
     void clear()
@@ -151,72 +134,310 @@ public:
         void * p;
         while ( stack_.unsynchronized_pop(p) )
         {
-            znn_free(p);
+            znn_free_block(p, mem_size_);
         }
+        held_ = 0;
     }
 
 public:
     void return_memory( void* c )
     {
+        // counted before the push so held_ never drops below the
+        // number of blocks in the queue
+        ++held_;
         while ( !stack_.push(c) );
     }
 
+    void* pop()
+    {
+        void* r;
+        if ( stack_.pop(r) )
+        {
+            --held_;
+            return r;
+        }
+        return nullptr;
+    }
+
 public:
     ~memory_bucket()
     {
         clear();
     }
 
-    void* get()
+    void touch( std::uint64_t epoch )
     {
-        void* r;
-        if ( stack_.pop(r) ) return r;
-        return znn_malloc(mem_size_);
+        if ( last_use_.load(std::memory_order_relaxed) != epoch )
+        {
+            last_use_.store(epoch, std::memory_order_relaxed);
+        }
     }
 };
 
-template< typename T >
-class single_type_xube_pool
+// Power of two sized buckets of raw memory shared by all cube types
+//
+// Idle memory is accounted for in held_. When a budget is set, memory
+// returned to a full pool first trims the least recently used buckets,
+// and is freed if it still doesn't fit. The recency is tracked in
+// epochs that advance on every miss and trim, so the buckets that are
+// part of the steady state working set always look the most recent.
+//
+class memory_pool
 {
 private:
-    std::array<memory_bucket,32> buckets_;
+    std::vector<std::unique_ptr<memory_bucket>> buckets_;
+
+    std::atomic<std::size_t>   held_  {0}; // bytes
+    std::atomic<std::size_t>   budget_{0}; // bytes, 0 for unlimited
+    std::atomic<std::uint64_t> epoch_ {1};
+    std::mutex                 trim_mutex_;
 
 public:
-    single_type_xube_pool()
+    explicit memory_pool(size_t reserve = 65536*4)
+        : buckets_(32)
     {
         for ( size_t i = 0; i < 32; ++i )
         {
-            buckets_[i].mem_size_ = static_cast<size_t>(1) << i;
+            buckets_[i] = std::make_unique<memory_bucket>
+                (static_cast<size_t>(1) << i, reserve);
+        }
+    }
+
+    static size_t bucket_of( size_t bytes )
+    {
+        return 64 - __builtin_clzl( bytes - 1 );
+    }
+
+    void* get( size_t bucket )
+    {
+        memory_bucket & b = *buckets_[bucket];
+
+        b.touch(epoch_.load(std::memory_order_relaxed));
+
+        if ( void* r = b.pop() )
+        {
+            b.hits_.fetch_add(1, std::memory_order_relaxed);
+            held_ -= b.mem_size_;
+            return r;
+        }
+
+        b.misses_.fetch_add(1, std::memory_order_relaxed);
+        ++epoch_;
+        return znn_malloc_block(b.mem_size_);
+    }
+
+    void return_memory( size_t bucket, void* p )
+    {
+        memory_bucket & b = *buckets_[bucket];
+
+        size_t budget = budget_.load(std::memory_order_relaxed);
+
+        if ( budget && held_.load() + b.mem_size_ > budget )
+        {
+            // trim a quarter below the budget, not to trim on every
+            // return once the pool is full
+            if ( b.mem_size_ <= budget )
+            {
+                trim( ( budget - b.mem_size_ ) / 4 * 3 );
+            }
+
+            if ( held_.load() + b.mem_size_ > budget )
+            {
+                znn_free_block(p, b.mem_size_);
+                return;
+            }
+        }
+
+        held_ += b.mem_size_;
+        b.return_memory(p);
+    }
+
+    // frees idle memory of the least recently used buckets until at
+    // most keep bytes are held
+    void trim( size_t keep = 0 )
+    {
+        std::lock_guard<std::mutex> g(trim_mutex_);
+
+        ++epoch_;
+
+        std::vector<memory_bucket*> order;
+        for ( auto & b: buckets_ )
+        {
+            if ( b->held_.load() ) order.push_back(b.get());
+        }
+
+        std::sort(order.begin(), order.end(),
+                  [](memory_bucket* a, memory_bucket* b) {
+                      return a->last_use_.load() < b->last_use_.load();
+                  });
+
+        for ( auto b: order )
+        {
+            while ( held_.load() > keep )
+            {
+                void* p = b->pop();
+                if ( !p ) break;
+                held_ -= b->mem_size_;
+                znn_free_block(p, b->mem_size_);
+            }
+        }
+    }
+
+    void set_budget( size_t bytes )
+    {
+        budget_ = bytes;
+        if ( bytes && held_.load() > bytes ) trim(bytes);
+    }
+
+    size_t budget() const
+    {
+        return budget_.load();
+    }
+
+    size_t bytes_held() const
+    {
+        return held_.load();
+    }
+
+    void append_stats( std::vector<pool_bucket_stats> & r ) const
+    {
+        for ( size_t i = 0; i < buckets_.size(); ++i )
+        {
+            memory_bucket const & b = *buckets_[i];
+
+            if ( r.size() <= i ) r.resize(i+1);
+
+            r[i].size        = b.mem_size_;
+            r[i].hits       += b.hits_.load();
+            r[i].misses     += b.misses_.load();
+            r[i].bytes_held += b.held_.load() * b.mem_size_;
+        }
+    }
+
+    void reset_stats()
+    {
+        for ( auto & b: buckets_ )
+        {
+            b->hits_   = 0;
+            b->misses_ = 0;
         }
     }
 
+}; // class memory_pool
+
+// One memory pool per NUMA node, the memory is first touched by (and
+// returned to) the node of the thread that requested it. A single pool
+// without ZNN_NUMA.
+//
+class memory_pools
+{
+private:
+    std::vector<std::unique_ptr<memory_pool>> pools_;
+
 public:
-    std::shared_ptr<cube<T>> get_cube( const vec3i& s )
+    memory_pools()
+#ifdef ZNN_NUMA
+        : pools_(numa.size())
+#else
+        : pools_(1)
+#endif
     {
-        size_t bucket = 64 - __builtin_clzl( __znn_aligned_size<cube<T>>::value
-                                             + s[0]*s[1]*s[2]*sizeof(T) - 1 );
+        // the queues preallocate their nodes, split the reserve
+        for ( auto& p: pools_ )
+        {
+            p = std::make_unique<memory_pool>(65536*4/pools_.size());
+        }
+    }
 
-        void*    mem  = buckets_[bucket].get();
-        T*       data = __offset_cast<T>(mem, __znn_aligned_size<cube<T>>::value);
-        cube<T>* c    = new (mem) cube<T>(s,data);
+    memory_pool & local()
+    {
+#ifdef ZNN_NUMA
+        return *pools_[this_numa_node() % pools_.size()];
+#else
+        return *pools_[0];
+#endif
+    }
 
-        return std::shared_ptr<cube<T>>(c,[this,bucket](cube<T>* c) {
-                this->buckets_[bucket].return_memory(c);
-            }, allocator<cube<T>>());
+    void trim( size_t keep )
+    {
+        for ( auto& p: pools_ ) p->trim(keep/pools_.size());
     }
 
-    std::shared_ptr<qube<T>> get_qube( const vec4i& s )
+    void set_budget( size_t bytes )
+    {
+        for ( auto& p: pools_ )
+        {
+            p->set_budget(bytes ? std::max<size_t>(bytes/pools_.size(),1) : 0);
+        }
+    }
+
+    size_t budget() const
+    {
+        size_t r = 0;
+        for ( auto& p: pools_ ) r += p->budget();
+        return r;
+    }
+
+    size_t bytes_held() const
+    {
+        size_t r = 0;
+        for ( auto& p: pools_ ) r += p->bytes_held();
+        return r;
+    }
+
+    std::vector<pool_bucket_stats> stats() const
+    {
+        std::vector<pool_bucket_stats> r;
+        for ( auto& p: pools_ ) p->append_stats(r);
+
+        std::vector<pool_bucket_stats> used;
+        for ( auto& s: r )
+        {
+            if ( s.hits || s.misses || s.bytes_held ) used.push_back(s);
+        }
+        return used;
+    }
+
+    void reset_stats()
+    {
+        for ( auto& p: pools_ ) p->reset_stats();
+    }
+
+}; // class memory_pools
+
+namespace {
+memory_pools& cube_memory = zi::singleton<memory_pools>::instance();
+}
+
+template< typename T >
+class single_type_xube_pool
+{
+private:
+    template< typename X, typename S >
+    std::shared_ptr<X> get( const S& s, size_t n )
     {
-        size_t bucket = 64 - __builtin_clzl( __znn_aligned_size<qube<T>>::value
-                                             + s[0]*s[1]*s[2]*s[3]*sizeof(T) - 1 );
+        memory_pool * mp     = &cube_memory.local();
+        size_t        bucket = memory_pool::bucket_of
+            ( __znn_aligned_size<X>::value + n * sizeof(T) );
+
+        void* mem  = mp->get(bucket);
+        T*    data = __offset_cast<T>(mem, __znn_aligned_size<X>::value);
+        X*    c    = new (mem) X(s,data);
 
-        void*    mem  = buckets_[bucket].get();
-        T*       data = __offset_cast<T>(mem, __znn_aligned_size<qube<T>>::value);
-        qube<T>* c    = new (mem) qube<T>(s,data);
+        return std::shared_ptr<X>(c,[mp,bucket](X* c) {
+                mp->return_memory(bucket, c);
+            }, allocator<X>());
+    }
+
+public:
+    std::shared_ptr<cube<T>> get_cube( const vec3i& s )
+    {
+        return get<cube<T>>(s, s[0]*s[1]*s[2]);
+    }
 
-        return std::shared_ptr<qube<T>>(c,[this,bucket](qube<T>* c) {
-                this->buckets_[bucket].return_memory(c);
-            }, allocator<qube<T>>());
+    std::shared_ptr<qube<T>> get_qube( const vec4i& s )
+    {
+        return get<qube<T>>(s, s[0]*s[1]*s[2]*s[3]);
     }
 
 }; // single_type_xube_pool
@@ -266,4 +487,59 @@ std::shared_ptr<qube<T>> get_qube(const vec4i& s)
     return pool<T>::get_qube(s);
 }
 
+// A cube sharing the memory of the n-th volume of the qube, keeps the
+// qube alive
+template<typename T>
+std::shared_ptr<cube<T>> get_cube_view(const std::shared_ptr<qube<T>>& q,
+                                       size_t n)
+{
+    vec3i    s(q->shape()[1], q->shape()[2], q->shape()[3]);
+    void*    mem = znn_malloc(sizeof(cube<T>));
+    cube<T>* c   = new (mem) cube<T>(s, q->data() + n * s[0] * s[1] * s[2]);
+
+    return std::shared_ptr<cube<T>>(c,[q](cube<T>* c) {
+            znn_free(c);
+        });
+}
+
+// Memory management of the pool
+
+// frees idle memory, least recently used sizes first, until at most
+// keep bytes are held
+inline void trim_cube_pool( size_t keep = 0 )
+{
+    cube_memory.trim(keep);
+}
+
+// limits the idle memory held by the pool, 0 for no limit
+inline void set_cube_pool_budget( size_t bytes )
+{
+    cube_memory.set_budget(bytes);
+}
+
+inline size_t cube_pool_budget()
+{
+    return cube_memory.budget();
+}
+
+inline size_t cube_pool_bytes_held()
+{
+    return cube_memory.bytes_held();
+}
+
+// the sizes are always rounded up to powers of two
+inline void set_cube_pool_size_classes( bool )
+{
+}
+
+inline std::vector<pool_bucket_stats> cube_pool_stats()
+{
+    return cube_memory.stats();
+}
+
+inline void reset_cube_pool_stats()
+{
+    cube_memory.reset_stats();
+}
+
 }} // namespace znn::v4
@@ -17,25 +17,13 @@
 //
 #pragma once
 
+#include "memory.hpp"
+#include "pool_stats.hpp"
 #include "../../types.hpp"
 #include "../../assert.hpp"
 
 namespace znn { namespace v4 {
 
-#define __ZNN_ALIGN 0xF // 16 byte alignment
-
-inline void* znn_malloc(size_t s)
-{
-    void* r = malloc(s);
-    if ( !r ) throw std::bad_alloc();
-    return r;
-}
-
-inline void znn_free(void* ptr)
-{
-    free(ptr);
-}
-
 template <typename T> struct cube: boost::multi_array_ref<T,3>
 {
 private:
@@ -146,4 +134,33 @@ std::shared_ptr<qube<T>> get_qube(const vec4i& s)
     return std::shared_ptr<qube<T>>(c,znn_free);
 }
 
+// A cube sharing the memory of the n-th volume of the qube, keeps the
+// qube alive
+template<typename T>
+std::shared_ptr<cube<T>> get_cube_view(const std::shared_ptr<qube<T>>& q,
+                                       size_t n)
+{
+    vec3i    s(q->shape()[1], q->shape()[2], q->shape()[3]);
+    void*    mem = znn_malloc(sizeof(cube<T>));
+    cube<T>* c   = new (mem) cube<T>(s, q->data() + n * s[0] * s[1] * s[2]);
+
+    return std::shared_ptr<cube<T>>(c,[q](cube<T>* c) {
+            znn_free(c);
+        });
+}
+
+// The cubes are not pooled, nothing to manage
+
+inline void trim_cube_pool( size_t = 0 ) {}
+inline void set_cube_pool_budget( size_t ) {}
+inline size_t cube_pool_budget() { return 0; }
+inline size_t cube_pool_bytes_held() { return 0; }
+inline void set_cube_pool_size_classes( bool ) {}
+inline void reset_cube_pool_stats() {}
+
+inline std::vector<pool_bucket_stats> cube_pool_stats()
+{
+    return std::vector<pool_bucket_stats>();
+}
+
 }} // namespace znn::v4
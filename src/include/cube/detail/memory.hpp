@@ -0,0 +1,140 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef ZNN_XEON_PHI
+#  include <mkl.h>
+#endif
+
+#ifdef ZNN_HUGE_PAGES
+#  include <sys/mman.h>
+#endif
+
+namespace znn { namespace v4 {
+
+// Cube data starts at a cache line (and AVX-512 register) boundary
+#if defined(ZNN_XEON_PHI) || defined(__x86_64__) || defined(__i386__)
+#  define __ZNN_ALIGN 0x3F // 64 byte alignment
+#else
+#  define __ZNN_ALIGN 0xF // 16 byte alignment
+#endif
+
+#ifdef ZNN_HUGE_PAGES
+
+// Blocks of at least huge_page_size bytes get their own mapping, backed
+// by explicit huge pages when some are reserved (vm.nr_hugepages),
+// otherwise by transparent huge pages. The pools keep the blocks, so the
+// mappings are rarely created.
+//
+static const std::size_t huge_page_size = static_cast<std::size_t>(1) << 21;
+
+inline std::size_t huge_page_round( std::size_t s )
+{
+    return ( ( s - 1 ) | ( huge_page_size - 1 ) ) + 1;
+}
+
+inline void* huge_page_malloc( std::size_t s )
+{
+    static std::atomic<bool> explicit_pages(true);
+
+    std::size_t n = huge_page_round(s);
+
+    if ( explicit_pages.load(std::memory_order_relaxed) )
+    {
+        void* r = mmap(nullptr, n, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if ( r != MAP_FAILED ) return r;
+
+        // none reserved, don't try again
+        explicit_pages = false;
+    }
+
+    // map an extra huge page, so the block can start at a huge page
+    // boundary and be backed by huge pages entirely
+    void* m = mmap(nullptr, n + huge_page_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if ( m == MAP_FAILED ) throw std::bad_alloc();
+
+    char*       p    = reinterpret_cast<char*>(m);
+    std::size_t head = ( huge_page_size - reinterpret_cast<std::uintptr_t>(p)
+                         % huge_page_size ) % huge_page_size;
+
+    if ( head ) munmap(p, head);
+    munmap(p + head + n, huge_page_size - head);
+
+    madvise(p + head, n, MADV_HUGEPAGE);
+
+    return p + head;
+}
+
+inline void huge_page_free( void* p, std::size_t s )
+{
+    munmap(p, huge_page_round(s));
+}
+
+#endif
+
+inline void* znn_malloc(size_t s)
+{
+#ifdef ZNN_XEON_PHI
+    void* r = mkl_malloc(s,64);
+#else
+    void* r = nullptr;
+    if ( posix_memalign(&r, __ZNN_ALIGN + 1, s) ) r = nullptr;
+#endif
+    if ( !r ) throw std::bad_alloc();
+    return r;
+}
+
+inline void znn_free(void* ptr)
+{
+#ifdef ZNN_XEON_PHI
+    mkl_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+// For the memory of the pools, the large blocks go to huge pages
+inline void* znn_malloc_block(size_t s)
+{
+#ifdef ZNN_HUGE_PAGES
+    if ( s >= huge_page_size ) return huge_page_malloc(s);
+#endif
+    return znn_malloc(s);
+}
+
+inline void znn_free_block(void* ptr, size_t s)
+{
+#ifdef ZNN_HUGE_PAGES
+    if ( s >= huge_page_size )
+    {
+        huge_page_free(ptr, s);
+        return;
+    }
+#endif
+    znn_free(ptr);
+}
+
+}} // namespace znn::v4
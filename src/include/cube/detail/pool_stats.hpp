@@ -0,0 +1,34 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace znn { namespace v4 {
+
+// Counters of a single size of the cube pool
+struct pool_bucket_stats
+{
+    std::size_t size       = 0; // bytes per block
+    std::size_t hits       = 0; // requests served from the pool
+    std::size_t misses     = 0; // requests that had to allocate
+    std::size_t bytes_held = 0; // idle memory kept by the pool
+};
+
+}} // namespace znn::v4
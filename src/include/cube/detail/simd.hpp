@@ -0,0 +1,564 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "../../types.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+// The element-wise cube operators are compiled for SSE3, AVX2 (with FMA)
+// and AVX-512 and the best set supported by the CPU is chosen at
+// runtime, so the binaries don't need -march. The environment variable
+// ZNN_SIMD (scalar, sse, avx2 or avx512) limits the choice.
+//
+#if !defined(ZNN_DONT_DISPATCH_SIMD) && !defined(__INTEL_COMPILER) &&   \
+    ( defined(__GNUC__) || defined(__clang__) ) &&                      \
+    ( defined(__x86_64__) || defined(__i386__) )
+#  define ZNN_SIMD_DISPATCH
+#  include <immintrin.h>
+#endif
+
+namespace znn { namespace v4 { namespace simd {
+
+enum class isa : int
+{
+    scalar = 0, sse = 1, avx2 = 2, avx512 = 3
+};
+
+inline char const * isa_name( isa i )
+{
+    static char const * names[] = { "scalar", "sse", "avx2", "avx512" };
+    return names[static_cast<int>(i)];
+}
+
+// r[z] += sum a[i*sx + j*sy + k*sz + z] * w[(i*by + j)*bz + k]
+typedef void (*conv_line_t)(real const*, std::size_t, std::size_t, std::size_t,
+                            real const*, std::size_t, std::size_t, std::size_t,
+                            real*, std::size_t);
+
+// The filter shapes with their own conv_line, unrolled and with the
+// taps kept in registers (the shapes of the networks/ we use)
+#define ZNN_SIMD_CONV_SHAPES(F)                                         \
+    F(3,3,3) F(2,3,3) F(1,3,3) F(1,2,2) F(1,4,4) F(1,5,5)               \
+    F(4,4,1) F(3,3,1)
+
+// The kernels of an instruction set
+struct kernels
+{
+    void (*add_to)  (real*, real const*, std::size_t);
+    void (*scale_add)(real, real const*, real*, std::size_t);
+    void (*mad_to)  (real const*, real const*, real*, std::size_t);
+    void (*mul_with)(real*, real const*, std::size_t);
+    real (*sum)     (real const*, std::size_t);
+    void (*reverse) (real*, std::size_t);
+    void (*cmul)    (real const*, real const*, real*, std::size_t);
+    void (*cmad)    (real const*, real const*, real*, std::size_t);
+    conv_line_t conv_line;
+    conv_line_t (*conv_line_for)(std::size_t, std::size_t, std::size_t);
+    void (*correlate_rows)(real const*, std::size_t, std::size_t,
+                           real const*, std::size_t, std::size_t, std::size_t,
+                           std::ptrdiff_t, real*, std::size_t);
+    void (*gemm)(std::size_t, std::size_t, std::size_t,
+                 real const*, std::size_t, real const*, std::size_t,
+                 real*, std::size_t);
+};
+
+namespace scalar {
+
+inline void add_to( real * a, real const * b, std::size_t n ) noexcept
+{
+    for ( std::size_t i = 0; i < n; ++i ) a[i] += b[i];
+}
+
+inline void mad_to( real c, real const * x, real * o, std::size_t n ) noexcept
+{
+    for ( std::size_t i = 0; i < n; ++i ) o[i] += c * x[i];
+}
+
+inline void mad_to( real const * a, real const * b, real * o,
+                    std::size_t n ) noexcept
+{
+    for ( std::size_t i = 0; i < n; ++i ) o[i] += a[i] * b[i];
+}
+
+inline void mul_with( real * a, real const * b, std::size_t n ) noexcept
+{
+    for ( std::size_t i = 0; i < n; ++i ) a[i] *= b[i];
+}
+
+inline real sum( real const * a, std::size_t n ) noexcept
+{
+    real r = 0;
+    for ( std::size_t i = 0; i < n; ++i ) r += a[i];
+    return r;
+}
+
+inline void reverse( real * a, std::size_t n ) noexcept
+{
+    std::reverse(a, a + n);
+}
+
+inline void cmul( real const * a, real const * b, real * r,
+                  std::size_t n ) noexcept
+{
+    for ( std::size_t i = 0; i < 2 * n; i += 2 )
+    {
+        real re = a[i] * b[i]   - a[i+1] * b[i+1];
+        real im = a[i] * b[i+1] + a[i+1] * b[i];
+        r[i]   = re;
+        r[i+1] = im;
+    }
+}
+
+inline void cmad( real const * a, real const * b, real * r,
+                  std::size_t n ) noexcept
+{
+    for ( std::size_t i = 0; i < 2 * n; i += 2 )
+    {
+        r[i]   += a[i] * b[i]   - a[i+1] * b[i+1];
+        r[i+1] += a[i] * b[i+1] + a[i+1] * b[i];
+    }
+}
+
+inline void conv_line( real const * a,
+                       std::size_t sx, std::size_t sy, std::size_t sz,
+                       real const * w,
+                       std::size_t bx, std::size_t by, std::size_t bz,
+                       real * r, std::size_t n ) noexcept
+{
+    for ( std::size_t z = 0; z < n; ++z )
+    {
+        real s = 0;
+
+        real const * wp = w;
+        for ( std::size_t i = 0; i < bx; ++i )
+            for ( std::size_t j = 0; j < by; ++j )
+                for ( std::size_t k = 0; k < bz; ++k )
+                    s += a[i * sx + j * sy + k * sz + z] * *wp++;
+
+        r[z] += s;
+    }
+}
+
+template<std::size_t BX, std::size_t BY, std::size_t BZ>
+inline void conv_line_fixed( real const * a,
+                             std::size_t sx, std::size_t sy, std::size_t sz,
+                             real const * w,
+                             std::size_t, std::size_t, std::size_t,
+                             real * r, std::size_t n ) noexcept
+{
+    conv_line(a, sx, sy, sz, w, BX, BY, BZ, r, n);
+}
+
+inline conv_line_t conv_line_for( std::size_t bx,
+                                  std::size_t by,
+                                  std::size_t bz ) noexcept
+{
+#define ZNN_CONV_LINE_FIXED(X,Y,Z)                                      \
+    if ( bx == X && by == Y && bz == Z ) return &conv_line_fixed<X,Y,Z>;
+
+    ZNN_SIMD_CONV_SHAPES(ZNN_CONV_LINE_FIXED)
+
+#undef ZNN_CONV_LINE_FIXED
+    return nullptr;
+}
+
+inline void correlate_rows( real const * a, std::size_t sx, std::size_t sy,
+                            real const * b,
+                            std::size_t bx, std::size_t by, std::size_t bz,
+                            std::ptrdiff_t shift,
+                            real * r, std::size_t m ) noexcept
+{
+    for ( std::size_t q = 0; q < m; ++q )
+    {
+        real s = 0;
+
+        real const * bp = b;
+        for ( std::size_t i = 0; i < bx; ++i )
+            for ( std::size_t j = 0; j < by; ++j, bp += bz )
+            {
+                real const * ap = a + i * sx + j * sy
+                    - static_cast<std::ptrdiff_t>(q) * shift;
+                for ( std::size_t z = 0; z < bz; ++z )
+                    s += ap[z] * bp[z];
+            }
+
+        r[q] += s;
+    }
+}
+
+inline void gemm( std::size_t m, std::size_t n, std::size_t k,
+                  real const * a, std::size_t lda,
+                  real const * b, std::size_t ldb,
+                  real * c, std::size_t ldc ) noexcept
+{
+    for ( std::size_t i = 0; i < m; ++i )
+        for ( std::size_t l = 0; l < k; ++l )
+        {
+            real x = a[i * lda + l];
+            for ( std::size_t j = 0; j < n; ++j )
+                c[i * ldc + j] += x * b[l * ldb + j];
+        }
+}
+
+} // namespace scalar
+
+#ifdef ZNN_SIMD_DISPATCH
+
+#if defined(__clang__)
+#  pragma clang attribute push (__attribute__((target("sse3"))), apply_to = function)
+#else
+#  pragma GCC push_options
+#  pragma GCC target("sse3")
+#endif
+
+namespace sse {
+
+#ifdef ZNN_USE_FLOATS
+
+struct vec
+{
+    typedef __m128 type;
+    static constexpr std::size_t width = 4;
+
+    static type load( real const * p ) { return _mm_loadu_ps(p); }
+    static void store( real * p, type x ) { _mm_storeu_ps(p, x); }
+    static type zero() { return _mm_setzero_ps(); }
+    static type set1( real c ) { return _mm_set1_ps(c); }
+    static type add( type a, type b ) { return _mm_add_ps(a, b); }
+    static type mul( type a, type b ) { return _mm_mul_ps(a, b); }
+    static type fmadd( type a, type b, type c )
+    { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static type reverse( type x ) { return _mm_shuffle_ps(x, x, 0x1B); }
+
+    static real hsum( type x )
+    {
+        float r[4]; _mm_storeu_ps(r, x);
+        return r[0] + r[1] + r[2] + r[3];
+    }
+
+    static type cmul( type a, type b )
+    {
+        type re = _mm_moveldup_ps(b);
+        type im = _mm_movehdup_ps(b);
+        type sw = _mm_shuffle_ps(a, a, 0xB1);
+        return _mm_addsub_ps(_mm_mul_ps(a, re), _mm_mul_ps(sw, im));
+    }
+};
+
+#else
+
+struct vec
+{
+    typedef __m128d type;
+    static constexpr std::size_t width = 2;
+
+    static type load( real const * p ) { return _mm_loadu_pd(p); }
+    static void store( real * p, type x ) { _mm_storeu_pd(p, x); }
+    static type zero() { return _mm_setzero_pd(); }
+    static type set1( real c ) { return _mm_set1_pd(c); }
+    static type add( type a, type b ) { return _mm_add_pd(a, b); }
+    static type mul( type a, type b ) { return _mm_mul_pd(a, b); }
+    static type fmadd( type a, type b, type c )
+    { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static type reverse( type x ) { return _mm_shuffle_pd(x, x, 1); }
+
+    static real hsum( type x )
+    {
+        double r[2]; _mm_storeu_pd(r, x);
+        return r[0] + r[1];
+    }
+
+    static type cmul( type a, type b )
+    {
+        type re = _mm_movedup_pd(b);
+        type im = _mm_unpackhi_pd(b, b);
+        type sw = _mm_shuffle_pd(a, a, 1);
+        return _mm_addsub_pd(_mm_mul_pd(a, re), _mm_mul_pd(sw, im));
+    }
+};
+
+#endif
+
+#include "simd_kernels.hpp"
+
+} // namespace sse
+
+#if defined(__clang__)
+#  pragma clang attribute pop
+#  pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#else
+#  pragma GCC pop_options
+#  pragma GCC push_options
+#  pragma GCC target("avx2,fma")
+#endif
+
+namespace avx2 {
+
+#ifdef ZNN_USE_FLOATS
+
+struct vec
+{
+    typedef __m256 type;
+    static constexpr std::size_t width = 8;
+
+    static type load( real const * p ) { return _mm256_loadu_ps(p); }
+    static void store( real * p, type x ) { _mm256_storeu_ps(p, x); }
+    static type zero() { return _mm256_setzero_ps(); }
+    static type set1( real c ) { return _mm256_set1_ps(c); }
+    static type add( type a, type b ) { return _mm256_add_ps(a, b); }
+    static type mul( type a, type b ) { return _mm256_mul_ps(a, b); }
+    static type fmadd( type a, type b, type c )
+    { return _mm256_fmadd_ps(a, b, c); }
+
+    static type reverse( type x )
+    {
+        return _mm256_permutevar8x32_ps(
+            x, _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+
+    static real hsum( type x )
+    {
+        float r[8]; _mm256_storeu_ps(r, x);
+        return ( r[0] + r[1] ) + ( r[2] + r[3] )
+            + ( r[4] + r[5] ) + ( r[6] + r[7] );
+    }
+
+    static type cmul( type a, type b )
+    {
+        type re = _mm256_moveldup_ps(b);
+        type im = _mm256_movehdup_ps(b);
+        type sw = _mm256_permute_ps(a, 0xB1);
+        return _mm256_fmaddsub_ps(a, re, _mm256_mul_ps(sw, im));
+    }
+};
+
+#else
+
+struct vec
+{
+    typedef __m256d type;
+    static constexpr std::size_t width = 4;
+
+    static type load( real const * p ) { return _mm256_loadu_pd(p); }
+    static void store( real * p, type x ) { _mm256_storeu_pd(p, x); }
+    static type zero() { return _mm256_setzero_pd(); }
+    static type set1( real c ) { return _mm256_set1_pd(c); }
+    static type add( type a, type b ) { return _mm256_add_pd(a, b); }
+    static type mul( type a, type b ) { return _mm256_mul_pd(a, b); }
+    static type fmadd( type a, type b, type c )
+    { return _mm256_fmadd_pd(a, b, c); }
+    static type reverse( type x ) { return _mm256_permute4x64_pd(x, 0x1B); }
+
+    static real hsum( type x )
+    {
+        double r[4]; _mm256_storeu_pd(r, x);
+        return ( r[0] + r[1] ) + ( r[2] + r[3] );
+    }
+
+    static type cmul( type a, type b )
+    {
+        type re = _mm256_movedup_pd(b);
+        type im = _mm256_permute_pd(b, 0xF);
+        type sw = _mm256_permute_pd(a, 0x5);
+        return _mm256_fmaddsub_pd(a, re, _mm256_mul_pd(sw, im));
+    }
+};
+
+#endif
+
+#include "simd_kernels.hpp"
+
+} // namespace avx2
+
+#if defined(__clang__)
+#  pragma clang attribute pop
+#  pragma clang attribute push (__attribute__((target("avx512f"))), apply_to = function)
+#else
+#  pragma GCC pop_options
+#  pragma GCC push_options
+#  pragma GCC target("avx512f")
+#endif
+
+namespace avx512 {
+
+#ifdef ZNN_USE_FLOATS
+
+struct vec
+{
+    typedef __m512 type;
+    static constexpr std::size_t width = 16;
+
+    static type load( real const * p ) { return _mm512_loadu_ps(p); }
+    static void store( real * p, type x ) { _mm512_storeu_ps(p, x); }
+    static type zero() { return _mm512_setzero_ps(); }
+    static type set1( real c ) { return _mm512_set1_ps(c); }
+    static type add( type a, type b ) { return _mm512_add_ps(a, b); }
+    static type mul( type a, type b ) { return _mm512_mul_ps(a, b); }
+    static type fmadd( type a, type b, type c )
+    { return _mm512_fmadd_ps(a, b, c); }
+
+    static type reverse( type x )
+    {
+        return _mm512_permutexvar_ps(
+            _mm512_set_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                             8, 9, 10, 11, 12, 13, 14, 15), x);
+    }
+
+    static real hsum( type x )
+    {
+        float r[16]; _mm512_storeu_ps(r, x);
+        real s = 0;
+        for ( int i = 0; i < 16; ++i ) s += r[i];
+        return s;
+    }
+
+    static type cmul( type a, type b )
+    {
+        type re = _mm512_moveldup_ps(b);
+        type im = _mm512_movehdup_ps(b);
+        type sw = _mm512_permute_ps(a, 0xB1);
+        return _mm512_fmaddsub_ps(a, re, _mm512_mul_ps(sw, im));
+    }
+};
+
+#else
+
+struct vec
+{
+    typedef __m512d type;
+    static constexpr std::size_t width = 8;
+
+    static type load( real const * p ) { return _mm512_loadu_pd(p); }
+    static void store( real * p, type x ) { _mm512_storeu_pd(p, x); }
+    static type zero() { return _mm512_setzero_pd(); }
+    static type set1( real c ) { return _mm512_set1_pd(c); }
+    static type add( type a, type b ) { return _mm512_add_pd(a, b); }
+    static type mul( type a, type b ) { return _mm512_mul_pd(a, b); }
+    static type fmadd( type a, type b, type c )
+    { return _mm512_fmadd_pd(a, b, c); }
+
+    static type reverse( type x )
+    {
+        return _mm512_permutexvar_pd(
+            _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7), x);
+    }
+
+    static real hsum( type x )
+    {
+        double r[8]; _mm512_storeu_pd(r, x);
+        real s = 0;
+        for ( int i = 0; i < 8; ++i ) s += r[i];
+        return s;
+    }
+
+    static type cmul( type a, type b )
+    {
+        type re = _mm512_movedup_pd(b);
+        type im = _mm512_permute_pd(b, 0xFF);
+        type sw = _mm512_permute_pd(a, 0x55);
+        return _mm512_fmaddsub_pd(a, re, _mm512_mul_pd(sw, im));
+    }
+};
+
+#endif
+
+#include "simd_kernels.hpp"
+
+} // namespace avx512
+
+#if defined(__clang__)
+#  pragma clang attribute pop
+#else
+#  pragma GCC pop_options
+#endif
+
+#endif // ZNN_SIMD_DISPATCH
+
+// The best instruction set of this CPU
+inline isa supported()
+{
+#ifdef ZNN_SIMD_DISPATCH
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx512f") ) return isa::avx512;
+    if ( __builtin_cpu_supports("avx2") &&
+         __builtin_cpu_supports("fma") )     return isa::avx2;
+    if ( __builtin_cpu_supports("sse3") )    return isa::sse;
+#endif
+    return isa::scalar;
+}
+
+#define ZNN_SIMD_KERNELS(NS)                                    \
+    kernels{ &NS::add_to, &NS::mad_to, &NS::mad_to,             \
+            &NS::mul_with, &NS::sum, &NS::reverse,              \
+            &NS::cmul, &NS::cmad, &NS::conv_line,               \
+            &NS::conv_line_for, &NS::correlate_rows, &NS::gemm }
+
+// The kernels of the instruction set i, which has to be supported
+inline kernels const & kernels_for( isa i )
+{
+    static const kernels scalar_k = ZNN_SIMD_KERNELS(scalar);
+#ifdef ZNN_SIMD_DISPATCH
+    static const kernels sse_k    = ZNN_SIMD_KERNELS(sse);
+    static const kernels avx2_k   = ZNN_SIMD_KERNELS(avx2);
+    static const kernels avx512_k = ZNN_SIMD_KERNELS(avx512);
+
+    switch ( i )
+    {
+    case isa::sse:    return sse_k;
+    case isa::avx2:   return avx2_k;
+    case isa::avx512: return avx512_k;
+    default:          break;
+    }
+#endif
+    return scalar_k;
+}
+
+#undef ZNN_SIMD_KERNELS
+
+// The instruction set used by the cube operators
+inline isa active_isa()
+{
+    static const isa i = []()
+        {
+            isa r = supported();
+            if ( char const * e = std::getenv("ZNN_SIMD") )
+            {
+                for ( int k = 0; k < static_cast<int>(r); ++k )
+                {
+                    if ( std::strcmp(e, isa_name(static_cast<isa>(k))) == 0 )
+                    {
+                        r = static_cast<isa>(k);
+                    }
+                }
+            }
+            return r;
+        }();
+    return i;
+}
+
+inline kernels const & active()
+{
+    static kernels const & k = kernels_for(active_isa());
+    return k;
+}
+
+}}} // namespace znn::v4::simd
@@ -0,0 +1,458 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// No include guard: the kernels are compiled once per instruction set,
+// included by simd.hpp inside the namespace of the set, where `vec` is
+// the register type of the set. The arrays don't have to be aligned.
+// The complex arrays are interleaved (re,im) pairs, n is the number of
+// complex values.
+
+inline void add_to( real * a, real const * b, std::size_t n ) noexcept
+{
+    std::size_t i = 0;
+    for ( ; i + vec::width <= n; i += vec::width )
+        vec::store(a+i, vec::add(vec::load(a+i), vec::load(b+i)));
+    for ( ; i < n; ++i )
+        a[i] += b[i];
+}
+
+inline void mad_to( real c, real const * x, real * o, std::size_t n ) noexcept
+{
+    vec::type cv = vec::set1(c);
+
+    std::size_t i = 0;
+    for ( ; i + vec::width <= n; i += vec::width )
+        vec::store(o+i, vec::fmadd(cv, vec::load(x+i), vec::load(o+i)));
+    for ( ; i < n; ++i )
+        o[i] += c * x[i];
+}
+
+inline void mad_to( real const * a, real const * b, real * o,
+                    std::size_t n ) noexcept
+{
+    std::size_t i = 0;
+    for ( ; i + vec::width <= n; i += vec::width )
+        vec::store(o+i, vec::fmadd(vec::load(a+i), vec::load(b+i),
+                                   vec::load(o+i)));
+    for ( ; i < n; ++i )
+        o[i] += a[i] * b[i];
+}
+
+inline void mul_with( real * a, real const * b, std::size_t n ) noexcept
+{
+    std::size_t i = 0;
+    for ( ; i + vec::width <= n; i += vec::width )
+        vec::store(a+i, vec::mul(vec::load(a+i), vec::load(b+i)));
+    for ( ; i < n; ++i )
+        a[i] *= b[i];
+}
+
+inline real sum( real const * a, std::size_t n ) noexcept
+{
+    vec::type s0 = vec::zero();
+    vec::type s1 = vec::zero();
+
+    std::size_t i = 0;
+    for ( ; i + 2 * vec::width <= n; i += 2 * vec::width )
+    {
+        s0 = vec::add(s0, vec::load(a+i));
+        s1 = vec::add(s1, vec::load(a+i+vec::width));
+    }
+
+    real r = vec::hsum(vec::add(s0, s1));
+    for ( ; i < n; ++i )
+        r += a[i];
+    return r;
+}
+
+inline void reverse( real * a, std::size_t n ) noexcept
+{
+    std::size_t i = 0;
+    std::size_t j = n;
+    for ( ; i + 2 * vec::width <= j; i += vec::width, j -= vec::width )
+    {
+        vec::type lo = vec::load(a+i);
+        vec::type hi = vec::load(a+j-vec::width);
+        vec::store(a+i, vec::reverse(hi));
+        vec::store(a+j-vec::width, vec::reverse(lo));
+    }
+    std::reverse(a+i, a+j);
+}
+
+inline void cmul( real const * a, real const * b, real * r,
+                  std::size_t n ) noexcept
+{
+    std::size_t i = 0;
+    for ( ; i + vec::width <= 2 * n; i += vec::width )
+        vec::store(r+i, vec::cmul(vec::load(a+i), vec::load(b+i)));
+    for ( ; i < 2 * n; i += 2 )
+    {
+        real re = a[i] * b[i]   - a[i+1] * b[i+1];
+        real im = a[i] * b[i+1] + a[i+1] * b[i];
+        r[i]   = re;
+        r[i+1] = im;
+    }
+}
+
+inline void cmad( real const * a, real const * b, real * r,
+                  std::size_t n ) noexcept
+{
+    std::size_t i = 0;
+    for ( ; i + vec::width <= 2 * n; i += vec::width )
+        vec::store(r+i, vec::add(vec::load(r+i),
+                                 vec::cmul(vec::load(a+i), vec::load(b+i))));
+    for ( ; i < 2 * n; i += 2 )
+    {
+        r[i]   += a[i] * b[i]   - a[i+1] * b[i+1];
+        r[i+1] += a[i] * b[i+1] + a[i+1] * b[i];
+    }
+}
+
+// r[z] += sum a[i*sx + j*sy + k*sz + z] * w[(i*by + j)*bz + k] for the
+// n values of r, the taps are in the order of w. Blocks of four
+// registers of r stay in registers while all the taps are applied.
+inline void conv_line( real const * a,
+                       std::size_t sx, std::size_t sy, std::size_t sz,
+                       real const * w,
+                       std::size_t bx, std::size_t by, std::size_t bz,
+                       real * r, std::size_t n ) noexcept
+{
+    constexpr std::size_t W = vec::width;
+
+    std::size_t z = 0;
+    for ( ; z + 4 * W <= n; z += 4 * W )
+    {
+        vec::type r0 = vec::load(r+z);
+        vec::type r1 = vec::load(r+z+W);
+        vec::type r2 = vec::load(r+z+2*W);
+        vec::type r3 = vec::load(r+z+3*W);
+
+        real const * wp = w;
+        for ( std::size_t i = 0; i < bx; ++i )
+            for ( std::size_t j = 0; j < by; ++j )
+            {
+                real const * ap = a + i * sx + j * sy + z;
+                for ( std::size_t k = 0; k < bz; ++k, ap += sz )
+                {
+                    vec::type wv = vec::set1(*wp++);
+                    r0 = vec::fmadd(vec::load(ap),     wv, r0);
+                    r1 = vec::fmadd(vec::load(ap+W),   wv, r1);
+                    r2 = vec::fmadd(vec::load(ap+2*W), wv, r2);
+                    r3 = vec::fmadd(vec::load(ap+3*W), wv, r3);
+                }
+            }
+
+        vec::store(r+z,     r0);
+        vec::store(r+z+W,   r1);
+        vec::store(r+z+2*W, r2);
+        vec::store(r+z+3*W, r3);
+    }
+
+    for ( ; z + W <= n; z += W )
+    {
+        vec::type r0 = vec::load(r+z);
+
+        real const * wp = w;
+        for ( std::size_t i = 0; i < bx; ++i )
+            for ( std::size_t j = 0; j < by; ++j )
+            {
+                real const * ap = a + i * sx + j * sy + z;
+                for ( std::size_t k = 0; k < bz; ++k, ap += sz )
+                    r0 = vec::fmadd(vec::load(ap), vec::set1(*wp++), r0);
+            }
+
+        vec::store(r+z, r0);
+    }
+
+    for ( ; z < n; ++z )
+    {
+        real s = 0;
+
+        real const * wp = w;
+        for ( std::size_t i = 0; i < bx; ++i )
+            for ( std::size_t j = 0; j < by; ++j )
+            {
+                real const * ap = a + i * sx + j * sy + z;
+                for ( std::size_t k = 0; k < bz; ++k, ap += sz )
+                    s += *ap * *wp++;
+            }
+
+        r[z] += s;
+    }
+}
+
+// conv_line of a filter of size BX x BY x BZ, the loops over the taps
+// are unrolled and the broadcast taps stay in registers
+template<std::size_t BX, std::size_t BY, std::size_t BZ>
+inline void conv_line_fixed( real const * a,
+                             std::size_t sx, std::size_t sy, std::size_t sz,
+                             real const * w,
+                             std::size_t, std::size_t, std::size_t,
+                             real * r, std::size_t n ) noexcept
+{
+    constexpr std::size_t W = vec::width;
+    constexpr std::size_t K = BX * BY * BZ;
+
+    vec::type wv[K];
+    for ( std::size_t t = 0; t < K; ++t )
+        wv[t] = vec::set1(w[t]);
+
+    std::size_t z = 0;
+    for ( ; z + 4 * W <= n; z += 4 * W )
+    {
+        vec::type r0 = vec::load(r+z);
+        vec::type r1 = vec::load(r+z+W);
+        vec::type r2 = vec::load(r+z+2*W);
+        vec::type r3 = vec::load(r+z+3*W);
+
+        for ( std::size_t i = 0; i < BX; ++i )
+            for ( std::size_t j = 0; j < BY; ++j )
+                for ( std::size_t k = 0; k < BZ; ++k )
+                {
+                    real const * ap = a + i * sx + j * sy + k * sz + z;
+                    vec::type    t  = wv[( i * BY + j ) * BZ + k];
+                    r0 = vec::fmadd(vec::load(ap),     t, r0);
+                    r1 = vec::fmadd(vec::load(ap+W),   t, r1);
+                    r2 = vec::fmadd(vec::load(ap+2*W), t, r2);
+                    r3 = vec::fmadd(vec::load(ap+3*W), t, r3);
+                }
+
+        vec::store(r+z,     r0);
+        vec::store(r+z+W,   r1);
+        vec::store(r+z+2*W, r2);
+        vec::store(r+z+3*W, r3);
+    }
+
+    for ( ; z + W <= n; z += W )
+    {
+        vec::type r0 = vec::load(r+z);
+
+        for ( std::size_t i = 0; i < BX; ++i )
+            for ( std::size_t j = 0; j < BY; ++j )
+                for ( std::size_t k = 0; k < BZ; ++k )
+                    r0 = vec::fmadd(vec::load(a + i * sx + j * sy + k * sz + z),
+                                    wv[( i * BY + j ) * BZ + k], r0);
+
+        vec::store(r+z, r0);
+    }
+
+    if ( z < n )
+    {
+        conv_line(a + z, sx, sy, sz, w, BX, BY, BZ, r + z, n - z);
+    }
+}
+
+// the specialized conv_line of a filter shape, or nullptr
+inline conv_line_t conv_line_for( std::size_t bx,
+                                  std::size_t by,
+                                  std::size_t bz ) noexcept
+{
+#define ZNN_CONV_LINE_FIXED(X,Y,Z)                                      \
+    if ( bx == X && by == Y && bz == Z ) return &conv_line_fixed<X,Y,Z>;
+
+    ZNN_SIMD_CONV_SHAPES(ZNN_CONV_LINE_FIXED)
+
+#undef ZNN_CONV_LINE_FIXED
+    return nullptr;
+}
+
+// r[q] += sum b[(i*by + j)*bz + z] * a[i*sx + j*sy + z - q*shift] for the
+// m values of r, four of them at a time share the loads of b
+inline void correlate_rows( real const * a, std::size_t sx, std::size_t sy,
+                            real const * b,
+                            std::size_t bx, std::size_t by, std::size_t bz,
+                            std::ptrdiff_t shift,
+                            real * r, std::size_t m ) noexcept
+{
+    constexpr std::size_t W = vec::width;
+
+    std::size_t q = 0;
+    for ( ; q + 4 <= m; q += 4 )
+    {
+        vec::type s0 = vec::zero();
+        vec::type s1 = vec::zero();
+        vec::type s2 = vec::zero();
+        vec::type s3 = vec::zero();
+        real t0 = 0, t1 = 0, t2 = 0, t3 = 0;
+
+        real const * bp = b;
+        for ( std::size_t i = 0; i < bx; ++i )
+            for ( std::size_t j = 0; j < by; ++j, bp += bz )
+            {
+                real const * a0 = a + i * sx + j * sy
+                    - static_cast<std::ptrdiff_t>(q) * shift;
+                real const * a1 = a0 - shift;
+                real const * a2 = a1 - shift;
+                real const * a3 = a2 - shift;
+
+                std::size_t z = 0;
+                for ( ; z + W <= bz; z += W )
+                {
+                    vec::type bv = vec::load(bp+z);
+                    s0 = vec::fmadd(vec::load(a0+z), bv, s0);
+                    s1 = vec::fmadd(vec::load(a1+z), bv, s1);
+                    s2 = vec::fmadd(vec::load(a2+z), bv, s2);
+                    s3 = vec::fmadd(vec::load(a3+z), bv, s3);
+                }
+                for ( ; z < bz; ++z )
+                {
+                    t0 += a0[z] * bp[z];
+                    t1 += a1[z] * bp[z];
+                    t2 += a2[z] * bp[z];
+                    t3 += a3[z] * bp[z];
+                }
+            }
+
+        r[q]   += vec::hsum(s0) + t0;
+        r[q+1] += vec::hsum(s1) + t1;
+        r[q+2] += vec::hsum(s2) + t2;
+        r[q+3] += vec::hsum(s3) + t3;
+    }
+
+    for ( ; q < m; ++q )
+    {
+        vec::type s0 = vec::zero();
+        real t0 = 0;
+
+        real const * bp = b;
+        for ( std::size_t i = 0; i < bx; ++i )
+            for ( std::size_t j = 0; j < by; ++j, bp += bz )
+            {
+                real const * a0 = a + i * sx + j * sy
+                    - static_cast<std::ptrdiff_t>(q) * shift;
+
+                std::size_t z = 0;
+                for ( ; z + W <= bz; z += W )
+                    s0 = vec::fmadd(vec::load(a0+z), vec::load(bp+z), s0);
+                for ( ; z < bz; ++z )
+                    t0 += a0[z] * bp[z];
+            }
+
+        r[q] += vec::hsum(s0) + t0;
+    }
+}
+
+// c[i*ldc + j] += sum a[i*lda + l] * b[l*ldb + j] for an MR x NR*W tile
+// of c, which stays in registers while the k products are added
+template<std::size_t MR, std::size_t NR>
+inline void gemm_tile( std::size_t k,
+                       real const * a, std::size_t lda,
+                       real const * b, std::size_t ldb,
+                       real * c, std::size_t ldc ) noexcept
+{
+    constexpr std::size_t W = vec::width;
+
+    vec::type acc[MR][NR];
+    for ( std::size_t i = 0; i < MR; ++i )
+        for ( std::size_t j = 0; j < NR; ++j )
+            acc[i][j] = vec::load(c + i * ldc + j * W);
+
+    for ( std::size_t l = 0; l < k; ++l, b += ldb )
+    {
+        vec::type bv[NR];
+        for ( std::size_t j = 0; j < NR; ++j )
+            bv[j] = vec::load(b + j * W);
+
+        for ( std::size_t i = 0; i < MR; ++i )
+        {
+            vec::type av = vec::set1(a[i * lda + l]);
+            for ( std::size_t j = 0; j < NR; ++j )
+                acc[i][j] = vec::fmadd(av, bv[j], acc[i][j]);
+        }
+    }
+
+    for ( std::size_t i = 0; i < MR; ++i )
+        for ( std::size_t j = 0; j < NR; ++j )
+            vec::store(c + i * ldc + j * W, acc[i][j]);
+}
+
+// the tiles of NR registers of a column block of c, six rows at a time
+template<std::size_t NR>
+inline void gemm_columns( std::size_t m, std::size_t k,
+                          real const * a, std::size_t lda,
+                          real const * b, std::size_t ldb,
+                          real * c, std::size_t ldc ) noexcept
+{
+    std::size_t i = 0;
+    for ( ; i + 6 <= m; i += 6 )
+        gemm_tile<6,NR>(k, a + i * lda, lda, b, ldb, c + i * ldc, ldc);
+
+    a += i * lda;
+    c += i * ldc;
+
+    switch ( m - i )
+    {
+    case 5: gemm_tile<5,NR>(k, a, lda, b, ldb, c, ldc); break;
+    case 4: gemm_tile<4,NR>(k, a, lda, b, ldb, c, ldc); break;
+    case 3: gemm_tile<3,NR>(k, a, lda, b, ldb, c, ldc); break;
+    case 2: gemm_tile<2,NR>(k, a, lda, b, ldb, c, ldc); break;
+    case 1: gemm_tile<1,NR>(k, a, lda, b, ldb, c, ldc); break;
+    default: break;
+    }
+}
+
+// c += a * b, where c is m x n, a is m x k and b is k x n, all of them
+// row-major with the leading dimensions ldc, lda and ldb. Panels of at
+// most 256 rows and 2*W columns of b are copied to a contiguous buffer
+// and shared by all the rows of c.
+inline void gemm( std::size_t m, std::size_t n, std::size_t k,
+                  real const * a, std::size_t lda,
+                  real const * b, std::size_t ldb,
+                  real * c, std::size_t ldc ) noexcept
+{
+    constexpr std::size_t W  = vec::width;
+    constexpr std::size_t KC = 256;
+
+    real panel[KC * 2 * W];
+
+    for ( std::size_t l = 0; l < k; l += KC )
+    {
+        std::size_t  kc = std::min(KC, k - l);
+        real const * ap = a + l;
+        real const * bp = b + l * ldb;
+
+        std::size_t j = 0;
+        for ( ; j + 2 * W <= n; j += 2 * W )
+        {
+            for ( std::size_t q = 0; q < kc; ++q )
+            {
+                vec::store(panel + q * 2 * W,
+                           vec::load(bp + q * ldb + j));
+                vec::store(panel + q * 2 * W + W,
+                           vec::load(bp + q * ldb + j + W));
+            }
+            gemm_columns<2>(m, kc, ap, lda, panel, 2 * W, c + j, ldc);
+        }
+
+        for ( ; j + W <= n; j += W )
+        {
+            for ( std::size_t q = 0; q < kc; ++q )
+                vec::store(panel + q * W, vec::load(bp + q * ldb + j));
+            gemm_columns<1>(m, kc, ap, lda, panel, W, c + j, ldc);
+        }
+
+        for ( ; j < n; ++j )
+            for ( std::size_t i = 0; i < m; ++i )
+            {
+                real s = 0;
+                for ( std::size_t q = 0; q < kc; ++q )
+                    s += ap[i * lda + q] * bp[q * ldb + j];
+                c[i * ldc + j] += s;
+            }
+    }
+}
@@ -0,0 +1,161 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "../types.hpp"
+
+#include <zi/utility/singleton.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace znn { namespace v4 {
+
+// Chooses the size of the transforms of the featuremaps
+//
+// The featuremaps are zero padded to a 2/3/5/7-smooth size in each
+// dimension (at most twice the original). The candidates are ranked by
+// a model of the cost per element: log2(p) per radix p stage, the
+// larger radices weighted more and the other primes (Rader/Bluestein)
+// a lot more, plus a constant for the work proportional to the volume
+// (padding, cropping and the products in the frequency domain). When a
+// timer is given, the best few candidates and the original size are
+// timed and the fastest one wins. The choices are memoized.
+//
+class fft_size_chooser
+{
+public:
+    static constexpr double volume_cost = 3;
+
+private:
+    static constexpr size_t timed       = 4;
+
+    std::mutex            m_    ;
+    std::map<vec3i,vec3i> sizes_;
+
+public:
+    static bool is_smooth( long n )
+    {
+        for ( long p: { 2, 3, 5, 7 } )
+        {
+            while ( n % p == 0 ) n /= p;
+        }
+        return n == 1;
+    }
+
+    // per element cost of a transform of length n along one dimension
+    static double length_cost( long n )
+    {
+        double r = 0;
+        for ( long p = 2; n > 1; ++p )
+        {
+            while ( n % p == 0 )
+            {
+                double w = ( p == 2 ) ? 1 : ( p == 3 ) ? 1.15
+                    : ( p == 5 ) ? 1.3 : ( p == 7 ) ? 1.45 : 4;
+                r += w * std::log2(static_cast<double>(p));
+                n /= p;
+            }
+        }
+        return r;
+    }
+
+    // proportional to the time of the transform and the products
+    static double cost( vec3i const & s )
+    {
+        double vol = static_cast<double>(s[0]) * s[1] * s[2];
+        return vol * ( volume_cost + length_cost(s[0])
+                       + length_cost(s[1]) + length_cost(s[2]) );
+    }
+
+    static std::vector<long> candidates( long n )
+    {
+        std::vector<long> r{n};
+        for ( long m = n + 1; m < 2 * n; ++m )
+        {
+            if ( is_smooth(m) ) r.push_back(m);
+        }
+        return r;
+    }
+
+    // time(s) returns the seconds taken by the transforms of size s
+    vec3i optimal( vec3i const & s,
+                   std::function<double(vec3i const &)> const & time = nullptr )
+    {
+        guard g(m_);
+
+        if ( sizes_.count(s) ) return sizes_[s];
+
+        std::vector<std::pair<double,vec3i>> ranked;
+
+        for ( auto x: candidates(s[0]) )
+            for ( auto y: candidates(s[1]) )
+                for ( auto z: candidates(s[2]) )
+                {
+                    vec3i c(x,y,z);
+                    ranked.emplace_back(cost(c), c);
+                }
+
+        std::sort(ranked.begin(), ranked.end(),
+                  [](std::pair<double,vec3i> const & a,
+                     std::pair<double,vec3i> const & b)
+                  { return a.first < b.first; });
+
+        vec3i best = ranked.front().second;
+
+        if ( time && best != s )
+        {
+            // the measured time doesn't include the volume dependent
+            // work, scale it by the modeled share of the transform
+            auto total = [&](vec3i const & c)
+                {
+                    double l = length_cost(c[0]) + length_cost(c[1])
+                        + length_cost(c[2]);
+                    return time(c) * ( volume_cost + l ) / std::max(l, 1.0);
+                };
+
+            double best_time = total(s);
+            best = s;
+
+            for ( size_t i = 0; i < std::min(timed, ranked.size()); ++i )
+            {
+                if ( ranked[i].second == s ) continue;
+                double t = total(ranked[i].second);
+                if ( t < best_time )
+                {
+                    best_time = t;
+                    best      = ranked[i].second;
+                }
+            }
+        }
+
+        return sizes_[s] = best;
+    }
+
+}; // class fft_size_chooser
+
+namespace {
+fft_size_chooser& fft_sizes = zi::singleton<fft_size_chooser>::instance();
+} // anonymous namespace
+
+}} // namespace znn::v4
@@ -0,0 +1,171 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "fft_size.hpp"
+#include "../types.hpp"
+
+#include <zi/utility/singleton.hpp>
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace znn { namespace v4 {
+
+// Chooses the size of the tiles of the overlap-save FFT convolutions
+//
+// An input of size n convolved with a filter of size k is covered by
+// tiles of size t (the size of the transforms), each one producing
+// t-k+1 outputs. The tile sizes are 2/3/5/7-smooth, the one with the
+// lowest modeled cost of all the tiles (fft_size_chooser::cost) whose
+// working set (the tile, its transform and the transform of the filter)
+// fits in the cache budget is chosen. A single tile covering the whole
+// input is a candidate as well. The budget is the last level cache per
+// hardware thread, at least the L2 cache, or ZNN_FFT_TILE_BYTES.
+//
+class fft_tile_chooser
+{
+private:
+    std::mutex                                  m_     ;
+    std::map<std::pair<vec3i,vec3i>,vec3i>      tiles_ ;
+    std::size_t                                 budget_;
+
+    static std::size_t cache_budget()
+    {
+        if ( char const * e = std::getenv("ZNN_FFT_TILE_BYTES") )
+        {
+            return std::strtoull(e, nullptr, 10);
+        }
+
+        long l2 = 0;
+        long l3 = 0;
+#if defined(_SC_LEVEL2_CACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+        l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+        long cpus = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+        long r = std::max(l3 / cpus, l2);
+        return r > 0 ? r : ( 1 << 20 );
+    }
+
+public:
+    fft_tile_chooser()
+        : budget_(cache_budget())
+    {}
+
+    std::size_t budget() const
+    {
+        return budget_;
+    }
+
+    // bytes touched while convolving a tile of size t
+    static std::size_t working_set( vec3i const & t )
+    {
+        std::size_t r = t[0] * t[1] * t[2];
+        std::size_t c = t[0] * t[1] * ( t[2] / 2 + 1 );
+        return r * sizeof(real) + 2 * c * sizeof(complex);
+    }
+
+    // tile sizes along one dimension of size n, filter size k
+    static std::vector<long> candidates( long n, long k )
+    {
+        std::vector<long> r;
+        for ( long t = k; t < n; ++t )
+        {
+            if ( fft_size_chooser::is_smooth(t) ) r.push_back(t);
+        }
+
+        long whole = n;
+        while ( !fft_size_chooser::is_smooth(whole) ) ++whole;
+        r.push_back(whole);
+
+        return r;
+    }
+
+    // the tile size for an input of size n and a (sparse) filter of
+    // size k
+    vec3i optimal( vec3i const & n, vec3i const & k )
+    {
+        guard g(m_);
+
+        auto key = std::make_pair(n, k);
+        if ( tiles_.count(key) ) return tiles_[key];
+
+        vec3i o = n - k + vec3i::one;
+
+        std::vector<long>   c[3];
+        std::vector<double> tiles[3];
+        std::vector<double> lcost[3];
+
+        for ( int d = 0; d < 3; ++d )
+        {
+            c[d] = candidates(n[d], k[d]);
+            for ( auto t: c[d] )
+            {
+                long step = t - k[d] + 1;
+                tiles[d].push_back( ( o[d] + step - 1 ) / step );
+                lcost[d].push_back(fft_size_chooser::length_cost(t));
+            }
+        }
+
+        double best      = std::numeric_limits<double>::max();
+        vec3i  best_tile = vec3i::zero;
+
+        for ( std::size_t x = 0; x < c[0].size(); ++x )
+            for ( std::size_t y = 0; y < c[1].size(); ++y )
+                for ( std::size_t z = 0; z < c[2].size(); ++z )
+                {
+                    vec3i t(c[0][x], c[1][y], c[2][z]);
+                    if ( working_set(t) > budget_ ) continue;
+
+                    // fft_size_chooser::cost() of all the tiles
+                    double cost = tiles[0][x] * tiles[1][y] * tiles[2][z]
+                        * t[0] * t[1] * t[2]
+                        * ( fft_size_chooser::volume_cost
+                            + lcost[0][x] + lcost[1][y] + lcost[2][z] );
+
+                    if ( cost < best )
+                    {
+                        best      = cost;
+                        best_tile = t;
+                    }
+                }
+
+        // nothing fits, the smallest tiles
+        if ( best_tile == vec3i::zero )
+        {
+            best_tile = vec3i(c[0].front(), c[1].front(), c[2].front());
+        }
+
+        return tiles_[key] = best_tile;
+    }
+
+}; // class fft_tile_chooser
+
+namespace {
+fft_tile_chooser& fft_tiles = zi::singleton<fft_tile_chooser>::instance();
+} // anonymous namespace
+
+}} // namespace znn::v4
@@ -17,7 +17,9 @@
 //
 #pragma once
 
+#include "fft_size.hpp"
 #include "fftmkl_plans.hpp"
+#include "../utils/parallel_for.hpp"
 
 #include <zi/time.hpp>
 
@@ -78,35 +80,21 @@ public:
         fft_plan forward_plan ;
         fft_plan backward_plan;
 
-        int32_t get_optimal(int32_t s) const
+    public:
+        // size of the transform used for the featuremaps of size s
+        static vec3i optimal_size(const vec3i& s)
         {
+#ifdef ZNN_DONT_PAD_FFTS
             return s;
-            // SLOW so what, SUE ME!
-            if ( s < 10 ) return s;
-            if ( s > 1024 ) return s;
-
-            std::vector<int32_t> mins(
-                { 11,13,14,15,16,18,20,33,36,49,54,55,60,64,80,81,90,100,
-                  104,128,132,136,160,168,176,192,200,208,210,216,224,
-                  240,256,264,280,288,294,300,320,336,352,360,364,384,392,
-                  400,416,448,450,462,480,512,520,560,576,588,600,640,648,
-                  650,672,704,728,750,768,784,800,832,840,864,896,936,960,
-                  968,1000,1024});
-
-            return *std::lower_bound(mins.begin(), mins.end(),s);
+#else
+            return fft_sizes.optimal(s);
+#endif
         }
 
-    public:
         transformer(const vec3i& s)
             : sz(s)
-            , actual_sz(s)
+            , actual_sz(optimal_size(s))
         {
-            if ( (s[0] == 1) && (s[1] == s[2]) )
-            {
-                int32_t opt = get_optimal(s[1]);
-                actual_sz[1] = actual_sz[2] = opt;
-            }
-
             forward_plan  = fft_plans.get_forward(actual_sz);
             backward_plan = fft_plans.get_backward(actual_sz);
         }
@@ -121,8 +109,10 @@ public:
             return actual_sz;
         }
 
+        // the MKL transforms aren't split, see fftw.hpp
         void forward( cube<real>& in,
-                      cube<complex>& out )
+                      cube<complex>& out,
+                      spatial_split const & = spatial_split() )
         {
             ZI_ASSERT(size(out)==fft_complex_size(in));
             ZI_ASSERT(size(in)==actual_sz);
@@ -141,7 +131,8 @@ public:
         }
 
         void backward( cube<complex>& in,
-                       cube<real>& out )
+                       cube<real>& out,
+                       spatial_split const & = spatial_split() )
         {
             ZI_ASSERT(size(in)==fft_complex_size(out));
             ZI_ASSERT(size(out)==actual_sz);
@@ -159,20 +150,23 @@ public:
 #           endif
         }
 
-        cube_p<complex> forward( cube_p<real>&& in )
+        cube_p<complex> forward( cube_p<real>&& in,
+                                 spatial_split const & = spatial_split() )
         {
             cube_p<complex> ret = get_cube<complex>(fft_complex_size(*in));
             forward( *in, *ret );
             return ret;
         }
 
-        cube_p<complex> forward_pad( const ccube_p<real>& in )
+        cube_p<complex> forward_pad( const ccube_p<real>& in,
+                                     spatial_split const & = spatial_split() )
         {
             cube_p<real> pin = pad_zeros(*in, actual_sz);
             return forward(std::move(pin));
         }
 
-        cube_p<real> backward( cube_p<complex>&& in )
+        cube_p<real> backward( cube_p<complex>&& in,
+                               spatial_split const & = spatial_split() )
         {
             cube_p<real> ret = get_cube<real>(actual_sz);
             backward( *in, *ret );
@@ -180,6 +174,49 @@ public:
         }
     };
 
+    // Same interface as the batched FFTW transforms, the featuremaps
+    // are transformed one by one
+    class batch_transformer
+    {
+    private:
+        transformer t_ ;
+        size_t      n_ ;
+
+    public:
+        batch_transformer(const vec3i& s, size_t n)
+            : t_(s)
+            , n_(n)
+        {}
+
+        vec3i const & size() const
+        {
+            return t_.size();
+        }
+
+        vec3i const & actual_size() const
+        {
+            return t_.actual_size();
+        }
+
+        size_t count() const
+        {
+            return n_;
+        }
+
+        std::vector<cube_p<complex>>
+        forward_pad( std::vector<ccube_p<real>> const & in )
+        {
+            ZI_ASSERT(in.size()==n_);
+
+            std::vector<cube_p<complex>> ret(n_);
+            for ( size_t i = 0; i < n_; ++i )
+            {
+                ret[i] = t_.forward_pad(in[i]);
+            }
+            return ret;
+        }
+    };
+
 
 public:
     static void forward( cube<real>& in,
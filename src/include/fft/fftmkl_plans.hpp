@@ -56,6 +56,23 @@ private:
     std::unordered_map<vec3i, fft_plan, vec_hash<vec3i>> fwd_        ;
     std::unordered_map<vec3i, fft_plan, vec_hash<vec3i>> bwd_        ;
     real                                                 time_       ;
+    size_t                                               created_ = 0;
+
+    typedef std::unordered_map<vec3i, fft_plan, vec_hash<vec3i>> plan_map;
+
+    // the descriptors are never freed before exit, each thread keeps
+    // the ones it has seen and finds them again without locking
+    static plan_map& local_forward()
+    {
+        static thread_local plan_map m;
+        return m;
+    }
+
+    static plan_map& local_backward()
+    {
+        static thread_local plan_map m;
+        return m;
+    }
 
 public:
     ~fft_plans_impl()
@@ -77,7 +94,45 @@ public:
     {
     }
 
+    // seconds spent creating descriptors so far
+    real planning_time()
+    {
+        guard g(m_);
+        return time_;
+    }
+
+    size_t plans_created()
+    {
+        guard g(m_);
+        return created_;
+    }
+
     fft_plan get_forward( const vec3i& s )
+    {
+        plan_map & local = local_forward();
+        auto it = local.find(s);
+        if ( it != local.end() ) return it->second;
+        return local[s] = create_forward(s);
+    }
+
+    fft_plan get_backward( const vec3i& s )
+    {
+        plan_map & local = local_backward();
+        auto it = local.find(s);
+        if ( it != local.end() ) return it->second;
+        return local[s] = create_backward(s);
+    }
+
+    // creates the descriptors of the transforms of size s ahead of
+    // their use
+    void prebuild( const vec3i& s )
+    {
+        create_forward(s);
+        create_backward(s);
+    }
+
+private:
+    fft_plan create_forward( const vec3i& s )
     {
         guard g(m_);
 
@@ -119,6 +174,7 @@ public:
         status = DftiCommitDescriptor(*ret);
 
         time_ += wt.elapsed<real>();
+        ++created_;
 
 //        std::cout << "Total time spent creating fft plans: "
 //                  << time_ << std::endl;
@@ -126,7 +182,7 @@ public:
         return ret;
     }
 
-    fft_plan get_backward( const vec3i& s )
+    fft_plan create_backward( const vec3i& s )
     {
         guard g(m_);
 
@@ -168,6 +224,7 @@ public:
         status = DftiCommitDescriptor(*ret);
 
         time_ += wt.elapsed<real>();
+        ++created_;
 
 //        std::cout << "Total time spent creating fft plans: "
 //                  << time_ << std::endl;
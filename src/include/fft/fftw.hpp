@@ -21,10 +21,15 @@
 #  include "fftmkl.hpp"
 #else
 
+#include "fft_size.hpp"
 #include "fftw_plans.hpp"
+#include "../utils/parallel_for.hpp"
 
 #include <zi/time.hpp>
 
+#include <cmath>
+#include <vector>
+
 #ifdef ZNN_MEASURE_FFT_RUNTIME
 #  define ZNN_MEASURE_FFT_START() zi::wall_timer wt
 #  define ZNN_MEASURE_FFT_END() fftw_stats.add(wt.elapsed<double>())
@@ -36,9 +41,11 @@
 #ifdef ZNN_USE_FLOATS
 #  define FFT_EXECUTE_DFT_R2C fftwf_execute_dft_r2c
 #  define FFT_EXECUTE_DFT_C2R fftwf_execute_dft_c2r
+#  define FFT_EXECUTE_DFT     fftwf_execute_dft
 #else
 #  define FFT_EXECUTE_DFT_R2C fftw_execute_dft_r2c
 #  define FFT_EXECUTE_DFT_C2R fftw_execute_dft_c2r
+#  define FFT_EXECUTE_DFT     fftw_execute_dft
 #endif
 
 namespace znn { namespace v4 {
@@ -90,6 +97,10 @@ fft_stats_impl& fft_stats = zi::singleton<fft_stats_impl>::instance();
 class fftw
 {
 public:
+    // Given a spatial_split, the large transforms are split along x (y
+    // when x is trivial) among the idle workers: the transforms of the
+    // slabs (planes or lines) followed, in place, by the transforms of
+    // the columns along x
     class transformer
     {
     private:
@@ -98,33 +109,137 @@ public:
         fft_plan forward_plan ;
         fft_plan backward_plan;
 
-        int32_t get_optimal(int32_t s) const
+        // seconds taken by a forward and a backward transform of size s
+        static double time_transforms(const vec3i& s)
         {
+            auto in  = get_cube<real>(s);
+            auto out = get_cube<complex>(fft_complex_size(s));
+            fill(*in, 0);
+
+            fft_plan fp = fft_plans.get_forward(s);
+            fft_plan bp = fft_plans.get_backward(s);
+
+            double best = std::numeric_limits<double>::max();
+            for ( int i = 0; i < 3; ++i )
+            {
+                zi::wall_timer wt; wt.reset();
+                FFT_EXECUTE_DFT_R2C(fp,
+                                     reinterpret_cast<real*>(in->data()),
+                                     reinterpret_cast<fft_complex*>(out->data()));
+                FFT_EXECUTE_DFT_C2R(bp,
+                                     reinterpret_cast<fft_complex*>(out->data()),
+                                     reinterpret_cast<real*>(in->data()));
+                best = std::min(best, wt.elapsed<double>());
+            }
+            return best;
+        }
+
+    public:
+        // size of the transform used for the featuremaps of size s, the
+        // candidates are timed unless the plans are only estimated
+        static vec3i optimal_size(const vec3i& s)
+        {
+#ifdef ZNN_DONT_PAD_FFTS
             return s;
-            // SLOW so what, SUE ME!
-            if ( s < 10 ) return s;
-            if ( s > 384 ) return s;
+#else
+            if ( fft_planning_flags() & FFTW_ESTIMATE )
+            {
+                return fft_sizes.optimal(s);
+            }
+            return fft_sizes.optimal(s, &transformer::time_transforms);
+#endif
+        }
+
+        // the transforms of the slabs of sizes n, rvol real (cvol
+        // complex) elements apart, and of the cvol columns of length
+        // slabs; no slabs when not worth splitting
+        struct split_shape
+        {
+            std::vector<int> n        ;
+            std::size_t      slabs = 0;
+            int              rvol  = 0;
+            int              cvol  = 0;
+            double           work  = 0;
+        };
+
+        split_shape split_parts( spatial_split const & split ) const
+        {
+            split_shape r;
+
+            long_t d = actual_sz[0] > 1 ? 0 : 1;
+            if ( actual_sz[d] < 2 ) return r;
+
+            double vol = static_cast<double>(actual_sz[0])
+                * actual_sz[1] * actual_sz[2];
+            r.work = vol * std::log2(vol) / 2;
+
+            if ( split.chunks(actual_sz[d], r.work) < 2 ) return r;
+
+            vec3i cs = fft_complex_size(actual_sz);
 
-            std::vector<int32_t> mins({
-                    10,15,16,20,25,32,36,44,48,64,72,78,84,88,90,
-                        100,112,128,140,150,160,176,200,220,224,
-                        256,260,300,320,384});
+            r.slabs = actual_sz[d];
+            r.rvol  = 1;
+            r.cvol  = 1;
+            for ( long_t i = d + 1; i < 3; ++i )
+            {
+                r.n.push_back(static_cast<int>(actual_sz[i]));
+                r.rvol *= static_cast<int>(actual_sz[i]);
+                r.cvol *= static_cast<int>(cs[i]);
+            }
 
-            return *std::lower_bound(mins.begin(), mins.end(),s);
+            return r;
         }
 
+        static void forward_split( spatial_split const & split,
+                                   split_shape const & sp,
+                                   real* in, complex* out )
+        {
+            split(sp.slabs, sp.work / 2, [&]( std::size_t b, std::size_t e )
+                {
+                    fft_plan p = fft_plans.get_slabs(sp.n, e - b, true);
+                    FFT_EXECUTE_DFT_R2C(p, in + b * sp.rvol,
+                                        reinterpret_cast<fft_complex*>
+                                        (out + b * sp.cvol));
+                });
+
+            split(sp.cvol, sp.work / 2, [&]( std::size_t b, std::size_t e )
+                {
+                    fft_plan p = fft_plans.get_columns(sp.slabs, sp.cvol,
+                                                       e - b, true);
+                    fft_complex* c
+                        = reinterpret_cast<fft_complex*>(out + b);
+                    FFT_EXECUTE_DFT(p, c, c);
+                });
+        }
+
+        // the input is destroyed, as by the 3D plans
+        static void backward_split( spatial_split const & split,
+                                    split_shape const & sp,
+                                    complex* in, real* out )
+        {
+            split(sp.cvol, sp.work / 2, [&]( std::size_t b, std::size_t e )
+                {
+                    fft_plan p = fft_plans.get_columns(sp.slabs, sp.cvol,
+                                                       e - b, false);
+                    fft_complex* c
+                        = reinterpret_cast<fft_complex*>(in + b);
+                    FFT_EXECUTE_DFT(p, c, c);
+                });
+
+            split(sp.slabs, sp.work / 2, [&]( std::size_t b, std::size_t e )
+                {
+                    fft_plan p = fft_plans.get_slabs(sp.n, e - b, false);
+                    FFT_EXECUTE_DFT_C2R(p, reinterpret_cast<fft_complex*>
+                                        (in + b * sp.cvol),
+                                        out + b * sp.rvol);
+                });
+        }
 
     public:
         transformer(const vec3i& s)
             : sz(s)
-            , actual_sz(s)
+            , actual_sz(optimal_size(s))
         {
-            if ( (s[0] == 1) && (s[1] == s[2]) )
-            {
-                int32_t opt = get_optimal(s[1]);
-                actual_sz[1] = actual_sz[2] = opt;
-            }
-
             forward_plan  = fft_plans.get_forward(actual_sz);
             backward_plan = fft_plans.get_backward(actual_sz);
         }
@@ -140,48 +255,158 @@ public:
         }
 
         void forward( cube<real>& in,
-                      cube<complex>& out )
+                      cube<complex>& out,
+                      spatial_split const & split = spatial_split() )
         {
             ZI_ASSERT(v4::size(out)==fft_complex_size(in));
             ZI_ASSERT(v4::size(in)==actual_sz);
 
             ZNN_MEASURE_FFT_START();
-            FFT_EXECUTE_DFT_R2C(forward_plan,
-                                 reinterpret_cast<real*>(in.data()),
-                                 reinterpret_cast<fft_complex*>(out.data()));
+            split_shape sp = split_parts(split);
+            if ( sp.slabs )
+            {
+                forward_split(split, sp, in.data(), out.data());
+            }
+            else
+            {
+                FFT_EXECUTE_DFT_R2C(forward_plan,
+                                     reinterpret_cast<real*>(in.data()),
+                                     reinterpret_cast<fft_complex*>
+                                     (out.data()));
+            }
             ZNN_MEASURE_FFT_END();
         }
 
         void backward( cube<complex>& in,
-                       cube<real>& out )
+                       cube<real>& out,
+                       spatial_split const & split = spatial_split() )
         {
             ZI_ASSERT(v4::size(in)==fft_complex_size(out));
             ZI_ASSERT(v4::size(out)==actual_sz);
 
             ZNN_MEASURE_FFT_START();
-            FFT_EXECUTE_DFT_C2R(backward_plan,
-                                 reinterpret_cast<fft_complex*>(in.data()),
-                                 reinterpret_cast<real*>(out.data()));
+            split_shape sp = split_parts(split);
+            if ( sp.slabs )
+            {
+                backward_split(split, sp, in.data(), out.data());
+            }
+            else
+            {
+                FFT_EXECUTE_DFT_C2R(backward_plan,
+                                     reinterpret_cast<fft_complex*>
+                                     (in.data()),
+                                     reinterpret_cast<real*>(out.data()));
+            }
             ZNN_MEASURE_FFT_END();
         }
 
-        cube_p<complex> forward( cube_p<real>&& in )
+        cube_p<complex> forward( cube_p<real>&& in,
+                                 spatial_split const & split
+                                 = spatial_split() )
         {
             cube_p<complex> ret = get_cube<complex>(fft_complex_size(*in));
-            forward( *in, *ret );
+            forward( *in, *ret, split );
             return ret;
         }
 
-        cube_p<complex> forward_pad( const ccube_p<real>& in )
+        cube_p<complex> forward_pad( const ccube_p<real>& in,
+                                     spatial_split const & split
+                                     = spatial_split() )
         {
             cube_p<real> pin = pad_zeros(*in, actual_sz);
-            return forward(std::move(pin));
+            return forward(std::move(pin), split);
         }
 
-        cube_p<real> backward( cube_p<complex>&& in )
+        cube_p<real> backward( cube_p<complex>&& in,
+                               spatial_split const & split
+                               = spatial_split() )
         {
             cube_p<real> ret = get_cube<real>(actual_sz);
-            backward( *in, *ret );
+            backward( *in, *ret, split );
+            return ret;
+        }
+    };
+
+    // Forward transforms of the n featuremaps of a layer, all of size
+    // s, as a single batched plan. The featuremaps are padded into one
+    // qube and the transforms are returned as views of the output qube.
+    class batch_transformer
+    {
+    private:
+        vec3i    sz           ;
+        vec3i    actual_sz    ;
+        size_t   n_           ;
+        fft_plan forward_plan ;
+
+    public:
+        batch_transformer(const vec3i& s, size_t n)
+            : sz(s)
+            , actual_sz(transformer::optimal_size(s))
+            , n_(n)
+        {
+            forward_plan = fft_plans.get_forward_many(
+                vec4i(n,actual_sz[0],actual_sz[1],actual_sz[2]));
+        }
+
+        vec3i const & size() const
+        {
+            return sz;
+        }
+
+        vec3i const & actual_size() const
+        {
+            return actual_sz;
+        }
+
+        size_t count() const
+        {
+            return n_;
+        }
+
+        std::vector<cube_p<complex>>
+        forward_pad( std::vector<ccube_p<real>> const & in )
+        {
+            ZI_ASSERT(in.size()==n_);
+
+            vec3i  cs  = fft_complex_size(actual_sz);
+            size_t vol = actual_sz[0] * actual_sz[1] * actual_sz[2];
+
+            auto rq = get_qube<real>(
+                vec4i(n_,actual_sz[0],actual_sz[1],actual_sz[2]));
+            auto cq = get_qube<complex>(vec4i(n_,cs[0],cs[1],cs[2]));
+
+            if ( sz != actual_sz )
+            {
+                std::fill_n(rq->data(), rq->num_elements(), 0);
+            }
+
+            for ( size_t i = 0; i < n_; ++i )
+            {
+                ZI_ASSERT(v4::size(*in[i])==sz);
+
+                real const * src = in[i]->data();
+                real       * dst = rq->data() + i * vol;
+
+                for ( long_t x = 0; x < sz[0]; ++x )
+                    for ( long_t y = 0; y < sz[1]; ++y )
+                    {
+                        std::copy_n(src + ( x * sz[1] + y ) * sz[2], sz[2],
+                                    dst + ( x * actual_sz[1] + y )
+                                    * actual_sz[2]);
+                    }
+            }
+
+            ZNN_MEASURE_FFT_START();
+            FFT_EXECUTE_DFT_R2C(forward_plan,
+                                 reinterpret_cast<real*>(rq->data()),
+                                 reinterpret_cast<fft_complex*>(cq->data()));
+            ZNN_MEASURE_FFT_END();
+
+            std::vector<cube_p<complex>> ret(n_);
+            for ( size_t i = 0; i < n_; ++i )
+            {
+                ret[i] = get_cube_view(cq, i);
+            }
             return ret;
         }
     };
@@ -252,6 +477,7 @@ public:
 
 #undef FFT_EXECUTE_DFT_R2C
 #undef FFT_EXECUTE_DFT_C2R
+#undef FFT_EXECUTE_DFT
 
 
 #endif
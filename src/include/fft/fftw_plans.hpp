@@ -23,17 +23,24 @@
 #  include <fftw3.h>
 #endif
 
+#include "../assert.hpp"
 #include "../types.hpp"
 #include "../cube/cube.hpp"
 
 #include <zi/utility/singleton.hpp>
 #include <zi/time/time.hpp>
 
-#include <map>
+#include <atomic>
+#include <cstdlib>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include <unordered_map>
 #include <type_traits>
 #include <mutex>
+#include <vector>
+
+#include <unistd.h>
 
 #ifndef ZNN_FFTW_PLANNING_MODE
 #  define ZNN_FFTW_PLANNING_MODE (FFTW_ESTIMATE)
@@ -56,6 +63,10 @@ namespace znn { namespace v4 {
 #define FFT_EXECUTE_DFT_C2R fftwf_execute_dft_c2r
 #define FFT_EXECUTE_DFT     fftwf_execute_dft
 
+#define FFT_IMPORT_WISDOM fftwf_import_wisdom_from_filename
+#define FFT_EXPORT_WISDOM fftwf_export_wisdom_to_filename
+#define FFT_WISDOM_SUFFIX "float"
+
 typedef fftwf_plan    fft_plan   ;
 typedef fftwf_complex fft_complex;
 
@@ -74,11 +85,22 @@ typedef fftwf_complex fft_complex;
 #define FFT_EXECUTE_DFT_C2R fftw_execute_dft_c2r
 #define FFT_EXECUTE_DFT     fftw_execute_dft
 
+#define FFT_IMPORT_WISDOM fftw_import_wisdom_from_filename
+#define FFT_EXPORT_WISDOM fftw_export_wisdom_to_filename
+#define FFT_WISDOM_SUFFIX "double"
+
 typedef fftw_plan    fft_plan   ;
 typedef fftw_complex fft_complex;
 
 #endif
 
+// Planning rigor of the plans created from now on
+inline std::atomic<unsigned>& fft_planning_flags()
+{
+    static std::atomic<unsigned> flags(ZNN_FFTW_PLANNING_MODE);
+    return flags;
+}
+
 inline vec3i fft_complex_size(const vec3i& s)
 {
     auto r = s;
@@ -142,12 +164,12 @@ public:
             f1 = FFT_PLAN_MANY_R2C( 1, n, howmany,
                                     rp, NULL, istride, idist,
                                     cp, NULL, ostride, odist,
-                                    ZNN_FFTW_PLANNING_MODE );
+                                    fft_planning_flags() );
 
             b1 = FFT_PLAN_MANY_C2R( 1, n, howmany,
                                     cp, NULL, ostride, odist,
                                     rp, NULL, istride, idist,
-                                    ZNN_FFTW_PLANNING_MODE );
+                                    fft_planning_flags() );
 
         }
 
@@ -164,12 +186,12 @@ public:
             f2 = FFT_PLAN_MANY_DFT( 1, n, howmany,
                                     cp, NULL, stride, dist,
                                     cp, NULL, stride, dist,
-                                    FFTW_FORWARD, ZNN_FFTW_PLANNING_MODE );
+                                    FFTW_FORWARD, fft_planning_flags() );
 
             b2 = FFT_PLAN_MANY_DFT( 1, n, howmany,
                                     cp, NULL, stride, dist,
                                     cp, NULL, stride, dist,
-                                    FFTW_BACKWARD, ZNN_FFTW_PLANNING_MODE );
+                                    FFTW_BACKWARD, fft_planning_flags() );
 
         }
 
@@ -187,12 +209,12 @@ public:
             f3 = FFT_PLAN_MANY_DFT( 1, n, howmany,
                                     cp, NULL, stride, dist,
                                     cp, NULL, stride, dist,
-                                    FFTW_FORWARD, ZNN_FFTW_PLANNING_MODE );
+                                    FFTW_FORWARD, fft_planning_flags() );
 
             b3 = FFT_PLAN_MANY_DFT( 1, n, howmany,
                                     cp, NULL, stride, dist,
                                     cp, NULL, stride, dist,
-                                    FFTW_BACKWARD, ZNN_FFTW_PLANNING_MODE );
+                                    FFTW_BACKWARD, fft_planning_flags() );
 
         }
     }
@@ -312,12 +334,12 @@ public:
             f1 = FFT_PLAN_MANY_R2C( 1, n, howmany,
                                     rp, NULL, istride, idist,
                                     cp, NULL, ostride, odist,
-                                    ZNN_FFTW_PLANNING_MODE );
+                                    fft_planning_flags() );
 
             b1 = FFT_PLAN_MANY_C2R( 1, n, howmany,
                                     cp, NULL, ostride, odist,
                                     rp, NULL, istride, idist,
-                                    ZNN_FFTW_PLANNING_MODE );
+                                    fft_planning_flags() );
 
         }
 
@@ -334,12 +356,12 @@ public:
             f2 = FFT_PLAN_MANY_DFT( 1, n, howmany,
                                     cp, NULL, stride, dist,
                                     cp, NULL, stride, dist,
-                                    FFTW_FORWARD, ZNN_FFTW_PLANNING_MODE );
+                                    FFTW_FORWARD, fft_planning_flags() );
 
             b2 = FFT_PLAN_MANY_DFT( 1, n, howmany,
                                     cp, NULL, stride, dist,
                                     cp, NULL, stride, dist,
-                                    FFTW_BACKWARD, ZNN_FFTW_PLANNING_MODE );
+                                    FFTW_BACKWARD, fft_planning_flags() );
 
         }
 
@@ -357,12 +379,12 @@ public:
             f3 = FFT_PLAN_MANY_DFT( 1, n, howmany,
                                     cp, NULL, stride, dist,
                                     cp, NULL, stride, dist,
-                                    FFTW_FORWARD, ZNN_FFTW_PLANNING_MODE );
+                                    FFTW_FORWARD, fft_planning_flags() );
 
             b3 = FFT_PLAN_MANY_DFT( 1, n, howmany,
                                     cp, NULL, stride, dist,
                                     cp, NULL, stride, dist,
-                                    FFTW_BACKWARD, ZNN_FFTW_PLANNING_MODE );
+                                    FFTW_BACKWARD, fft_planning_flags() );
 
         }
     }
@@ -435,32 +457,136 @@ public:
 
 };
 
+// Plans of the full 3D transforms, shared by all the transformers
+//
+// The planning rigor is ESTIMATE unless changed by set_planning_mode()
+// or the ZNN_FFTW_PLANNING environment variable (estimate, measure,
+// patient or exhaustive). With ZNN_FFTW_WISDOM_DIR set, the wisdom of
+// this host is imported at startup and the new plans are exported back
+// at exit, so the measured plans only cost planning time once.
+//
 class fft_plans_impl
 {
 private:
     std::mutex                                           m_          ;
     std::unordered_map<vec3i, fft_plan, vec_hash<vec3i>> fwd_        ;
     std::unordered_map<vec3i, fft_plan, vec_hash<vec3i>> bwd_        ;
+    std::unordered_map<vec4i, fft_plan, vec_hash<vec4i>> fwd_many_   ;
+    std::unordered_map<vec4i, fft_plan, vec_hash<vec4i>> parts_      ;
     real                                                 time_       ;
+    size_t                                               created_ = 0;
+    std::string                                          wisdom_dir_ ;
 
 
 
     static_assert(std::is_pointer<fft_plan>::value,
                   "fftw_plan must be a pointer");
 
+    typedef std::unordered_map<vec3i, fft_plan, vec_hash<vec3i>> plan_map;
+    typedef std::unordered_map<vec4i, fft_plan, vec_hash<vec4i>> part_map;
+
+    // the plans are never destroyed before exit, each thread keeps the
+    // ones it has seen and finds them again without locking
+    static plan_map& local_forward()
+    {
+        static thread_local plan_map m;
+        return m;
+    }
+
+    static plan_map& local_backward()
+    {
+        static thread_local plan_map m;
+        return m;
+    }
+
+    static part_map& local_parts()
+    {
+        static thread_local part_map m;
+        return m;
+    }
+
 public:
     ~fft_plans_impl()
     {
+        if ( wisdom_dir_.size() && created_ )
+        {
+            export_wisdom(wisdom_file(wisdom_dir_));
+        }
+
         for ( auto& p: fwd_ ) FFT_DESTROY_PLAN(p.second);
         for ( auto& p: bwd_ ) FFT_DESTROY_PLAN(p.second);
+        for ( auto& p: fwd_many_ ) FFT_DESTROY_PLAN(p.second);
+        for ( auto& p: parts_ ) FFT_DESTROY_PLAN(p.second);
         FFT_CLEANUP();
     }
 
     fft_plans_impl(): m_(), fwd_(), bwd_(), time_(0)
     {
+        if ( char const * mode = std::getenv("ZNN_FFTW_PLANNING") )
+        {
+            set_planning_mode(mode);
+        }
+
+        if ( char const * dir = std::getenv("ZNN_FFTW_WISDOM_DIR") )
+        {
+            wisdom_dir_ = dir;
+            import_wisdom(wisdom_file(wisdom_dir_));
+        }
+    }
+
+    // wisdom is only valid for the machine (and precision) it was
+    // created on
+    static std::string wisdom_file( std::string const & dir )
+    {
+        char host[256] = "unknown";
+        gethostname(host, sizeof(host) - 1);
+        host[sizeof(host) - 1] = 0;
+
+        return dir + "/znn_fftw_wisdom." + host + "." FFT_WISDOM_SUFFIX;
     }
 
-    fft_plan get_forward( const vec3i& s )
+    bool import_wisdom( std::string const & fname )
+    {
+        guard g(m_);
+        return FFT_IMPORT_WISDOM(fname.c_str()) != 0;
+    }
+
+    bool export_wisdom( std::string const & fname )
+    {
+        guard g(m_);
+        return FFT_EXPORT_WISDOM(fname.c_str()) != 0;
+    }
+
+    // affects only the plans created afterwards
+    void set_planning_mode( std::string const & mode )
+    {
+        if ( mode == "estimate" )
+            fft_planning_flags() = FFTW_ESTIMATE;
+        else if ( mode == "measure" )
+            fft_planning_flags() = FFTW_MEASURE;
+        else if ( mode == "patient" )
+            fft_planning_flags() = FFTW_PATIENT;
+        else if ( mode == "exhaustive" )
+            fft_planning_flags() = FFTW_EXHAUSTIVE;
+        else
+            throw std::logic_error(HERE() + "unknown planning mode: " + mode);
+    }
+
+    // seconds spent creating plans so far
+    real planning_time()
+    {
+        guard g(m_);
+        return time_;
+    }
+
+    size_t plans_created()
+    {
+        guard g(m_);
+        return created_;
+    }
+
+private:
+    fft_plan create_forward( const vec3i& s )
     {
         guard g(m_);
 
@@ -477,14 +603,15 @@ public:
             ( s[0], s[1], s[2],
               reinterpret_cast<real*>(in->data()),
               reinterpret_cast<fft_complex*>(out->data()),
-              ZNN_FFTW_PLANNING_MODE );
+              fft_planning_flags() );
 
         time_ += wt.elapsed<real>();
+        ++created_;
 
         return ret;
     }
 
-    fft_plan get_backward( const vec3i& s )
+    fft_plan create_backward( const vec3i& s )
     {
         guard g(m_);
 
@@ -501,16 +628,181 @@ public:
             ( s[0], s[1], s[2],
               reinterpret_cast<fft_complex*>(in->data()),
               reinterpret_cast<real*>(out->data()),
-              ZNN_FFTW_PLANNING_MODE );
+              fft_planning_flags() );
 
         time_ += wt.elapsed<real>();
+        ++created_;
+
+        return ret;
+    }
+
+public:
+    fft_plan get_forward( const vec3i& s )
+    {
+        plan_map & local = local_forward();
+        auto it = local.find(s);
+        if ( it != local.end() ) return it->second;
+        return local[s] = create_forward(s);
+    }
 
-//        std::cout << "Total time spent creating fftw plans: "
-//                  << time_ << std::endl;
+    fft_plan get_backward( const vec3i& s )
+    {
+        plan_map & local = local_backward();
+        auto it = local.find(s);
+        if ( it != local.end() ) return it->second;
+        return local[s] = create_backward(s);
+    }
+
+    // creates the plans of the transforms of size s ahead of their use
+    void prebuild( const vec3i& s )
+    {
+        create_forward(s);
+        create_backward(s);
+    }
+
+    // Batched forward transforms of s[0] volumes of size
+    // (s[1],s[2],s[3]), stored one after the other (see
+    // fftw::batch_transformer)
+    fft_plan get_forward_many( const vec4i& s )
+    {
+        guard g(m_);
+
+        fft_plan& ret = fwd_many_[s];
+
+        if ( ret ) return ret;
+
+        zi::wall_timer wt; wt.reset();
+
+        vec3i rs(s[1],s[2],s[3]);
+        vec3i cs = fft_complex_size(rs);
+
+        auto in  = get_qube<real>(s);
+        auto out = get_qube<complex>(vec4i(s[0],cs[0],cs[1],cs[2]));
+
+        int n[] = { static_cast<int>(rs[0]),
+                    static_cast<int>(rs[1]),
+                    static_cast<int>(rs[2]) };
+
+        ret = FFT_PLAN_MANY_R2C
+            ( 3, n, static_cast<int>(s[0]),
+              reinterpret_cast<real*>(in->data()), NULL, 1,
+              static_cast<int>(rs[0]*rs[1]*rs[2]),
+              reinterpret_cast<fft_complex*>(out->data()), NULL, 1,
+              static_cast<int>(cs[0]*cs[1]*cs[2]),
+              fft_planning_flags() );
+
+        time_ += wt.elapsed<real>();
+        ++created_;
 
         return ret;
     }
 
+private:
+    // the parts are keyed by their sizes, the number of transforms and
+    // their kind: 0/1 forward/backward slabs, 2/3 forward/backward
+    // columns
+    fft_plan create_slabs( vec4i const & key, std::vector<int> const & n,
+                           int howmany, bool forward )
+    {
+        guard g(m_);
+
+        fft_plan& ret = parts_[key];
+
+        if ( ret ) return ret;
+
+        zi::wall_timer wt; wt.reset();
+
+        int rvol = 1;
+        for ( auto x: n ) rvol *= x;
+        int cvol = rvol / n.back() * ( n.back() / 2 + 1 );
+
+        std::vector<real>    r(static_cast<size_t>(rvol) * howmany);
+        std::vector<complex> c(static_cast<size_t>(cvol) * howmany);
+
+        int rank = static_cast<int>(n.size());
+
+        if ( forward )
+        {
+            ret = FFT_PLAN_MANY_R2C
+                ( rank, n.data(), howmany,
+                  r.data(), NULL, 1, rvol,
+                  reinterpret_cast<fft_complex*>(c.data()), NULL, 1, cvol,
+                  fft_planning_flags() | FFTW_UNALIGNED );
+        }
+        else
+        {
+            ret = FFT_PLAN_MANY_C2R
+                ( rank, n.data(), howmany,
+                  reinterpret_cast<fft_complex*>(c.data()), NULL, 1, cvol,
+                  r.data(), NULL, 1, rvol,
+                  fft_planning_flags() | FFTW_UNALIGNED );
+        }
+
+        time_ += wt.elapsed<real>();
+        ++created_;
+
+        return ret;
+    }
+
+    fft_plan create_columns( vec4i const & key, int n, int stride,
+                             int howmany, bool forward )
+    {
+        guard g(m_);
+
+        fft_plan& ret = parts_[key];
+
+        if ( ret ) return ret;
+
+        zi::wall_timer wt; wt.reset();
+
+        std::vector<complex> c(static_cast<size_t>(n - 1) * stride
+                               + howmany);
+        fft_complex* cp = reinterpret_cast<fft_complex*>(c.data());
+
+        ret = FFT_PLAN_MANY_DFT
+            ( 1, &n, howmany,
+              cp, NULL, stride, 1,
+              cp, NULL, stride, 1,
+              forward ? FFTW_FORWARD : FFTW_BACKWARD,
+              fft_planning_flags() | FFTW_UNALIGNED );
+
+        time_ += wt.elapsed<real>();
+        ++created_;
+
+        return ret;
+    }
+
+public:
+    // Plans of the parts of a transform split among the threads (see
+    // fftw::transformer), executed on any part of the arrays. Every
+    // chunk of a split asks for its plan, the threads find the ones
+    // they have seen without locking:
+    //
+    // howmany real to complex (or complex to real) transforms of the
+    // sizes n (rank 1 or 2), stored one after the other
+    fft_plan get_slabs( std::vector<int> const & n, int howmany,
+                        bool forward )
+    {
+        vec4i key(n[0], n.size() > 1 ? n[1] : 0, howmany, forward ? 0 : 1);
+
+        part_map & local = local_parts();
+        auto it = local.find(key);
+        if ( it != local.end() ) return it->second;
+        return local[key] = create_slabs(key, n, howmany, forward);
+    }
+
+    // howmany in place complex transforms of length n, the elements
+    // stride apart, the transforms next to each other
+    fft_plan get_columns( int n, int stride, int howmany, bool forward )
+    {
+        vec4i key(n, stride, howmany, forward ? 2 : 3);
+
+        part_map & local = local_parts();
+        auto it = local.find(key);
+        if ( it != local.end() ) return it->second;
+        return local[key] = create_columns(key, n, stride, howmany, forward);
+    }
+
 }; // class fft_plans_impl
 
 namespace {
@@ -533,3 +825,7 @@ fft_plans_impl& fft_plans =
 #undef FFT_EXECUTE_DFT_R2C
 #undef FFT_EXECUTE_DFT_C2R
 #undef FFT_EXECUTE_DFT
+
+#undef FFT_IMPORT_WISDOM
+#undef FFT_EXPORT_WISDOM
+#undef FFT_WISDOM_SUFFIX
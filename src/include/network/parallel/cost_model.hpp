@@ -0,0 +1,384 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "../../types.hpp"
+#include "../../cube/cube.hpp"
+#include "../../cube/cube_operators.hpp"
+#include "../../convolution/convolution.hpp"
+#include "../../convolution/convolve_gemm.hpp"
+#include "../../convolution/convolve_winograd.hpp"
+#include "../../fft/fftw.hpp"
+#include "../../fft/fft_tiling.hpp"
+
+#include <zi/time.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace znn { namespace v4 { namespace parallel_network {
+
+// The geometry of the conv edges of a layer
+struct conv_layer
+{
+    size_t n      = 0;
+    size_t m      = 0;
+    vec3i  in     = vec3i::zero; // size of the inputs
+    vec3i  width  = vec3i::one ; // size of the filters
+    vec3i  stride = vec3i::one ; // sparseness of the filters
+    bool   input  = false;       // the inputs are the input of the net
+    bool   exact  = true ;       // false if the model doesn't cover it
+                                 // (repeat)
+};
+
+// Predicted time of an iteration of the conv edges of a layer with each
+// convolution, from microbenchmarks
+//
+// The direct convolutions and the layer engines (gemm_convolution,
+// winograd_convolution) are timed on the featuremaps of the layer
+// cropped to at most 2^16 voxels (a featuremap pair, a block) and scaled
+// by the number of outputs; the FFTs are timed at the actual transform
+// size of the layer (as src/cpp/measurements/fft_size_vs_speed.cpp
+// does), the tiled ones at the size of the tiles, their products are
+// charged the memory traffic at the measured copy bandwidth. The work is divided by the number of threads that can
+// share it, the overlap of the layers is ignored.
+//
+class conv_cost_model
+{
+private:
+    size_t threads_       ;
+    size_t rounds_        ;
+    double bandwidth_ = 0 ; // bytes per second
+
+    std::map<std::vector<long_t>, double> transforms_; // forward+backward
+
+    // voxels of the cropped featuremaps
+    static constexpr long_t crop_limit = 1 << 16;
+
+    static double volume( vec3i const & v )
+    {
+        return static_cast<double>(v[0]) * v[1] * v[2];
+    }
+
+    // the best of rounds_ runs of f, after a warmup
+    template<typename F>
+    double best_time( F const & f ) const
+    {
+        f();
+
+        double best = std::numeric_limits<double>::max();
+        for ( size_t i = 0; i < rounds_; ++i )
+        {
+            zi::wall_timer wt;
+            wt.reset();
+            f();
+            best = std::min(best, wt.elapsed<double>());
+        }
+        return best;
+    }
+
+    // the inputs with fewer outputs along x (then y), at most
+    // crop_limit voxels
+    static vec3i cropped( conv_layer const & l )
+    {
+        vec3i c = l.in;
+        vec3i o = ( l.width - vec3i::one ) * l.stride;
+
+        for ( std::size_t d = 0; d < 2; ++d )
+        {
+            while ( volume(c) > crop_limit && c[d] - o[d] > 1 )
+            {
+                c[d] = ( c[d] - o[d] + 1 ) / 2 + o[d];
+            }
+        }
+
+        return c;
+    }
+
+    static std::vector<cube_p<real>> featuremaps( size_t n, vec3i const & s )
+    {
+        std::vector<cube_p<real>> r(n);
+        for ( auto & f: r )
+        {
+            f = get_cube<real>(s);
+            fill(*f, 0.5);
+        }
+        return r;
+    }
+
+    double bandwidth()
+    {
+        if ( bandwidth_ == 0 )
+        {
+            std::vector<real> a(1 << 22, 1), b(a.size());
+            double t = best_time([&]() { std::copy(a.begin(), a.end(),
+                                                   b.begin()); });
+            bandwidth_ = 2 * a.size() * sizeof(real) / t;
+        }
+        return bandwidth_;
+    }
+
+    // a forward and a backward transform of the actual size of s
+    double transform( vec3i const & s )
+    {
+        vec3i a = fftw::transformer::optimal_size(s);
+
+        std::vector<long_t> key{ a[0], a[1], a[2] };
+        if ( transforms_.count(key) ) return transforms_[key];
+
+        fftw::transformer fft(a);
+
+        return transforms_[key] = best_time([&]()
+            {
+                auto v = get_cube<real>(a);
+                fill(*v, 0.5);
+                auto t = fft.forward(std::move(v));
+                fft.backward(std::move(t));
+            });
+    }
+
+    // time of the units of work (of a block) in flight at once
+    double parallel( double t, size_t units ) const
+    {
+        return t * units / std::min(threads_, std::max<size_t>(units, 1));
+    }
+
+public:
+    explicit conv_cost_model( size_t threads, size_t rounds = 2 )
+        : threads_(std::max<size_t>(threads, 1))
+        , rounds_(rounds)
+    {}
+
+    double direct( conv_layer const & l, bool train )
+    {
+        vec3i c  = cropped(l);
+        vec3i oc = c    - ( l.width - vec3i::one ) * l.stride;
+        vec3i of = l.in - ( l.width - vec3i::one ) * l.stride;
+
+        auto a = featuremaps(1, c)[0];
+        auto w = featuremaps(1, l.width)[0];
+        auto g = featuremaps(1, oc)[0];
+
+        direct_kernel k(l.width, c, l.stride);
+
+        double t = best_time([&]() { convolve_sparse(*a, *w, l.stride, k); });
+
+        if ( train )
+        {
+            if ( !l.input )
+            {
+                t += best_time([&]()
+                    {
+                        convolve_sparse_inverse(*g, *w, l.stride, k);
+                    });
+            }
+            t += best_time([&]()
+                {
+                    convolve_sparse_flipped(*a, *g, l.stride);
+                });
+        }
+
+        // and the sums of the outputs (input gradients)
+        double sums = volume(of) * sizeof(real) * 3 / bandwidth();
+        if ( train ) sums *= 2;
+
+        return parallel(t * volume(of) / volume(oc) + sums, l.n * l.m);
+    }
+
+    double fft( conv_layer const & l, bool train )
+    {
+        if ( l.width == vec3i::one ) return direct(l, train);
+
+        vec3i  a = fftw::transformer::optimal_size(l.in);
+        double f = transform(l.in) / 2;
+        double e = l.n * l.m;
+
+        // a product accumulated: two complex inputs, the sum read and
+        // written
+        double p = volume(fft_complex_size(a)) * sizeof(complex) * 4
+            / bandwidth();
+
+        // the inputs, the products, the outputs
+        double t = l.n * f + e * p + l.m * f;
+
+#ifdef ZNN_DONT_CACHE_FFTS
+        t += e * f;
+#endif
+
+        if ( train )
+        {
+            // the gradients, the products and the input gradients;
+            // the updates are a product, the inverse and the transform
+            // of the filter per edge
+            t += l.m * f + e * ( p + 2 * f );
+            if ( !l.input ) t += e * p + l.n * f;
+        }
+
+        return parallel(t / e, l.n * l.m);
+    }
+
+    // fft_tiled_filter_edge with the tiles chosen by fft_tiles, every
+    // edge transforms its own tiles
+    double fft_tiled( conv_layer const & l, bool train )
+    {
+        if ( l.width == vec3i::one ) return direct(l, train);
+
+        vec3i k    = ( l.width - vec3i::one ) * l.stride + vec3i::one;
+        vec3i tile = fft_tiles.optimal(l.in, k);
+        vec3i step = tile - k + vec3i::one;
+        vec3i o    = l.in - k + vec3i::one;
+
+        vec3i  a = fftw::transformer::optimal_size(tile);
+        double f = transform(tile);
+        double n = volume(( o + step - vec3i::one ) / step);
+
+        // a product and the copies of the tile
+        double p = ( volume(fft_complex_size(a)) * sizeof(complex) * 3
+                     + volume(a) * sizeof(real) * 2 ) / bandwidth();
+
+        double t = n * ( f + p );
+
+        if ( train )
+        {
+            // the update transforms the tiles of the input and of the
+            // gradient, and the filter
+            t += n * ( f * 3 / 2 + p ) + f / 2;
+            if ( !l.input ) t += n * ( f + p );
+        }
+
+        return parallel(t, l.n * l.m);
+    }
+
+    // gemm_convolution or winograd_convolution, with the extra arguments
+    // of its constructor
+    template<class Conv, typename... Args>
+    double layer( conv_layer const & l, bool train, Args const &... args )
+    {
+        vec3i c  = cropped(l);
+        vec3i oc = c - ( l.width - vec3i::one ) * l.stride;
+        vec3i o  = ( l.width - vec3i::one ) * l.stride;
+        size_t k = l.width[0] * l.width[1] * l.width[2];
+
+        std::vector<real> w(l.n * l.m * k, 0.01);
+
+        Conv full(l.n, l.m, l.in, l.width, l.stride, threads_, args...);
+        Conv part(l.n, l.m, c,    l.width, l.stride, 1,        args...);
+        part.set_taps(w.data());
+
+        auto ins  = featuremaps(l.n, c );
+        auto outs = featuremaps(l.m, oc);
+
+        std::vector<real const *> in;
+        std::vector<real *>       out;
+        for ( auto & f: ins  ) in.push_back(f->data());
+        for ( auto & f: outs ) out.push_back(f->data());
+
+        // the time of a unit of work (an output or a tile)
+        auto unit = [&]( Conv const & e, double t )
+            {
+                return t / e.block_size(0);
+            };
+
+        auto units = [&]( Conv const & e )
+            {
+                double r = 0;
+                for ( size_t b = 0; b < e.blocks(); ++b )
+                {
+                    r += e.block_size(b);
+                }
+                return r;
+            };
+
+        double fwd = unit(part, best_time([&]()
+            {
+                part.forward(0, in.data(), out.data());
+            }));
+
+        double t = parallel(fwd * units(full) / full.blocks(), full.blocks());
+
+        if ( train )
+        {
+            std::vector<real const *> g(out.begin(), out.end());
+            std::vector<real>         dw(w.size());
+
+            double upd = unit(part, best_time([&]()
+                {
+                    part.weight_gradient(0, in.data(), g.data(), dw.data());
+                }));
+
+            // the blocks of the update are split among the threads, the
+            // reduction of the partial gradients is negligible
+            t += parallel(upd * units(full) / full.blocks(), full.blocks());
+
+            if ( !l.input )
+            {
+                Conv bfull(l.m, l.n, l.in + o, l.width, l.stride,
+                           threads_, args...);
+                Conv bpart(l.m, l.n, c + o, l.width, l.stride, 1, args...);
+                bpart.set_taps(w.data());
+
+                // the padded gradients and the input gradients
+                auto pgs = featuremaps(l.m, c + o);
+                auto igs = featuremaps(l.n, c);
+
+                std::vector<real const *> pg;
+                std::vector<real *>       ig;
+                for ( auto & f: pgs ) pg.push_back(f->data());
+                for ( auto & f: igs ) ig.push_back(f->data());
+
+                double bwd = unit(bpart, best_time([&]()
+                    {
+                        bpart.forward(0, pg.data(), ig.data());
+                    }));
+
+                t += parallel(bwd * units(bfull) / bfull.blocks(),
+                              bfull.blocks());
+            }
+        }
+
+        return t;
+    }
+
+    // the choices of network::set_conv, a negative time when the model
+    // doesn't cover the layer
+    double predict( conv_layer const & l,
+                    std::string const & choice,
+                    bool train )
+    {
+        if ( !l.exact ) return -1;
+
+        if ( choice == "direct" ) return direct(l, train);
+        if ( choice == "fft"    ) return fft(l, train);
+        if ( choice == "fft_tiled" ) return fft_tiled(l, train);
+        if ( choice == "gemm"   ) return layer<gemm_convolution>(l, train);
+
+        if ( choice == "winograd2" )
+            return layer<winograd_convolution>(l, train, long_t(2));
+
+        if ( choice == "winograd4" )
+            return layer<winograd_convolution>(l, train, long_t(4));
+
+        return -1;
+    }
+
+}; // class conv_cost_model
+
+}}} // namespace znn::v4::parallel_network
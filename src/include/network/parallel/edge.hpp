@@ -21,6 +21,7 @@
 #include "../../types.hpp"
 #include "../../cube/cube.hpp"
 #include "../../utils/task_manager.hpp"
+#include "../../utils/tracer.hpp"
 #include "nodes.hpp"
 
 namespace znn { namespace v4 { namespace parallel_network {
@@ -40,6 +41,16 @@ protected:
     size_t fwd_priority_;
     size_t bwd_priority_;
 
+    // forward runs where the output is accumulated, backward where the
+    // gradient is
+    size_t fwd_numa_node_;
+    size_t bwd_numa_node_;
+
+    // names of the edge and its featuremaps, for the tracer
+    std::uint32_t trace_name_    ;
+    std::uint32_t in_trace_name_ ;
+    std::uint32_t out_trace_name_;
+
     // minibatch averaging
     real   patch_sz_ = 1;
 
@@ -52,17 +63,51 @@ public:
     {
         fwd_priority_ = out->fwd_priority() * 1024 + outn;
         bwd_priority_ = in->bwd_priority() * 1024 + inn;
+
+        fwd_numa_node_ = out->numa_node(outn);
+        bwd_numa_node_ = in->numa_node(inn);
+
+        trace_name_     = tracer.intern(name());
+        in_trace_name_  = tracer.intern(in->name() + ":" + std::to_string(inn));
+        out_trace_name_ = tracer.intern(out->name() + ":" + std::to_string(outn));
     }
 
     size_t fwd_priority() const { return fwd_priority_; }
     size_t bwd_priority() const { return bwd_priority_; }
 
+    // override the priorities derived from the nodes
+    void set_priorities( size_t fwd, size_t bwd )
+    {
+        fwd_priority_ = fwd * 1024 + out_num;
+        bwd_priority_ = bwd * 1024 + in_num;
+    }
+
+    size_t fwd_numa_node() const { return fwd_numa_node_; }
+    size_t bwd_numa_node() const { return bwd_numa_node_; }
+
+    std::uint32_t trace_name()     const { return trace_name_;     }
+    std::uint32_t in_trace_name()  const { return in_trace_name_;  }
+    std::uint32_t out_trace_name() const { return out_trace_name_; }
+
     void set_patch_size( real s )
     {
         ZI_ASSERT(s > 0);
         patch_sz_ = s;
     }
 
+    nodes * in()        const { return in_nodes;  }
+    size_t  in_index()  const { return in_num;    }
+    nodes * out()       const { return out_nodes; }
+    size_t  out_index() const { return out_num;   }
+    bool    enabled()   const { return enabled_;  }
+
+    // receives the fft of the input featuremap
+    virtual bool is_fft() const { return false; }
+
+    // gets the input featuremap from the forward dispatch, false for the
+    // edges computed by another edge of their layer
+    virtual bool receives_forward() const { return true; }
+
     std::string name() const
     {
         return in_nodes->name() + ":" + std::to_string(in_num) + "_" +
@@ -21,6 +21,8 @@
 #include "softmax_edges.hpp"
 #include "filter_edge.hpp"
 #include "fft_filter_edge.hpp"
+#include "fft_tiled_filter_edge.hpp"
+#include "layer_filter_edge.hpp"
 #include "filter_ds_edge.hpp"
 #include "fft_filter_ds_edge.hpp"
 #include "dummy_edge.hpp"
@@ -102,13 +104,58 @@ inline edges::edges( nodes * in,
 
     if ( size_ == vec3i::one ) does_fft = 0;
 
+    // overlap-save tiles instead of whole featuremaps
+    vec3i tile = vec3i::zero;
+    if ( does_fft && repeat == ovec3i::one )
+    {
+        tile = fft_tile_size(opts, in->fsize(),
+                             ( size_ - vec3i::one ) * stride + vec3i::one);
+    }
+
+    // the whole layer with Winograd's minimal filtering, or as matrix
+    // products
+    std::shared_ptr<winograd_filter_edge::layer> winograd_layer;
+    std::shared_ptr<gemm_filter_edge::layer>     gemm_layer;
+    if ( !does_fft && repeat == ovec3i::one )
+    {
+        long_t wt = options_.optional_as<long_t>("winograd", "0");
+        if ( wt && winograd_convolution::eligible(size_, stride) )
+        {
+            winograd_layer = std::make_shared<winograd_filter_edge::layer>
+                (in, out, size_, stride, tm_, wt);
+        }
+        else if ( options_.optional_as<int>("gemm", "0") )
+        {
+            gemm_layer = std::make_shared<gemm_filter_edge::layer>
+                (in, out, size_, stride, tm_);
+        }
+    }
+
     for ( size_t i = 0, k = 0; i < n; ++i )
     {
         for ( size_t j = 0; j < m; ++j, ++k )
         {
             if ( repeat == ovec3i::one )
             {
-                if ( does_fft )
+                if ( winograd_layer )
+                {
+                    edges_[k]
+                        = std::make_unique<winograd_filter_edge>
+                        (in, i, out, j, tm_, *filters_[k], winograd_layer);
+                }
+                else if ( gemm_layer )
+                {
+                    edges_[k]
+                        = std::make_unique<gemm_filter_edge>
+                        (in, i, out, j, tm_, *filters_[k], gemm_layer);
+                }
+                else if ( tile != vec3i::zero )
+                {
+                    edges_[k]
+                        = std::make_unique<fft_tiled_filter_edge>
+                        (in, i, out, j, tm_, stride, tile, *filters_[k]);
+                }
+                else if ( does_fft )
                 {
                     edges_[k]
                         = std::make_unique<fft_filter_edge>
@@ -138,6 +185,9 @@ inline edges::edges( nodes * in,
             }
         }
     }
+
+    if ( winograd_layer ) winograd_layer->initialize();
+    if ( gemm_layer )     gemm_layer->initialize();
 }
 
 inline edges::edges( nodes * in,
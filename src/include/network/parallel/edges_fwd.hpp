@@ -74,6 +74,16 @@ public:
         return options_.require_as<std::string>("name");
     }
 
+    size_t size() const
+    {
+        return edges_.size();
+    }
+
+    edge * get( size_t i ) const
+    {
+        return edges_[i].get();
+    }
+
     // [kisuklee]
     // This is only temporary implementation and will be removed.
     void set_phase( phase phs )
@@ -111,6 +121,14 @@ public:
         }
     }
 
+    void set_priorities( size_t fwd, size_t bwd )
+    {
+        for ( auto & e: edges_ )
+        {
+            e->set_priorities(fwd, bwd);
+        }
+    }
+
     void set_patch_size( real s )
     {
         if ( filters_.size() )
@@ -0,0 +1,429 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "edges.hpp"
+#include "nodes.hpp"
+#include "../../fft/fftw.hpp"
+#include "../../utils/task_manager.hpp"
+#include "../../utils/tracer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace znn { namespace v4 { namespace parallel_network {
+
+// Forward pass compiled into a static plan
+//
+// Every enabled featuremap becomes a task slot and every enabled edge
+// fed by one a plan edge (only the edges that receive_forward(), the
+// others of a layer are computed by those). The producers of the featuremaps are found
+// once when the plan is built, each iteration just resets the atomic
+// counters and replays the plan: once a featuremap is done, each of its
+// outgoing edges is scheduled as a separate task, with the priority and
+// on the NUMA node of the edge, and the accumulator of the consumer
+// joins them. A featuremap (and its fft) is released as soon as the
+// last of its edges is done.
+//
+// Featuremaps that can't be computed (enabled, but without enabled
+// producers, or with a producer that can't be computed) are left out
+// of the plan.
+//
+// The featuremaps of a layer that need FFTs are transformed in batches
+// (one plan_many transform per chunk, a chunk per thread) once the whole
+// layer is done, their edges start when all the chunks are done.
+// Layers with fewer than two featuremaps per thread are transformed one
+// featuremap at a time.
+//
+// The nodes report the completed featuremaps to the plan instead of
+// their forward dispatchers. The plan has to be rebuilt after
+// enabling/disabling featuremaps or edges.
+//
+class execution_plan: public forward_listener
+{
+private:
+    struct fft_batch;
+
+    struct task
+    {
+        nodes *                                node     ;
+        size_t                                 index    ;
+        size_t                                 priority = 0;
+        bool                                   live     = false;
+
+        // distinct producing tasks and the plan edges fed by the task
+        std::vector<size_t>                    producers;
+        std::vector<size_t>                    out_edges;
+        size_t                                 real_edges = 0;
+
+        std::atomic<size_t>                    consumers{0};
+
+        fftw::transformer *                    fft = nullptr;
+        fft_batch *                            batch = nullptr;
+
+        ccube_p<real>                          fmap    ;
+        ccube_p<complex>                       fmap_fft;
+
+        uint32_t                               trace_name;
+    };
+
+    struct plan_edge
+    {
+        edge *                                 e   ;
+        size_t                                 from;
+    };
+
+    // the featuremaps of a layer transformed together
+    struct fft_batch
+    {
+        std::vector<size_t>                                   tasks ;
+        std::vector<std::unique_ptr<fftw::batch_transformer>> chunks;
+        size_t                                                chunk ;
+
+        std::atomic<size_t>                    pending{0};
+        std::atomic<size_t>                    chunks_pending{0};
+
+        uint32_t                               trace_name;
+    };
+
+private:
+    task_manager &                                      tm_     ;
+    std::vector<std::unique_ptr<task>>                  tasks_  ;
+    std::vector<plan_edge>                              edges_  ;
+    std::map<nodes*, size_t>                            first_  ;
+    std::map<vec3i,std::unique_ptr<fftw::transformer>>  fftw_   ;
+    std::vector<nodes*>                                 nodes_  ;
+    std::vector<std::unique_ptr<fft_batch>>             batches_;
+
+    size_t                  live_tasks_ = 0;
+    std::atomic<size_t>     remaining_{0};
+    std::mutex              mutex_;
+    std::condition_variable cv_   ;
+
+private:
+    task & get_task( nodes * n, size_t i )
+    {
+        return *tasks_[first_[n] + i];
+    }
+
+    void run_edge( size_t id )
+    {
+        plan_edge & pe = edges_[id];
+        task      & p  = *tasks_[pe.from];
+
+        {
+            trace_scope s(trace_kind::forward, pe.e->trace_name(),
+                          pe.e->fwd_priority());
+
+            if ( pe.e->is_fft() )
+            {
+                pe.e->forward(p.fmap_fft);
+            }
+            else
+            {
+                pe.e->forward(p.fmap);
+            }
+        }
+
+        if ( --p.consumers == 0 ) release(p);
+        one_done();
+    }
+
+    void release( task & t )
+    {
+        t.fmap.reset();
+        t.fmap_fft.reset();
+    }
+
+    void one_done()
+    {
+        if ( --remaining_ == 0 )
+        {
+            std::lock_guard<std::mutex> g(mutex_);
+            cv_.notify_all();
+        }
+    }
+
+    void run_chunk( fft_batch * b, size_t c )
+    {
+        {
+            trace_scope s(trace_kind::fft, b->trace_name,
+                          std::numeric_limits<std::size_t>::max());
+
+            size_t first = c * b->chunk;
+            size_t n     = b->chunks[c]->count();
+
+            std::vector<ccube_p<real>> in(n);
+            for ( size_t i = 0; i < n; ++i )
+            {
+                in[i] = tasks_[b->tasks[first + i]]->fmap;
+            }
+
+            auto out = b->chunks[c]->forward_pad(in);
+
+            for ( size_t i = 0; i < n; ++i )
+            {
+                tasks_[b->tasks[first + i]]->fmap_fft = std::move(out[i]);
+            }
+        }
+
+        if ( --b->chunks_pending == 0 )
+        {
+            for ( auto id: b->tasks ) notify(*tasks_[id]);
+        }
+    }
+
+    void finish( task & t )
+    {
+        if ( t.batch )
+        {
+            fft_batch * b = t.batch;
+            if ( --b->pending == 0 )
+            {
+                for ( size_t c = 1; c < b->chunks.size(); ++c )
+                {
+                    tm_.asap(&execution_plan::run_chunk, this, b, c);
+                }
+                run_chunk(b, 0);
+            }
+            return;
+        }
+
+        if ( t.fft )
+        {
+            trace_scope s(trace_kind::fft, t.trace_name, t.priority);
+            t.fmap_fft = t.fft->forward_pad(t.fmap);
+        }
+
+        notify(t);
+    }
+
+    void notify( task & t )
+    {
+        // only the ffts are used from here on
+        if ( t.fft && t.real_edges == 0 ) t.fmap.reset();
+
+        if ( t.out_edges.empty() )
+        {
+            release(t);
+        }
+
+        for ( auto id: t.out_edges )
+        {
+            edge * e = edges_[id].e;
+            tm_.schedule_on(e->fwd_numa_node(), e->fwd_priority(),
+                            &execution_plan::run_edge, this, id);
+        }
+
+        one_done();
+    }
+
+public:
+    execution_plan( std::vector<nodes*> const & ns,
+                    std::vector<edges*> const & es,
+                    task_manager & tm,
+                    size_t n_threads = 1 )
+        : tm_(tm)
+        , nodes_(ns)
+    {
+        for ( auto n: ns )
+        {
+            first_[n] = tasks_.size();
+            for ( size_t i = 0; i < n->size(); ++i )
+            {
+                tasks_.push_back(std::make_unique<task>());
+                tasks_.back()->node  = n;
+                tasks_.back()->index = i;
+                tasks_.back()->trace_name =
+                    tracer.intern(n->name() + ":" + std::to_string(i));
+            }
+        }
+
+        std::vector<edge*> enabled;
+
+        for ( auto g: es )
+        {
+            for ( size_t k = 0; k < g->size(); ++k )
+            {
+                edge * e = g->get(k);
+
+                if ( !e->enabled() ||
+                     !e->in()->enabled(e->in_index()) ||
+                     !e->out()->enabled(e->out_index()) )
+                {
+                    continue;
+                }
+
+                size_t from = first_[e->in()]  + e->in_index();
+                size_t to   = first_[e->out()] + e->out_index();
+
+                tasks_[to]->producers.push_back(from);
+                enabled.push_back(e);
+            }
+        }
+
+        // the input featuremaps, and the ones all of whose producers
+        // can be computed
+        for ( auto & t: tasks_ )
+        {
+            auto & p = t->producers;
+            std::sort(p.begin(), p.end());
+            p.erase(std::unique(p.begin(), p.end()), p.end());
+
+            t->live = t->node->enabled(t->index) &&
+                ( t->node->is_input() || p.size() );
+        }
+
+        for ( bool changed = true; changed; )
+        {
+            changed = false;
+            for ( auto & t: tasks_ )
+            {
+                if ( !t->live ) continue;
+                for ( auto x: t->producers )
+                {
+                    if ( !tasks_[x]->live )
+                    {
+                        t->live = false;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        for ( auto & t: tasks_ )
+        {
+            if ( t->live ) ++live_tasks_;
+        }
+
+        for ( auto e: enabled )
+        {
+            size_t from = first_[e->in()] + e->in_index();
+            task & p    = *tasks_[from];
+
+            if ( !p.live || !e->receives_forward() ) continue;
+
+            p.out_edges.push_back(edges_.size());
+            p.priority = std::max(p.priority, e->fwd_priority());
+            edges_.push_back({e, from});
+
+            if ( !e->is_fft() )
+            {
+                ++p.real_edges;
+            }
+            else if ( !p.fft )
+            {
+                vec3i s = p.node->fsize();
+                if ( fftw_.count(s) == 0 )
+                {
+                    fftw_[s] = std::make_unique<fftw::transformer>(s);
+                }
+                p.fft = fftw_[s].get();
+            }
+        }
+
+        for ( auto n: ns )
+        {
+            std::vector<size_t> ids;
+            for ( size_t i = 0; i < n->size(); ++i )
+            {
+                size_t id = first_[n] + i;
+                if ( tasks_[id]->live && tasks_[id]->fft ) ids.push_back(id);
+            }
+
+            size_t chunks = std::max(std::min(n_threads, ids.size()),
+                                     static_cast<size_t>(1));
+            size_t chunk  = ( ids.size() + chunks - 1 ) / chunks;
+
+            if ( chunk < 2 ) continue;
+
+            auto b = std::make_unique<fft_batch>();
+            b->tasks      = ids;
+            b->chunk      = chunk;
+            b->trace_name = tracer.intern(n->name() + ":fft");
+
+            for ( size_t f = 0; f < ids.size(); f += chunk )
+            {
+                b->chunks.push_back(std::make_unique<fftw::batch_transformer>
+                                    (n->fsize(),
+                                     std::min(chunk, ids.size() - f)));
+            }
+
+            for ( auto id: ids ) tasks_[id]->batch = b.get();
+
+            batches_.push_back(std::move(b));
+        }
+
+        for ( auto n: ns ) n->set_forward_listener(this);
+    }
+
+    ~execution_plan()
+    {
+        for ( auto n: nodes_ ) n->set_forward_listener(nullptr);
+    }
+
+    // number of featuremaps computed by the plan
+    size_t size() const
+    {
+        return live_tasks_;
+    }
+
+    void reset()
+    {
+        for ( auto & t: tasks_ )
+        {
+            t->consumers = t->out_edges.size();
+        }
+        for ( auto & b: batches_ )
+        {
+            b->pending        = b->tasks.size();
+            b->chunks_pending = b->chunks.size();
+        }
+        remaining_ = live_tasks_ + edges_.size();
+    }
+
+    // waits for all the featuremaps and edges of the iteration, their
+    // slots are released by then
+    void wait()
+    {
+        std::unique_lock<std::mutex> g(mutex_);
+        while ( remaining_.load() )
+        {
+            cv_.wait(g);
+        }
+    }
+
+    void featuremap_done( nodes * n, size_t i,
+                          ccube_p<real> const & f ) override
+    {
+        task & t = get_task(n,i);
+        ZI_ASSERT(t.live);
+        t.fmap = f;
+        finish(t);
+    }
+
+}; // class execution_plan
+
+}}} // namespace znn::v4::parallel_network
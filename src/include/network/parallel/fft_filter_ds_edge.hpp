@@ -43,6 +43,8 @@ private:
 
     task_manager::task_handle pending_ = 0;
 
+    fftw::transformer fftw_;
+
 private:
     void do_forward( ccube_p<complex> const & f )
     {
@@ -53,19 +55,25 @@ private:
 #ifdef ZNN_DONT_CACHE_FFTS
         auto w_fft = get_w_fft();
 #endif
-        auto fw = *w_fft * *f;
-        out_nodes->forward(out_num, fwd_bucket_, std::move(fw));
-        //out_nodes->forward(out_num, fwd_bucket_, w_fft, f);
+        // multiply-added straight into the bucket of the output
+        out_nodes->forward(out_num, fwd_bucket_, f, w_fft);
     }
 
     void do_update( ccube_p<complex> const & g )
     {
         ZI_ASSERT(enabled_);
 
+        trace_scope s(trace_kind::update, trace_name(), 0);
+
         auto dEdW_fft = *last_input * *g;
-        auto dEdW = fftw::backward(std::move(dEdW_fft), in_nodes->fsize());
+        auto dEdW = fftw_.backward(std::move(dEdW_fft));
         real norm = dEdW->num_elements();
 
+        if ( fftw_.size() != fftw_.actual_size() )
+        {
+            dEdW = crop_left(*dEdW, fftw_.size());
+        }
+
         flip(*dEdW);
         // TODO(zlateski): WTH was happening with sparse_implode before
         //                 when I had to use sparse_implode_slow
@@ -96,8 +104,8 @@ private:
         //                 ony happened on my laptop
 
         auto w_tmp = sparse_explode_slow(filter_.W(), filter_stride,
-                                         in_nodes->fsize());
-        return fftw::forward(std::move(w_tmp));
+                                         fftw_.actual_size());
+        return fftw_.forward(std::move(w_tmp));
     }
 
 
@@ -113,7 +121,8 @@ public:
         : edge(in,inn,out,outn,tm),
           filter_stride(stride),
           repeat_(repeat),
-          filter_(f)
+          filter_(f),
+          fftw_(in->fsize())
     {
         bwd_bucket_ = in->attach_out_fft_edge(inn, this);
         fwd_bucket_ = out->attach_in_fft_edge(outn, this, in->fsize());
@@ -124,6 +133,11 @@ public:
 #endif
     }
 
+    bool is_fft() const override
+    {
+        return true;
+    }
+
     void forward( ccube_p<complex> const & f ) override
     {
         if ( !enabled_ ) return;
@@ -146,8 +160,7 @@ public:
 #ifdef ZNN_DONT_CACHE_FFTS
             auto w_fft = get_w_fft();
 #endif
-            auto grad = *w_fft * *g;
-            in_nodes->backward(in_num, bwd_bucket_, std::move(grad));
+            in_nodes->backward(in_num, bwd_bucket_, g, w_fft);
         }
 
         pending_ = manager.schedule_unprivileged(
@@ -54,15 +54,16 @@ private:
 #ifdef ZNN_DONT_CACHE_FFTS
         auto w_fft = get_w_fft();
 #endif
-        auto fw = *w_fft * *f;
-        out_nodes->forward(out_num, fwd_bucket_, std::move(fw));
-        //out_nodes->forward(out_num, fwd_bucket_, w_fft, f);
+        // multiply-added straight into the bucket of the output
+        out_nodes->forward(out_num, fwd_bucket_, f, w_fft);
     }
 
     void do_update( ccube_p<complex> const & g )
     {
         ZI_ASSERT(enabled_);
 
+        trace_scope s(trace_kind::update, trace_name(), 0);
+
         auto dEdW_fft = *last_input * *g;
         auto dEdW = fftw_.backward(std::move(dEdW_fft));
         real norm = dEdW->num_elements();
@@ -123,6 +124,11 @@ public:
 #endif
     }
 
+    bool is_fft() const override
+    {
+        return true;
+    }
+
     void forward( ccube_p<complex> const & f ) override
     {
         if ( !enabled_ ) return;
@@ -145,8 +151,7 @@ public:
 #ifdef ZNN_DONT_CACHE_FFTS
             auto w_fft = get_w_fft();
 #endif
-            auto grad = *w_fft * *g;
-            in_nodes->backward(in_num, bwd_bucket_, std::move(grad));
+            in_nodes->backward(in_num, bwd_bucket_, g, w_fft);
         }
 
         pending_ = manager.schedule_unprivileged(
@@ -0,0 +1,314 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "edge.hpp"
+#include "edges_fwd.hpp"
+#include "nodes.hpp"
+
+#include "../../assert.hpp"
+#include "../../fft/fftw.hpp"
+#include "../../fft/fft_tiling.hpp"
+#include "../../options/options.hpp"
+#include "../filter.hpp"
+
+#include <stdexcept>
+#include <string>
+
+namespace znn { namespace v4 { namespace parallel_network {
+
+// Size of the tiles of a conv edge with the option fft_tile ("auto" or
+// the size of the tiles), zero when the edge transforms whole featuremaps.
+// fsize is the size of the input featuremaps and k the size of the
+// sparse filter.
+inline vec3i fft_tile_size( options const & op,
+                            vec3i const & fsize,
+                            vec3i const & k )
+{
+    auto t = op.optional_as<std::string>("fft_tile", "0");
+
+    if ( t == "0" ) return vec3i::zero;
+    if ( t == "auto" ) return fft_tiles.optimal(fsize, k);
+
+    vec3i r = op.require_as<ovec3i>("fft_tile");
+
+    if ( r[0] < k[0] || r[1] < k[1] || r[2] < k[2] )
+    {
+        throw std::logic_error(HERE() + "fft_tile smaller than the filter");
+    }
+
+    return r;
+}
+
+// Overlap-save FFT convolution
+//
+// The input featuremap is covered by tiles of size tile_, each one
+// transformed at the tile size and multiplied with the transform of the
+// filter at the same size; every tile yields tile_-k+1 outputs. The
+// backward pass adds up the (full) convolutions of the tiles of the
+// gradient (overlap-add), the update sums the correlations of the
+// matching tiles of the input and the gradient. The working set is a
+// few tiles instead of the transforms of the whole featuremaps.
+//
+class fft_tiled_filter_edge: public edge
+{
+private:
+    vec3i    filter_stride;
+    filter & filter_;
+
+    vec3i    k_   ; // size of the sparse filter
+    vec3i    tile_;
+    vec3i    step_; // outputs per tile
+
+#ifndef ZNN_DONT_CACHE_FFTS
+    ccube_p<complex> w_fft;
+#endif
+    ccube_p<real> last_input;
+
+    task_manager::task_handle pending_ = 0;
+
+    fftw::transformer fftw_;
+
+private:
+    // copies the block of size s at offset o of the cube c to the
+    // beginning of a zero padded cube of the transform size
+    cube_p<real> get_tile( cube<real> const & c,
+                           vec3i const & o, vec3i const & s ) const
+    {
+        vec3i as = fftw_.actual_size();
+        auto r = get_cube<real>(as);
+        if ( s != as ) fill(*r, 0);
+
+        (*r)[indices[range(0,s[0])][range(0,s[1])][range(0,s[2])]]
+            = c[indices
+                [range(o[0],o[0]+s[0])]
+                [range(o[1],o[1]+s[1])]
+                [range(o[2],o[2]+s[2])]];
+        return r;
+    }
+
+    // convolution of a tile with the filter, the transform size result
+    // is not normalized
+    cube_p<real> convolve_tile( cube_p<real> && t, cube<complex> const & w )
+    {
+        auto f = fftw_.forward(std::move(t));
+        *f *= w;
+        return fftw_.backward(std::move(f));
+    }
+
+    template<typename F>
+    void for_each_tile( vec3i const & osz, F const & f ) const
+    {
+        vec3i o;
+        for ( o[0] = 0; o[0] < osz[0]; o[0] += step_[0] )
+            for ( o[1] = 0; o[1] < osz[1]; o[1] += step_[1] )
+                for ( o[2] = 0; o[2] < osz[2]; o[2] += step_[2] )
+                {
+                    vec3i s( std::min(step_[0], osz[0] - o[0]),
+                             std::min(step_[1], osz[1] - o[1]),
+                             std::min(step_[2], osz[2] - o[2]) );
+                    f(o, s);
+                }
+    }
+
+    real norm() const
+    {
+        vec3i as = fftw_.actual_size();
+        return as[0] * as[1] * as[2];
+    }
+
+    void do_forward( ccube_p<real> const & f )
+    {
+        ZI_ASSERT(enabled_);
+
+        // might run after the update, outside of the scope of the
+        // dispatch
+        trace_scope ts(trace_kind::forward, trace_name(), fwd_priority());
+
+        last_input = f;
+
+#ifdef ZNN_DONT_CACHE_FFTS
+        auto w_fft = get_w_fft();
+#endif
+        vec3i osz = size(*f) - k_ + vec3i::one;
+        auto  out = get_cube<real>(osz);
+
+        for_each_tile(osz, [&](vec3i const & o, vec3i const & s)
+            {
+                auto r = convolve_tile(get_tile(*f, o, s + k_ - vec3i::one),
+                                       *w_fft);
+
+                (*out)[indices
+                       [range(o[0],o[0]+s[0])]
+                       [range(o[1],o[1]+s[1])]
+                       [range(o[2],o[2]+s[2])]]
+                    = (*r)[indices
+                           [range(k_[0]-1,k_[0]-1+s[0])]
+                           [range(k_[1]-1,k_[1]-1+s[1])]
+                           [range(k_[2]-1,k_[2]-1+s[2])]];
+            });
+
+        *out /= norm();
+        out_nodes->forward(out_num, std::move(out));
+    }
+
+    // full convolution of the flipped gradient with the filter, flipped
+    cube_p<real> input_gradient( cube<real> const & g )
+    {
+#ifdef ZNN_DONT_CACHE_FFTS
+        auto w_fft = get_w_fft();
+#endif
+        vec3i osz = size(g);
+        vec3i isz = osz + k_ - vec3i::one;
+
+        auto gf = get_copy(g);
+        flip(*gf);
+
+        auto ret = get_cube<real>(isz);
+        fill(*ret, 0);
+
+        for_each_tile(osz, [&](vec3i const & o, vec3i const & s)
+            {
+                auto r = convolve_tile(get_tile(*gf, o, s), *w_fft);
+
+                vec3i e = s + k_ - vec3i::one;
+                for ( long_t x = 0; x < e[0]; ++x )
+                    for ( long_t y = 0; y < e[1]; ++y )
+                        for ( long_t z = 0; z < e[2]; ++z )
+                            (*ret)[o[0]+x][o[1]+y][o[2]+z] += (*r)[x][y][z];
+            });
+
+        *ret /= norm();
+        flip(*ret);
+        return ret;
+    }
+
+    void do_update( ccube_p<real> const & g )
+    {
+        ZI_ASSERT(enabled_);
+
+        trace_scope s(trace_kind::update, trace_name(), 0);
+
+        auto dEdW = get_cube<real>(k_);
+        fill(*dEdW, 0);
+
+        // correlations of the gradient tiles with the input tiles,
+        // as convolutions with the flipped gradient tiles
+        for_each_tile(size(*g), [&](vec3i const & o, vec3i const & s)
+            {
+                auto gt = crop(*g, o, s);
+                flip(*gt);
+
+                auto gf = fftw_.forward(get_tile(*gt, vec3i::zero, s));
+                auto xf = fftw_.forward(
+                    get_tile(*last_input, o, s + k_ - vec3i::one));
+
+                *gf *= *xf;
+                auto r = fftw_.backward(std::move(gf));
+
+                for ( long_t x = 0; x < k_[0]; ++x )
+                    for ( long_t y = 0; y < k_[1]; ++y )
+                        for ( long_t z = 0; z < k_[2]; ++z )
+                            (*dEdW)[x][y][z]
+                                += (*r)[s[0]-1+x][s[1]-1+y][s[2]-1+z];
+            });
+
+        flip(*dEdW);
+        dEdW = sparse_implode_slow(*dEdW, filter_stride, size(filter_.W()));
+        *dEdW /= norm();
+
+        filter_.update(*dEdW, patch_sz_);
+
+#ifndef ZNN_DONT_CACHE_FFTS
+        initialize();
+#endif
+    }
+
+#ifndef ZNN_DONT_CACHE_FFTS
+    void initialize()
+    {
+        w_fft = get_w_fft();
+    }
+#endif
+
+    cube_p<complex> get_w_fft()
+    {
+        auto w_tmp = sparse_explode_slow(filter_.W(), filter_stride,
+                                         fftw_.actual_size());
+        return fftw_.forward(std::move(w_tmp));
+    }
+
+public:
+    fft_tiled_filter_edge( nodes * in,
+                           size_t inn,
+                           nodes * out,
+                           size_t outn,
+                           task_manager & tm,
+                           vec3i const & stride,
+                           vec3i const & tile,
+                           filter & f )
+        : edge(in,inn,out,outn,tm), filter_stride(stride), filter_(f)
+        , k_((size(f.W()) - vec3i::one) * stride + vec3i::one)
+        , tile_(tile)
+        , step_(tile - k_ + vec3i::one)
+        , fftw_(tile)
+    {
+        ZI_ASSERT(step_[0]>0&&step_[1]>0&&step_[2]>0);
+
+        in->attach_out_edge(inn,this);
+        out->attach_in_edge(outn,this);
+#ifndef ZNN_DONT_CACHE_FFTS
+        pending_ = manager.schedule_unprivileged(
+                                &fft_tiled_filter_edge::initialize,this);
+#endif
+    }
+
+    void forward( ccube_p<real> const & f ) override
+    {
+        if ( !enabled_ ) return;
+
+        manager.require_done( pending_, &fft_tiled_filter_edge::do_forward,
+                              this, f );
+    }
+
+    void backward( ccube_p<real> const & g ) override
+    {
+        if ( !enabled_ ) return;
+
+        ZI_ASSERT(last_input);
+
+        if ( in_nodes->is_input() )
+        {
+            in_nodes->backward(in_num, cube_p<real>());
+        }
+        else
+        {
+            in_nodes->backward(in_num, input_gradient(*g));
+        }
+
+        pending_ = manager.schedule_unprivileged(
+                                &fft_tiled_filter_edge::do_update, this, g);
+    }
+
+    void zap(edges* e) override
+    {
+        manager.require_done(pending_,&edges::edge_zapped,e);
+    }
+};
+
+}}} // namespace znn::v4::parallel_network
@@ -33,6 +33,9 @@ private:
     vec3i    repeat_;
     filter & filter_;
 
+    direct_kernel kernel_;
+    spatial_split split_ ; // of the large featuremaps
+
     ccube_p<real> last_input;
 
     task_manager::task_handle pending_ = 0;
@@ -45,14 +48,18 @@ private:
         last_input = f;
 
         out_nodes->forward(out_num,
-            convolve_sparse(*f, filter_.W(), filter_stride));
+            convolve_sparse(*f, filter_.W(), filter_stride, kernel_,
+                            split_));
     }
 
     void do_update( ccube_p<real> const & g )
     {
         ZI_ASSERT(enabled_);
 
-        auto dEdW = convolve_sparse_flipped(*last_input, *g, filter_stride);
+        trace_scope s(trace_kind::update, trace_name(), 0);
+
+        auto dEdW = convolve_sparse_flipped(*last_input, *g, filter_stride,
+                                            split_);
         filter_.update(*dEdW, patch_sz_);
         flatten(filter_.W(), repeat_);
     }
@@ -69,7 +76,9 @@ public:
         : edge(in,inn,out,outn,tm),
           filter_stride(stride),
           repeat_(repeat),
-          filter_(f)
+          filter_(f),
+          kernel_(size(f.W()), in->fsize(), stride),
+          split_(tm)
     {
         in->attach_out_edge(inn,this);
         out->attach_in_edge(outn,this);
@@ -92,7 +101,9 @@ public:
         in_nodes->backward(in_num,
                        convolve_sparse_inverse(*g,
                                                filter_.W(),
-                                               filter_stride));
+                                               filter_stride,
+                                               kernel_,
+                                               split_));
 
         pending_ = manager.schedule_unprivileged(&filter_ds_edge::do_update,
                                                  this, g);
@@ -60,7 +60,14 @@ public:
         ZI_ASSERT(n<nodes::size());
         if ( !enabled_[n] ) return;
 
-        outputs_.dispatch(n,f,nodes::manager());
+        if ( nodes::listener() )
+        {
+            nodes::listener()->featuremap_done(this, n, f);
+        }
+        else
+        {
+            outputs_.dispatch(n,f,nodes::manager());
+        }
     }
 
 private:
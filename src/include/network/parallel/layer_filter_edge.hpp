@@ -0,0 +1,528 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "edge.hpp"
+#include "edges_fwd.hpp"
+#include "nodes.hpp"
+
+#include "../../convolution/convolve_gemm.hpp"
+#include "../../convolution/convolve_winograd.hpp"
+#include "../../utils/parallel_for.hpp"
+#include "../filter.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace znn { namespace v4 { namespace parallel_network {
+
+// Conv edges of a layer computed together
+//
+// The n x m edges of the layer share a layer holding the taps of all
+// the filters, convolved with all the featuremaps at once by Conv
+// (gemm_convolution or winograd_convolution). Only the edges (i,0) are
+// attached to the inputs and only the edges (0,j) to the outputs. Once
+// all the inputs (gradients) have arrived, the blocks of the outputs
+// (input gradients) are computed as separate tasks, the last one to
+// finish passes them on. The input gradients are the convolutions of
+// the zero padded gradients with the filters, flipped. The update of
+// all the filters is a single unprivileged task that splits the blocks
+// among the idle workers (parallel_for), each run of blocks into its own
+// partial gradient, and reduces the partial gradients per filter.
+//
+// In the compiled forward pass only the edges (i,0) receive the inputs
+// (receives_forward()).
+//
+// Conv( n, m, input size, filter size, stride, threads, args... ) is
+// the valid convolution of n inputs into m outputs, with
+//
+//   set_taps(w)                     the m x nK taps in the order of
+//                                   the correlation
+//   blocks()                        the number of blocks of outputs
+//   forward(b, in, out)             the outputs of the block b
+//   weight_gradient(b, in, g, dw)   dw += the gradient of the taps
+//                                   from the outputs of the block b
+//
+template<class Conv>
+class layer_filter_edge: public edge
+{
+public:
+
+    class layer
+    {
+    private:
+        std::size_t                      n_        ;
+        std::size_t                      m_        ;
+        vec3i                            filter_sz_;
+        vec3i                            stride_   ;
+        vec3i                            in_sz_    ;
+        vec3i                            out_sz_   ;
+
+        Conv                             fwd_      ;
+        Conv                             bwd_      ;
+
+        std::vector<layer_filter_edge*>  edges_    ; // edge (i,j) at i*m+j
+
+        std::vector<real>                w_        ; // m x nK, flipped
+        std::vector<real>                wb_       ; // n x mK
+
+        // partial weight gradients of the update, m x nK each
+        std::vector<std::vector<real>>   dw_       ;
+
+        std::vector<ccube_p<real>>       inputs_   ;
+        std::vector<ccube_p<real>>       grads_    ;
+        std::vector<ccube_p<real>>       padded_   ;
+        std::vector<cube_p<real>>        outputs_  ;
+        std::vector<cube_p<real>>        igrads_   ;
+
+        std::vector<real const*>         in_ptrs_  ;
+        std::vector<real*>               out_ptrs_ ;
+        std::vector<real const*>         g_ptrs_   ;
+        std::vector<real*>               ig_ptrs_  ;
+
+        std::vector<bool>                in_on_    ;
+        std::vector<bool>                out_on_   ;
+        std::size_t                      n_on_     ;
+        std::size_t                      m_on_     ;
+
+        std::size_t                      fwd_arrived_ = 0;
+        std::size_t                      bwd_arrived_ = 0;
+        std::atomic<std::size_t>         fwd_left_;
+        std::atomic<std::size_t>         bwd_left_;
+        std::mutex                       mutex_    ;
+
+        task_manager &                   tm_       ;
+        task_manager::task_handle        pending_  = 0;
+
+    private:
+        layer_filter_edge & at( std::size_t i, std::size_t j ) const
+        {
+            return *edges_[i * m_ + j];
+        }
+
+        void attach( std::size_t i, std::size_t j, layer_filter_edge * e )
+        {
+            edges_[i * m_ + j] = e;
+        }
+
+        // the taps of the forward pass, flipped
+        void load_taps()
+        {
+            std::size_t k  = size_of(filter_sz_);
+            std::size_t nk = n_ * k;
+
+            for ( std::size_t i = 0; i < n_; ++i )
+                for ( std::size_t j = 0; j < m_; ++j )
+                {
+                    real const * w = at(i,j).filter_.W().data();
+                    std::reverse_copy(w, w + k, &w_[j * nk + i * k]);
+                }
+
+            fwd_.set_taps(w_.data());
+        }
+
+        // the taps of the input gradients, not flipped
+        void load_backward_taps()
+        {
+            std::size_t k  = size_of(filter_sz_);
+            std::size_t mk = m_ * k;
+
+            for ( std::size_t i = 0; i < n_; ++i )
+                for ( std::size_t j = 0; j < m_; ++j )
+                {
+                    real const * w = at(i,j).filter_.W().data();
+                    std::copy_n(w, k, &wb_[i * mk + j * k]);
+                }
+
+            bwd_.set_taps(wb_.data());
+        }
+
+        static std::size_t size_of( vec3i const & s )
+        {
+            return s[0] * s[1] * s[2];
+        }
+
+        // runs f(b) for all the blocks, the first one in this thread,
+        // and done() after the last one
+        template<typename F, typename D>
+        void for_blocks( std::size_t blocks,
+                         std::size_t priority,
+                         std::atomic<std::size_t> & left,
+                         F const & f, D const & done )
+        {
+            left = blocks;
+
+            auto task = [f,done,&left]( std::size_t b )
+                {
+                    f(b);
+                    if ( --left == 0 ) done();
+                };
+
+            for ( std::size_t b = 1; b < blocks; ++b )
+            {
+                tm_.schedule(priority, [task,b]() { task(b); });
+            }
+            task(0);
+        }
+
+        void add_input( std::size_t i, ccube_p<real> const & f )
+        {
+            {
+                guard g(mutex_);
+                inputs_[i] = f;
+                if ( ++fwd_arrived_ < n_on_ ) return;
+                fwd_arrived_ = 0;
+            }
+
+            tm_.require_done(pending_, &layer::do_forward, this);
+        }
+
+        void do_forward()
+        {
+            for ( std::size_t i = 0; i < n_; ++i )
+            {
+                in_ptrs_[i] = in_on_[i] ? inputs_[i]->data() : nullptr;
+            }
+
+            for ( std::size_t j = 0; j < m_; ++j )
+            {
+                outputs_[j]   = out_on_[j] ? get_cube<real>(out_sz_) : nullptr;
+                out_ptrs_[j]  = out_on_[j] ? outputs_[j]->data() : nullptr;
+            }
+
+            for_blocks(fwd_.blocks(), at(0,0).fwd_priority(), fwd_left_,
+                       [this]( std::size_t b )
+                       {
+                           fwd_.forward(b, in_ptrs_.data(),
+                                        out_ptrs_.data());
+                       },
+                       [this]()
+                       {
+                           for ( std::size_t j = 0; j < m_; ++j )
+                           {
+                               if ( out_on_[j] )
+                                   at(0,j).pass_forward(std::move(outputs_[j]));
+                           }
+                       });
+        }
+
+        void add_gradient( std::size_t j, ccube_p<real> const & g )
+        {
+            {
+                guard gg(mutex_);
+                grads_[j] = g;
+                if ( ++bwd_arrived_ < m_on_ ) return;
+                bwd_arrived_ = 0;
+            }
+
+            do_backward();
+        }
+
+        void do_backward()
+        {
+            for ( std::size_t j = 0; j < m_; ++j )
+            {
+                g_ptrs_[j] = out_on_[j] ? grads_[j]->data() : nullptr;
+            }
+
+            // the update is scheduled before the gradients are passed on,
+            // so that zap() always finds it in pending_
+            if ( at(0,0).in()->is_input() )
+            {
+                pending_ = tm_.schedule_unprivileged(&layer::do_update, this);
+
+                for ( std::size_t i = 0; i < n_; ++i )
+                {
+                    if ( in_on_[i] ) at(i,0).pass_backward(cube_p<real>());
+                }
+            }
+            else
+            {
+                load_backward_taps();
+
+                // the gradients padded by the size of the filter
+                vec3i o = ( filter_sz_ - vec3i::one ) * stride_;
+
+                for ( std::size_t j = 0; j < m_; ++j )
+                {
+                    if ( !out_on_[j] || o == vec3i::zero )
+                    {
+                        padded_[j] = grads_[j];
+                        continue;
+                    }
+
+                    auto p = get_cube<real>(out_sz_ + o + o);
+                    fill(*p, 0);
+                    (*p)[indices
+                         [range(o[0],o[0]+out_sz_[0])]
+                         [range(o[1],o[1]+out_sz_[1])]
+                         [range(o[2],o[2]+out_sz_[2])]] = *grads_[j];
+                    padded_[j] = p;
+                }
+
+                std::vector<real const*> pp(m_);
+                for ( std::size_t j = 0; j < m_; ++j )
+                {
+                    pp[j] = out_on_[j] ? padded_[j]->data() : nullptr;
+                }
+
+                for ( std::size_t i = 0; i < n_; ++i )
+                {
+                    igrads_[i]  = in_on_[i] ? get_cube<real>(in_sz_) : nullptr;
+                    ig_ptrs_[i] = in_on_[i] ? igrads_[i]->data() : nullptr;
+                }
+
+                // the taps of the input gradients are already loaded
+                pending_ = tm_.schedule_unprivileged(&layer::do_update, this);
+
+                for_blocks(bwd_.blocks(), at(0,0).bwd_priority(), bwd_left_,
+                           [this,pp]( std::size_t b )
+                           {
+                               bwd_.forward(b, pp.data(), ig_ptrs_.data());
+                           },
+                           [this]()
+                           {
+                               for ( std::size_t j = 0; j < m_; ++j )
+                                   padded_[j].reset();
+
+                               for ( std::size_t i = 0; i < n_; ++i )
+                               {
+                                   if ( in_on_[i] )
+                                       at(i,0).pass_backward(
+                                           std::move(igrads_[i]));
+                               }
+                           });
+            }
+        }
+
+        // the partial gradients of contiguous runs of blocks, summed
+        // and applied per filter
+        void do_update()
+        {
+            trace_scope s(trace_kind::update, at(0,0).trace_name(), 0);
+
+            std::size_t k      = size_of(filter_sz_);
+            std::size_t nk     = n_ * k;
+            std::size_t blocks = fwd_.blocks();
+            std::size_t parts  = dw_.size();
+
+            parallel_for(tm_, parts, [&,this]( std::size_t p )
+                {
+                    std::vector<real> & dw = dw_[p];
+                    std::fill(dw.begin(), dw.end(), 0);
+
+                    for ( std::size_t b = blocks * p / parts;
+                          b < blocks * ( p + 1 ) / parts; ++b )
+                    {
+                        fwd_.weight_gradient(b, in_ptrs_.data(),
+                                             g_ptrs_.data(), dw.data());
+                    }
+                });
+
+            parallel_for(tm_, n_ * m_, [&,this]( std::size_t f )
+                {
+                    std::size_t i = f / m_;
+                    std::size_t j = f % m_;
+
+                    if ( !in_on_[i] || !out_on_[j] ) return;
+
+                    auto dEdW = get_cube<real>(filter_sz_);
+                    real * d  = dEdW->data();
+
+                    std::fill_n(d, k, 0);
+                    for ( std::size_t p = 0; p < parts; ++p )
+                    {
+                        real const * dw = &dw_[p][j * nk + i * k];
+                        for ( std::size_t x = 0; x < k; ++x )
+                        {
+                            d[x] += dw[k - 1 - x];
+                        }
+                    }
+
+                    at(i,j).filter_.update(*dEdW, at(i,j).patch_sz_);
+                });
+
+            for ( auto & g: grads_ ) g.reset();
+
+            load_taps();
+        }
+
+        // the outputs lose (regain) their only incoming edge when the
+        // last input is disabled (the first one is enabled)
+        void enable_input( std::size_t i, bool b )
+        {
+            if ( in_on_[i] == b ) return;
+
+            in_on_[i] = b;
+            if ( b ) ++n_on_; else --n_on_;
+
+            if ( n_on_ != ( b ? 1 : 0 ) ) return;
+
+            for ( std::size_t j = 0; j < m_; ++j )
+            {
+                if ( b )
+                    at(0,j).out()->enable(j, true);
+                else if ( out_on_[j] )
+                    at(0,j).out()->disable_in_edge(j);
+            }
+        }
+
+        void enable_output( std::size_t j, bool b )
+        {
+            if ( out_on_[j] == b ) return;
+
+            out_on_[j] = b;
+            if ( b ) ++m_on_; else --m_on_;
+
+            if ( m_on_ != ( b ? 1 : 0 ) ) return;
+
+            for ( std::size_t i = 0; i < n_; ++i )
+            {
+                if ( b )
+                    at(i,0).in()->enable(i, true);
+                else if ( in_on_[i] )
+                    at(i,0).in()->disable_out_edge(i);
+            }
+        }
+
+        friend class layer_filter_edge;
+
+    public:
+        // args are passed on to the constructors of Conv
+        template<typename... Args>
+        layer( nodes * in,
+               nodes * out,
+               vec3i const & filter_size,
+               vec3i const & stride,
+               task_manager & tm,
+               Args const &... args )
+            : n_(in->num_out_nodes())
+            , m_(out->num_in_nodes())
+            , filter_sz_(filter_size)
+            , stride_(stride)
+            , in_sz_(in->fsize())
+            , out_sz_(in->fsize() - ( filter_size - vec3i::one ) * stride)
+            , fwd_(n_, m_, in_sz_, filter_size, stride,
+                   tm.get_concurrency(), args...)
+            , bwd_(m_, n_, in_sz_ + ( filter_size - vec3i::one ) * stride,
+                   filter_size, stride, tm.get_concurrency(), args...)
+            , edges_(n_ * m_)
+            , w_(n_ * m_ * size_of(filter_size))
+            , wb_(n_ * m_ * size_of(filter_size))
+            , dw_(std::max<std::size_t>(std::min(fwd_.blocks(),
+                                                 tm.get_concurrency()), 1),
+                  std::vector<real>(n_ * m_ * size_of(filter_size)))
+            , inputs_(n_)
+            , grads_(m_)
+            , padded_(m_)
+            , outputs_(m_)
+            , igrads_(n_)
+            , in_ptrs_(n_)
+            , out_ptrs_(m_)
+            , g_ptrs_(m_)
+            , ig_ptrs_(n_)
+            , in_on_(n_, true)
+            , out_on_(m_, true)
+            , n_on_(n_)
+            , m_on_(m_)
+            , tm_(tm)
+        {}
+
+        // once all the edges are attached
+        void initialize()
+        {
+            load_taps();
+        }
+    };
+
+private:
+    filter &               filter_;
+    std::shared_ptr<layer> layer_ ;
+
+    void pass_forward( cube_p<real> && r )
+    {
+        out_nodes->forward(out_num, std::move(r));
+    }
+
+    void pass_backward( cube_p<real> && g )
+    {
+        in_nodes->backward(in_num, std::move(g));
+    }
+
+public:
+    layer_filter_edge( nodes * in,
+                      size_t inn,
+                      nodes * out,
+                      size_t outn,
+                      task_manager & tm,
+                      filter & f,
+                      std::shared_ptr<layer> const & l )
+        : edge(in,inn,out,outn,tm), filter_(f), layer_(l)
+    {
+        if ( outn == 0 ) in->attach_out_edge(inn,this);
+        if ( inn == 0 )  out->attach_in_edge(outn,this);
+        l->attach(inn,outn,this);
+    }
+
+    // only the edges (i,0) get the inputs
+    void forward( ccube_p<real> const & f ) override
+    {
+        layer_->add_input(in_num, f);
+    }
+
+    bool receives_forward() const override
+    {
+        return out_num == 0;
+    }
+
+    // only the edges (0,j) get the gradients
+    void backward( ccube_p<real> const & g ) override
+    {
+        layer_->add_gradient(out_num, g);
+    }
+
+    void enable_fwd( bool b ) override
+    {
+        layer_->enable_input(in_num, b);
+    }
+
+    void enable_bwd( bool b ) override
+    {
+        layer_->enable_output(out_num, b);
+    }
+
+    void zap(edges* e) override
+    {
+        if ( in_num == 0 && out_num == 0 )
+        {
+            manager.require_done(layer_->pending_,&edges::edge_zapped,e);
+        }
+        else
+        {
+            e->edge_zapped();
+        }
+    }
+};
+
+typedef layer_filter_edge<gemm_convolution>     gemm_filter_edge    ;
+typedef layer_filter_edge<winograd_convolution> winograd_filter_edge;
+
+}}} // namespace znn::v4::parallel_network
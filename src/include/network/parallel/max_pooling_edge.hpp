@@ -19,7 +19,7 @@
 
 #include "edges_fwd.hpp"
 #include "nodes.hpp"
-#include "../../pooling/pooling.hpp"
+#include "../../pooling/max_filter.hpp"
 
 
 namespace znn { namespace v4 { namespace parallel_network {
@@ -30,8 +30,10 @@ private:
     vec3i filter_size;
     vec3i filter_stride;
 
-    cube_p<int> indices;
-    vec3i       insize ;
+    max_filter_offsets indices;
+    vec3i              insize ;
+
+    spatial_split split_ ; // of the large featuremaps
 
 public:
     max_pooling_edge( nodes * in,
@@ -44,6 +46,7 @@ public:
         : edge(in,inn,out,outn,tm)
         , filter_size(size)
         , filter_stride(stride)
+        , split_(tm)
     {
         insize = in->fsize();
 
@@ -56,10 +59,12 @@ public:
         if ( !enabled_ ) return;
 
         ZI_ASSERT(size(*f)==insize);
-        auto r = pooling_filter(get_copy(*f),
-                                [](real a, real b){ return a>b; },
-                                filter_size,
-                                filter_stride);
+        auto r = max_filter(*f,
+                            [](real a, real b){ return a>b; },
+                            filter_size,
+                            filter_stride,
+                            vec3i::one,
+                            split_);
         indices = r.second;
         out_nodes->forward(out_num,std::move(r.first));
     }
@@ -77,7 +82,7 @@ public:
         else
         {
             in_nodes->backward(in_num,
-                               pooling_backprop(insize, *g, *indices));
+                               max_filter_backprop(insize, *g, indices));
         }
     }
 
@@ -93,10 +98,12 @@ class real_pooling_edge: public edge
 private:
     vec3i filter_size;
 
-    cube_p<int> indices;
-    vec3i       insize ;
+    max_filter_offsets indices;
+    vec3i              insize ;
+
+    vec3i              outsize ;
 
-    vec3i       outsize ;
+    spatial_split split_ ; // of the large featuremaps
 
 public:
     real_pooling_edge( nodes * in,
@@ -107,6 +114,7 @@ public:
                        vec3i const & size )
         : edge(in,inn,out,outn,tm)
         , filter_size(size)
+        , split_(tm)
     {
         insize = in->fsize();
         outsize = insize / size;
@@ -122,14 +130,18 @@ public:
         if ( !enabled_ ) return;
 
         ZI_ASSERT(size(*f)==insize);
-        auto r = pooling_filter(get_copy(*f),
-                                [](real a, real b){ return a>b; },
-                                filter_size,
-                                vec3i::one);
-
-        indices = sparse_implode_slow(*r.second,filter_size,outsize);
-        out_nodes->forward(out_num,
-            sparse_implode_slow(*r.first,filter_size,outsize));
+        // the windows at the multiples of their size
+        auto r = max_filter(*f,
+                            [](real a, real b){ return a>b; },
+                            filter_size,
+                            vec3i::one,
+                            filter_size,
+                            split_);
+
+        ZI_ASSERT(size(*r.first)==outsize);
+
+        indices = r.second;
+        out_nodes->forward(out_num,std::move(r.first));
     }
 
     void backward( ccube_p<real> const & g ) override
@@ -145,7 +157,7 @@ public:
         else
         {
             in_nodes->backward(in_num,
-                               pooling_backprop(insize, *g, *indices));
+                               max_filter_backprop(insize, *g, indices));
         }
     }
 
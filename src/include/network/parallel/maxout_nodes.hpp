@@ -66,7 +66,8 @@ public:
             fwd_accumulators_[i]
                 = std::make_unique<max_accumulator>();
             bwd_accumulators_[i]
-                = std::make_unique<backward_accumulator>(fsize);
+                = std::make_unique<backward_accumulator>(fsize, 0,
+                                                         spatial_split(tm));
         }
 
         auto type = op.require_as<std::string>("type");
@@ -112,14 +113,19 @@ private:
         //STRONG_ASSERT(!fwd_done_[n]);
         fwd_done_[n] = true;
 
-        if ( nodes::is_output() )
+        if ( nodes::listener() )
         {
-            waiter_.one_done();
+            nodes::listener()->featuremap_done(this, n, fs_[n]);
         }
-        else
+        else if ( !nodes::is_output() )
         {
             fwd_dispatch_.dispatch(n,fs_[n],nodes::manager());
         }
+
+        if ( nodes::is_output() )
+        {
+            waiter_.one_done();
+        }
     }
 
 public:
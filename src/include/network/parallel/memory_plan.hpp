@@ -0,0 +1,205 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "../../cube/cube.hpp"
+#include "../../types.hpp"
+
+#include <algorithm>
+#include <map>
+#include <ostream>
+#include <tuple>
+#include <vector>
+
+namespace znn { namespace v4 { namespace parallel_network {
+
+// offsets8/offsets16: the positions of the maxima of the max filters
+// with windows of up to 256/65536 voxels
+enum class buffer_type : std::uint8_t
+{
+    real = 0, complex = 1, offsets8 = 2, mask = 3, offsets16 = 4
+};
+
+inline size_t element_size( buffer_type t )
+{
+    switch ( t )
+    {
+    case buffer_type::real:      return sizeof(real);
+    case buffer_type::complex:   return sizeof(complex);
+    case buffer_type::offsets8:  return sizeof(uint8_t);
+    case buffer_type::offsets16: return sizeof(uint16_t);
+    default:                     return sizeof(bool);
+    }
+}
+
+// Cubes of the same type and shape, reused between the buffers whose
+// lifetimes don't overlap
+struct memory_slot
+{
+    buffer_type type ;
+    vec3i       shape;
+    size_t      count;
+
+    size_t bytes() const
+    {
+        return count * element_size(type) * shape[0] * shape[1] * shape[2];
+    }
+};
+
+struct memory_plan
+{
+    size_t peak_bytes       = 0; // most memory live at any step
+    size_t persistent_bytes = 0; // live for the whole iteration
+    size_t slot_bytes       = 0; // all the slots, what gets preallocated
+
+    std::vector<memory_slot> slots;
+
+    // gets all the slots from the cube pool and returns them, so the
+    // following iterations find them there
+    void preallocate() const
+    {
+        std::vector<std::shared_ptr<void>> held;
+
+        for ( auto & s: slots )
+        {
+            for ( size_t i = 0; i < s.count; ++i )
+            {
+                switch ( s.type )
+                {
+                case buffer_type::real:
+                    held.push_back(get_cube<real>(s.shape));    break;
+                case buffer_type::complex:
+                    held.push_back(get_cube<complex>(s.shape)); break;
+                case buffer_type::offsets8:
+                    held.push_back(get_cube<uint8_t>(s.shape)); break;
+                case buffer_type::offsets16:
+                    held.push_back(get_cube<uint16_t>(s.shape)); break;
+                default:
+                    held.push_back(get_cube<bool>(s.shape));    break;
+                }
+            }
+        }
+    }
+};
+
+inline std::ostream& operator<<( std::ostream & os, memory_plan const & p )
+{
+    static char const * names[] = { "real", "complex", "offsets8", "mask",
+                                    "offsets16" };
+
+    os << "peak: " << p.peak_bytes << " bytes, persistent: "
+       << p.persistent_bytes << " bytes, slots: "
+       << p.slot_bytes << " bytes\n";
+
+    for ( auto & s: p.slots )
+    {
+        os << "  " << names[static_cast<size_t>(s.type)] << ' ' << s.shape
+           << " x " << s.count << " = " << s.bytes() << " bytes\n";
+    }
+
+    return os;
+}
+
+// Liveness of the buffers of a single iteration
+//
+// The iteration is split in steps (one per layer in the forward and
+// again in the backward pass); each buffer is live over a closed range
+// of steps. The buffers of the same type and shape share slots, the
+// number of slots of a kind is the most buffers of it live at a single
+// step.
+//
+class memory_planner
+{
+private:
+    struct buffer
+    {
+        buffer_type type ;
+        vec3i       shape;
+        size_t      count;
+        size_t      first;
+        size_t      last ;
+    };
+
+    size_t              steps_;
+    std::vector<buffer> buffers_;
+
+public:
+    explicit memory_planner( size_t steps )
+        : steps_(steps)
+    {}
+
+    size_t steps() const
+    {
+        return steps_;
+    }
+
+    void add( buffer_type t, vec3i const & s, size_t n,
+              size_t first, size_t last )
+    {
+        ZI_ASSERT(first<=last&&last<steps_);
+        if ( n ) buffers_.push_back({t,s,n,first,last});
+    }
+
+    void add_persistent( buffer_type t, vec3i const & s, size_t n )
+    {
+        add(t, s, n, 0, steps_ - 1);
+    }
+
+    memory_plan plan() const
+    {
+        memory_plan ret;
+
+        typedef std::tuple<buffer_type,vec3i> key_t;
+
+        std::map<key_t, std::vector<size_t>> live;
+        std::vector<size_t>                  bytes(steps_);
+
+        for ( auto & b: buffers_ )
+        {
+            auto & l = live[key_t(b.type,b.shape)];
+            l.resize(steps_);
+
+            size_t sz = memory_slot{b.type,b.shape,b.count}.bytes();
+
+            for ( size_t s = b.first; s <= b.last; ++s )
+            {
+                l[s]     += b.count;
+                bytes[s] += sz;
+            }
+
+            if ( b.first == 0 && b.last == steps_ - 1 )
+            {
+                ret.persistent_bytes += sz;
+            }
+        }
+
+        ret.peak_bytes = *std::max_element(bytes.begin(), bytes.end());
+
+        for ( auto & l: live )
+        {
+            memory_slot s{ std::get<0>(l.first), std::get<1>(l.first),
+                    *std::max_element(l.second.begin(), l.second.end()) };
+            ret.slot_bytes += s.bytes();
+            ret.slots.push_back(s);
+        }
+
+        return ret;
+    }
+};
+
+}}} // namespace znn::v4::parallel_network
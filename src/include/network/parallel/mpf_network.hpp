@@ -0,0 +1,428 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "network.hpp"
+#include "../../pooling/max_filter.hpp"
+
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace znn { namespace v4 { namespace parallel_network {
+
+// Dense inference with max-pooling fragments (MPF)
+//
+// The net is cut at its pooling layers (max_pool edges, and the
+// max_filter edges of the dense nets, whose stride equals their size)
+// into stages, each a network without pooling. The output of a stage is
+// max filtered once; each offset within the pooling window gives a
+// fragment, the windows at that offset, which the next stage takes as a
+// regular input. The outputs of the fragments of the last stage are
+// interleaved into the dense output. It equals the output of the net
+// with max_filter edges and sparse convolutions, but every convolution
+// is dense.
+//
+// The fragments of a stage are run at once, side by side along the rows
+// (the last dimension), every a[2] voxels for the fragments of size a.
+// A valid convolution keeps the output of a fragment at the start of its
+// stretch, the rest (mixing two fragments) is never read. Long rows keep
+// the direct convolutions as fast as the sparse ones, and a stage is a
+// single forward pass however many fragments it has.
+//
+class mpf_network
+{
+private:
+    struct stage
+    {
+        std::vector<options>     nodes  ;
+        std::vector<options>     edges  ;
+        std::string              input  ;
+        std::vector<std::string> outputs;
+        vec3i                    pool = vec3i::one; // after the stage
+        std::size_t              count  ; // fragments
+        vec3i                    insize ; // of a fragment
+        vec3i                    outsize;
+        std::unique_ptr<network> net    ;
+    };
+
+    std::vector<stage> stages_;
+    vec3i              outsz_ ;
+
+    // the pooling factor of a pooling layer, one for any other edge
+    static vec3i pooling( options const & e )
+    {
+        auto type = e.require_as<std::string>("type");
+
+        if ( type == "max_pool" )
+        {
+            return e.require_as<ovec3i>("size");
+        }
+
+        if ( type == "max_filter" )
+        {
+            vec3i size   = e.require_as<ovec3i>("size");
+            vec3i stride = e.require_as<ovec3i>("stride");
+
+            if ( stride == vec3i::one ) return vec3i::one;
+            if ( stride == size ) return size;
+
+            throw std::logic_error(HERE() + "mpf: max_filter " +
+                                   e.require_as<std::string>("name") +
+                                   " with a stride other than its size");
+        }
+
+        // would crop the fragments side by side as one
+        if ( type == "crop" )
+        {
+            throw std::logic_error(HERE() + "mpf: crop edge " +
+                                   e.require_as<std::string>("name"));
+        }
+
+        return vec3i::one;
+    }
+
+    void cut( std::vector<options> const & ns,
+              std::vector<options> const & es )
+    {
+        std::map<std::string, options const *>                  nodes;
+        std::map<std::string, std::vector<options const *>>     outs ;
+        std::string                                             input;
+
+        for ( auto & n: ns )
+        {
+            auto name = n.require_as<std::string>("name");
+            nodes[name] = &n;
+            if ( n.require_as<std::string>("type") == "input" )
+            {
+                if ( input.size() )
+                {
+                    throw std::logic_error(HERE() + "mpf: more than one "
+                                           "input");
+                }
+                input = name;
+            }
+        }
+
+        for ( auto & e: es )
+        {
+            outs[e.require_as<std::string>("input")].push_back(&e);
+        }
+
+        std::string    start = input;
+        options const* pool  = nullptr; // the one before the stage
+
+        while ( true )
+        {
+            stage s;
+
+            if ( pool )
+            {
+                // the fragments enter through an input node of the
+                // name of the pooling layer
+                auto name = pool->require_as<std::string>("name");
+                auto size = nodes[start]->require_as<size_t>("size");
+
+                s.input = name;
+                s.nodes.push_back(options().push("name", name)
+                                  .push("type", "input")
+                                  .push("size", size));
+                s.edges.push_back(options().push("name", name)
+                                  .push("type", "dummy")
+                                  .push("input", name)
+                                  .push("output", start));
+            }
+            else
+            {
+                s.input = input;
+            }
+
+            std::set<std::string>          seen{start};
+            std::vector<std::string>       queue{start};
+            std::vector<options const *>   pools;
+
+            while ( queue.size() )
+            {
+                auto n = queue.back();
+                queue.pop_back();
+
+                s.nodes.push_back(*nodes[n]);
+
+                if ( outs[n].empty() ) s.outputs.push_back(n);
+
+                for ( auto e: outs[n] )
+                {
+                    if ( pooling(*e) != vec3i::one )
+                    {
+                        pools.push_back(e);
+                        continue;
+                    }
+
+                    s.edges.push_back(*e);
+
+                    auto o = e->require_as<std::string>("output");
+                    if ( seen.insert(o).second ) queue.push_back(o);
+                }
+            }
+
+            // the edges into the stage have to come from the stage
+            for ( auto & e: es )
+            {
+                if ( seen.count(e.require_as<std::string>("output")) &&
+                     !seen.count(e.require_as<std::string>("input")) &&
+                     &e != pool )
+                {
+                    throw std::logic_error(HERE() + "mpf: the edge " +
+                                           e.require_as<std::string>("name")
+                                           + " enters the stage of " + start);
+                }
+            }
+
+            if ( pools.empty() )
+            {
+                stages_.push_back(std::move(s));
+                break;
+            }
+
+            auto from = pools[0]->require_as<std::string>("input");
+
+            if ( pools.size() > 1 || s.outputs.size() ||
+                 outs[from].size() > 1 )
+            {
+                throw std::logic_error(HERE() + "mpf: the stage of " + start
+                                       + " has to end with a single "
+                                       "pooling layer");
+            }
+
+            s.outputs.push_back(from);
+            s.pool = pooling(*pools[0]);
+            stages_.push_back(std::move(s));
+
+            pool  = pools[0];
+            start = pool->require_as<std::string>("output");
+        }
+    }
+
+    // d[do + i * ds] = s[so + i * ss] for i in [0, n)
+    static void strided_copy( cube<real> const & s,
+                              vec3i const & so,
+                              vec3i const & ss,
+                              cube<real> & d,
+                              vec3i const & dof,
+                              vec3i const & ds,
+                              vec3i const & n )
+    {
+        vec3i sz = size(s);
+        vec3i dz = size(d);
+
+        for ( long_t x = 0; x < n[0]; ++x )
+            for ( long_t y = 0; y < n[1]; ++y )
+            {
+                real const * sp = s.data()
+                    + ( ( so[0] + x * ss[0] ) * sz[1] + so[1] + y * ss[1] )
+                    * sz[2] + so[2];
+
+                real * dp = d.data()
+                    + ( ( dof[0] + x * ds[0] ) * dz[1] + dof[1] + y * ds[1] )
+                    * dz[2] + dof[2];
+
+                for ( long_t z = 0; z < n[2]; ++z )
+                {
+                    dp[z * ds[2]] = sp[z * ss[2]];
+                }
+            }
+    }
+
+    // the size of the fragments of a stage side by side
+    static vec3i stacked( vec3i const & s, std::size_t n, vec3i const & a )
+    {
+        return vec3i(s[0], s[1], a[2] * ( n - 1 ) + s[2]);
+    }
+
+public:
+    // outsz is the size of the dense output, a multiple of the product
+    // of the pooling factors
+    mpf_network( std::vector<options> const & ns,
+                 std::vector<options> const & es,
+                 vec3i const & outsz,
+                 size_t n_threads = 1 )
+        : outsz_(outsz)
+    {
+        cut(ns, es);
+
+        vec3i       factor = vec3i::one;
+        std::size_t count  = 1;
+
+        for ( auto & s: stages_ )
+        {
+            s.count = count;
+            factor *= s.pool;
+            count  *= s.pool[0] * s.pool[1] * s.pool[2];
+        }
+
+        if ( outsz % factor != vec3i::zero )
+        {
+            throw std::logic_error(HERE() + "mpf: the output size has to be "
+                                   "a multiple of the pooling factor");
+        }
+
+        // the output of a stage is the max filtered input of the
+        // fragments of the next one
+        vec3i o = outsz / factor;
+        for ( std::size_t k = stages_.size(); k-- > 0; )
+        {
+            stage & s = stages_[k];
+
+            s.outsize = o;
+            s.net = std::make_unique<network>(s.nodes, s.edges, o,
+                                              n_threads, phase::TEST);
+            s.insize = s.net->inputs()[s.input].first;
+
+            // the size of a fragment is known from the net of one
+            if ( s.count > 1 )
+            {
+                s.net.reset();
+                s.net = std::make_unique<network>
+                    (s.nodes, s.edges, stacked(o, s.count, s.insize),
+                     n_threads, phase::TEST);
+
+                ZI_ASSERT(s.net->inputs()[s.input].first ==
+                          stacked(s.insize, s.count, s.insize));
+            }
+
+            if ( k > 0 )
+            {
+                vec3i p = stages_[k-1].pool;
+                o = s.insize * p + p - vec3i::one;
+            }
+        }
+    }
+
+    std::size_t stages() const
+    {
+        return stages_.size();
+    }
+
+    vec3i fov() const
+    {
+        return stages_.front().insize - outsz_ + vec3i::one;
+    }
+
+    std::map<std::string, std::pair<vec3i,size_t>> inputs() const
+    {
+        return stages_.front().net->inputs();
+    }
+
+    std::map<std::string, std::pair<vec3i,size_t>> outputs() const
+    {
+        auto ret = stages_.back().net->outputs();
+        for ( auto & o: ret ) o.second.first = outsz_;
+        return ret;
+    }
+
+    std::map<std::string, std::vector<cube_p<real>>>
+    forward( std::map<std::string, std::vector<cube_p<real>>> && fin )
+    {
+        std::map<std::string, std::vector<cube_p<real>>> in
+            = std::move(fin);
+
+        // the origins of the fragments in the dense output, mult apart
+        std::vector<vec3i> origin{vec3i::zero};
+        vec3i              mult = vec3i::one;
+
+        for ( std::size_t k = 0; k + 1 < stages_.size(); ++k )
+        {
+            stage & s = stages_[k];
+            stage & t = stages_[k+1];
+            vec3i   p = s.pool;
+
+            auto out = s.net->forward(std::move(in));
+            in.clear();
+
+            std::vector<vec3i> next;
+            next.reserve(t.count);
+
+            for ( auto & f: out[s.outputs[0]] )
+            {
+                // the windows of the max filter don't leave the fragments
+                auto d = max_filter(*f, [](real a, real b){ return a>b; },
+                                    p).first;
+
+                auto r = get_cube<real>(stacked(t.insize, t.count,
+                                                t.insize));
+
+                std::size_t j = 0;
+                for ( std::size_t i = 0; i < s.count; ++i )
+                    for ( long_t x = 0; x < p[0]; ++x )
+                        for ( long_t y = 0; y < p[1]; ++y )
+                            for ( long_t z = 0; z < p[2]; ++z, ++j )
+                            {
+                                vec3i o(x, y, z);
+
+                                strided_copy(*d, o + vec3i(0, 0, i *
+                                                           s.insize[2]), p,
+                                             *r, vec3i(0, 0, j *
+                                                       t.insize[2]),
+                                             vec3i::one, t.insize);
+
+                                if ( next.size() < t.count )
+                                {
+                                    next.push_back(origin[i] + o * mult);
+                                }
+                            }
+
+                in[t.input].push_back(r);
+            }
+
+            origin.swap(next);
+            mult *= p;
+        }
+
+        stage & s = stages_.back();
+
+        auto out = s.net->forward(std::move(in));
+
+        std::map<std::string, std::vector<cube_p<real>>> ret;
+        for ( auto & f: out )
+        {
+            for ( auto & c: f.second )
+            {
+                auto r = get_cube<real>(outsz_);
+                for ( std::size_t i = 0; i < s.count; ++i )
+                {
+                    strided_copy(*c, vec3i(0, 0, i * s.insize[2]),
+                                 vec3i::one, *r, origin[i], mult,
+                                 s.outsize);
+                }
+                ret[f.first].push_back(r);
+            }
+        }
+
+        return ret;
+    }
+
+    void zap()
+    {
+        for ( auto & s: stages_ ) s.net->zap();
+    }
+};
+
+}}} // namespace znn::v4::parallel_network
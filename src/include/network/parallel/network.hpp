@@ -18,13 +18,23 @@
 #pragma once
 
 #include "edges.hpp"
+#include "execution_plan.hpp"
 #include "input_nodes.hpp"
+#include "memory_plan.hpp"
 #include "transfer_nodes.hpp"
+#include "tuning_cache.hpp"
+#include "cost_model.hpp"
 #include "maxout_nodes.hpp"
 #include "../../initializator/initializators.hpp"
 #include "../helpers.hpp"
 
+#include <algorithm>
+#include <limits>
 #include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <utility>
 #include <zi/time.hpp>
 
 namespace znn { namespace v4 { namespace parallel_network {
@@ -44,11 +54,23 @@ private:
 
         bool pool = false;
         bool crop = false;
+        bool fft  = false;
+
+        std::string type;
+
+        // estimated cost of a single edge and of the longest path
+        // from it to the end of the forward/backward pass
+        double cost     = 0;
+        double fwd_path = -1;
+        double bwd_path = -1;
+
+        size_t fwd_priority = 0;
+        size_t bwd_priority = 0;
 
         nnodes * in;
         nnodes * out;
 
-        options const * opts;
+        options         opts;
 
         std::unique_ptr<edges> dedges;
     };
@@ -58,12 +80,16 @@ private:
         vec3i fov       = vec3i::zero;
         vec3i stride    = vec3i::zero;
         vec3i fsize     = vec3i::zero;
+        size_t fmaps    = 0;
 
-        options const * opts;
+        options         opts;
 
         std::unique_ptr<nodes> dnodes;
         std::vector<nedges *> in, out;
 
+        double fwd_path = -1;
+        double bwd_path = -1;
+
         size_t fwd_priority = 0;
         size_t bwd_priority = 0;
     };
@@ -79,6 +105,7 @@ public:
     ~network()
     {
         zap();
+        plan_.reset();
         for ( auto& n: nodes_ ) delete n.second;
         for ( auto& e: edges_ ) delete e.second;
     }
@@ -122,12 +149,19 @@ private:
     // This is only temporary implementation and will be removed.
     std::map<std::string, nedges*> phase_dependent_edges_;
 
+    size_t       n_threads_;
     task_manager tm_;
 
     phase phase_;
 
+    std::unique_ptr<execution_plan> plan_;
+
+    // names of the iterations, for the tracer
+    std::uint32_t forward_trace_name_  = tracer.intern("forward") ;
+    std::uint32_t backward_trace_name_ = tracer.intern("backward");
+
 #ifdef ZNN_ANALYSE_TASK_MANAGER
-    void dump() { tm_.dump(); }
+    void dump() { tracer.write_chrome_trace("znn_trace.json"); }
 #endif
 
 
@@ -186,7 +220,7 @@ private:
         {
             vec3i real_stride = stride;
 
-            if ( n->opts->optional_as<int>("dense",0) )
+            if ( n->opts.optional_as<int>("dense",0) )
             {
                 real_stride = vec3i::one;
             }
@@ -206,40 +240,470 @@ private:
         }
     }
 
-    size_t fwd_priority_pass(nnodes* n)
+    static double volume( vec3i const & v )
+    {
+        return static_cast<double>(v[0]) * v[1] * v[2];
+    }
+
+    // size of the overlap-save tiles of an fft conv edge, zero when
+    // the edge transforms whole featuremaps
+    static vec3i fft_tile( nedges const * e )
     {
-        if ( n->fwd_priority > 0 )
+        if ( !e->fft || e->width == vec3i::one ||
+             e->opts.optional_as<ovec3i>("repeat", "1,1,1") != ovec3i::one )
         {
-            return n->fwd_priority;
+            return vec3i::zero;
         }
 
-        size_t p = 0;
+        return fft_tile_size(e->opts, e->in_fsize,
+                             ( e->width - vec3i::one ) * e->in_stride
+                             + vec3i::one);
+    }
 
-        for ( auto& e: n->in )
+    // a conv layer computed as matrix products (gemm_filter_edge)
+    static bool gemm_layer( nedges const * e )
+    {
+        return e->type == "conv" && !e->fft && !winograd_tile(e) &&
+            e->opts.optional_as<int>("gemm", "0") &&
+            e->opts.optional_as<ovec3i>("repeat", "1,1,1") == ovec3i::one;
+    }
+
+    // the tile of a conv layer computed with Winograd's minimal
+    // filtering (winograd_filter_edge), 0 if it isn't
+    static long_t winograd_tile( nedges const * e )
+    {
+        if ( e->type != "conv" || e->fft ||
+             e->opts.optional_as<ovec3i>("repeat", "1,1,1") != ovec3i::one ||
+             !winograd_convolution::eligible(e->width, e->in_stride) )
+        {
+            return 0;
+        }
+
+        return e->opts.optional_as<long_t>("winograd", "0");
+    }
+
+    // rough number of operations performed by a single edge
+    static double edge_cost( nedges const * e )
+    {
+        auto type = e->opts.require_as<std::string>("type");
+
+        if ( type == "conv" )
+        {
+            vec3i tile = fft_tile(e);
+            if ( tile != vec3i::zero )
+            {
+                // both transforms and the product of every tile
+                vec3i  k = e->in_fsize - e->out->fsize + vec3i::one;
+                vec3i  t = tile - k + vec3i::one;
+                double n = volume(tile);
+                double tiles = volume((e->out->fsize + t - vec3i::one) / t);
+
+                return tiles * ( 4 * n + 5 * n * std::log2(std::max(n, 2.0)) );
+            }
+
+            if ( e->opts.optional_as<int>("fft", "0") &&
+                 e->width != vec3i::one )
+            {
+                // pointwise product, plus the share of the transforms
+                // of the input and the output featuremaps
+                double n   = volume(e->in_fsize);
+                double fft = 2.5 * n * std::log2(std::max(n, 2.0));
+
+                return 4 * n
+                    + fft / e->out->opts.require_as<size_t>("size")
+                    + fft / e->in->opts.require_as<size_t>("size");
+            }
+
+            return volume(e->out->fsize) * volume(e->width);
+        }
+        else if ( type == "max_filter" )
         {
-            p = std::max(p, fwd_priority_pass(e->in));
+            return volume(e->out->fsize) * volume(e->width);
         }
 
-        n->fwd_priority = p + 1;
-        return n->fwd_priority;
+        return volume(e->in_fsize);
     }
 
-    size_t bwd_priority_pass(nnodes* n)
+    double fwd_path_pass(nnodes* n)
     {
-        if ( n->bwd_priority > 0 )
+        if ( n->fwd_path >= 0 )
         {
-            return n->bwd_priority;
+            return n->fwd_path;
         }
 
-        size_t p = n->fwd_priority;
+        double p = 0;
 
         for ( auto& e: n->out )
         {
-            p = std::max(p, bwd_priority_pass(e->out));
+            e->fwd_path = e->cost + fwd_path_pass(e->out);
+            p = std::max(p, e->fwd_path);
+        }
+
+        n->fwd_path = volume(n->fsize) + p;
+        return n->fwd_path;
+    }
+
+    double bwd_path_pass(nnodes* n)
+    {
+        if ( n->bwd_path >= 0 )
+        {
+            return n->bwd_path;
+        }
+
+        double p = 0;
+
+        for ( auto& e: n->in )
+        {
+            e->bwd_path = e->cost + bwd_path_pass(e->in);
+            p = std::max(p, e->bwd_path);
+        }
+
+        n->bwd_path = volume(n->fsize) + p;
+        return n->bwd_path;
+    }
+
+    // The priority of a task is the rank of the longest path from it
+    // to the end of the pass, so the expensive branches get started
+    // first (critical path scheduling)
+    void priority_pass()
+    {
+        for ( auto& e: edges_ )
+            e.second->cost = edge_cost(e.second);
+
+        for ( auto& o: input_nodes_ )
+            fwd_path_pass(o.second);
+        for ( auto& o: output_nodes_ )
+            bwd_path_pass(o.second);
+
+        std::vector<double> fwd, bwd;
+
+        for ( auto& n: nodes_ )
+        {
+            fwd.push_back(n.second->fwd_path);
+            bwd.push_back(n.second->bwd_path);
+        }
+
+        for ( auto& e: edges_ )
+        {
+            fwd.push_back(e.second->fwd_path);
+            bwd.push_back(e.second->bwd_path);
+        }
+
+        for ( auto* v: { &fwd, &bwd } )
+        {
+            std::sort(v->begin(), v->end());
+            v->erase(std::unique(v->begin(), v->end()), v->end());
+        }
+
+        auto rank = []( std::vector<double> const & v, double x )
+            {
+                return static_cast<size_t>
+                    (std::lower_bound(v.begin(), v.end(), x) - v.begin() + 1);
+            };
+
+        for ( auto& n: nodes_ )
+        {
+            n.second->fwd_priority = rank(fwd, n.second->fwd_path);
+            n.second->bwd_priority = rank(bwd, n.second->bwd_path);
+        }
+
+        for ( auto& e: edges_ )
+        {
+            e.second->fwd_priority = rank(fwd, e.second->fwd_path);
+            e.second->bwd_priority = rank(bwd, e.second->bwd_path);
+        }
+    }
+
+    // layer of the node group in the forward pass
+    static size_t level_pass( nnodes * n, std::map<nnodes*,size_t> & l )
+    {
+        if ( l.count(n) ) return l[n];
+
+        size_t r = 0;
+        for ( auto& e: n->in )
+        {
+            r = std::max(r, level_pass(e->in, l) + 1);
+        }
+        return l[n] = r;
+    }
+
+    // The buffers of a layer_filter_edge, f computes the outputs and b
+    // the input gradients: the scratch of the blocks in flight and the
+    // outputs; the scratch of the parts of the update and the reduced
+    // weight gradients, that can run until the end of the iteration, the
+    // padded gradients, the blocks in flight and the input gradients
+    template<class Conv>
+    void plan_layer( memory_planner & p,
+                     nedges const * e,
+                     Conv const & f,
+                     Conv const * b,
+                     size_t step,
+                     size_t back ) const
+    {
+        auto const R = buffer_type::real;
+
+        size_t ni     = e->in->fmaps;
+        size_t no     = e->out->fmaps;
+        size_t blocks = std::min(f.blocks(), n_threads_);
+
+        for ( auto const & s: f.forward_buffers() )
+        {
+            p.add(R, s, blocks, step, step);
+        }
+        p.add(R, e->out->fsize, no, step, step);
+
+        if ( phase_ != phase::TRAIN ) return;
+
+        size_t parts = std::max(blocks, static_cast<size_t>(1));
+
+        for ( auto const & s: f.update_buffers() )
+        {
+            p.add(R, s, parts, back, p.steps() - 1);
         }
+        p.add(R, e->width, std::min(ni * no, n_threads_), back,
+              p.steps() - 1);
 
-        n->bwd_priority = p + 1;
-        return n->bwd_priority;
+        blocks = std::min(b->blocks(), n_threads_);
+
+        p.add(R, e->in_fsize + ( e->width - vec3i::one ) * e->in_stride,
+              no, back, back);
+        for ( auto const & s: b->forward_buffers() )
+        {
+            p.add(R, s, blocks, back, back);
+        }
+        p.add(R, e->in_fsize, ni, back, back);
+    }
+
+    // The values and the offsets of the passes of the max filter of a
+    // pooling edge along each axis, the last offsets are kept for the
+    // backward pass (the last values are the output)
+    void plan_pooling( memory_planner & p,
+                       nedges const * e,
+                       size_t step ) const
+    {
+        auto const R = buffer_type::real;
+        auto const O = e->width[0] * e->width[1] * e->width[2] <= 256
+            ? buffer_type::offsets8 : buffer_type::offsets16;
+
+        vec3i  stride = e->pool ? vec3i::one : e->in_stride;
+        vec3i  by     = e->pool ? e->width   : vec3i::one;
+        size_t no     = e->out->fmaps;
+
+        vec3i cs    = e->in_fsize;
+        bool  first = true;
+
+        for ( size_t a = 0; a < 3; ++a )
+        {
+            if ( e->width[a] == 1 && by[a] == 1 ) continue;
+
+            if ( !first )
+            {
+                p.add(R, cs, no, step, step);
+                p.add(O, cs, no, step, step);
+            }
+
+            cs[a] = ( cs[a] - ( e->width[a] - 1 ) * stride[a] - 1 )
+                / by[a] + 1;
+            first = false;
+        }
+
+        p.add_persistent(O, cs, no);
+    }
+
+    // Lifetimes of the featuremaps, gradients and FFT buffers of an
+    // iteration, one step per layer in each pass. At most one product
+    // per thread is assumed in flight.
+    memory_plan memory_pass() const
+    {
+        std::map<nnodes*,size_t> level;
+
+        size_t layers = 0;
+        for ( auto& n: nodes_ )
+        {
+            layers = std::max(layers, level_pass(n.second, level) + 1);
+        }
+
+        bool train = ( phase_ == phase::TRAIN );
+
+        memory_planner p( train ? 2 * layers : layers );
+
+        auto fwd = [&]( nnodes * n ) { return level[n]; };
+        auto bwd = [&]( nnodes * n ) { return 2 * layers - 1 - level[n]; };
+
+        auto const R = buffer_type::real;
+        auto const C = buffer_type::complex;
+
+        // featuremaps are kept by the nodes until the next iteration
+        for ( auto& n: nodes_ )
+        {
+            p.add_persistent(R, n.second->fsize, n.second->fmaps);
+        }
+
+        for ( auto& x: edges_ )
+        {
+            nedges * e    = x.second;
+            auto &   type = e->type;
+            size_t   ni   = e->in->fmaps;
+            size_t   no   = e->out->fmaps;
+            size_t   step = fwd(e->out);
+            size_t   back = bwd(e->in);
+
+            if ( type == "conv" )
+            {
+                size_t inflight = std::min(ni * no, n_threads_);
+                vec3i  tile     = fft_tile(e);
+
+                if ( tile != vec3i::zero )
+                {
+                    vec3i rs = fftw::transformer::optimal_size(tile);
+                    vec3i cs = fft_complex_size(rs);
+
+                    // transforms of the filters, a tile and its transform
+                    // per edge in flight, the outputs
+#ifndef ZNN_DONT_CACHE_FFTS
+                    p.add_persistent(C, cs, ni * no);
+#endif
+                    p.add(R, rs, inflight, step, step);
+                    p.add(C, cs, inflight, step, step);
+                    p.add(R, e->out->fsize, inflight + no, step, step);
+
+                    if ( train )
+                    {
+                        p.add(R, rs, inflight, back, back);
+                        p.add(C, cs, 2 * inflight, back, back);
+                        p.add(R, e->in_fsize, inflight + ni, back, back);
+                    }
+                }
+                else if ( e->fft && e->width != vec3i::one )
+                {
+                    vec3i rs = fftw::transformer::optimal_size(e->in_fsize);
+                    vec3i cs = fft_complex_size(rs);
+
+                    // transforms of the inputs (kept for the update) and
+                    // of the filters
+                    p.add_persistent(C, cs, ni);
+                    p.add(R, rs, ni, fwd(e->in), fwd(e->in));
+#ifndef ZNN_DONT_CACHE_FFTS
+                    p.add_persistent(C, cs, ni * no);
+#endif
+                    // products, accumulated sums and their inverses
+                    p.add(C, cs, inflight + no, step, step);
+                    p.add(R, rs, no, step, step);
+
+                    if ( train )
+                    {
+                        // transforms of the gradients, kept until the
+                        // updates are done
+                        p.add(C, cs, no, bwd(e->out), p.steps() - 1);
+                        p.add(C, cs, inflight + ni, back, back);
+                        p.add(R, rs, inflight + ni, back, back);
+
+                        // the products, their inverses and the weight
+                        // gradients of the updates in flight, which
+                        // may run until the end of the iteration
+                        p.add(C, cs, inflight, back, p.steps() - 1);
+                        p.add(R, rs, inflight, back, p.steps() - 1);
+                        if ( rs != e->in_fsize )
+                        {
+                            p.add(R, e->in_fsize, inflight,
+                                  back, p.steps() - 1);
+                        }
+                        p.add(R, e->width, inflight, back, p.steps() - 1);
+                    }
+                }
+                else if ( long_t t = winograd_tile(e) )
+                {
+                    vec3i o = e->width - vec3i::one;
+
+                    winograd_convolution f(ni, no, e->in_fsize, e->width,
+                                           e->in_stride, n_threads_, t);
+                    if ( train )
+                    {
+                        winograd_convolution b(no, ni, e->in_fsize + o,
+                                               e->width, e->in_stride,
+                                               n_threads_, t);
+                        plan_layer(p, e, f, &b, step, back);
+                    }
+                    else
+                    {
+                        plan_layer(p, e, f, &f, step, back);
+                    }
+                }
+                else if ( gemm_layer(e) )
+                {
+                    vec3i o = ( e->width - vec3i::one ) * e->in_stride;
+
+                    gemm_convolution f(ni, no, e->in_fsize, e->width,
+                                       e->in_stride, n_threads_);
+                    if ( train )
+                    {
+                        gemm_convolution b(no, ni, e->in_fsize + o, e->width,
+                                           e->in_stride, n_threads_);
+                        plan_layer(p, e, f, &b, step, back);
+                    }
+                    else
+                    {
+                        plan_layer(p, e, f, &f, step, back);
+                    }
+                }
+                else
+                {
+                    p.add(R, e->out->fsize, inflight + no, step, step);
+
+                    if ( train )
+                    {
+                        p.add(R, e->in_fsize, inflight + ni, back, back);
+
+                        // the weight gradients of the updates in flight,
+                        // which may run until the end of the iteration
+                        p.add(R, e->width, inflight, back, p.steps() - 1);
+                    }
+                }
+            }
+            else
+            {
+                // one to one edges
+                p.add(R, e->out->fsize, no, step, step);
+
+                if ( type == "max_filter" || type == "max_pool" )
+                {
+                    plan_pooling(p, e, step);
+                }
+                else if ( type == "dropout" )
+                {
+                    p.add_persistent(buffer_type::mask, e->in_fsize, no);
+                }
+
+                if ( train )
+                {
+                    p.add(R, e->in_fsize, ni, back, back);
+                }
+            }
+        }
+
+        // gradients of the featuremaps, until consumed by all the
+        // incoming edges
+        if ( train )
+        {
+            for ( auto& n: nodes_ )
+            {
+                size_t first = bwd(n.second);
+                size_t last  = first;
+
+                for ( auto& e: n.second->in )
+                {
+                    last = std::max(last, bwd(e->in));
+                }
+
+                if ( n.second->in.size() )
+                {
+                    p.add(R, n.second->fsize, n.second->fmaps,
+                          first, last);
+                }
+            }
+        }
+
+        return p.plan();
     }
 
     // [kisuklee]
@@ -266,10 +730,7 @@ private:
         for ( auto& o: output_nodes_ )
             fov_pass(o.second, vec3i::one, outsz);
 
-        for ( auto& o: output_nodes_ )
-            fwd_priority_pass(o.second);
-        for ( auto& o: input_nodes_ )
-            bwd_priority_pass(o.second);
+        priority_pass();
 
         // for ( auto& o: nodes_ )
         // {
@@ -295,7 +756,8 @@ private:
 
         ZI_ASSERT(nodes_.count(name)==0);
         nnodes* ns = new nnodes;
-        ns->opts = &op;
+        ns->opts = op;
+        ns->fmaps = op.require_as<size_t>("size");
         nodes_[name] = ns;
 
         if ( type == "input" )
@@ -304,38 +766,57 @@ private:
         }
     }
 
+    // all the transforms of the network are planned before any of them
+    // is used, the FFTW planner is not thread safe
+    void prebuild_fft_plans()
+    {
+        std::set<vec3i> sizes;
+        for ( auto & e: edges_ )
+        {
+            if ( e.second->type == "conv" && e.second->fft &&
+                 e.second->width != vec3i::one )
+            {
+                vec3i tile = fft_tile(e.second);
+                sizes.insert(fftw::transformer::optimal_size(
+                    tile == vec3i::zero ? e.second->in_fsize : tile));
+            }
+        }
+
+        for ( auto & s: sizes ) fft_plans.prebuild(s);
+    }
+
     void create_edges()
     {
         for ( auto & e: edges_ )
         {
-            auto opts = e.second->opts;
-            auto type = opts->require_as<std::string>("type");
+            auto const & opts = e.second->opts;
+            auto type = opts.require_as<std::string>("type");
             nodes * in  = e.second->in->dnodes.get();
             nodes * out = e.second->out->dnodes.get();
 
 
-            oss_ << e.second->opts->require_as<std::string>("input")
+            oss_ << e.second->opts.require_as<std::string>("input")
                  << " -> "
-                 << e.second->opts->require_as<std::string>("output")
+                 << e.second->opts.require_as<std::string>("output")
                  << " [label=\"" + e.first + "\"];\n";
 
 
             if ( type == "max_filter" )
             {
                 e.second->dedges = std::make_unique<edges>
-                    ( in, out, *opts, e.second->in_stride,
+                    ( in, out, opts, e.second->in_stride,
                       e.second->in_fsize, tm_, edges::max_pooling_tag() );
             }
             else if ( type == "max_pool" )
             {
                 e.second->dedges = std::make_unique<edges>
-                    ( in, out, *opts,
+                    ( in, out, opts,
                       e.second->in_fsize, tm_, edges::real_pooling_tag() );
             }
             else if ( type == "conv" )
             {
                 e.second->dedges = std::make_unique<edges>
-                    ( in, out, *opts, e.second->in_stride,
+                    ( in, out, opts, e.second->in_stride,
                       e.second->in_fsize, tm_, edges::filter_tag() );
             }
             else if ( type == "dropout" )
@@ -347,13 +828,13 @@ private:
                 // the effectiveness is yet to be proven.
 
                 e.second->dedges = std::make_unique<edges>
-                    ( in, out, *opts, e.second->in_fsize,
+                    ( in, out, opts, e.second->in_fsize,
                       tm_, phase_, edges::dropout_tag() );
             }
             else if ( type == "crop" )
             {
                 e.second->dedges = std::make_unique<edges>
-                    ( in, out, *opts, tm_, edges::crop_tag() );
+                    ( in, out, opts, tm_, edges::crop_tag() );
             }
             else if ( type == "maxout")
             {
@@ -361,19 +842,20 @@ private:
                 STRONG_ASSERT(dynamic_cast<maxout_nodes*>(out));
 
                 e.second->dedges = std::make_unique<edges>
-                    ( in, out, *opts, tm_, edges::maxout_tag() );
+                    ( in, out, opts, tm_, edges::maxout_tag() );
             }
             else if ( type == "dummy" )
             {
                 e.second->dedges = std::make_unique<edges>
-                    ( in, out, *opts, tm_, edges::dummy_tag() );
+                    ( in, out, opts, tm_, edges::dummy_tag() );
             }
             else
             {
                 throw std::logic_error(HERE() + "unknown edges type: " + type);
             }
 
-            e.second->opts = nullptr;
+            e.second->dedges->set_priorities(e.second->fwd_priority,
+                                             e.second->bwd_priority);
         }
     }
 
@@ -385,8 +867,8 @@ private:
 
         for ( auto & n: nodes_ )
         {
-            auto type = n.second->opts->require_as<std::string>("type");
-            auto sz   = n.second->opts->require_as<size_t>("size");
+            auto type = n.second->opts.require_as<std::string>("type");
+            auto sz   = n.second->opts.require_as<size_t>("size");
 
             oss_ << n.first
                  << " [label=\"" + n.first + "\", shape=\"circle\"];\n";
@@ -406,26 +888,24 @@ private:
             if ( type == "input" )
             {
                 n.second->dnodes = std::make_unique<input_nodes>
-                    (sz,n.second->fsize,*n.second->opts,tm_,fwd_p,bwd_p);
+                    (sz,n.second->fsize,n.second->opts,tm_,fwd_p,bwd_p);
             }
             else if ( (type == "sum") || (type == "transfer") )
             {
                 n.second->dnodes = std::make_unique<transfer_nodes>
-                    ( sz, n.second->fsize, *n.second->opts, tm_,
+                    ( sz, n.second->fsize, n.second->opts, tm_,
                       fwd_p,bwd_p,n.second->out.size()==0 );
             }
             else if ( type == "maxout" )
             {
                 n.second->dnodes = std::make_unique<maxout_nodes>
-                    ( sz, n.second->fsize, *n.second->opts, tm_,
+                    ( sz, n.second->fsize, n.second->opts, tm_,
                       fwd_p,bwd_p,n.second->out.size()==0 );
             }
             else
             {
                 throw std::logic_error(HERE() + "unknown nodes type: " + type);
             }
-
-            n.second->opts = nullptr;
         }
     }
 
@@ -441,7 +921,9 @@ private:
         ZI_ASSERT(nodes_.count(in)&&nodes_.count(out));
 
         nedges * es = new nedges;
-        es->opts    = &op;
+        es->opts    = op;
+        es->type    = type;
+        es->fft     = op.optional_as<int>("fft", "0");
         es->in      = nodes_[in];
         es->out     = nodes_[out];
         es->pool    = false;
@@ -491,19 +973,40 @@ private:
     }
 
 
+    struct graph_only_tag {};
+
+    // only the shapes, no nodes/edges are created
+    network( std::vector<options> const & ns,
+             std::vector<options> const & es,
+             vec3i const & outsz,
+             size_t n_threads,
+             phase phs,
+             graph_only_tag )
+        : n_threads_(n_threads)
+        , tm_(0)
+        , phase_(phs)
+    {
+        for ( auto& n: ns ) add_nodes(n);
+        for ( auto& e: es ) add_edges(e);
+        init(outsz);
+    }
+
 public:
     network( std::vector<options> const & ns,
              std::vector<options> const & es,
              vec3i const & outsz,
              size_t n_threads = 1,
              phase phs = phase::TRAIN )
-        : tm_(n_threads)
+        : n_threads_(n_threads)
+        , tm_(n_threads)
         , phase_(phs)
     {
         for ( auto& n: ns ) add_nodes(n);
         for ( auto& e: es ) add_edges(e);
         init(outsz);
 
+        prebuild_fft_plans();
+
         oss_ << "digraph {\n";
 
         create_nodes();
@@ -572,9 +1075,89 @@ public:
         return ret;
     }
 
+    // Predicted memory use of an iteration, without constructing the
+    // network
+    static memory_plan plan_memory( std::vector<options> const & ns,
+                                    std::vector<options> const & es,
+                                    vec3i const & outsz,
+                                    size_t n_threads = 1,
+                                    phase phs = phase::TRAIN )
+    {
+        network net(ns, es, outsz, n_threads, phs, graph_only_tag());
+        return net.memory_pass();
+    }
+
+    memory_plan plan_memory() const
+    {
+        return memory_pass();
+    }
+
+    // Sizes of the inputs of the convolutional layers (the sizes of
+    // their transforms when done with FFTs, before padding)
+    static std::map<std::string, vec3i>
+    conv_input_sizes( std::vector<options> const & ns,
+                      std::vector<options> const & es,
+                      vec3i const & outsz )
+    {
+        network net(ns, es, outsz, 1, phase::TEST, graph_only_tag());
+
+        std::map<std::string, vec3i> ret;
+        for ( auto & e: net.edges_ )
+        {
+            if ( e.second->type == "conv" )
+            {
+                ret[e.first] = e.second->in_fsize;
+            }
+        }
+        return ret;
+    }
+
+    // fill the cube pool with all the buffers of the plan, so the
+    // iterations don't have to allocate. The buffers are not assigned
+    // to the slots of the plan, the edges and nodes keep getting them
+    // from the pool; after the first iteration the pool holds enough of
+    // each size (src/cpp/memory_plan.cpp fails if it doesn't).
+    void preallocate()
+    {
+        zap();
+        memory_pass().preallocate();
+    }
+
+    // Replace the dynamic dispatch of the forward pass with a static
+    // plan built from the current graph. Has to be called again after
+    // enabling/disabling parts of the network.
+    void compile()
+    {
+        zap();
+        plan_.reset();
+
+        std::vector<nodes*> ns;
+        std::vector<edges*> es;
+
+        for ( auto & n: nodes_ ) ns.push_back(n.second->dnodes.get());
+        for ( auto & e: edges_ ) es.push_back(e.second->dedges.get());
+
+        plan_ = std::make_unique<execution_plan>(ns, es, tm_, n_threads_);
+    }
+
+    void uncompile()
+    {
+        zap();
+        plan_.reset();
+    }
+
+    bool compiled() const
+    {
+        return static_cast<bool>(plan_);
+    }
+
     std::map<std::string, std::vector<cube_p<real>>>
     forward( std::map<std::string, std::vector<cube_p<real>>> && fin )
     {
+        trace_scope ts(trace_kind::iteration, forward_trace_name_, 0);
+
+        if ( plan_ ) plan_->reset();
+
         ZI_ASSERT(fin.size()==input_nodes_.size());
         for ( auto & in: fin )
         {
@@ -590,6 +1173,8 @@ public:
             }
         }
 
+        if ( plan_ ) plan_->wait();
+
         std::map<std::string, std::vector<cube_p<real>>> ret;
         for ( auto & l: output_nodes_ )
         {
@@ -603,6 +1188,8 @@ public:
     std::map<std::string, std::vector<cube_p<real>>>
     backward( std::map<std::string, std::vector<cube_p<real>>> && fout )
     {
+        trace_scope ts(trace_kind::iteration, backward_trace_name_, 0);
+
         ZI_ASSERT(fout.size()==input_nodes_.size());
         for ( auto & out: fout )
         {
@@ -645,242 +1232,407 @@ public:
     void zap()
     {
         for ( auto & n: nodes_ )
-            n.second->dnodes->zap();
+            if ( n.second->dnodes ) n.second->dnodes->zap();
 
         for ( auto & e: edges_ )
-            e.second->dedges->zap();
+            if ( e.second->dedges ) e.second->dedges->zap();
     }
 
-    static void optimize( std::vector<options> & ns,
-                          std::vector<options> & es,
-                          vec3i const & outsz,
-                          size_t n_threads = 1,
-                          size_t rounds = 10)
+private:
+    // time of rounds-1 iterations (forward only unless train) of the
+    // network with the edge options es, after the first forward pass
+    static real time_rounds(
+        std::vector<options> & ns,
+        std::vector<options> & es,
+        vec3i const & outsz,
+        size_t n_threads,
+        std::vector<std::map<std::string, std::vector<cube_p<real>>>>
+        const & allins,
+        std::vector<std::map<std::string, std::vector<cube_p<real>>>>
+        const & allouts,
+        size_t rounds,
+        bool train )
     {
-        std::vector<options*> edge_groups;
-        for ( auto & e: es )
+        network net(ns,es,outsz,n_threads);
+
+        auto is = copy_samples(allins);
+        auto os = copy_samples(allouts);
+
+        zi::wall_timer wt;
+        net.forward(std::move(is[0]));
+
+        wt.reset();
+
+        for ( size_t i = 0; i < rounds-1; ++i )
         {
-            if ( e.require_as<std::string>("type") == "conv" )
-            {
-                edge_groups.push_back(&e);
-                e.push("fft",1);
-            }
+            if ( train ) net.backward(std::move(os[i]));
+            net.forward(std::move(is[i+1]));
         }
 
-        std::cout << "Total of " << edge_groups.size()
-                  << " to optimize\n\n";
+        real r = wt.elapsed<real>();
+        net.zap();
+        return r;
+    }
 
-        // generate 10 inputs and outputs
-        network net(ns,es,outsz,n_threads);
+    // the options of the conv edges e for the choice c: direct, fft,
+    // fft_tiled (fft_tiled_filter_edge, auto tiles), gemm
+    // (gemm_filter_edge), winograd2 or winograd4 (winograd_filter_edge)
+    static void set_conv( options & e, std::string const & c )
+    {
+        e.push("fft", c == "fft" || c == "fft_tiled" ? 1 : 0);
+        e.push("fft_tile", c == "fft_tiled" ? "auto" : "0");
+        e.push("gemm", c == "gemm" ? 1 : 0);
+        e.push("winograd", c == "winograd2" ? 2 : c == "winograd4" ? 4 : 0);
+    }
 
-        std::vector<std::map<std::string, std::vector<cube_p<real>>>>
-            allins, allouts;
+    static char const * conv_name( std::string const & c )
+    {
+        if ( c == "fft"       ) return "FFT";
+        if ( c == "fft_tiled" ) return "tiled FFT";
+        if ( c == "gemm"      ) return "GEMM";
+        if ( c == "winograd2" ) return "Winograd F(2,3)";
+        if ( c == "winograd4" ) return "Winograd F(4,3)";
+        return "direct";
+    }
+
+    // key of the conv edges e in the tuning cache, everything the
+    // times of the convolutions depend on
+    static std::string tuning_key( nedges const * e,
+                                   vec3i const & outsz,
+                                   size_t n_threads,
+                                   bool train )
+    {
+        std::ostringstream key;
 
+        auto vec = [&]( vec3i const & v ) -> std::ostream &
+            {
+                return key << v[0] << ',' << v[1] << ',' << v[2];
+            };
+
+        key << "cpu=" << tuning_cache_impl::cpu_model()
+            << ";simd=" << simd::isa_name(simd::active_isa())
+            << ";real=" << ( sizeof(real) == 4 ? "float" : "double" )
+            << ";threads=" << n_threads
+            << ";pass=" << ( train ? "train" : "forward" )
+            << ";tile_bytes=" << fft_tiles.budget()
+            << ";in=" << e->in->fmaps << '@';
+        vec(e->in_fsize) << ";out=" << e->out->fmaps << ";size=";
+        vec(e->width) << ";stride=";
+        vec(e->in_stride) << ";repeat=";
+        vec(e->opts.optional_as<ovec3i>("repeat", "1,1,1")) << ";outsz=";
+        vec(outsz);
+
+        return key.str();
+    }
 
-        std::cout << "Create samples...";
+    // a conv edge group to be optimized
+    struct conv_group
+    {
+        options *                opts      ;
+        std::string              key       ; // in the tuning cache
+        conv_layer               layer     ;
+        std::vector<std::string> candidates; // see set_conv
+    };
+
+    static conv_group make_conv_group( options & o,
+                                       nedges const * e,
+                                       std::string const & key )
+    {
+        bool single = e->opts.optional_as<ovec3i>("repeat", "1,1,1")
+            == ovec3i::one;
 
-        std::tie(allins, allouts) = generate_inout(rounds,net);
+        conv_group g;
+        g.opts = &o;
+        g.key  = key;
 
-        std::cout << "DONE\nFFT Warmup..." << std::flush;
+        g.layer.n      = e->in->fmaps;
+        g.layer.m      = e->out->fmaps;
+        g.layer.in     = e->in_fsize;
+        g.layer.width  = e->width;
+        g.layer.stride = e->in_stride;
+        g.layer.input  =
+            e->in->opts.require_as<std::string>("type") == "input";
+        g.layer.exact  = single;
 
+        g.candidates.push_back("direct");
+
+        if ( e->width != vec3i::one ) g.candidates.push_back("fft");
+
+        if ( single )
         {
-            auto is = copy_samples(allins);
-            auto os = copy_samples(allouts);
-            net.forward(std::move(is[0]));
-            net.backward(std::move(os[0]));
-            net.zap();
+            if ( e->width != vec3i::one )
+            {
+                g.candidates.push_back("fft_tiled");
+            }
+            g.candidates.push_back("gemm");
+            if ( winograd_convolution::eligible(e->width, e->in_stride) )
+            {
+                g.candidates.push_back("winograd2");
+                g.candidates.push_back("winograd4");
+            }
         }
 
-        std::cout << "DONE\nTrying all FFTs..." << std::flush;
-
-        real tot_time = 0;
+        return g;
+    }
 
+    // Resets the conv edge groups of es to FFTs and applies the choices
+    // found in the tuning cache; returns the groups to be optimized
+    static std::vector<conv_group>
+    cached_convs( std::vector<options> & ns,
+                  std::vector<options> & es,
+                  vec3i const & outsz,
+                  size_t n_threads,
+                  bool train )
+    {
+        for ( auto & e: es )
         {
-            network net(ns,es,outsz,n_threads);
+            if ( e.require_as<std::string>("type") == "conv" )
+            {
+                set_conv(e, "fft");
+            }
+        }
 
-            auto is = copy_samples(allins);
-            auto os = copy_samples(allouts);
+        network net(ns, es, outsz, n_threads,
+                    train ? phase::TRAIN : phase::TEST, graph_only_tag());
 
-            zi::wall_timer wt;
-            net.forward(std::move(is[0]));
+        std::vector<conv_group> ret;
 
-            wt.reset();
+        for ( auto & e: es )
+        {
+            if ( e.require_as<std::string>("type") != "conv" ) continue;
 
-            for ( size_t i = 0; i < rounds-1; ++i )
+            auto name = e.require_as<std::string>("name");
+            auto key  = tuning_key(net.edges_[name], outsz, n_threads,
+                                   train);
+
+            std::string choice;
+            if ( tuning_cache.lookup(key, choice) )
             {
-                net.backward(std::move(os[i]));
-                net.forward(std::move(is[i+1]));
+                std::cout << "Edge group " << name << ": " << choice
+                          << " (cached)" << std::endl;
+                set_conv(e, choice);
+            }
+            else
+            {
+                ret.push_back(make_conv_group(e, net.edges_[name], key));
             }
+        }
 
-            tot_time = wt.elapsed<real>();
+        return ret;
+    }
 
-            //net.backward(std::move(os[rounds-1]));
-            net.zap();
+    // Chooses the convolutions of the conv edge groups of es not found in
+    // the tuning cache. The cost model predicts the time of each
+    // candidate; the ones within margin (relative) of the best, and the
+    // ones the model doesn't cover, are timed within the network, one
+    // group after the other with the choices of the others in place
+    static void optimize_convs( std::vector<options> & ns,
+                                std::vector<options> & es,
+                                vec3i const & outsz,
+                                size_t n_threads,
+                                size_t rounds,
+                                bool train,
+                                real margin )
+    {
+        auto edge_groups = cached_convs(ns, es, outsz, n_threads, train);
 
-#ifdef ZNN_ANALYSE_TASK_MANAGER
-            std::cout << "HERE";
-            net.dump();
-#endif
+        std::cout << "Total of " << edge_groups.size()
+                  << " to optimize\n\n";
 
+        if ( edge_groups.empty() ) return;
 
-            std::cout << (tot_time/(rounds-1)) << " secs" << std::endl;
-        }
+        conv_cost_model model(n_threads);
+
+        // the groups to be timed, with the candidates to try
+        std::vector<std::pair<conv_group*, std::vector<std::string>>> ties;
 
-        //std::vector<options*> edge_groups;
-        for ( auto & e: edge_groups )
+        zi::wall_timer mt;
+
+        for ( auto & g: edge_groups )
         {
-            std::cout << "Trying edge group: "
-                      << e->require_as<std::string>("name")
-                      << " ..." << std::flush;
-            e->push("fft","0");
+            std::cout << "Modeling edge group: "
+                      << g.opts->require_as<std::string>("name")
+                      << std::endl;
 
-            network net(ns,es,outsz,n_threads);
+            std::vector<std::pair<double, std::string>> predicted;
+            double best = std::numeric_limits<double>::max();
 
-            auto is = copy_samples(allins);
-            auto os = copy_samples(allouts);
+            for ( auto const & c: g.candidates )
+            {
+                double t = model.predict(g.layer, c, train);
 
-            zi::wall_timer wt;
-            net.forward(std::move(is[0]));
+                std::cout << "   " << conv_name(c) << " ... ";
+                if ( t < 0 )
+                {
+                    std::cout << "not modeled" << std::endl;
+                    t = std::numeric_limits<double>::max();
+                }
+                else
+                {
+                    std::cout << t << " secs" << std::endl;
+                    best = std::min(best, t);
+                }
 
-            wt.reset();
+                predicted.emplace_back(t, c);
+            }
 
-            for ( size_t i = 0; i < rounds-1; ++i )
+            // the predicted best first, it's used while the other groups
+            // are timed
+            std::stable_sort(predicted.begin(), predicted.end(),
+                             []( std::pair<double, std::string> const & a,
+                                 std::pair<double, std::string> const & b )
+                             {
+                                 return a.first < b.first;
+                             });
+
+            std::vector<std::string> close;
+            for ( auto const & p: predicted )
             {
-                net.backward(std::move(os[i]));
-                net.forward(std::move(is[i+1]));
+                if ( p.first == std::numeric_limits<double>::max() ||
+                     p.first <= best * ( 1 + margin ) )
+                {
+                    close.push_back(p.second);
+                }
             }
 
-            //net.backward(std::move(os[rounds-1]));
-
-            real my_time = wt.elapsed<real>();
+            set_conv(*g.opts, close[0]);
 
-            std::cout <<  (my_time/(rounds-1)) << " secs" << std::endl;
-
-            if ( my_time < tot_time )
+            if ( close.size() == 1 )
             {
-                tot_time = my_time;
-                std::cout << "   will use direct convolution" << std::endl;
+                std::cout << "   will use " << conv_name(close[0])
+                          << " convolution" << std::endl;
+                tuning_cache.store(g.key, close[0]);
             }
             else
             {
-                std::cout << "   will use FFT convolution" << std::endl;
-                e->push("fft","1");
-            }
-        }
-    }
-
-    static void optimize_forward( std::vector<options> & ns,
-                                  std::vector<options> & es,
-                                  vec3i const & outsz,
-                                  size_t n_threads = 1,
-                                  size_t rounds = 10 )
-    {
-        std::vector<options*> edge_groups;
-        for ( auto & e: es )
-        {
-            if ( e.require_as<std::string>("type") == "conv" )
-            {
-                edge_groups.push_back(&e);
-                e.push("fft",1);
+                ties.emplace_back(&g, close);
             }
         }
 
-        std::cout << "Total of " << edge_groups.size()
-                  << " to optimize\n\n";
-
-        // generate 10 inputs and outputs
-        network net(ns,es,outsz,n_threads);
-        auto ins  = net.inputs();
-        auto outs = net.outputs();
+        std::cout << "Modeling: " << mt.elapsed<double>() << " secs, "
+                  << ties.size() << " edge groups to time\n\n";
 
         std::vector<std::map<std::string, std::vector<cube_p<real>>>>
             allins, allouts;
 
-        std::cout << "Create samples...";
+        if ( !ties.empty() )
+        {
+            network net(ns,es,outsz,n_threads);
 
-        std::tie(allins, allouts) = generate_inout(rounds,net);
+            std::cout << "Create samples...";
 
-        std::cout << "DONE\nFFT Warmup..." << std::flush;
+            std::tie(allins, allouts) = generate_inout(rounds,net);
 
-        {
-            auto is = copy_samples(allins);
-            auto os = copy_samples(allouts);
-            net.forward(std::move(is[0]));
-            //net.backward(std::move(os[0]));
-            net.zap();
-        }
+            std::cout << "DONE\nFFT Warmup..." << std::flush;
 
-        std::cout << "DONE\nTrying all FFTs..." << std::flush;
+            {
+                auto is = copy_samples(allins);
+                auto os = copy_samples(allouts);
+                net.forward(std::move(is[0]));
+                if ( train ) net.backward(std::move(os[0]));
+                net.zap();
+            }
 
-        real tot_time = 0;
+            std::cout << "DONE" << std::endl;
+        }
 
+        for ( auto & t: ties )
         {
-            network net(ns,es,outsz,n_threads);
+            conv_group & g = *t.first;
 
-            auto is = copy_samples(allins);
-            auto os = copy_samples(allouts);
-
-            zi::wall_timer wt;
-            net.forward(std::move(is[0]));
+            std::cout << "Trying edge group: "
+                      << g.opts->require_as<std::string>("name")
+                      << std::endl;
 
-            wt.reset();
+            real        best = std::numeric_limits<real>::max();
+            std::string chosen;
 
-            for ( size_t i = 0; i < rounds-1; ++i )
+            for ( auto const & c: t.second )
             {
-                //net.backward(std::move(os[i]));
-                net.forward(std::move(is[i+1]));
-            }
+                std::cout << "   " << conv_name(c) << " ..." << std::flush;
+                set_conv(*g.opts, c);
 
-            //net.backward(std::move(os[rounds-1]));
+                real my_time = time_rounds(ns, es, outsz, n_threads,
+                                           allins, allouts, rounds, train);
 
-            tot_time = wt.elapsed<real>();
+                std::cout << (my_time/(rounds-1)) << " secs" << std::endl;
 
-            net.zap();
+                if ( my_time < best )
+                {
+                    best   = my_time;
+                    chosen = c;
+                }
+            }
+
+            std::cout << "   will use " << conv_name(chosen)
+                      << " convolution" << std::endl;
 
-            std::cout << (tot_time/(rounds-1)) << " secs" << std::endl;
+            set_conv(*g.opts, chosen);
+            tuning_cache.store(g.key, chosen);
         }
 
-        //std::vector<options*> edge_groups;
-        for ( auto & e: edge_groups )
+#ifdef ZNN_ANALYSE_TASK_MANAGER
+        // the trace of the chosen convolutions
         {
-            std::cout << "Trying edge group: "
-                      << e->require_as<std::string>("name")
-                      << " ..." << std::flush;
-            e->push("fft","0");
-
             network net(ns,es,outsz,n_threads);
 
+            if ( allins.empty() )
+            {
+                std::tie(allins, allouts) = generate_inout(rounds,net);
+            }
+
             auto is = copy_samples(allins);
             auto os = copy_samples(allouts);
 
-            zi::wall_timer wt;
             net.forward(std::move(is[0]));
 
-            wt.reset();
+            tracer.enable();
 
             for ( size_t i = 0; i < rounds-1; ++i )
             {
-                //net.backward(std::move(os[i]));
+                if ( train ) net.backward(std::move(os[i]));
                 net.forward(std::move(is[i+1]));
             }
 
-            //net.backward(std::move(os[rounds-1]));
+            net.zap();
 
-            real my_time = wt.elapsed<real>();
+            tracer.enable(false);
+            net.dump();
+        }
+#endif
 
-            std::cout << (my_time/(rounds-1)) << " secs" << std::endl;
+        tuning_cache.flush();
 
-            if ( my_time < tot_time )
-            {
-                tot_time = my_time;
-                std::cout << "   will use direct convolution" << std::endl;
-            }
-            else
-            {
-                std::cout << "   will use FFT convolution" << std::endl;
-                e->push("fft","1");
-            }
-        }
+        // release the cubes of the sizes only the discarded
+        // configurations used
+        trim_cube_pool();
+
+        std::cout << "FFT planning: " << fft_plans.planning_time()
+                  << " secs (" << fft_plans.plans_created()
+                  << " plans)" << std::endl;
+    }
+
+public:
+    // margin: the candidates predicted within margin of the best are
+    // timed, an infinite margin times them all
+    static void optimize( std::vector<options> & ns,
+                          std::vector<options> & es,
+                          vec3i const & outsz,
+                          size_t n_threads = 1,
+                          size_t rounds = 10,
+                          real margin = 0.2 )
+    {
+        optimize_convs(ns, es, outsz, n_threads, rounds, true, margin);
+    }
+
+    static void optimize_forward( std::vector<options> & ns,
+                                  std::vector<options> & es,
+                                  vec3i const & outsz,
+                                  size_t n_threads = 1,
+                                  size_t rounds = 10,
+                                  real margin = 0.2 )
+    {
+        optimize_convs(ns, es, outsz, n_threads, rounds, false, margin);
     }
 
     static void force_fft( std::vector<options> & es )
@@ -22,12 +22,27 @@
 #include "../../utils/task_manager.hpp"
 #include "../../cube/cube.hpp"
 
+#ifdef ZNN_NUMA
+#  include "../../utils/numa.hpp"
+#endif
+
 namespace znn { namespace v4 { namespace parallel_network {
 
 enum class phase : std::uint8_t {TRAIN = 0, TEST = 1};
 
 // Forward definition
 class edge;
+class nodes;
+
+// Gets the completed featuremaps instead of the forward dispatchers,
+// see execution_plan
+class forward_listener
+{
+public:
+    virtual ~forward_listener() {}
+    virtual void featuremap_done( nodes *, size_t,
+                                  ccube_p<real> const & ) = 0;
+};
 
 class nodes
 {
@@ -42,6 +57,8 @@ private:
     size_t const   fwd_priority_;
     size_t const   bwd_priority_;
 
+    forward_listener * listener_ = nullptr;
+
 protected:
     real           patch_sz_ = 1; // minibatch averaging
 
@@ -71,6 +88,8 @@ protected:
     options & opts() { return options_; }
     options const & opts() const { return options_; }
 
+    forward_listener * listener() const { return listener_; }
+
 public:
     bool is_input()  { return is_input_ ; }
     bool is_output() { return is_output_; }
@@ -82,6 +101,24 @@ public:
     size_t         fwd_priority() const { return fwd_priority_; }
     size_t         bwd_priority() const { return bwd_priority_; }
 
+    // featuremaps of a layer are split into contiguous blocks, one per
+    // NUMA node
+    size_t numa_node( size_t i ) const
+    {
+#ifdef ZNN_NUMA
+        return i * numa.size() / size_;
+#else
+        return 0;
+#endif
+    }
+
+    bool enabled( size_t i ) const { return enabled_[i]; }
+
+    void set_forward_listener( forward_listener * l )
+    {
+        listener_ = l;
+    }
+
     void set_patch_size( real s )
     {
         ZI_ASSERT(s > 0);
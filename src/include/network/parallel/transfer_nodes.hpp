@@ -44,6 +44,7 @@ private:
     std::vector<cube_p<real>>    fs_      ;
     std::vector<int>             fwd_done_;
     waiter                       waiter_  ;
+    spatial_split                split_   ; // of the large featuremaps
 
 public:
     transfer_nodes( size_t s,
@@ -63,14 +64,15 @@ public:
         , fs_(s)
         , fwd_done_(s)
         , waiter_(s)
+        , split_(tm)
     {
 
         for ( size_t i = 0; i < nodes::size(); ++i )
         {
             fwd_accumulators_[i]
-                = std::make_unique<forward_accumulator>(fsize);
+                = std::make_unique<forward_accumulator>(fsize, 0, split_);
             bwd_accumulators_[i]
-                = std::make_unique<backward_accumulator>(fsize);
+                = std::make_unique<backward_accumulator>(fsize, 0, split_);
         }
 
 
@@ -183,17 +185,22 @@ private:
 
         if ( func_ )
         {
-            func_.apply(*fs_[n], biases_[n]->b());
+            func_.apply(*fs_[n], biases_[n]->b(), split_);
         }
 
-        if ( nodes::is_output() )
+        if ( nodes::listener() )
         {
-            waiter_.one_done();
+            nodes::listener()->featuremap_done(this, n, fs_[n]);
         }
-        else
+        else if ( !nodes::is_output() )
         {
             fwd_dispatch_.dispatch(n,fs_[n],nodes::manager());
         }
+
+        if ( nodes::is_output() )
+        {
+            waiter_.one_done();
+        }
     }
 
 public:
@@ -266,7 +273,7 @@ private:
             //         ( nodes::is_output() ? " output\n" : "no\n");
             //     STRONG_ASSERT(0);
             // }
-            func_.apply_grad(*g,*fs_[n]);
+            func_.apply_grad(*g,*fs_[n],split_);
             biases_[n]->update(sum(*g),patch_sz_);
             fs_[n].reset();
         }
@@ -0,0 +1,189 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "../../types.hpp"
+
+#include <zi/utility/singleton.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <unistd.h>
+
+namespace znn { namespace v4 { namespace parallel_network {
+
+// The convolutions chosen by network::optimize(), kept between runs
+//
+// Each choice (direct, fft, gemm, winograd2 or winograd4) is stored
+// under a key naming the CPU model, the kernels, the number of threads,
+// the pass and the geometry of the layer (see network::tuning_key). With
+// ZNN_TUNING_CACHE set to a file (or after set_file()), the file is read
+// and optimize() writes its new choices back, so a network is only timed
+// once per machine, thread count and output size.
+//
+// The file has a line per choice: the key, a tab and the choice.
+//
+class tuning_cache_impl
+{
+private:
+    std::mutex                         m_      ;
+    std::map<std::string, std::string> choices_;
+    std::string                        file_   ;
+    bool                               dirty_ = false;
+
+    bool read( std::string const & fname )
+    {
+        std::ifstream in(fname);
+        if ( !in ) return false;
+
+        std::string line;
+        while ( std::getline(in, line) )
+        {
+            auto tab = line.rfind('\t');
+            if ( tab == std::string::npos || tab == 0 ) continue;
+
+            // the entries of this process take precedence
+            choices_.emplace(line.substr(0, tab), line.substr(tab + 1));
+        }
+
+        return true;
+    }
+
+public:
+    tuning_cache_impl()
+    {
+        if ( char const * f = std::getenv("ZNN_TUNING_CACHE") )
+        {
+            file_ = f;
+            read(file_);
+        }
+    }
+
+    // the model name of the CPU, as reported by /proc/cpuinfo
+    static std::string cpu_model()
+    {
+        std::ifstream in("/proc/cpuinfo");
+
+        std::string line;
+        while ( std::getline(in, line) )
+        {
+            if ( line.compare(0, 10, "model name") == 0 ||
+                 line.compare(0, 9,  "cpu model")  == 0 ||
+                 line.compare(0, 8,  "Hardware")   == 0 )
+            {
+                auto c = line.find(':');
+                if ( c == std::string::npos ) continue;
+
+                auto b = line.find_first_not_of(" \t", c + 1);
+                if ( b == std::string::npos ) continue;
+
+                return line.substr(b);
+            }
+        }
+
+        return "unknown";
+    }
+
+    // uses the file fname from now on, its choices are merged in
+    bool set_file( std::string const & fname )
+    {
+        guard g(m_);
+        file_ = fname;
+        return read(fname);
+    }
+
+    std::string file()
+    {
+        guard g(m_);
+        return file_;
+    }
+
+    bool lookup( std::string const & key, std::string & choice )
+    {
+        guard g(m_);
+        auto it = choices_.find(key);
+        if ( it == choices_.end() ) return false;
+        choice = it->second;
+        return true;
+    }
+
+    void store( std::string const & key, std::string const & choice )
+    {
+        guard g(m_);
+        choices_[key] = choice;
+        dirty_ = true;
+    }
+
+    size_t size()
+    {
+        guard g(m_);
+        return choices_.size();
+    }
+
+    void clear()
+    {
+        guard g(m_);
+        choices_.clear();
+        dirty_ = false;
+    }
+
+    // writes the choices to the file (when set), together with the ones
+    // other processes added since it was read; the file is replaced at
+    // once so that the readers never see half of it
+    bool flush()
+    {
+        guard g(m_);
+
+        if ( file_.empty() || !dirty_ ) return true;
+
+        read(file_);
+
+        std::string tmp = file_ + "." + std::to_string(getpid());
+
+        {
+            std::ofstream out(tmp);
+            for ( auto & c: choices_ )
+            {
+                out << c.first << '\t' << c.second << '\n';
+            }
+            if ( !out ) return false;
+        }
+
+        if ( std::rename(tmp.c_str(), file_.c_str()) != 0 )
+        {
+            std::remove(tmp.c_str());
+            return false;
+        }
+
+        dirty_ = false;
+        return true;
+    }
+
+}; // class tuning_cache_impl
+
+namespace {
+tuning_cache_impl& tuning_cache =
+    zi::singleton<tuning_cache_impl>::instance();
+} // anonymous namespace
+
+}}} // namespace znn::v4::parallel_network
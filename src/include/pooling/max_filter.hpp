@@ -0,0 +1,408 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include "../assert.hpp"
+#include "../types.hpp"
+#include "../cube/cube.hpp"
+#include "../cube/cube_operators.hpp"
+#include "../utils/parallel_for.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Separable max filter (van Herk/Gil-Werman), the replacement of
+// pooling_filter for the pooling edges
+//
+// Each pass filters the lines along one axis: the lines are cut into
+// blocks of the window length, the maxima of the prefixes and suffixes of
+// the blocks are computed once and the maximum of any window is the max
+// of a suffix and a prefix, three comparisons per voxel whatever the
+// window length. The lines are processed in bundles of neighbouring
+// columns (contiguous along z for the x and y passes), so the inner
+// loops vectorize. Only the windows at the multiples of the step are
+// computed, each pass reads the output of the previous one (the input
+// isn't copied) and the passes carry the position of each maximum as the
+// offset in its window.
+//
+namespace znn { namespace v4 {
+
+// The positions of the maxima of the windows, as the offsets in the
+// windows, ( dx * size[1] + dy ) * size[2] + dz; a byte per voxel for
+// windows of up to 256 voxels, two for up to 65536
+struct max_filter_offsets
+{
+    vec3i size  ;
+    vec3i stride;
+    vec3i step  ;
+
+    cube_p<uint8_t>  bytes;
+    cube_p<uint16_t> words;
+
+    explicit operator bool() const
+    {
+        return bytes || words;
+    }
+};
+
+namespace detail { namespace max_filter {
+
+// columns of a bundle
+constexpr long_t bundle = 32;
+
+// b ? x : y without a branch, vectorized next to the selects of the
+// values (the branch isn't, below AVX2)
+inline int pick( bool b, int x, int y ) noexcept
+{
+    int m = -static_cast<int>(b);
+    return ( x & m ) | ( y & ~m );
+}
+
+// The maxima of the prefixes (g) and the suffixes (h) of the blocks of a
+// bundle of lines and their positions in the lines
+struct scratch
+{
+    std::vector<real> gv, hv;
+    std::vector<int>  gp, hp;
+
+    void reserve( std::size_t n )
+    {
+        if ( gv.size() < n )
+        {
+            gv.resize(n);
+            hv.resize(n);
+            gp.resize(n);
+            hp.resize(n);
+        }
+    }
+};
+
+// One pass over the columns c < C of lines of length L, element i of
+// column c at in[i*ils + c*ics] (its offset code at ic, none for the first
+// pass). The output j (j < n) is the max of the k elements d apart
+// starting at j*p, stored at out[j*ols + c*ocs] with the offset code of
+// its maximum, plus mult times its position in the window.
+template<typename I, typename F>
+inline void pass( real const * in, I const * ic, long_t ils, long_t ics,
+                  real * out, I * oc, long_t ols, long_t ocs,
+                  long_t L, long_t C, long_t n,
+                  long_t k, long_t d, long_t p, long_t mult,
+                  F const & cmp, scratch & s ) noexcept
+{
+    ZI_ASSERT(C<=bundle);
+
+    s.reserve(( L + d - 1 ) / d * C);
+
+    // the sublines of the elements d apart
+    for ( long_t r = 0; r < d && r < L; ++r )
+    {
+        long_t lr  = ( L - r + d - 1 ) / d;
+        long_t sls = d * ils;
+
+        real const * a = in + r * ils;
+
+        for ( long_t t = 0; t < lr; ++t )
+        {
+            real const * at = a + t * sls;
+            real       * gv = s.gv.data() + t * C;
+            int        * gp = s.gp.data() + t * C;
+
+            if ( t % k == 0 )
+            {
+                for ( long_t c = 0; c < C; ++c )
+                {
+                    gv[c] = at[c*ics];
+                    gp[c] = t;
+                }
+            }
+            else
+            {
+                real const * pv = gv - C;
+                int  const * pp = gp - C;
+
+                for ( long_t c = 0; c < C; ++c )
+                {
+                    real v = at[c*ics];
+                    real w = pv[c];
+                    int  i = pp[c];
+                    bool b = cmp(v, w);
+                    gv[c] = b ? v : w;
+                    gp[c] = pick(b, static_cast<int>(t), i);
+                }
+            }
+        }
+
+        for ( long_t t = lr - 1; t >= 0; --t )
+        {
+            real const * at = a + t * sls;
+            real       * hv = s.hv.data() + t * C;
+            int        * hp = s.hp.data() + t * C;
+
+            if ( t % k == k - 1 || t == lr - 1 )
+            {
+                for ( long_t c = 0; c < C; ++c )
+                {
+                    hv[c] = at[c*ics];
+                    hp[c] = t;
+                }
+            }
+            else
+            {
+                real const * nv = hv + C;
+                int  const * np = hp + C;
+
+                for ( long_t c = 0; c < C; ++c )
+                {
+                    real v = at[c*ics];
+                    real w = nv[c];
+                    int  i = np[c];
+                    bool b = cmp(w, v);
+                    hv[c] = b ? w : v;
+                    hp[c] = pick(b, i, static_cast<int>(t));
+                }
+            }
+        }
+
+        // the window [t, t+k) is the suffix of the block of t and the
+        // prefix of the block of t+k-1, the first maximum wins the ties
+        for ( long_t j = 0; j < n; ++j )
+        {
+            if ( ( j * p ) % d != r ) continue;
+
+            long_t t = j * p / d;
+            long_t e = t + k - 1;
+
+            real const * hv = s.hv.data() + t * C;
+            int  const * hp = s.hp.data() + t * C;
+            real const * gv = s.gv.data() + e * C;
+            int  const * gp = s.gp.data() + e * C;
+
+            real * o = out + j * ols;
+            I    * q = oc  + j * ols;
+
+            int sel[bundle];
+
+            for ( long_t c = 0; c < C; ++c )
+            {
+                real u = gv[c];
+                real v = hv[c];
+                int  a = gp[c];
+                int  b = hp[c];
+                bool g = cmp(u, v);
+                o[c*ocs] = g ? u : v;
+                sel[c]   = pick(g, a, b);
+            }
+
+            for ( long_t c = 0; c < C; ++c )
+            {
+                long_t code = ( sel[c] - t ) * mult;
+                if ( ic ) code += ic[( r + sel[c] * d ) * ils + c * ics];
+                q[c*ocs] = static_cast<I>(code);
+            }
+        }
+    }
+}
+
+template<typename I, typename F>
+inline std::pair<cube_p<real>, cube_p<I>>
+filter( ccube<real> const & f,
+        F const & cmp,
+        vec3i const & size,
+        vec3i const & stride,
+        vec3i const & step,
+        spatial_split const & split )
+{
+    vec3i cs = v4::size(f);
+
+    cube_p<real> vals;
+    cube_p<I>    codes;
+
+    real const * in = f.data();
+    I    const * ic = nullptr;
+
+    long_t mult[3] = { size[1] * size[2], size[2], 1 };
+
+    for ( long_t a = 0; a < 3; ++a )
+    {
+        if ( size[a] == 1 && step[a] == 1 ) continue;
+
+        vec3i os = cs;
+        os[a] = ( cs[a] - ( size[a] - 1 ) * stride[a] - 1 ) / step[a] + 1;
+
+        ZI_ASSERT(os[a]>0);
+
+        auto ov = get_cube<real>(os);
+        auto oc = get_cube<I>(os);
+
+        // the outer loop (x for the y pass), the columns of a line and
+        // the strides of the lines and the columns
+        long_t outer = a == 1 ? cs[0] : 1;
+        long_t C     = a == 0 ? cs[1] * cs[2]
+                     : a == 1 ? cs[2] : cs[0] * cs[1];
+        long_t ils   = a == 0 ? cs[1] * cs[2] : a == 1 ? cs[2] : 1;
+        long_t ols   = a == 0 ? os[1] * os[2] : a == 1 ? os[2] : 1;
+        long_t ics   = a == 2 ? cs[2] : 1;
+        long_t ocs   = a == 2 ? os[2] : 1;
+        long_t iout  = cs[1] * cs[2];
+        long_t oout  = os[1] * os[2];
+
+        long_t bundles = ( C + bundle - 1 ) / bundle;
+        double work    = 4.0 * cs[0] * cs[1] * cs[2];
+
+        real * out = ov->data();
+        I    * q   = oc->data();
+
+        split(outer * bundles, work, [&]( std::size_t b, std::size_t e )
+            {
+                scratch s;
+                for ( long_t i = b; i < static_cast<long_t>(e); ++i )
+                {
+                    long_t x  = i / bundles;
+                    long_t c0 = ( i % bundles ) * bundle;
+                    long_t c  = std::min(bundle, C - c0);
+
+                    pass(in + x * iout + c0 * ics,
+                         ic ? ic + x * iout + c0 * ics : nullptr,
+                         ils, ics,
+                         out + x * oout + c0 * ocs,
+                         q + x * oout + c0 * ocs,
+                         ols, ocs,
+                         cs[a], c, os[a],
+                         size[a], stride[a], step[a], mult[a],
+                         cmp, s);
+                }
+            });
+
+        vals  = ov;
+        codes = oc;
+        in    = vals->data();
+        ic    = codes->data();
+        cs    = os;
+    }
+
+    if ( !vals )
+    {
+        vals  = get_copy(f);
+        codes = get_cube<I>(cs);
+        std::fill_n(codes->data(), codes->num_elements(), 0);
+    }
+
+    return { vals, codes };
+}
+
+template<typename I>
+inline void backprop( real * r, vec3i const & rs,
+                      ccube<real> const & g,
+                      cube<I> const & codes,
+                      max_filter_offsets const & o )
+{
+    // the offsets of the positions in the windows in the input
+    std::vector<long_t> off(o.size[0] * o.size[1] * o.size[2]);
+    for ( long_t x = 0, i = 0; x < o.size[0]; ++x )
+        for ( long_t y = 0; y < o.size[1]; ++y )
+            for ( long_t z = 0; z < o.size[2]; ++z, ++i )
+                off[i] = ( x * o.stride[0] * rs[1] + y * o.stride[1] )
+                    * rs[2] + z * o.stride[2];
+
+    vec3i gs = size(g);
+
+    real const * gp = g.data();
+    I    const * cp = codes.data();
+
+    for ( long_t x = 0; x < gs[0]; ++x )
+        for ( long_t y = 0; y < gs[1]; ++y )
+        {
+            long_t base = ( x * o.step[0] * rs[1] + y * o.step[1] ) * rs[2];
+            for ( long_t z = 0; z < gs[2]; ++z, ++gp, ++cp )
+            {
+                r[base + z * o.step[2] + off[*cp]] += *gp;
+            }
+        }
+}
+
+}} // namespace detail::max_filter
+
+// The max (given cmp, the min or any order) of the windows of the given
+// size, the voxels of a window stride apart, at the multiples of step
+// (one for a max filter, the size for a non-overlapping pooling)
+template<typename F>
+inline std::pair<cube_p<real>, max_filter_offsets>
+max_filter( ccube<real> const & f,
+            F const & cmp,
+            vec3i const & size,
+            vec3i const & stride = vec3i::one,
+            vec3i const & step = vec3i::one,
+            spatial_split const & split = spatial_split() )
+{
+    long_t volume = size[0] * size[1] * size[2];
+
+    max_filter_offsets o;
+    o.size   = size  ;
+    o.stride = stride;
+    o.step   = step  ;
+
+    cube_p<real> r;
+
+    if ( volume <= 256 )
+    {
+        std::tie(r, o.bytes) = detail::max_filter::filter<uint8_t>
+            (f, cmp, size, stride, step, split);
+    }
+    else if ( volume <= 65536 )
+    {
+        std::tie(r, o.words) = detail::max_filter::filter<uint16_t>
+            (f, cmp, size, stride, step, split);
+    }
+    else
+    {
+        throw std::logic_error(HERE() + "max filter windows of more than "
+                               "65536 voxels");
+    }
+
+    return { r, o };
+}
+
+// The gradient of the input of max_filter, the gradient of each window
+// added to its maximum
+inline cube_p<real> max_filter_backprop( vec3i const & sz,
+                                         ccube<real> const & g,
+                                         max_filter_offsets const & o )
+{
+    ZI_ASSERT(o);
+
+    auto ret = get_cube<real>(sz);
+    fill(*ret,0);
+
+    if ( o.bytes )
+    {
+        ZI_ASSERT(size(g)==size(*o.bytes));
+        detail::max_filter::backprop(ret->data(), sz, g, *o.bytes, o);
+    }
+    else
+    {
+        ZI_ASSERT(size(g)==size(*o.words));
+        detail::max_filter::backprop(ret->data(), sz, g, *o.words, o);
+    }
+
+    return ret;
+}
+
+}} // namespace znn::v4
@@ -28,16 +28,25 @@ inline void inplace_pooling_filter( cube<real> & featuremap,
                                     cube<int>    & indices,
                                     F const & f,
                                     vec3i const & filter_size,
-                                    vec3i const & filter_stride = vec3i::one )
+                                    vec3i const & filter_stride = vec3i::one,
+                                    spatial_split const & split = spatial_split() )
 {
     vec3i s = size(featuremap);
 
+    // the lines of a direction are independent, they are split among
+    // the idle workers
+    double work = static_cast<double>(s[0]) * s[1] * s[2];
+
     // x-direction
     // delta x is then s[1]*s[2]
     if ( filter_size[0] > 1 )
     {
-        for ( long_t y = 0; y < s[1]; ++y )
-            for ( long_t z = 0; z < s[2]; ++z )
+        split(s[1]*s[2], work*filter_size[0], [&](size_t b, size_t e)
+        {
+            for ( long_t q = b; q < static_cast<long_t>(e); ++q )
+            {
+                long_t y = q / s[2];
+                long_t z = q % s[2];
                 for ( long_t x = 0; x < filter_stride[0]; ++x )
                     pooling_filter_pass( &(featuremap[x][y][z]),
                                          &(featuremap[s[0]-1][y][z]),
@@ -45,31 +54,41 @@ inline void inplace_pooling_filter( cube<real> & featuremap,
                                          filter_size[0],
                                          s[1]*s[2]*filter_stride[0],
                                          f);
-
-
+            }
+        });
     }
 
     // y-direction
     // delta y is then s[2]
     if ( filter_size[1] > 1 )
     {
-        for ( long_t x = 0; x < s[0]; ++x )
-            for ( long_t y = 0; y < filter_stride[1]; ++y )
-                for ( long_t z = 0; z < s[2]; ++z )
+        split(s[0]*s[2], work*filter_size[1], [&](size_t b, size_t e)
+        {
+            for ( long_t q = b; q < static_cast<long_t>(e); ++q )
+            {
+                long_t x = q / s[2];
+                long_t z = q % s[2];
+                for ( long_t y = 0; y < filter_stride[1]; ++y )
                     pooling_filter_pass( &(featuremap[x][y][z]),
                                          &(featuremap[x][s[1]-1][z]),
                                          &(indices[x][y][z]),
                                          filter_size[1],
                                          s[2]*filter_stride[1],
                                          f);
+            }
+        });
     }
 
     // z-direction
     // delta z is 1
     if ( filter_size[2] > 1 )
     {
-        for ( long_t x = 0; x < s[0]; ++x )
-            for ( long_t y = 0; y < s[1]; ++y )
+        split(s[0]*s[1], work*filter_size[2], [&](size_t b, size_t e)
+        {
+            for ( long_t q = b; q < static_cast<long_t>(e); ++q )
+            {
+                long_t x = q / s[1];
+                long_t y = q % s[1];
                 for ( long_t z = 0; z < filter_stride[2]; ++z )
                     pooling_filter_pass( &(featuremap[x][y][z]),
                                          &(featuremap[x][y][s[2]-1]),
@@ -77,6 +96,8 @@ inline void inplace_pooling_filter( cube<real> & featuremap,
                                          filter_size[2],
                                          filter_stride[2],
                                          f);
+            }
+        });
     }
 
 }
@@ -85,67 +106,88 @@ template<typename F>
 inline void inplace_pooling_filter_no_indices( cube<real> & featuremap,
                                                F const & f,
                                                vec3i const & filter_size,
-                                               vec3i const & filter_stride = vec3i::one )
+                                               vec3i const & filter_stride = vec3i::one,
+                                               spatial_split const & split = spatial_split() )
 {
     vec3i s = size(featuremap);
 
+    // the lines of a direction are independent, they are split among
+    // the idle workers
+    double work = static_cast<double>(s[0]) * s[1] * s[2];
+
     // x-direction
     // delta x is then s[1]*s[2]
     if ( filter_size[0] > 1 )
     {
-        for ( long_t y = 0; y < s[1]; ++y )
-            for ( long_t z = 0; z < s[2]; ++z )
+        split(s[1]*s[2], work*filter_size[0], [&](size_t b, size_t e)
+        {
+            for ( long_t q = b; q < static_cast<long_t>(e); ++q )
+            {
+                long_t y = q / s[2];
+                long_t z = q % s[2];
                 for ( long_t x = 0; x < filter_stride[0]; ++x )
                     pooling_filter_pass_no_indices( &(featuremap[x][y][z]),
                                                     &(featuremap[s[0]-1][y][z]),
                                                     filter_size[0],
                                                     s[1]*s[2]*filter_stride[0],
                                                     f);
-
-
+            }
+        });
     }
 
     // y-direction
     // delta y is then s[2]
     if ( filter_size[1] > 1 )
     {
-        for ( long_t x = 0; x < s[0]; ++x )
-            for ( long_t y = 0; y < filter_stride[1]; ++y )
-                for ( long_t z = 0; z < s[2]; ++z )
+        split(s[0]*s[2], work*filter_size[1], [&](size_t b, size_t e)
+        {
+            for ( long_t q = b; q < static_cast<long_t>(e); ++q )
+            {
+                long_t x = q / s[2];
+                long_t z = q % s[2];
+                for ( long_t y = 0; y < filter_stride[1]; ++y )
                     pooling_filter_pass_no_indices( &(featuremap[x][y][z]),
                                                     &(featuremap[x][s[1]-1][z]),
                                                     filter_size[1],
                                                     s[2]*filter_stride[1],
                                                     f);
+            }
+        });
     }
 
     // z-direction
     // delta z is 1
     if ( filter_size[2] > 1 )
     {
-        for ( long_t x = 0; x < s[0]; ++x )
-            for ( long_t y = 0; y < s[1]; ++y )
+        split(s[0]*s[1], work*filter_size[2], [&](size_t b, size_t e)
+        {
+            for ( long_t q = b; q < static_cast<long_t>(e); ++q )
+            {
+                long_t x = q / s[1];
+                long_t y = q % s[1];
                 for ( long_t z = 0; z < filter_stride[2]; ++z )
                     pooling_filter_pass_no_indices( &(featuremap[x][y][z]),
                                                     &(featuremap[x][y][s[2]-1]),
                                                     filter_size[2],
                                                     filter_stride[2],
                                                     f);
+            }
+        });
     }
 
 }
 
-
 template<typename F>
 inline std::pair<cube_p<real>, cube_p<int>>
 pooling_filter( cube_p<real>&& featuremap,
                 F const & f,
                 vec3i const & filter_size,
-                vec3i const & filter_stride = vec3i::one )
+                vec3i const & filter_stride = vec3i::one,
+                spatial_split const & split = spatial_split() )
 {
     auto indices = make_indices(size(*featuremap));
     inplace_pooling_filter(*featuremap, *indices, f,
-                           filter_size, filter_stride);
+                           filter_size, filter_stride, split);
 
     // the real filter size equals to
     // (SIZE-1) * STRIDE + 1
@@ -166,10 +208,11 @@ inline cube_p<real>
 pooling_filter_no_indices( cube_p<real>&& featuremap,
                            F const & f,
                            vec3i const & filter_size,
-                           vec3i const & filter_stride = vec3i::one )
+                           vec3i const & filter_stride = vec3i::one,
+                           spatial_split const & split = spatial_split() )
 {
     inplace_pooling_filter_no_indices(*featuremap, f,
-                                      filter_size, filter_stride);
+                                      filter_size, filter_stride, split);
 
     // the real filter size equals to
     // (SIZE-1) * STRIDE + 1
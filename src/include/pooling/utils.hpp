@@ -20,6 +20,7 @@
 #include "../types.hpp"
 #include "../cube/cube.hpp"
 #include "../cube/cube_operators.hpp"
+#include "../utils/parallel_for.hpp"
 
 
 #include <utility>
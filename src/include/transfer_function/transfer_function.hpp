@@ -21,6 +21,7 @@
 #include "../assert.hpp"
 #include "../cube/cube.hpp"
 #include "../options/options.hpp"
+#include "../utils/parallel_for.hpp"
 
 #include <memory>
 #include <map>
@@ -33,8 +34,9 @@ class transfer_function_interface
 public:
     virtual ~transfer_function_interface() {}
     virtual void apply(cube<real>&) noexcept = 0;
-    virtual void apply(cube<real>&, real) noexcept = 0;
-    virtual void apply_grad(cube<real>&, const cube<real>&) noexcept = 0;
+    virtual void apply(cube<real>&, real, spatial_split const &) noexcept = 0;
+    virtual void apply_grad(cube<real>&, const cube<real>&,
+                            spatial_split const &) noexcept = 0;
     virtual options serialize() const = 0;
 };
 
@@ -59,18 +61,23 @@ private:
 
     template<typename T>
     typename std::enable_if<has_public_member_grad<T>::value>::type
-    apply_grad(cube<real>& g, const cube<real>& f, const T& fn) noexcept
+    apply_grad(cube<real>& g, const cube<real>& f, const T& fn,
+               spatial_split const & split) noexcept
     {
         real* gp = g.data();
         const real* fp = f.data();
         size_t  n = g.num_elements();
-        for ( size_t i = 0; i < n; ++i )
-            gp[i] *= fn.grad(fp[i]);
+        split(n, n, [&](size_t b, size_t e)
+            {
+                for ( size_t i = b; i < e; ++i )
+                    gp[i] *= fn.grad(fp[i]);
+            });
     }
 
     template<typename T>
     typename std::enable_if<!has_public_member_grad<T>::value>::type
-    apply_grad(cube<real>&, const cube<real>&, const T&) noexcept
+    apply_grad(cube<real>&, const cube<real>&, const T&,
+               spatial_split const &) noexcept
     {}
 
 public:
@@ -86,18 +93,23 @@ public:
             d[i] = f_(d[i]);
     }
 
-    void apply(cube<real>& v, real bias) noexcept override
+    void apply(cube<real>& v, real bias,
+               spatial_split const & split) noexcept override
     {
         real* d = v.data();
         size_t  n = v.num_elements();
-        for ( size_t i = 0; i < n; ++i )
-            d[i] = f_(d[i] + bias);
+        split(n, n, [&](size_t b, size_t e)
+            {
+                for ( size_t i = b; i < e; ++i )
+                    d[i] = f_(d[i] + bias);
+            });
     }
 
-    void apply_grad(cube<real>& g, const cube<real>& f) noexcept override
+    void apply_grad(cube<real>& g, const cube<real>& f,
+                    spatial_split const & split) noexcept override
     {
         ZI_ASSERT(size(g)==size(f));
-        apply_grad(g,f,f_);
+        apply_grad(g,f,f_,split);
     }
 
     options serialize() const override
@@ -140,14 +152,17 @@ public:
         if ( f_ ) f_->apply(v);
     }
 
-    void apply(cube<real>& v, real bias) noexcept
+    // the large featuremaps are split among the idle workers
+    void apply(cube<real>& v, real bias,
+               spatial_split const & split = spatial_split()) noexcept
     {
-        if ( f_ ) f_->apply(v, bias);
+        if ( f_ ) f_->apply(v, bias, split);
     }
 
-    void apply_grad(cube<real>& g, const cube<real>& f) noexcept
+    void apply_grad(cube<real>& g, const cube<real>& f,
+                    spatial_split const & split = spatial_split()) noexcept
     {
-        if ( f_ ) f_->apply_grad(g,f);
+        if ( f_ ) f_->apply_grad(g, f, split);
     }
 
     options serialize() const
@@ -42,6 +42,7 @@ private:
 
     cube_p<real>       sum_;
     std::mutex         mutex_;
+    spatial_split      split_; // of the inverse FFTs
 
     bool do_add(cube_p<real>&& to_add)
     {
@@ -63,7 +64,7 @@ private:
 
     bool merge_bucket(size_t b)
     {
-        cube_p<real> f = buckets_[b]->reset();
+        cube_p<real> f = buckets_[b]->reset(split_);
 
         if ( Forward )
         {
@@ -83,7 +84,8 @@ private:
     }
 
 public:
-    explicit accumulator(const vec3i& size, std::size_t n = 0)
+    explicit accumulator(const vec3i& size, std::size_t n = 0,
+                         spatial_split const & split = spatial_split())
         : size_(size)
         , bucket_map_()
         , buckets_()
@@ -91,6 +93,7 @@ public:
         , disabled_(0)
         , current_(0)
         , sum_()
+        , split_(split)
     {}
 
     size_t grow(size_t n)
@@ -37,6 +37,7 @@
 
 #include "log.hpp"
 #include "global_task_manager.hpp"
+#include "small_task.hpp"
 
 namespace znn { namespace v4 {
 
@@ -46,7 +47,7 @@ thread_local size_t znn_thread_id = 0;
 
 struct regular_task
 {
-    std::function<void()> fn;
+    small_task            fn;
     size_t                thread_id;
     list<regular_task*>::const_iterator local ;
     list<regular_task*>::const_iterator global;
@@ -54,22 +55,22 @@ struct regular_task
     template<class... Args>
     explicit regular_task( size_t tid,
                            Args && ... args )
-        : thread_id(tid)
-        , fn(std::bind(std::forward<Args>(args)...))
+        : fn(make_small_task(std::forward<Args>(args)...))
+        , thread_id(tid)
     {}
 };
 
 class dfs_task_manager
 {
 private:
-    typedef std::function<void()> callable_t;
+    typedef small_task callable_t;
 
 private:
     struct unprivileged_task
     {
     private:
-        std::function<void()>  fn_               ;
-        callable_t*            then_   = nullptr ;
+        callable_t             fn_               ;
+        callable_t             then_             ;
         int                    status_ = 1       ;
 
         list<std::shared_ptr<unprivileged_task>>::iterator it_;
@@ -79,7 +80,7 @@ private:
     public:
         template<class... Args>
         explicit unprivileged_task(Args&&... args)
-            : fn_(std::bind(std::forward<Args>(args)...))
+            : fn_(make_small_task(std::forward<Args>(args)...))
         {}
     };
 
@@ -179,20 +180,17 @@ private:
         t->fn_();
         t->fn_ = nullptr;
 
-        callable_t* after = nullptr;
+        callable_t after;
 
         {
             std::unique_lock<std::mutex> g(mutex_);
-            after      = t->then_;
+            after      = std::move(t->then_);
             t->status_ = 0;
         }
 
         if ( after )
         {
-            (*after)();
-            allocator<callable_t> alloc;
-            alloc.destroy(after);
-            alloc.deallocate(after,1);
+            after();
         }
     }
 
@@ -304,7 +302,7 @@ public:
         allocator<regular_task> alloc;
         regular_task* t = alloc.allocate(1);
 
-        alloc.construct(t, id, std::bind(std::forward<Args>(args)...));
+        alloc.construct(t, id, std::forward<Args>(args)...);
         {
             std::lock_guard<std::mutex> g(mutex_);
             t->local  = local_tasks_[id].insert(local_tasks_[id].begin(),t);
@@ -314,6 +312,13 @@ public:
         }
     }
 
+    // no NUMA placement
+    template<typename... Args>
+    void schedule_on(std::size_t, std::size_t priority, Args&&... args)
+    {
+        schedule(priority, std::forward<Args>(args)...);
+    }
+
     template<typename... Args>
     void asap(Args&&... args)
     {
@@ -332,9 +337,7 @@ public:
 
         bool stolen = false;
 
-        allocator<callable_t> alloc;
-        callable_t* after = alloc.allocate(1);
-        alloc.construct(after, std::bind(std::forward<Args>(args)...));
+        callable_t after = make_small_task(std::forward<Args>(args)...);
 
         {
             std::lock_guard<std::mutex> g(mutex_);
@@ -349,8 +352,8 @@ public:
             {
                 if ( t->status_ == 2 )
                 {
-                    ZI_ASSERT(t->then_==nullptr);
-                    t->then_ = after;
+                    ZI_ASSERT(!t->then_);
+                    t->then_ = std::move(after);
                     return;
                 }
             }
@@ -362,9 +365,7 @@ public:
             t->fn_ = nullptr;
         }
 
-        (*after)();
-        alloc.destroy(after);
-        alloc.deallocate(after,1);
+        after();
     }
 
 
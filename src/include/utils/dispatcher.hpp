@@ -21,6 +21,7 @@
 #include "../cube/cube_operators.hpp"
 #include "../fft/fftw.hpp"
 #include "task_manager.hpp"
+#include "tracer.hpp"
 
 #include <zi/utility/non_copyable.hpp>
 #include <vector>
@@ -172,10 +173,17 @@ private:
                        std::vector<FFTEdge*> const & targets,
                        task_manager & manager )
     {
-        ccube_p<complex> x = fftw_[s]->forward_pad(v);
+        trace_scope ts(trace_kind::fft, targets.front()->in_trace_name(),
+                       std::numeric_limits<std::size_t>::max());
+
+        ccube_p<complex> x = fftw_[s]->forward_pad(v, spatial_split(manager));
         for ( auto& t: targets )
         {
-            manager.schedule(t->fwd_priority(), [t,x](){t->forward(x);});
+            manager.schedule_on(t->fwd_numa_node(), t->fwd_priority(), [t,x]() {
+                    trace_scope s(trace_kind::forward, t->trace_name(),
+                                  t->fwd_priority());
+                    t->forward(x);
+                });
         }
     }
 
@@ -184,7 +192,11 @@ public:
                    task_manager & manager)
     {
         for ( auto& t: targets_ )
-            manager.schedule(t->fwd_priority(), [t,v](){t->forward(v);});
+            manager.schedule_on(t->fwd_numa_node(), t->fwd_priority(), [t,v]() {
+                    trace_scope s(trace_kind::forward, t->trace_name(),
+                                  t->fwd_priority());
+                    t->forward(v);
+                });
 
         for ( auto& fft_target: fft_targets_ )
             manager.asap(&this_type::fft_dispatch,this,v,fft_target.first,
@@ -243,14 +255,22 @@ private:
                        const std::vector<FFTEdge*>& targets,
                        task_manager& manager )
     {
+        trace_scope ts(trace_kind::fft, targets.front()->out_trace_name(),
+                       std::numeric_limits<std::size_t>::max());
+
         auto vp = get_copy(*v);
         flip(*vp);
 
-        ccube_p<complex> x = fftw_[s]->forward_pad(std::move(vp));
+        ccube_p<complex> x = fftw_[s]->forward_pad(std::move(vp),
+                                                   spatial_split(manager));
 
         for ( auto& t: targets )
         {
-            manager.schedule(t->bwd_priority(), [t,x](){t->backward(x);});
+            manager.schedule_on(t->bwd_numa_node(), t->bwd_priority(), [t,x]() {
+                    trace_scope s(trace_kind::backward, t->trace_name(),
+                                  t->bwd_priority());
+                    t->backward(x);
+                });
         }
     }
 
@@ -258,7 +278,11 @@ public:
     void dispatch(const ccube_p<real>& v, task_manager& manager)
     {
         for ( auto& t: targets_ )
-            manager.schedule(t->bwd_priority(), [t,v](){t->backward(v);});
+            manager.schedule_on(t->bwd_numa_node(), t->bwd_priority(), [t,v]() {
+                    trace_scope s(trace_kind::backward, t->trace_name(),
+                                  t->bwd_priority());
+                    t->backward(v);
+                });
 
         for ( auto& fft_target: fft_targets_ )
             manager.asap(&this_type::fft_dispatch,this,v,fft_target.first,
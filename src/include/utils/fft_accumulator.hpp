@@ -105,8 +105,12 @@ public:
         return do_add(std::move(v));
     }
 
+    // sum += f .* w in a single pass over the sum, the product is
+    // only allocated for the first term
     bool add(const ccube_p<complex>& f, const ccube_p<complex>& w)
     {
+        ZI_ASSERT(f->num_elements()==w->num_elements());
+
         cube_p<complex> previous_sum;
         {
             guard g(mutex_);
@@ -125,11 +129,11 @@ public:
         return do_add(std::move(previous_sum));
     }
 
-    cube_p<real> reset()
+    cube_p<real> reset( spatial_split const & split = spatial_split() )
     {
         ZI_ASSERT(current_==effectively_required());
 
-        cube_p<real> r = fftw_->backward(std::move(sum_));
+        cube_p<real> r = fftw_->backward(std::move(sum_), split);
         sum_.reset();
         current_ = 0;
 
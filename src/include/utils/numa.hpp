@@ -0,0 +1,218 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zi/utility/singleton.hpp>
+
+#if defined( __linux__ )
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+
+namespace znn { namespace v4 {
+
+// NUMA topology of the machine
+//
+// Read from /sys/devices/system/node on linux. Setting the environment
+// variable ZNN_NUMA_NODES=n (or calling simulate(n)) splits the cpus
+// into n equal nodes instead, so that the NUMA code paths can be
+// exercised on a single socket machine.
+//
+class numa_topology
+{
+public:
+    static const std::size_t max_nodes = 64;
+
+private:
+    std::vector<std::vector<std::size_t>> cpus_             ;
+    bool                                  simulated_ = false;
+
+private:
+    static std::vector<std::size_t> parse_cpulist( std::string const & s )
+    {
+        std::vector<std::size_t> r;
+        std::istringstream iss(s);
+        std::string range;
+
+        while ( std::getline(iss, range, ',') )
+        {
+            if ( range.empty() ) continue;
+
+            std::size_t dash = range.find('-');
+            std::size_t from = std::stoul(range.substr(0,dash));
+            std::size_t to   = ( dash == std::string::npos )
+                ? from : std::stoul(range.substr(dash+1));
+
+            for ( std::size_t i = from; i <= to; ++i )
+            {
+                r.push_back(i);
+            }
+        }
+
+        return r;
+    }
+
+    static std::vector<std::size_t> all_cpus()
+    {
+        std::size_t n = std::thread::hardware_concurrency();
+        std::vector<std::size_t> r(n ? n : 1);
+        for ( std::size_t i = 0; i < r.size(); ++i )
+        {
+            r[i] = i;
+        }
+        return r;
+    }
+
+    void detect()
+    {
+        cpus_.clear();
+        simulated_ = false;
+
+        if ( char const * env = std::getenv("ZNN_NUMA_NODES") )
+        {
+            std::size_t n = std::strtoul(env, nullptr, 10);
+            if ( n > 0 )
+            {
+                split(n);
+                return;
+            }
+        }
+
+#if defined( __linux__ )
+        for ( std::size_t i = 0; i < max_nodes; ++i )
+        {
+            std::ifstream f("/sys/devices/system/node/node"
+                            + std::to_string(i) + "/cpulist");
+            if ( !f ) break;
+
+            std::string s;
+            std::getline(f, s);
+
+            auto cpus = parse_cpulist(s);
+            if ( cpus.size() ) cpus_.push_back(cpus);
+        }
+#endif
+
+        if ( cpus_.empty() )
+        {
+            cpus_.push_back(all_cpus());
+        }
+    }
+
+    void split( std::size_t n )
+    {
+        auto cpus = all_cpus();
+        n = std::min(n, max_nodes);
+
+        cpus_.clear();
+        cpus_.resize(n);
+
+        for ( std::size_t i = 0; i < cpus.size(); ++i )
+        {
+            cpus_[i * n / cpus.size()].push_back(cpus[i]);
+        }
+
+        // more nodes than cpus, the cpus are shared
+        for ( std::size_t i = 0; i < n; ++i )
+        {
+            if ( cpus_[i].empty() )
+            {
+                cpus_[i].push_back(cpus[i % cpus.size()]);
+            }
+        }
+
+        simulated_ = true;
+    }
+
+public:
+    numa_topology()
+    {
+        detect();
+    }
+
+    // has to be called before any of the pools or task managers are
+    // created
+    void simulate( std::size_t n )
+    {
+        split(n);
+    }
+
+    std::size_t size() const
+    {
+        return cpus_.size();
+    }
+
+    bool simulated() const
+    {
+        return simulated_;
+    }
+
+    std::vector<std::size_t> const & cpus( std::size_t node ) const
+    {
+        return cpus_[node % cpus_.size()];
+    }
+
+    // workers are split into contiguous blocks, one per node
+    std::size_t node_of_worker( std::size_t worker, std::size_t workers ) const
+    {
+        return workers ? ( worker % workers ) * cpus_.size() / workers : 0;
+    }
+
+    // restrict the calling thread to the cpus of the given node
+    bool pin_this_thread( std::size_t node ) const
+    {
+#if defined( __linux__ )
+        cpu_set_t set;
+        CPU_ZERO(&set);
+
+        for ( auto c: cpus(node) )
+        {
+            CPU_SET(c, &set);
+        }
+
+        return pthread_setaffinity_np(pthread_self(),
+                                      sizeof(cpu_set_t), &set) == 0;
+#else
+        (void)node;
+        return false;
+#endif
+    }
+
+}; // class numa_topology
+
+namespace {
+numa_topology& numa = zi::singleton<numa_topology>::instance();
+}
+
+// node of the calling thread, set by the worker threads of the task
+// managers when they get pinned
+inline std::size_t & this_numa_node()
+{
+    static thread_local std::size_t node = 0;
+    return node;
+}
+
+}} // namespace znn::v4
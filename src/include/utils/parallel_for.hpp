@@ -0,0 +1,150 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+// Work (voxels, times the taps of the filter for the convolutions) below
+// which a chunk of a loop isn't worth a task
+#ifndef ZNN_PARALLEL_FOR_GRAIN
+#  define ZNN_PARALLEL_FOR_GRAIN (1 << 16)
+#endif
+
+namespace znn { namespace v4 {
+
+// Runs f(i) for i in [0, n) in the calling thread, helped by the idle
+// workers of the task manager tm (any of the schedulers). The helpers
+// are scheduled asap and claim the iterations left; the caller never
+// waits for a helper that didn't start, so it's safe to call from the
+// tasks of tm (and nested). Returns when all the iterations are done.
+template<class TM, typename F>
+inline void parallel_for( TM & tm, std::size_t n, F const & f )
+{
+    std::size_t helpers = n > 1 ? std::min(tm.idle_threads(), n - 1) : 0;
+
+    if ( helpers == 0 )
+    {
+        for ( std::size_t i = 0; i < n; ++i ) f(i);
+        return;
+    }
+
+    // the helpers may run after this returns, they only touch f while
+    // there are iterations left
+    struct state
+    {
+        std::atomic<std::size_t> next{0};
+        std::atomic<std::size_t> done{0};
+        std::mutex               m      ;
+        std::condition_variable  cv     ;
+    };
+
+    auto st = std::make_shared<state>();
+    F const * fp = &f;
+
+    auto work = [st, fp, n]()
+        {
+            for ( std::size_t i = st->next++; i < n; i = st->next++ )
+            {
+                (*fp)(i);
+                if ( ++st->done == n )
+                {
+                    std::lock_guard<std::mutex> g(st->m);
+                    st->cv.notify_all();
+                }
+            }
+        };
+
+    for ( std::size_t i = 0; i < helpers; ++i ) tm.asap(work);
+
+    work();
+
+    std::unique_lock<std::mutex> g(st->m);
+    while ( st->done < n ) st->cv.wait(g);
+}
+
+// Splits a loop over the rows of a featuremap into chunks run by
+// parallel_for, when there are idle workers. The kernels (direct
+// convolutions, FFTs, pooling, transfer functions) take one, the default
+// runs the whole loop in the calling thread.
+class spatial_split
+{
+private:
+    typedef std::function<void(std::size_t,
+                               std::function<void(std::size_t)> const &)>
+    runner_t;
+
+    runner_t                     run_       ;
+    std::function<std::size_t()> idle_      ;
+    std::size_t                  threads_ = 1;
+
+public:
+    spatial_split() = default;
+
+    // any of the task managers (not a copy of a spatial_split)
+    template<class TM, class = typename std::enable_if<
+                           !std::is_same<TM, spatial_split>::value>::type>
+    explicit spatial_split( TM & tm )
+        : run_([&tm]( std::size_t n,
+                      std::function<void(std::size_t)> const & f )
+               {
+                   parallel_for(tm, n, f);
+               })
+        , idle_([&tm]() { return tm.idle_threads(); })
+        , threads_(std::max<std::size_t>(tm.get_concurrency(), 1))
+    {}
+
+    // chunks of a loop of n rows doing the given work in total
+    std::size_t chunks( std::size_t n, double work ) const
+    {
+        if ( !run_ || work < 2 * ZNN_PARALLEL_FOR_GRAIN ) return 1;
+        if ( idle_() == 0 ) return 1;
+
+        double c = work / ZNN_PARALLEL_FOR_GRAIN;
+        c = std::min(c, static_cast<double>(2 * threads_));
+        c = std::min(c, static_cast<double>(n));
+
+        return std::max<std::size_t>(static_cast<std::size_t>(c), 1);
+    }
+
+    // f(b, e) for the chunks [b, e) of the rows [0, n)
+    template<typename F>
+    void operator()( std::size_t n, double work, F const & f ) const
+    {
+        std::size_t c = chunks(n, work);
+
+        if ( c < 2 )
+        {
+            f(std::size_t(0), n);
+            return;
+        }
+
+        run_(c, [&]( std::size_t i )
+             {
+                 f(n * i / c, n * ( i + 1 ) / c);
+             });
+    }
+};
+
+}} // namespace znn::v4
@@ -0,0 +1,220 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "../types.hpp"
+
+namespace znn { namespace v4 {
+
+// Move only void() callable
+//
+// Callables of up to inline_size bytes (a member function pointer with
+// the object and a shared_ptr, or a lambda capturing an edge and a
+// featuremap) are stored in place, so scheduling a task doesn't touch
+// the heap. Larger ones are placed in the pooled allocator.
+//
+class small_task
+{
+public:
+    static const std::size_t inline_size = 48;
+
+private:
+    struct ops_t
+    {
+        void (*invoke )(void*);
+        void (*move   )(void* dst, void* src); // also destroys src
+        void (*destroy)(void*);
+    };
+
+    template<typename F>
+    struct inline_ops
+    {
+        static void invoke( void* p )
+        {
+            (*reinterpret_cast<F*>(p))();
+        }
+
+        static void move( void* dst, void* src )
+        {
+            new (dst) F(std::move(*reinterpret_cast<F*>(src)));
+            reinterpret_cast<F*>(src)->~F();
+        }
+
+        static void destroy( void* p )
+        {
+            reinterpret_cast<F*>(p)->~F();
+        }
+
+        static ops_t const * get()
+        {
+            static ops_t const ops = { &invoke, &move, &destroy };
+            return &ops;
+        }
+    };
+
+    template<typename F>
+    struct pooled_ops
+    {
+        static F*& ptr( void* p )
+        {
+            return *reinterpret_cast<F**>(p);
+        }
+
+        static void invoke( void* p )
+        {
+            (*ptr(p))();
+        }
+
+        static void move( void* dst, void* src )
+        {
+            *reinterpret_cast<F**>(dst) = ptr(src);
+        }
+
+        static void destroy( void* p )
+        {
+            allocator<F> alloc;
+            alloc.destroy(ptr(p));
+            alloc.deallocate(ptr(p),1);
+        }
+
+        static ops_t const * get()
+        {
+            static ops_t const ops = { &invoke, &move, &destroy };
+            return &ops;
+        }
+    };
+
+    template<typename F>
+    struct fits_inline
+    {
+        static const bool value = sizeof(F) <= inline_size &&
+            alignof(std::max_align_t) % alignof(F) == 0 &&
+            std::is_nothrow_move_constructible<F>::value;
+    };
+
+private:
+    typename std::aligned_storage<inline_size,
+                                  alignof(std::max_align_t)>::type storage_;
+    ops_t const * ops_ = nullptr;
+
+private:
+    template<typename F>
+    typename std::enable_if<fits_inline<F>::value>::type
+    store( F && f )
+    {
+        new (&storage_) F(std::move(f));
+        ops_ = inline_ops<F>::get();
+    }
+
+    template<typename F>
+    typename std::enable_if<!fits_inline<F>::value>::type
+    store( F && f )
+    {
+        allocator<F> alloc;
+        F* p = alloc.allocate(1);
+        alloc.construct(p, std::move(f));
+        *reinterpret_cast<F**>(&storage_) = p;
+        ops_ = pooled_ops<F>::get();
+    }
+
+public:
+    small_task() noexcept {}
+
+    small_task( std::nullptr_t ) noexcept {}
+
+    template<typename F, typename = typename std::enable_if<
+                             !std::is_same<typename std::decay<F>::type,
+                                           small_task>::value>::type>
+    small_task( F && f )
+    {
+        store(typename std::decay<F>::type(std::forward<F>(f)));
+    }
+
+    small_task( small_task && other ) noexcept
+        : ops_(other.ops_)
+    {
+        if ( ops_ )
+        {
+            ops_->move(&storage_, &other.storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    small_task& operator=( small_task && other ) noexcept
+    {
+        if ( this != &other )
+        {
+            reset();
+            if ( other.ops_ )
+            {
+                other.ops_->move(&storage_, &other.storage_);
+                ops_ = other.ops_;
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    small_task& operator=( std::nullptr_t ) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    small_task( small_task const & ) = delete;
+    small_task& operator=( small_task const & ) = delete;
+
+    ~small_task()
+    {
+        reset();
+    }
+
+    void reset() noexcept
+    {
+        if ( ops_ )
+        {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return ops_ != nullptr;
+    }
+
+    void operator()()
+    {
+        ops_->invoke(&storage_);
+    }
+
+}; // class small_task
+
+template<typename... Args>
+inline small_task make_small_task( Args&&... args )
+{
+    return small_task(std::bind(std::forward<Args>(args)...));
+}
+
+}} // namespace znn::v4
@@ -37,47 +37,28 @@
 
 #include "log.hpp"
 #include "global_task_manager.hpp"
+#include "parallel_for.hpp"
+#include "small_task.hpp"
 
-#ifdef ZNN_DFS_TASK_SCHEDULER
+#if defined( ZNN_DFS_TASK_SCHEDULER )
 #  include "dfs_task_manager.hpp"
+#elif defined( ZNN_WS_TASK_SCHEDULER ) || defined( ZNN_NUMA )
+#  include "ws_task_manager.hpp"
 #else
 
 namespace znn { namespace v4 {
 
-namespace detail {
-
-class function_base
-{
-public:
-    virtual ~function_base() {}
-    virtual void operator()() = 0;
-};
-
-template<typename T>
-class function_wrapper: function_base
-{
-private:
-    T t_;
-public:
-    function_wrapper(T && t): t_(t) {};
-    function_wrapper(T const &) = delete;
-};
-
-
-
-} // namespace detail
-
 class task_manager
 {
 private:
-    typedef std::function<void()> callable_t;
+    typedef small_task callable_t;
 
 private:
     struct unprivileged_task
     {
     private:
-        std::function<void()>  fn_               ;
-        callable_t*            then_   = nullptr ;
+        callable_t             fn_               ;
+        callable_t             then_             ;
         int                    status_ = 1       ;
 
         list<std::shared_ptr<unprivileged_task>>::iterator it_;
@@ -87,7 +68,7 @@ private:
     public:
         template<class... Args>
         explicit unprivileged_task(Args&&... args)
-            : fn_(std::bind(std::forward<Args>(args)...))
+            : fn_(make_small_task(std::forward<Args>(args)...))
         {}
     };
 
@@ -95,7 +76,7 @@ public:
     typedef std::shared_ptr<unprivileged_task> task_handle;
 
 private:
-    map<std::size_t, list<callable_t*>> tasks_                  ;
+    map<std::size_t, list<callable_t>>  tasks_                  ;
     size_t                                       tot_tasks_ = 0 ;
     list<task_handle>                            unprivileged_  ;
 
@@ -129,7 +110,7 @@ private:
 
         while (true)
         {
-            callable_t* f1 = nullptr;
+            callable_t f1;
 
             {
                 std::unique_lock<std::mutex> g(mutex_);
@@ -159,7 +140,6 @@ private:
                 }
                 else
                 {
-                    f1 = nullptr;
                     f2 = next_unprivileged_task();
                 }
 
@@ -167,10 +147,7 @@ private:
 
             if ( f1 )
             {
-                (*f1)();
-                allocator<callable_t> alloc;
-                alloc.destroy(f1);
-                alloc.deallocate(f1,1);
+                f1();
             }
             else
             {
@@ -186,20 +163,17 @@ private:
         t->fn_();
         t->fn_ = nullptr;
 
-        callable_t* after = nullptr;
+        callable_t after;
 
         {
             std::unique_lock<std::mutex> g(mutex_);
-            after      = t->then_;
+            after      = std::move(t->then_);
             t->status_ = 0;
         }
 
         if ( after )
         {
-            (*after)();
-            allocator<callable_t> alloc;
-            alloc.destroy(after);
-            alloc.deallocate(after,1);
+            after();
         }
     }
 
@@ -271,9 +245,9 @@ public:
     }
 
 private:
-    callable_t* next_task()
+    callable_t next_task()
     {
-        callable_t* f = tasks_.rbegin()->second.front();
+        callable_t f = std::move(tasks_.rbegin()->second.front());
 
         tasks_.rbegin()->second.pop_front();
         if ( tasks_.rbegin()->second.size() == 0 )
@@ -300,26 +274,30 @@ public:
     template<typename... Args>
     void schedule(std::size_t priority, Args&&... args)
     {
-        allocator<callable_t> alloc;
-        callable_t* fn = alloc.allocate(1);
-        alloc.construct(fn, std::bind(std::forward<Args>(args)...));
+        callable_t fn = make_small_task(std::forward<Args>(args)...);
         {
             std::lock_guard<std::mutex> g(mutex_);
-            tasks_[priority].emplace_front(fn);
+            tasks_[priority].emplace_front(std::move(fn));
             ++tot_tasks_;
             if ( idle_threads_ > 0 ) workers_cv_.notify_one();
         }
     }
 
+    // no NUMA placement
+    template<typename... Args>
+    void schedule_on(std::size_t, std::size_t priority, Args&&... args)
+    {
+        schedule(priority, std::forward<Args>(args)...);
+    }
+
     template<typename... Args>
     void asap(Args&&... args)
     {
-        allocator<callable_t> alloc;
-        callable_t* fn = alloc.allocate(1);
-        alloc.construct(fn, std::bind(std::forward<Args>(args)...));
+        callable_t fn = make_small_task(std::forward<Args>(args)...);
         {
             std::lock_guard<std::mutex> g(mutex_);
-            tasks_[std::numeric_limits<std::size_t>::max()].emplace_front(fn);
+            tasks_[std::numeric_limits<std::size_t>::max()]
+                .emplace_front(std::move(fn));
             ++tot_tasks_;
             if ( idle_threads_ > 0 ) workers_cv_.notify_one();
         }
@@ -350,11 +328,8 @@ public:
             {
                 if ( t->status_ == 2 )
                 {
-                    ZI_ASSERT(t->then_==nullptr);
-                    allocator<callable_t> alloc;
-                    t->then_ = alloc.allocate(1);
-                    alloc.construct(t->then_,
-                                    std::bind(std::forward<Args>(args)...));
+                    ZI_ASSERT(!t->then_);
+                    t->then_ = make_small_task(std::forward<Args>(args)...);
                     return;
                 }
             }
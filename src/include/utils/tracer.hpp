@@ -0,0 +1,275 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <zi/utility/singleton.hpp>
+
+namespace znn { namespace v4 {
+
+enum class trace_kind : std::uint8_t
+{
+    forward = 0, backward = 1, update = 2, fft = 3, iteration = 4
+};
+
+// Task tracer
+//
+// Always compiled in, does nothing unless enabled at runtime. Every
+// thread records into its own ring buffer (the oldest events get
+// overwritten), write_chrome_trace() produces the JSON read by
+// chrome://tracing and Perfetto. Should only be dumped while no tasks
+// are running.
+//
+class tracer_impl
+{
+public:
+    static const std::size_t default_capacity = 1 << 16;
+
+private:
+    struct event
+    {
+        std::uint64_t start    ;
+        std::uint64_t stop     ;
+        std::size_t   priority ;
+        std::uint32_t name     ;
+        trace_kind    kind     ;
+    };
+
+    struct ring_buffer
+    {
+        std::vector<event>       events_   ;
+        std::atomic<std::size_t> recorded_{0};
+        std::size_t              worker_   ;
+
+        ring_buffer( std::size_t capacity, std::size_t worker )
+            : events_(capacity)
+            , worker_(worker)
+        {}
+
+        void push( event const & e )
+        {
+            std::size_t n = recorded_.load(std::memory_order_relaxed);
+            events_[n % events_.size()] = e;
+            recorded_.store(n+1, std::memory_order_release);
+        }
+    };
+
+private:
+    std::atomic<bool> enabled_{false};
+    std::size_t       capacity_ = default_capacity;
+
+    std::mutex                                   mutex_  ;
+    std::vector<std::shared_ptr<ring_buffer>>    buffers_;
+    std::vector<std::string>                     names_  ;
+    std::unordered_map<std::string,std::uint32_t> ids_   ;
+
+    std::chrono::steady_clock::time_point const  epoch_ =
+        std::chrono::steady_clock::now();
+
+private:
+    ring_buffer & local_buffer()
+    {
+        // the buffers are kept alive by the tracer after the thread
+        // exits, so the events don't get lost
+        static thread_local std::shared_ptr<ring_buffer> buffer;
+
+        if ( !buffer )
+        {
+            std::lock_guard<std::mutex> g(mutex_);
+            buffer = std::make_shared<ring_buffer>(capacity_,
+                                                   buffers_.size());
+            buffers_.push_back(buffer);
+        }
+
+        return *buffer;
+    }
+
+    static void write_escaped( std::ostream & out, std::string const & s )
+    {
+        for ( char c: s )
+        {
+            if ( c == '"' || c == '\\' ) out << '\\';
+            out << c;
+        }
+    }
+
+    static char const * category( trace_kind k )
+    {
+        static char const * names[] =
+            { "forward", "backward", "update", "fft", "iteration" };
+        return names[static_cast<std::size_t>(k)];
+    }
+
+public:
+    void enable( bool b = true )
+    {
+        enabled_.store(b, std::memory_order_relaxed);
+    }
+
+    bool enabled() const
+    {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // number of events kept per thread, affects only the threads that
+    // didn't record anything yet
+    void set_capacity( std::size_t n )
+    {
+        std::lock_guard<std::mutex> g(mutex_);
+        capacity_ = n ? n : 1;
+    }
+
+    std::uint32_t intern( std::string const & name )
+    {
+        std::lock_guard<std::mutex> g(mutex_);
+
+        auto it = ids_.find(name);
+        if ( it != ids_.end() )
+        {
+            return it->second;
+        }
+
+        std::uint32_t id = static_cast<std::uint32_t>(names_.size());
+        names_.push_back(name);
+        ids_[name] = id;
+        return id;
+    }
+
+    std::uint64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>
+            (std::chrono::steady_clock::now() - epoch_).count();
+    }
+
+    void record( trace_kind kind, std::uint32_t name, std::size_t priority,
+                 std::uint64_t start, std::uint64_t stop )
+    {
+        local_buffer().push({start, stop, priority, name, kind});
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> g(mutex_);
+        for ( auto & b: buffers_ )
+        {
+            b->recorded_ = 0;
+        }
+    }
+
+    void write_chrome_trace( std::ostream & out )
+    {
+        std::lock_guard<std::mutex> g(mutex_);
+
+        // microseconds with nanosecond resolution
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize    prec  = out.precision();
+        out << std::fixed << std::setprecision(3);
+
+        out << "{\"traceEvents\":[\n";
+
+        bool first = true;
+
+        for ( auto & b: buffers_ )
+        {
+            out << ( first ? "" : ",\n" )
+                << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+                << "\"tid\":" << b->worker_
+                << ",\"args\":{\"name\":\"worker " << b->worker_ << "\"}}";
+            first = false;
+
+            std::size_t n    = b->recorded_.load(std::memory_order_acquire);
+            std::size_t cap  = b->events_.size();
+            std::size_t from = ( n > cap ) ? n - cap : 0;
+
+            for ( std::size_t i = from; i < n; ++i )
+            {
+                event const & e = b->events_[i % cap];
+
+                out << ",\n{\"name\":\"";
+                write_escaped(out, names_[e.name]);
+                out << "\",\"cat\":\"" << category(e.kind)
+                    << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << b->worker_
+                    << ",\"ts\":" << ( e.start / 1000.0 )
+                    << ",\"dur\":" << ( ( e.stop - e.start ) / 1000.0 )
+                    << ",\"args\":{\"priority\":" << e.priority << "}}";
+            }
+        }
+
+        out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+
+        out.flags(flags);
+        out.precision(prec);
+    }
+
+    void write_chrome_trace( std::string const & fname )
+    {
+        std::ofstream out(fname.c_str());
+        write_chrome_trace(out);
+    }
+
+}; // class tracer_impl
+
+namespace {
+tracer_impl& tracer = zi::singleton<tracer_impl>::instance();
+}
+
+// records the lifetime of the scope
+class trace_scope
+{
+private:
+    trace_kind    kind_    ;
+    std::uint32_t name_    ;
+    std::size_t   priority_;
+    std::uint64_t start_   ;
+    bool          active_  ;
+
+public:
+    trace_scope( trace_kind kind, std::uint32_t name, std::size_t priority )
+        : kind_(kind)
+        , name_(name)
+        , priority_(priority)
+        , start_(0)
+        , active_(tracer.enabled())
+    {
+        if ( active_ ) start_ = tracer.now();
+    }
+
+    ~trace_scope()
+    {
+        if ( active_ )
+        {
+            tracer.record(kind_, name_, priority_, start_, tracer.now());
+        }
+    }
+
+    trace_scope( trace_scope const & ) = delete;
+    trace_scope& operator=( trace_scope const & ) = delete;
+};
+
+}} // namespace znn::v4
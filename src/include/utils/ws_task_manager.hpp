@@ -0,0 +1,596 @@
+//
+// Copyright (C) 2012-2015  Aleksandar Zlateski <zlateski@mit.edu>
+// ---------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <limits>
+#include <utility>
+
+#include <zi/utility/singleton.hpp>
+
+#include "../types.hpp"
+#include "log.hpp"
+#include "global_task_manager.hpp"
+#include "small_task.hpp"
+
+#ifdef ZNN_NUMA
+#  include "numa.hpp"
+#endif
+
+namespace znn { namespace v4 {
+
+namespace {
+thread_local void const * ws_current_manager = nullptr;
+thread_local size_t       ws_current_worker  = 0;
+}
+
+// Work stealing scheduler
+//
+// Every worker owns a queue; tasks scheduled from within a worker go
+// to its own queue, tasks scheduled from outside are spread round
+// robin. A worker runs the highest priority task of its own queue
+// and, when that is empty, steals the highest priority task of
+// another worker. Unprivileged tasks are only picked up when no
+// regular task can be found anywhere, as in the default scheduler.
+//
+// With ZNN_NUMA the workers are pinned to the NUMA nodes in contiguous
+// blocks, schedule_on() places a task on the workers of a given node
+// and the workers steal from their own node first.
+//
+class ws_task_manager
+{
+private:
+    typedef small_task callable_t;
+
+    static const std::size_t max_workers = 1024;
+
+#ifdef ZNN_NUMA
+    static const std::size_t numa_passes = 2;
+#else
+    static const std::size_t numa_passes = 1;
+#endif
+
+private:
+    struct unprivileged_task
+    {
+    private:
+        callable_t             fn_               ;
+        callable_t             then_             ;
+
+        // 1 - queued, 2 - running, 0 - done (or stolen)
+        std::atomic<int>       status_{1}        ;
+        std::mutex             m_                ;
+
+        friend class ws_task_manager;
+
+    public:
+        template<class... Args>
+        explicit unprivileged_task(Args&&... args)
+            : fn_(make_small_task(std::forward<Args>(args)...))
+        {}
+    };
+
+public:
+    typedef std::shared_ptr<unprivileged_task> task_handle;
+
+private:
+    struct regular_task
+    {
+        std::size_t priority;
+        std::size_t sequence;
+        callable_t  fn      ;
+
+        // same priority - the most recently scheduled goes first
+        bool operator<( regular_task const & o ) const
+        {
+            return ( priority == o.priority )
+                ? ( sequence < o.sequence )
+                : ( priority < o.priority );
+        }
+    };
+
+    // the queues are kept on separate cache lines
+    struct alignas(64) worker_queue
+    {
+        std::mutex                 m_               ;
+        vector<regular_task>       tasks_           ; // max heap
+        list<task_handle>          unprivileged_    ;
+        std::size_t                sequence_ = 0    ;
+        std::atomic<std::size_t>   n_tasks_{0}      ;
+        std::atomic<std::size_t>   n_unprivileged_{0};
+        std::atomic<std::size_t>   node_{0}         ;
+
+        // plain new doesn't honour the alignment before C++17
+        static void* operator new[]( std::size_t s )
+        {
+            void* r = nullptr;
+            if ( posix_memalign(&r, alignof(worker_queue), s) )
+            {
+                throw std::bad_alloc();
+            }
+            return r;
+        }
+
+        static void operator delete[]( void* p ) noexcept
+        {
+            std::free(p);
+        }
+    };
+
+private:
+    std::unique_ptr<worker_queue[]> queues_      ;
+    std::atomic<std::size_t>        num_queues_  ;
+    std::atomic<std::size_t>        next_queue_  ;
+    std::atomic<std::size_t>        pending_     ;
+    std::atomic<std::size_t>        idle_threads_;
+
+    std::size_t spawned_threads_;
+    std::size_t concurrency_    ;
+
+    vector<std::size_t> free_ids_;
+
+    std::mutex              mutex_;
+    std::condition_variable manager_cv_;
+    std::condition_variable workers_cv_;
+
+private:
+    void worker_loop()
+    {
+        std::size_t id = 0;
+
+        {
+            std::lock_guard<std::mutex> g(mutex_);
+
+            if ( spawned_threads_ >= concurrency_ )
+            {
+                return;
+            }
+
+            if ( free_ids_.size() )
+            {
+                id = free_ids_.back();
+                free_ids_.pop_back();
+            }
+            else
+            {
+                id = num_queues_.load();
+                ZI_ASSERT(id<max_workers);
+                ++num_queues_;
+            }
+
+#ifdef ZNN_NUMA
+            queues_[id].node_ = numa.node_of_worker(id, concurrency_);
+#endif
+
+            ++spawned_threads_;
+            if ( spawned_threads_ == concurrency_ )
+            {
+                manager_cv_.notify_all();
+            }
+        }
+
+        ws_current_manager = this;
+        ws_current_worker  = id;
+
+#ifdef ZNN_NUMA
+        this_numa_node() = queues_[id].node_;
+        numa.pin_this_thread(this_numa_node());
+#endif
+
+        while (true)
+        {
+            callable_t f1 = next_task(id);
+
+            if ( f1 )
+            {
+                f1();
+                continue;
+            }
+
+            task_handle f2 = next_unprivileged_task(id);
+
+            if ( f2 )
+            {
+                execute_unprivileged_task(f2);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> g(mutex_);
+
+            ++idle_threads_;
+            while ( pending_.load() == 0 && concurrency_ >= spawned_threads_ )
+            {
+                workers_cv_.wait(g);
+            }
+            --idle_threads_;
+
+            if ( pending_.load() == 0 && concurrency_ < spawned_threads_ )
+            {
+                --spawned_threads_;
+                free_ids_.push_back(id);
+                ws_current_manager = nullptr;
+
+                if ( spawned_threads_ == concurrency_ )
+                {
+                    manager_cv_.notify_all();
+                }
+                return;
+            }
+        }
+    }
+
+private:
+    // executing in one of the manaer's threads
+    void execute_unprivileged_task(task_handle const & t)
+    {
+        t->fn_();
+        t->fn_ = nullptr;
+
+        callable_t after;
+
+        {
+            std::lock_guard<std::mutex> g(t->m_);
+            after      = std::move(t->then_);
+            t->status_ = 0;
+        }
+
+        if ( after )
+        {
+            after();
+        }
+    }
+
+public:
+    ws_task_manager(std::size_t concurrency = std::thread::hardware_concurrency())
+        : queues_(new worker_queue[max_workers])
+        , num_queues_{0}
+        , next_queue_{0}
+        , pending_{0}
+        , idle_threads_{0}
+        , spawned_threads_{0}
+        , concurrency_{0}
+    {
+        set_concurrency(concurrency);
+    }
+
+    ws_task_manager(const ws_task_manager&) = delete;
+    ws_task_manager& operator=(const ws_task_manager&) = delete;
+
+    ws_task_manager(ws_task_manager&& other) = delete;
+    ws_task_manager& operator=(ws_task_manager&&) = delete;
+
+    ~ws_task_manager()
+    {
+        set_concurrency(0);
+    }
+
+    std::size_t set_concurrency(std::size_t n)
+    {
+        std::unique_lock<std::mutex> g(mutex_);
+
+        if ( concurrency_ != spawned_threads_ )
+        {
+            return concurrency_;
+        }
+
+        ZI_ASSERT(n<=max_workers);
+
+        std::size_t to_spawn = (n > concurrency_) ? ( n - concurrency_ ) : 0;
+        concurrency_ = n;
+
+        for ( std::size_t i = 0; i < to_spawn; ++i )
+        {
+            global_task_manager.schedule(&ws_task_manager::worker_loop, this);
+        }
+
+        workers_cv_.notify_all();
+
+        while ( concurrency_ != spawned_threads_ )
+        {
+            manager_cv_.wait(g);
+        }
+
+        return concurrency_;
+    }
+
+    std::size_t get_concurrency()
+    {
+        std::lock_guard<std::mutex> g(mutex_);
+        return concurrency_;
+    }
+
+    std::size_t idle_threads()
+    {
+        return idle_threads_.load();
+    }
+
+    std::size_t active_threads()
+    {
+        std::lock_guard<std::mutex> g(mutex_);
+        return concurrency_ - idle_threads_.load();
+    }
+
+private:
+    worker_queue & target_queue()
+    {
+        if ( ws_current_manager == this )
+        {
+            return queues_[ws_current_worker];
+        }
+
+        std::size_t n = std::max(num_queues_.load(),
+                                 static_cast<std::size_t>(1));
+        return queues_[next_queue_++ % n];
+    }
+
+    worker_queue & target_queue( std::size_t node )
+    {
+        if ( ws_current_manager == this &&
+             queues_[ws_current_worker].node_ == node )
+        {
+            return queues_[ws_current_worker];
+        }
+
+        std::size_t n     = num_queues_.load();
+        std::size_t first = next_queue_++;
+
+        for ( std::size_t i = 0; i < n; ++i )
+        {
+            worker_queue & q = queues_[(first+i)%n];
+            if ( q.node_ == node )
+            {
+                return q;
+            }
+        }
+
+        return target_queue();
+    }
+
+    // first pass visits the queues on the same node as the worker id,
+    // the second one (NUMA only) all the others
+    bool in_pass( std::size_t pass, std::size_t id, std::size_t other ) const
+    {
+        return numa_passes == 1 ||
+            ( (queues_[id].node_ == queues_[other].node_) == (pass == 0) );
+    }
+
+    void notify_worker()
+    {
+        ++pending_;
+        if ( idle_threads_.load() > 0 )
+        {
+            std::lock_guard<std::mutex> g(mutex_);
+            workers_cv_.notify_one();
+        }
+    }
+
+    callable_t pop_task( worker_queue & q )
+    {
+        if ( q.n_tasks_.load() == 0 )
+        {
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> g(q.m_);
+
+        if ( q.tasks_.empty() )
+        {
+            return nullptr;
+        }
+
+        std::pop_heap(q.tasks_.begin(), q.tasks_.end());
+        callable_t f = std::move(q.tasks_.back().fn);
+        q.tasks_.pop_back();
+        --q.n_tasks_;
+
+        return f;
+    }
+
+    callable_t next_task( std::size_t id )
+    {
+        std::size_t n = num_queues_.load();
+
+        for ( std::size_t pass = 0; pass < numa_passes; ++pass )
+        {
+            for ( std::size_t i = 0; i < n; ++i )
+            {
+                std::size_t other = (id+i)%n;
+                if ( !in_pass(pass, id, other) ) continue;
+
+                if ( callable_t f = pop_task(queues_[other]) )
+                {
+                    --pending_;
+                    return f;
+                }
+            }
+        }
+
+        return nullptr;
+    }
+
+    task_handle pop_unprivileged_task( worker_queue & q, bool own )
+    {
+        if ( q.n_unprivileged_.load() == 0 )
+        {
+            return task_handle();
+        }
+
+        std::lock_guard<std::mutex> g(q.m_);
+
+        if ( q.unprivileged_.empty() )
+        {
+            return task_handle();
+        }
+
+        task_handle x;
+
+        // own queue is used as a stack, others are stolen from the bottom
+        if ( own )
+        {
+            x = std::move(q.unprivileged_.front());
+            q.unprivileged_.pop_front();
+        }
+        else
+        {
+            x = std::move(q.unprivileged_.back());
+            q.unprivileged_.pop_back();
+        }
+
+        --q.n_unprivileged_;
+        return x;
+    }
+
+    task_handle next_unprivileged_task( std::size_t id )
+    {
+        std::size_t n = num_queues_.load();
+
+        for ( std::size_t pass = 0; pass < numa_passes; ++pass )
+        {
+            for ( std::size_t i = 0; i < n; )
+            {
+                std::size_t other = (id+i)%n;
+                if ( !in_pass(pass, id, other) )
+                {
+                    ++i;
+                    continue;
+                }
+
+                task_handle x = pop_unprivileged_task(queues_[other], i == 0);
+
+                if ( !x )
+                {
+                    ++i;
+                    continue;
+                }
+
+                --pending_;
+
+                // might have been stolen by require_done
+                int expected = 1;
+                if ( x->status_.compare_exchange_strong(expected, 2) )
+                {
+                    return x;
+                }
+            }
+        }
+
+        return task_handle();
+    }
+
+public:
+    template<typename... Args>
+    void schedule(std::size_t priority, Args&&... args)
+    {
+        push_task(target_queue(), priority, std::forward<Args>(args)...);
+    }
+
+    // run on one of the workers of the given NUMA node
+    template<typename... Args>
+    void schedule_on(std::size_t node, std::size_t priority, Args&&... args)
+    {
+        push_task(target_queue(node), priority, std::forward<Args>(args)...);
+    }
+
+private:
+    template<typename... Args>
+    void push_task(worker_queue & q, std::size_t priority, Args&&... args)
+    {
+        callable_t fn = make_small_task(std::forward<Args>(args)...);
+
+        {
+            std::lock_guard<std::mutex> g(q.m_);
+            q.tasks_.push_back({priority, q.sequence_++, std::move(fn)});
+            std::push_heap(q.tasks_.begin(), q.tasks_.end());
+            ++q.n_tasks_;
+        }
+
+        notify_worker();
+    }
+
+public:
+    template<typename... Args>
+    void asap(Args&&... args)
+    {
+        schedule(std::numeric_limits<std::size_t>::max(),
+                 std::forward<Args>(args)...);
+    }
+
+    template<typename... Args>
+    void require_done(task_handle const & t, Args&&... args)
+    {
+        // doesn't exist!
+        if ( !t )
+        {
+            std::bind(std::forward<Args>(args)...)();
+            return;
+        }
+
+        int expected = 1;
+        if ( t->status_.compare_exchange_strong(expected, 0) )
+        {
+            // stolen, the queue entry is dropped by the worker popping it
+            t->fn_();
+            t->fn_ = nullptr;
+        }
+        else
+        {
+            std::lock_guard<std::mutex> g(t->m_);
+
+            if ( t->status_ == 2 )
+            {
+                ZI_ASSERT(!t->then_);
+                t->then_ = make_small_task(std::forward<Args>(args)...);
+                return;
+            }
+        }
+
+        std::bind(std::forward<Args>(args)...)();
+    }
+
+
+    template<typename... Args>
+    task_handle schedule_unprivileged(Args&&... args)
+    {
+        task_handle t = std::allocate_shared<unprivileged_task>
+            (allocator<unprivileged_task>(), std::forward<Args>(args)...);
+
+        worker_queue & q = target_queue();
+        {
+            std::lock_guard<std::mutex> g(q.m_);
+            q.unprivileged_.push_front(t);
+            ++q.n_unprivileged_;
+        }
+
+        notify_worker();
+        return t;
+    }
+
+}; // class ws_task_manager
+
+using task_manager = ws_task_manager;
+
+}} // namespace znn::v4